@@ -0,0 +1,212 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file ahocorasick.cpp
+ * @brief All non-template member functions of the AhoCorasick class.
+ *
+ * The AhoCorasick class compiles a set of literal patterns into a single
+ * automaton. Bytes that appear in no pattern share one column so the
+ * transition table stays small even with thousands of patterns.
+ */
+#include "h/includes.h"
+#include "h/ahocorasick.h"
+
+/**
+ * @brief Add a pattern to be found by Scan(). Build() must be called before the pattern is matched.
+ * @param[in] pattern The literal to find. Empty patterns are ignored.
+ * @param[in] id The value reported by Scan() when the pattern is found.
+ * @retval void
+ */
+const void AhoCorasick::Add( const string& pattern, const uint_t& id )
+{
+    if ( pattern.empty() )
+        return;
+
+    m_patterns.push_back( make_pair( pattern, id ) );
+
+    return;
+}
+
+/**
+ * @brief Compile all added patterns into the transition table.
+ * @retval void
+ */
+const void AhoCorasick::Build()
+{
+    deque<uint_t> queue;
+    vector<uint_t> fail;
+    uint_t c = 0, col = 0, i = 0, next = 0, state = 0, states = 1;
+    uint8_t byte = 0;
+
+    ::memset( m_class, 0, sizeof( m_class ) );
+    m_width = 1;
+
+    for ( i = 0; i < m_patterns.size(); i++ )
+    {
+        for ( c = 0; c < m_patterns[i].first.length(); c++ )
+        {
+            byte = static_cast<uint8_t>( m_patterns[i].first[c] );
+
+            if ( m_fold )
+                byte = ::tolower( byte );
+
+            if ( m_class[byte] == 0 )
+                m_class[byte] = m_width++;
+        }
+    }
+
+    if ( m_fold )
+        for ( c = 'A'; c <= 'Z'; c++ )
+            m_class[c] = m_class[::tolower( c )];
+
+    // Build the trie; state 0 is the root and is never a child, so 0 marks a missing edge
+    m_next.assign( m_width, 0 );
+    m_output.assign( 1, vector<uint_t>() );
+
+    for ( i = 0; i < m_patterns.size(); i++ )
+    {
+        state = 0;
+
+        for ( c = 0; c < m_patterns[i].first.length(); c++ )
+        {
+            col = m_class[static_cast<uint8_t>( m_patterns[i].first[c] )];
+
+            if ( m_next[state * m_width + col] == 0 )
+            {
+                m_next[state * m_width + col] = states++;
+                m_next.resize( states * m_width, 0 );
+                m_output.push_back( vector<uint_t>() );
+            }
+
+            state = m_next[state * m_width + col];
+        }
+
+        m_output[state].push_back( m_patterns[i].second );
+    }
+
+    // Resolve failure links breadth first so every missing edge becomes a direct transition
+    fail.assign( states, 0 );
+
+    for ( col = 0; col < m_width; col++ )
+        if ( ( next = m_next[col] ) != 0 )
+            queue.push_back( next );
+
+    while ( !queue.empty() )
+    {
+        state = queue.front();
+        queue.pop_front();
+
+        for ( col = 0; col < m_width; col++ )
+        {
+            if ( ( next = m_next[state * m_width + col] ) != 0 )
+            {
+                fail[next] = m_next[fail[state] * m_width + col];
+                m_output[next].insert( m_output[next].end(), m_output[fail[next]].begin(), m_output[fail[next]].end() );
+                queue.push_back( next );
+            }
+            else
+                m_next[state * m_width + col] = m_next[fail[state] * m_width + col];
+        }
+    }
+
+    return;
+}
+
+/**
+ * @brief Remove all patterns and the compiled table.
+ * @retval void
+ */
+const void AhoCorasick::Clear()
+{
+    m_patterns.clear();
+    m_next.clear();
+    m_output.clear();
+    ::memset( m_class, 0, sizeof( m_class ) );
+    m_width = 1;
+
+    return;
+}
+
+/**
+ * @brief Returns the number of patterns added.
+ * @retval uint_t The number of patterns added.
+ */
+const uint_t AhoCorasick::gPatterns()
+{
+    return m_patterns.size();
+}
+
+/**
+ * @brief Returns the number of states in the compiled automaton.
+ * @retval uint_t The number of states in the compiled automaton, 0 if Build() has not been called.
+ */
+const uint_t AhoCorasick::gStates()
+{
+    return m_output.size();
+}
+
+/**
+ * @brief Find every pattern that occurs in text.
+ * @param[in] text The text to search.
+ * @param[out] hits The id of each pattern found is appended once per occurrence.
+ * @retval void
+ */
+const void AhoCorasick::Scan( const string& text, vector<uint_t>& hits )
+{
+    const uint_t* next = m_next.data();
+    uint_t i = 0, state = 0;
+
+    if ( m_next.empty() )
+        return;
+
+    for ( i = 0; i < text.length(); i++ )
+    {
+        state = next[state * m_width + m_class[static_cast<uint8_t>( text[i] )]];
+
+        if ( !m_output[state].empty() )
+            hits.insert( hits.end(), m_output[state].begin(), m_output[state].end() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the AhoCorasick class.
+ * @param[in] fold If true, ASCII letters are matched without regard to case.
+ */
+AhoCorasick::AhoCorasick( const bool& fold )
+{
+    m_fold = fold;
+    ::memset( m_class, 0, sizeof( m_class ) );
+    m_width = 1;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the AhoCorasick class.
+ */
+AhoCorasick::~AhoCorasick()
+{
+    return;
+}
@@ -0,0 +1,1148 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file archivelister.cpp
+ * @brief All non-template member functions of the ArchiveLister class.
+ *
+ * The ArchiveLister class walks archive headers as data arrives and skips
+ * over packed data without holding it. Once a header has been read the
+ * lister knows the offset of the next one. A fetcher can therefore leave
+ * out the segments in between, or go straight to the last segments of a
+ * 7-Zip archive, whose file list is kept at the end. Listing stops at the
+ * first verdict, such as encrypted headers or an encrypted file.
+ */
+#include "h/includes.h"
+#include "h/archivelister.h"
+
+/**
+ * @brief List a set of archives from disk, reading only what the lister asks for, and report how much of each was needed.
+ * @param[in] files Paths of the archives to list.
+ * @retval void
+ */
+const void ArchiveLister::Benchmark( const vector<string>& files )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    static const char* types[MAX_ARCHIVE_TYPE] = { "unknown", "rar4", "rar5", "7z", "zip" };
+    static const char* statuses[MAX_ARCHIVE_STATUS] = { "truncated", "listed", "partial", "encrypted", "unlisted", "not an archive", "error" };
+    vector<string> buffers;
+    chrono::high_resolution_clock::time_point start;
+    ArchiveLister lister;
+    uint_t i = 0, y = 0, pass = 0, offset = 0, length = 0, read = 0, total = 0;
+    double elapsed = 0;
+
+    for ( i = 0; i < files.size(); i++ )
+    {
+        ifstream input( files[i], ios::binary );
+
+        if ( !input.is_open() )
+        {
+            LOGFMT( flags, "ArchiveLister::Benchmark()-> unable to open %s", CSTR( files[i] ) );
+            continue;
+        }
+
+        buffers.push_back( string( istreambuf_iterator<char>( input ), istreambuf_iterator<char>() ) );
+    }
+
+    if ( buffers.empty() )
+        return;
+
+    start = chrono::high_resolution_clock::now();
+
+    // Keep going for at least a second so the rate means something for small sets
+    for ( pass = 0; pass < 1000 && elapsed < 1; pass++ )
+    {
+        for ( i = 0; i < buffers.size(); i++ )
+        {
+            lister.Reset();
+            read = uintmin_t;
+
+            // Hand over exactly what is asked for, at least a page at a time as a fetcher would
+            while ( lister.gStatus() == ARCHIVE_STATUS_NEED && ( offset = lister.gOffset() ) < buffers[i].length() )
+            {
+                length = min( max( lister.gNeed(), static_cast<uint_t>( 4096 ) ), buffers[i].length() - offset );
+                lister.Feed( offset, buffers[i].data() + offset, length );
+                read += length;
+            }
+
+            if ( pass > 0 )
+                continue;
+
+            total += read;
+
+            LOGFMT( iflags, "ArchiveLister::Benchmark()-> %s: %s, %s, %lu files, read %lu of %lu bytes", CSTR( files[i] ), types[lister.gType()],
+                statuses[lister.gStatus()], lister.gFiles().size(), read, buffers[i].length() );
+
+            for ( y = 0; y < lister.gFiles().size(); y++ )
+                LOGFMT( iflags, "ArchiveLister::Benchmark()->     %s %lu%s%s", CSTR( lister.gFiles()[y].name ), lister.gFiles()[y].size,
+                    lister.gFiles()[y].directory ? " dir" : "", lister.gFiles()[y].encrypted ? " encrypted" : "" );
+        }
+
+        elapsed = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+    }
+
+    LOGFMT( iflags, "ArchiveLister::Benchmark()-> %lu archives x %lu passes: %.0f archives/sec, %lu bytes read per pass",
+        buffers.size(), pass, elapsed > 0 ? buffers.size() * pass / elapsed : 0, total );
+
+    return;
+}
+
+/**
+ * @brief Hand over the next piece of the archive.
+ * @param[in] offset Offset of the data within the archive. Data the lister is skipping may be left out, but nothing after gOffset() may be.
+ * @param[in] data The data.
+ * @param[in] length The number of bytes of data.
+ * @retval bool False if the data starts after gOffset(), leaving a gap.
+ */
+const bool ArchiveLister::Feed( const uint_t& offset, const char* data, const uint_t& length )
+{
+    uint_t end = gOffset(), from = 0;
+    bool more = true;
+
+    if ( m_status != ARCHIVE_STATUS_NEED )
+        return true;
+
+    if ( offset > end )
+        return false;
+
+    if ( offset + length <= end )
+        return true;
+
+    // Drop consumed data now and then rather than after every header
+    if ( m_head > 0 && m_head >= m_buffer.length() / 2 )
+    {
+        m_buffer.erase( 0, m_head );
+        m_head = uintmin_t;
+    }
+
+    from = end - offset;
+    m_buffer.append( data + from, length - from );
+
+    while ( more && m_status == ARCHIVE_STATUS_NEED )
+    {
+        switch ( m_type )
+        {
+            case ARCHIVE_TYPE_RAR4:     more = Rar4();      break;
+            case ARCHIVE_TYPE_RAR5:     more = Rar5();      break;
+            case ARCHIVE_TYPE_SEVENZIP: more = SevenZip();  break;
+            case ARCHIVE_TYPE_ZIP:      more = Zip();       break;
+            default:                    more = Signature(); break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns the files listed so far.
+ * @retval vector<File> The files listed so far, in archive order.
+ */
+const vector<ArchiveLister::File> ArchiveLister::gFiles()
+{
+    return m_files;
+}
+
+/**
+ * @brief Returns how many bytes are needed from gOffset() before the next header can be read.
+ * @retval uint_t The number of bytes needed, 0 once there is a verdict.
+ */
+const uint_t ArchiveLister::gNeed()
+{
+    uint_t available = m_buffer.length() - m_head;
+
+    if ( m_status != ARCHIVE_STATUS_NEED )
+        return 0;
+
+    return m_need > available ? m_need - available : 1;
+}
+
+/**
+ * @brief Returns the offset within the archive that data should be fed from next. This jumps ahead past packed data.
+ * @retval uint_t The offset within the archive that data should be fed from next.
+ */
+const uint_t ArchiveLister::gOffset()
+{
+    return m_pos + m_buffer.length() - m_head;
+}
+
+/**
+ * @brief Returns the verdict so far.
+ * @retval uint_t The verdict so far from #ARCHIVE_STATUS.
+ */
+const uint_t ArchiveLister::gStatus()
+{
+    return m_status;
+}
+
+/**
+ * @brief Returns the format of the archive.
+ * @retval uint_t The format of the archive from #ARCHIVE_TYPE.
+ */
+const uint_t ArchiveLister::gType()
+{
+    return m_type;
+}
+
+/**
+ * @brief Forget everything fed so far to start on another archive.
+ * @retval void
+ */
+const void ArchiveLister::Reset()
+{
+    m_type = ARCHIVE_TYPE_NONE;
+    m_status = ARCHIVE_STATUS_NEED;
+    m_buffer.clear();
+    m_head = uintmin_t;
+    m_pos = uintmin_t;
+    m_need = uintmin_t;
+    m_header_size = uintmin_t;
+    m_header_crc = uintmin_t;
+    m_descriptor = false;
+    m_files.clear();
+
+    return;
+}
+
+/**
+ * @brief Move past a header and any packed data that follows it.
+ * @param[in] length The number of bytes to move forward, which may be beyond what has been fed.
+ * @retval void
+ */
+const void ArchiveLister::Consume( const uint_t& length )
+{
+    if ( length < m_buffer.length() - m_head )
+        m_head += length;
+    else
+    {
+        m_buffer.clear();
+        m_head = uintmin_t;
+    }
+
+    m_pos += length;
+    m_need = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Returns the next bytes of the archive if enough have been fed, otherwise records how many are needed.
+ * @param[in] length The number of bytes needed from the current position.
+ * @retval uint8_t* The bytes at the current position, or NULL if not enough have been fed.
+ */
+const uint8_t* ArchiveLister::Peek( const uint_t& length )
+{
+    if ( length > CFG_MEM_MAX_ARCHIVE_HEADER )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return NULL;
+    }
+
+    if ( m_buffer.length() - m_head < length )
+    {
+        m_need = length;
+        return NULL;
+    }
+
+    return reinterpret_cast<const uint8_t*>( m_buffer.data() ) + m_head;
+}
+
+/**
+ * @brief Read the next RAR4 block.
+ * @retval bool False if more data is needed or there is a verdict.
+ */
+const bool ArchiveLister::Rar4()
+{
+    const uint8_t* data = NULL;
+    uint_t type = 0, flags = 0, size = 0, add = 0, packed = 0, unpacked = 0, offset = 32, length = 0;
+    File file;
+
+    // Every block starts with CRC16, type, flags, and size
+    if ( ( data = Peek( 7 ) ) == NULL )
+        return false;
+
+    type = data[2];
+    flags = data[3] | data[4] << 8;
+    size = data[5] | data[6] << 8;
+
+    if ( size < ( flags & 0x8000 ? 11 : 7 ) )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return false;
+    }
+
+    if ( ( data = Peek( size ) ) == NULL )
+        return false;
+
+    if ( ( crc32( 0, data + 2, size - 2 ) & 0xFFFF ) != static_cast<uint_t>( data[0] | data[1] << 8 ) )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return false;
+    }
+
+    if ( flags & 0x8000 )
+        add = data[7] | data[8] << 8 | data[9] << 16 | static_cast<uint_t>( data[10] ) << 24;
+
+    switch ( type )
+    {
+        // Main header, where 0x0080 means every block after it is encrypted
+        case 0x73:
+            if ( flags & 0x0080 )
+            {
+                m_status = ARCHIVE_STATUS_ENCRYPTED;
+                return false;
+            }
+
+            Consume( size );
+            break;
+
+        // File header, whose packed size doubles as the added size
+        case 0x74:
+            if ( size < 32 )
+            {
+                m_status = ARCHIVE_STATUS_ERROR;
+                return false;
+            }
+
+            packed = add;
+            unpacked = data[11] | data[12] << 8 | data[13] << 16 | static_cast<uint_t>( data[14] ) << 24;
+            length = data[26] | data[27] << 8;
+
+            if ( flags & 0x0100 )
+            {
+                if ( size < 40 )
+                {
+                    m_status = ARCHIVE_STATUS_ERROR;
+                    return false;
+                }
+
+                packed |= static_cast<uint_t>( data[32] | data[33] << 8 | data[34] << 16 | static_cast<uint_t>( data[35] ) << 24 ) << 32;
+                unpacked |= static_cast<uint_t>( data[36] | data[37] << 8 | data[38] << 16 | static_cast<uint_t>( data[39] ) << 24 ) << 32;
+                offset = 40;
+            }
+
+            if ( offset + length > size )
+            {
+                m_status = ARCHIVE_STATUS_ERROR;
+                return false;
+            }
+
+            // Unicode names follow the plain name after a null
+            file.name.assign( reinterpret_cast<const char*>( data + offset ), ::strnlen( reinterpret_cast<const char*>( data + offset ), length ) );
+            file.size = unpacked;
+            file.packed = packed;
+            file.directory = ( flags & 0x00E0 ) == 0x00E0;
+            file.encrypted = flags & 0x0004;
+            m_files.push_back( file );
+
+            if ( file.encrypted )
+            {
+                m_status = ARCHIVE_STATUS_ENCRYPTED;
+                return false;
+            }
+
+            Consume( size + packed );
+            break;
+
+        // End of archive
+        case 0x7B:
+            m_status = ARCHIVE_STATUS_LISTED;
+            return false;
+
+        default:
+            Consume( size + add );
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read the next RAR5 header.
+ * @retval bool False if more data is needed or there is a verdict.
+ */
+const bool ArchiveLister::Rar5()
+{
+    const uint8_t* data = NULL;
+    uint64_t size = 0, type = 0, flags = 0, extra = 0, area = 0, file_flags = 0, unpacked = 0, value = 0, length = 0, record = 0;
+    uint_t pos = 4, total = 0, end = 0;
+    File file;
+
+    // CRC32 and a header size of up to three bytes; the smallest header is eight bytes in all
+    if ( ( data = Peek( 7 ) ) == NULL )
+        return false;
+
+    if ( !Rar5Number( data, 7, pos, size ) || size == 0 )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return false;
+    }
+
+    total = pos + size;
+
+    if ( ( data = Peek( total ) ) == NULL )
+        return false;
+
+    if ( crc32( 0, data + 4, total - 4 ) != static_cast<uLong>( data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>( data[3] ) << 24 ) ||
+        !Rar5Number( data, total, pos, type ) || !Rar5Number( data, total, pos, flags ) ||
+        ( ( flags & 0x01 ) && !Rar5Number( data, total, pos, extra ) ) || ( ( flags & 0x02 ) && !Rar5Number( data, total, pos, area ) ) || extra > total - pos )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return false;
+    }
+
+    switch ( type )
+    {
+        // File header
+        case 2:
+            if ( !Rar5Number( data, total, pos, file_flags ) || !Rar5Number( data, total, pos, unpacked ) || !Rar5Number( data, total, pos, value ) )
+            {
+                m_status = ARCHIVE_STATUS_ERROR;
+                return false;
+            }
+
+            // Optional modification time and data CRC32
+            pos += ( file_flags & 0x02 ? 4 : 0 ) + ( file_flags & 0x04 ? 4 : 0 );
+
+            if ( !Rar5Number( data, total, pos, value ) || !Rar5Number( data, total, pos, value ) || !Rar5Number( data, total, pos, length ) || pos + length > total - extra )
+            {
+                m_status = ARCHIVE_STATUS_ERROR;
+                return false;
+            }
+
+            file.name.assign( reinterpret_cast<const char*>( data + pos ), length );
+            file.size = unpacked;
+            file.packed = area;
+            file.directory = file_flags & 0x01;
+            file.encrypted = false;
+
+            // Encryption is a record of type 1 in the extra area at the end of the header
+            for ( pos = total - extra; pos < total && !file.encrypted; pos = end + record )
+            {
+                if ( !Rar5Number( data, total, pos, record ) )
+                    break;
+
+                end = pos;
+
+                if ( !Rar5Number( data, total, pos, value ) )
+                    break;
+
+                file.encrypted = value == 0x01;
+            }
+
+            m_files.push_back( file );
+
+            if ( file.encrypted )
+            {
+                m_status = ARCHIVE_STATUS_ENCRYPTED;
+                return false;
+            }
+
+            break;
+
+        // Archive encryption header, everything after it is encrypted
+        case 4:
+            m_status = ARCHIVE_STATUS_ENCRYPTED;
+            return false;
+
+        // End of archive
+        case 5:
+            m_status = ARCHIVE_STATUS_LISTED;
+            return false;
+
+        default:
+            break;
+    }
+
+    Consume( total + area );
+
+    return true;
+}
+
+/**
+ * @brief Read a RAR5 variable length integer, seven bits per byte with the high bit set on all but the last.
+ * @param[in] data The header.
+ * @param[in] length The number of bytes in the header.
+ * @param[in,out] pos The position of the integer, moved past it.
+ * @param[out] value The integer.
+ * @retval bool False if the integer runs past the end of the header.
+ */
+const bool ArchiveLister::Rar5Number( const uint8_t* data, const uint_t& length, uint_t& pos, uint64_t& value )
+{
+    uint_t shift = 0;
+
+    value = uintmin_t;
+
+    for ( shift = 0; pos < length && shift < 64; shift += 7 )
+    {
+        value |= static_cast<uint64_t>( data[pos] & 0x7F ) << shift;
+
+        if ( ( data[pos++] & 0x80 ) == 0 )
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Read the 7-Zip start header, then the header it points to at the end of the archive.
+ * @retval bool False if more data is needed or there is a verdict.
+ */
+const bool ArchiveLister::SevenZip()
+{
+    const uint8_t* data = NULL;
+    uint64_t offset = 0;
+    uint_t i = 0;
+
+    if ( m_header_size == 0 )
+    {
+        // Signature, version, start header CRC32, then the offset, size, and CRC32 of the header
+        if ( ( data = Peek( 32 ) ) == NULL )
+            return false;
+
+        if ( crc32( 0, data + 12, 20 ) != static_cast<uLong>( data[8] | data[9] << 8 | data[10] << 16 | static_cast<uint32_t>( data[11] ) << 24 ) )
+        {
+            m_status = ARCHIVE_STATUS_ERROR;
+            return false;
+        }
+
+        for ( i = 0; i < 8; i++ )
+        {
+            offset |= static_cast<uint64_t>( data[12 + i] ) << ( i * 8 );
+            m_header_size |= static_cast<uint_t>( data[20 + i] ) << ( i * 8 );
+        }
+
+        m_header_crc = data[28] | data[29] << 8 | data[30] << 16 | static_cast<uint32_t>( data[31] ) << 24;
+
+        if ( m_header_size == 0 )
+        {
+            m_status = ARCHIVE_STATUS_LISTED;
+            return false;
+        }
+
+        Consume( 32 + offset );
+
+        return true;
+    }
+
+    if ( ( data = Peek( m_header_size ) ) == NULL )
+        return false;
+
+    if ( crc32( 0, data, m_header_size ) != m_header_crc )
+        m_status = ARCHIVE_STATUS_ERROR;
+    else
+        m_status = SevenZipHeader( data, m_header_size );
+
+    return false;
+}
+
+/**
+ * @brief Parse a 7-Zip header for its file list.
+ * @param[in] data The header.
+ * @param[in] length The number of bytes in the header.
+ * @retval uint_t The verdict from #ARCHIVE_STATUS.
+ */
+const uint_t ArchiveLister::SevenZipHeader( const uint8_t* data, const uint_t& length )
+{
+    vector<uint64_t> sizes, unused;
+    vector<bool> empty, empty_file;
+    vector<string> names;
+    uint64_t id = 0, count = 0, type = 0, size = 0;
+    uint_t pos = 0, end = 0, i = 0, next = 0, stream = 0, y = 0;
+    bool encrypted = false, ignored = false;
+    File file;
+
+    if ( !SevenZipNumber( data, length, pos, id ) )
+        return ARCHIVE_STATUS_ERROR;
+
+    // The real header was compressed and stored as a stream of its own; its coders still show whether it was encrypted
+    if ( id == 0x17 )
+    {
+        if ( !SevenZipStreams( data, length, pos, unused, encrypted ) )
+            return ARCHIVE_STATUS_ERROR;
+
+        return encrypted ? ARCHIVE_STATUS_ENCRYPTED : ARCHIVE_STATUS_UNLISTED;
+    }
+
+    if ( id != 0x01 )
+        return ARCHIVE_STATUS_ERROR;
+
+    while ( SevenZipNumber( data, length, pos, id ) && id != 0x00 )
+    {
+        switch ( id )
+        {
+            // Archive properties
+            case 0x02:
+                while ( SevenZipNumber( data, length, pos, type ) && type != 0x00 )
+                {
+                    if ( !SevenZipNumber( data, length, pos, size ) || size > length - pos )
+                        return ARCHIVE_STATUS_ERROR;
+
+                    pos += size;
+                }
+                break;
+
+            // Additional streams
+            case 0x03:
+                if ( !SevenZipStreams( data, length, pos, unused, ignored ) )
+                    return ARCHIVE_STATUS_ERROR;
+                break;
+
+            // Main streams, giving the size of each file with data and whether it is encrypted
+            case 0x04:
+                if ( !SevenZipStreams( data, length, pos, sizes, encrypted ) )
+                    return ARCHIVE_STATUS_ERROR;
+                break;
+
+            // Files
+            case 0x05:
+                if ( !SevenZipNumber( data, length, pos, count ) || count > length )
+                    return ARCHIVE_STATUS_ERROR;
+
+                empty.assign( count, false );
+
+                while ( SevenZipNumber( data, length, pos, type ) && type != 0x00 )
+                {
+                    if ( !SevenZipNumber( data, length, pos, size ) || size > length - pos )
+                        return ARCHIVE_STATUS_ERROR;
+
+                    end = pos + size;
+
+                    // Files without data, which are directories unless also marked as empty files
+                    if ( type == 0x0E )
+                    {
+                        for ( i = 0; i < count && pos + i / 8 < end; i++ )
+                            empty[i] = data[pos + i / 8] & ( 0x80 >> ( i % 8 ) );
+                    }
+                    else if ( type == 0x0F )
+                    {
+                        for ( i = 0; i < size * 8; i++ )
+                            empty_file.push_back( data[pos + i / 8] & ( 0x80 >> ( i % 8 ) ) );
+                    }
+                    // Names as null terminated UTF-16, unless stored elsewhere
+                    else if ( type == 0x11 && size > 0 && data[pos] == 0 )
+                    {
+                        for ( i = pos + 1; i + 1 < end && names.size() < count; i = next + 2 )
+                        {
+                            for ( next = i; next + 1 < end && ( data[next] != 0 || data[next + 1] != 0 ); next += 2 );
+                            names.push_back( Utf16( data + i, next - i ) );
+                        }
+                    }
+
+                    pos = end;
+                }
+
+                for ( i = 0, y = 0; i < count; i++ )
+                {
+                    file.name = i < names.size() ? names[i] : "";
+                    file.packed = uintmin_t;
+
+                    if ( empty[i] )
+                    {
+                        file.size = uintmin_t;
+                        file.directory = y >= empty_file.size() || !empty_file[y];
+                        file.encrypted = false;
+                        y++;
+                    }
+                    else
+                    {
+                        file.size = stream < sizes.size() ? sizes[stream++] : 0;
+                        file.directory = false;
+                        file.encrypted = encrypted;
+                    }
+
+                    m_files.push_back( file );
+                }
+                break;
+
+            default:
+                return ARCHIVE_STATUS_ERROR;
+        }
+    }
+
+    return encrypted ? ARCHIVE_STATUS_ENCRYPTED : ARCHIVE_STATUS_LISTED;
+}
+
+/**
+ * @brief Read a 7-Zip number, where the leading one bits of the first byte give how many bytes follow.
+ * @param[in] data The header.
+ * @param[in] length The number of bytes in the header.
+ * @param[in,out] pos The position of the number, moved past it.
+ * @param[out] value The number.
+ * @retval bool False if the number runs past the end of the header.
+ */
+const bool ArchiveLister::SevenZipNumber( const uint8_t* data, const uint_t& length, uint_t& pos, uint64_t& value )
+{
+    uint8_t first = 0, mask = 0x80;
+    uint_t i = 0;
+
+    value = uintmin_t;
+
+    if ( pos >= length )
+        return false;
+
+    first = data[pos++];
+
+    for ( i = 0; i < 8; i++, mask >>= 1 )
+    {
+        if ( ( first & mask ) == 0 )
+        {
+            value |= static_cast<uint64_t>( first & ( mask - 1 ) ) << ( i * 8 );
+            return true;
+        }
+
+        if ( pos >= length )
+            return false;
+
+        value |= static_cast<uint64_t>( data[pos++] ) << ( i * 8 );
+    }
+
+    return true;
+}
+
+/**
+ * @brief Parse 7-Zip streams info for the unpacked size of each stream and whether any coder is AES.
+ * @param[in] data The header.
+ * @param[in] length The number of bytes in the header.
+ * @param[in,out] pos The position of the streams info, moved past it.
+ * @param[out] sizes The unpacked size of each stream, in file order.
+ * @param[out] encrypted Set if any folder is encrypted with AES.
+ * @retval bool False if the streams info could not be parsed.
+ */
+const bool ArchiveLister::SevenZipStreams( const uint8_t* data, const uint_t& length, uint_t& pos, vector<uint64_t>& sizes, bool& encrypted )
+{
+    static const uint8_t aes[4] = { 0x06, 0xF1, 0x07, 0x01 };
+    vector<uint64_t> folders, streams;
+    vector<uint_t> outputs;
+    vector<bool> crcs, bound;
+    uint64_t id = 0, count = 0, coders = 0, in = 0, out = 0, value = 0, sum = 0;
+    uint_t i = 0, y = 0, z = 0, total_in = 0, total_out = 0, flag = 0;
+    bool listed = false;
+
+    // Digests are a defined bit per item, unless all are defined, then a CRC32 per defined item
+    auto digests = [&]( const uint_t& items, vector<bool>& defined ) -> bool
+    {
+        uint_t n = 0, k = 0;
+
+        if ( pos >= length )
+            return false;
+
+        defined.assign( items, true );
+
+        if ( data[pos++] == 0 )
+        {
+            if ( pos + ( items + 7 ) / 8 > length )
+                return false;
+
+            for ( k = 0; k < items; k++ )
+                defined[k] = data[pos + k / 8] & ( 0x80 >> ( k % 8 ) );
+
+            pos += ( items + 7 ) / 8;
+        }
+
+        for ( k = 0; k < items; k++ )
+            n += defined[k] ? 1 : 0;
+
+        pos += n * 4;
+
+        return pos <= length;
+    };
+
+    while ( SevenZipNumber( data, length, pos, id ) && id != 0x00 )
+    {
+        switch ( id )
+        {
+            // Pack info: position, stream count, then sizes and digests of the packed streams
+            case 0x06:
+                if ( !SevenZipNumber( data, length, pos, value ) || !SevenZipNumber( data, length, pos, count ) || count > length )
+                    return false;
+
+                while ( SevenZipNumber( data, length, pos, id ) && id != 0x00 )
+                {
+                    if ( id == 0x09 )
+                    {
+                        for ( i = 0; i < count; i++ )
+                            if ( !SevenZipNumber( data, length, pos, value ) )
+                                return false;
+                    }
+                    else if ( id != 0x0A || !digests( count, bound ) )
+                        return false;
+                }
+                break;
+
+            // Unpack info: the coders of each folder, then the size of every coder output
+            case 0x07:
+                if ( !SevenZipNumber( data, length, pos, id ) || id != 0x0B || !SevenZipNumber( data, length, pos, count ) || count > length || pos >= length || data[pos++] != 0 )
+                    return false;
+
+                for ( i = 0; i < count; i++ )
+                {
+                    if ( !SevenZipNumber( data, length, pos, coders ) || coders > length )
+                        return false;
+
+                    total_in = total_out = uintmin_t;
+
+                    for ( y = 0; y < coders; y++ )
+                    {
+                        if ( pos >= length )
+                            return false;
+
+                        flag = data[pos++];
+
+                        if ( pos + ( flag & 0x0F ) > length )
+                            return false;
+
+                        if ( ( flag & 0x0F ) == sizeof( aes ) && memcmp( data + pos, aes, sizeof( aes ) ) == 0 )
+                            encrypted = true;
+
+                        pos += flag & 0x0F;
+                        in = out = 1;
+
+                        if ( ( flag & 0x10 ) && ( !SevenZipNumber( data, length, pos, in ) || !SevenZipNumber( data, length, pos, out ) ) )
+                            return false;
+
+                        if ( flag & 0x20 )
+                        {
+                            if ( !SevenZipNumber( data, length, pos, value ) || value > length - pos )
+                                return false;
+
+                            pos += value;
+                        }
+
+                        total_in += in;
+                        total_out += out;
+                    }
+
+                    if ( total_out == 0 || total_out > length )
+                        return false;
+
+                    // Every output but the final one is bound to the input of another coder
+                    bound.assign( total_out, false );
+
+                    for ( y = 0; y + 1 < total_out; y++ )
+                    {
+                        if ( !SevenZipNumber( data, length, pos, in ) || !SevenZipNumber( data, length, pos, out ) || out >= total_out )
+                            return false;
+
+                        bound[out] = true;
+                    }
+
+                    for ( y = 0; y < total_out && bound[y]; y++ );
+
+                    outputs.push_back( total_out );
+                    outputs.push_back( y );
+
+                    if ( total_in > total_out )
+                        for ( y = 0; y < total_in - total_out + 1; y++ )
+                            if ( !SevenZipNumber( data, length, pos, value ) )
+                                return false;
+                }
+
+                if ( !SevenZipNumber( data, length, pos, id ) || id != 0x0C )
+                    return false;
+
+                for ( i = 0; i < count; i++ )
+                {
+                    for ( y = 0; y < outputs[i * 2]; y++ )
+                    {
+                        if ( !SevenZipNumber( data, length, pos, value ) )
+                            return false;
+
+                        if ( y == outputs[i * 2 + 1] )
+                            folders.push_back( value );
+                    }
+                }
+
+                crcs.assign( count, false );
+
+                while ( SevenZipNumber( data, length, pos, id ) && id != 0x00 )
+                    if ( id != 0x0A || !digests( count, crcs ) )
+                        return false;
+
+                streams.assign( count, 1 );
+                break;
+
+            // Substreams info: how many files each folder holds and their sizes
+            case 0x08:
+                while ( SevenZipNumber( data, length, pos, id ) && id != 0x00 )
+                {
+                    if ( id == 0x0D )
+                    {
+                        for ( i = 0; i < streams.size(); i++ )
+                            if ( !SevenZipNumber( data, length, pos, streams[i] ) || streams[i] > length )
+                                return false;
+                    }
+                    else if ( id == 0x09 )
+                    {
+                        for ( i = 0; i < streams.size(); i++ )
+                        {
+                            if ( streams[i] == 0 )
+                                continue;
+
+                            for ( y = 0, sum = 0; y + 1 < streams[i]; y++, sum += value )
+                            {
+                                if ( !SevenZipNumber( data, length, pos, value ) )
+                                    return false;
+
+                                sizes.push_back( value );
+                            }
+
+                            sizes.push_back( folders[i] > sum ? folders[i] - sum : 0 );
+                        }
+
+                        listed = true;
+                    }
+                    else if ( id == 0x0A )
+                    {
+                        for ( i = 0, z = 0; i < streams.size(); i++ )
+                            z += streams[i] == 1 && crcs[i] ? 0 : streams[i];
+
+                        if ( !digests( z, bound ) )
+                            return false;
+                    }
+                    else
+                        return false;
+                }
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    // Without sizes each folder holds a single file
+    if ( !listed )
+        for ( i = 0; i < folders.size(); i++ )
+            if ( streams[i] == 1 )
+                sizes.push_back( folders[i] );
+
+    return true;
+}
+
+/**
+ * @brief Read the archive signature to choose a format.
+ * @retval bool False if more data is needed or the data is not an archive.
+ */
+const bool ArchiveLister::Signature()
+{
+    const uint8_t* data = NULL;
+
+    if ( ( data = Peek( 8 ) ) == NULL )
+        return false;
+
+    if ( memcmp( data, "Rar!\x1A\x07\x01\x00", 8 ) == 0 )
+    {
+        m_type = ARCHIVE_TYPE_RAR5;
+        Consume( 8 );
+    }
+    else if ( memcmp( data, "Rar!\x1A\x07\x00", 7 ) == 0 )
+    {
+        m_type = ARCHIVE_TYPE_RAR4;
+        Consume( 7 );
+    }
+    else if ( memcmp( data, "7z\xBC\xAF\x27\x1C", 6 ) == 0 )
+        m_type = ARCHIVE_TYPE_SEVENZIP;
+    else if ( memcmp( data, "PK\x03\x04", 4 ) == 0 )
+        m_type = ARCHIVE_TYPE_ZIP;
+    // Split zips start with the data descriptor signature as a marker
+    else if ( memcmp( data, "PK\x07\x08", 4 ) == 0 )
+    {
+        m_type = ARCHIVE_TYPE_ZIP;
+        Consume( 4 );
+    }
+    else
+    {
+        m_status = ARCHIVE_STATUS_UNKNOWN;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Convert UTF-16LE to UTF-8.
+ * @param[in] data The UTF-16LE text.
+ * @param[in] length The number of bytes of text.
+ * @retval string The text as UTF-8.
+ */
+const string ArchiveLister::Utf16( const uint8_t* data, const uint_t& length )
+{
+    string output;
+    uint32_t c = 0, low = 0;
+    uint_t i = 0;
+
+    for ( i = 0; i + 1 < length; i += 2 )
+    {
+        c = data[i] | data[i + 1] << 8;
+
+        // Surrogate pairs carry code points beyond the basic plane
+        if ( c >= 0xD800 && c < 0xDC00 && i + 3 < length && ( low = data[i + 2] | data[i + 3] << 8 ) >= 0xDC00 && low < 0xE000 )
+        {
+            c = 0x10000 + ( ( c - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+            i += 2;
+        }
+
+        if ( c < 0x80 )
+            output.push_back( c );
+        else if ( c < 0x800 )
+        {
+            output.push_back( 0xC0 | c >> 6 );
+            output.push_back( 0x80 | ( c & 0x3F ) );
+        }
+        else if ( c < 0x10000 )
+        {
+            output.push_back( 0xE0 | c >> 12 );
+            output.push_back( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            output.push_back( 0x80 | ( c & 0x3F ) );
+        }
+        else
+        {
+            output.push_back( 0xF0 | c >> 18 );
+            output.push_back( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+            output.push_back( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            output.push_back( 0x80 | ( c & 0x3F ) );
+        }
+    }
+
+    return output;
+}
+
+/**
+ * @brief Read the next zip local file header.
+ * @retval bool False if more data is needed or there is a verdict.
+ */
+const bool ArchiveLister::Zip()
+{
+    const uint8_t* data = NULL;
+    uint_t signature = 0, flags = 0, packed = 0, unpacked = 0, name = 0, extra = 0, pos = 0, id = 0, size = 0, i = 0;
+    File file;
+
+    if ( ( data = Peek( 4 ) ) == NULL )
+        return false;
+
+    signature = data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint_t>( data[3] ) << 24;
+
+    // The descriptor after an entry's data may or may not carry its signature
+    if ( m_descriptor )
+    {
+        m_descriptor = false;
+        Consume( signature == 0x08074B50 ? 16 : 12 );
+
+        return true;
+    }
+
+    // Central directory or end of central directory, so every entry has been seen
+    if ( signature == 0x02014B50 || signature == 0x06054B50 || signature == 0x06064B50 )
+    {
+        m_status = ARCHIVE_STATUS_LISTED;
+        return false;
+    }
+
+    if ( signature != 0x04034B50 )
+    {
+        m_status = ARCHIVE_STATUS_ERROR;
+        return false;
+    }
+
+    if ( ( data = Peek( 30 ) ) == NULL )
+        return false;
+
+    name = data[26] | data[27] << 8;
+    extra = data[28] | data[29] << 8;
+
+    if ( ( data = Peek( 30 + name + extra ) ) == NULL )
+        return false;
+
+    flags = data[6] | data[7] << 8;
+    packed = data[18] | data[19] << 8 | data[20] << 16 | static_cast<uint_t>( data[21] ) << 24;
+    unpacked = data[22] | data[23] << 8 | data[24] << 16 | static_cast<uint_t>( data[25] ) << 24;
+
+    // Zip64 sizes are in extra field 0x0001, present only for the sizes that overflowed
+    for ( pos = 30 + name; pos + 4 <= 30 + name + extra; pos += 4 + size )
+    {
+        id = data[pos] | data[pos + 1] << 8;
+        size = data[pos + 2] | data[pos + 3] << 8;
+
+        if ( id != 0x0001 || pos + 4 + size > 30 + name + extra )
+            continue;
+
+        i = pos + 4;
+
+        if ( unpacked == 0xFFFFFFFF && i + 8 <= pos + 4 + size )
+        {
+            unpacked = uintmin_t;
+            for ( id = 0; id < 8; id++ )
+                unpacked |= static_cast<uint_t>( data[i + id] ) << ( id * 8 );
+            i += 8;
+        }
+
+        if ( packed == 0xFFFFFFFF && i + 8 <= pos + 4 + size )
+        {
+            packed = uintmin_t;
+            for ( id = 0; id < 8; id++ )
+                packed |= static_cast<uint_t>( data[i + id] ) << ( id * 8 );
+        }
+    }
+
+    file.name.assign( reinterpret_cast<const char*>( data + 30 ), name );
+    file.size = unpacked;
+    file.packed = packed;
+    file.directory = !file.name.empty() && file.name[file.name.length() - 1] == '/';
+    file.encrypted = flags & 0x0001;
+    m_files.push_back( file );
+
+    if ( file.encrypted )
+    {
+        m_status = ARCHIVE_STATUS_ENCRYPTED;
+        return false;
+    }
+
+    // With a data descriptor the sizes may only be known after the data, so the next header cannot be found
+    if ( ( flags & 0x0008 ) && packed == 0 && !file.directory )
+    {
+        m_status = ARCHIVE_STATUS_PARTIAL;
+        return false;
+    }
+
+    m_descriptor = flags & 0x0008;
+    Consume( 30 + name + extra + packed );
+
+    return true;
+}
+
+/**
+ * @brief Constructor for the ArchiveLister class.
+ */
+ArchiveLister::ArchiveLister()
+{
+    Reset();
+
+    return;
+}
+
+/**
+ * @brief Destructor for the ArchiveLister class.
+ */
+ArchiveLister::~ArchiveLister()
+{
+    return;
+}
@@ -0,0 +1,179 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file bulkwriter.cpp
+ * @brief All non-template member functions of the BulkWriter class.
+ *
+ * The BulkWriter class batches rows bound for one table into as few
+ * INSERT statements as possible.
+ */
+#include "h/includes.h"
+#include "h/bulkwriter.h"
+
+#include "h/dbconn.h"
+
+/**
+ * @brief Buffer a row for insertion, flushing once #CFG_DB_BULK_ROWS rows are pending.
+ * @param[in] row One value per column, unescaped.
+ * @retval void
+ */
+const void BulkWriter::Add( const vector<string>& row )
+{
+    UFLAGS_DE( flags );
+
+    if ( row.size() != m_columns.size() )
+    {
+        LOGFMT( flags, "BulkWriter::Add()-> %s: called with %lu values for %lu columns", CSTR( m_table ), row.size(), m_columns.size() );
+        return;
+    }
+
+    m_rows.push_back( row );
+
+    if ( m_rows.size() >= CFG_DB_BULK_ROWS )
+        Flush();
+
+    return;
+}
+
+/**
+ * @brief Discard all pending rows, such as after the transaction they were meant for was rolled back.
+ * @retval void
+ */
+const void BulkWriter::Clear()
+{
+    m_rows.clear();
+
+    return;
+}
+
+/**
+ * @brief Write all pending rows, splitting into statements no larger than #CFG_DB_BULK_BYTES.
+ * @retval bool False if no connector was available or a statement failed; the rows are kept for the next flush.
+ */
+const bool BulkWriter::Flush()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    string prefix, query;
+    uint_t first = 0, i = 0, y = 0;
+
+    if ( m_rows.empty() )
+        return true;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGFMT( flags, "BulkWriter::Flush()-> %s: no database connector available, %lu rows pending", CSTR( m_table ), m_rows.size() );
+        return false;
+    }
+
+    prefix = "INSERT ";
+    if ( !m_modifier.empty() )
+        prefix.append( m_modifier + " " );
+    prefix.append( "INTO `" + m_table + "` (" );
+
+    for ( y = 0; y < m_columns.size(); y++ )
+    {
+        if ( y > 0 )
+            prefix.append( ", " );
+        prefix.append( "`" + m_columns[y] + "`" );
+    }
+
+    prefix.append( ") VALUES " );
+
+    for ( i = 0; i < m_rows.size(); i++ )
+    {
+        query.append( query.empty() ? prefix : ", " );
+        query.append( "(" );
+
+        for ( y = 0; y < m_columns.size(); y++ )
+        {
+            if ( y > 0 )
+                query.append( ", " );
+            query.append( "'" + db->Escape( m_rows[i][y] ) + "'" );
+        }
+
+        query.append( ")" );
+
+        if ( query.length() < CFG_DB_BULK_BYTES && i + 1 < m_rows.size() )
+            continue;
+
+        if ( !m_suffix.empty() )
+            query.append( " " + m_suffix );
+
+        if ( db->Execute( query ) < 0 )
+        {
+            // Keep whatever was not written so it is retried on the next flush
+            m_rows.erase( m_rows.begin(), m_rows.begin() + first );
+            LOGFMT( flags, "BulkWriter::Flush()-> %s: insert failed, %lu rows pending", CSTR( m_table ), m_rows.size() );
+
+            return false;
+        }
+
+        m_written += i + 1 - first;
+        first = i + 1;
+        query.clear();
+    }
+
+    m_rows.clear();
+
+    return true;
+}
+
+/**
+ * @brief Returns the number of rows waiting to be written.
+ * @retval uint_t The number of rows waiting to be written.
+ */
+const uint_t BulkWriter::gPending()
+{
+    return m_rows.size();
+}
+
+/**
+ * @brief Returns the number of rows written since construction.
+ * @retval uint_t The number of rows written since construction.
+ */
+const uint_t BulkWriter::gWritten()
+{
+    return m_written;
+}
+
+/**
+ * @brief Constructor for the BulkWriter class.
+ */
+BulkWriter::BulkWriter( const string& table, const vector<string>& columns, const string& modifier, const string& suffix ) :
+    m_table( table ), m_columns( columns ), m_modifier( modifier ), m_suffix( suffix )
+{
+    m_written = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the BulkWriter class.
+ */
+BulkWriter::~BulkWriter()
+{
+    Flush();
+
+    return;
+}
@@ -0,0 +1,501 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file categorizer.cpp
+ * @brief All non-template member functions of the Categorizer class.
+ *
+ * The Categorizer class replaces the chain of checks nZEDb runs over every
+ * release name to find its category. The rules are read from a data file
+ * transcribed from Categorize.php, in its order, so they can be corrected
+ * and checked against recorded releases without a rebuild, and are
+ * compiled once into a table: the rules that apply to a group are resolved the first time the
+ * group is seen, and the literals every match must contain are compiled into
+ * one AhoCorasick automaton. A name is scanned once, and only rules whose
+ * literals were all seen and whose size limits allow it run their regex.
+ * Rules are still tried in order and the first match wins.
+ */
+#include "h/includes.h"
+#include "h/categorizer.h"
+
+#include "h/collectionregex.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Classify a recorded corpus with and without the compiled table and log releases/sec for each, along with any release placed differently than recorded.
+ * @param[in] rules The category rules, as read by Load().
+ * @param[in] file A text file with one "group<TAB>name<TAB>size<TAB>categoryid" line per release, such as the output of SELECT g.name, r.searchname, r.size, r.categoryid FROM releases r INNER JOIN groups g ON g.id = r.groupid WHERE r.iscategorized = 1.
+ * @retval void
+ */
+const void Categorizer::Benchmark( const string& rules, const string& file )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    /**
+     * @brief One line of the corpus.
+     */
+    struct Entry
+    {
+        string group; /**< The name of the group. */
+        string name; /**< The search name. */
+        uint_t size; /**< Total bytes. */
+        uint_t recorded; /**< The category the release was given when recorded. */
+        uint_t category; /**< The category given by the compiled pass. */
+    };
+    ifstream input( file );
+    vector<Entry> corpus;
+    vector<string> fields;
+    chrono::high_resolution_clock::time_point start;
+    Entry entry;
+    string line;
+    string::size_type first = 0, tab = 0;
+    uint_t i = 0, disagreed = 0, mismatched = 0, pass = 0, slice = 0;
+    double elapsed = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "Categorizer::Benchmark()-> unable to open %s", CSTR( file ) );
+        return;
+    }
+
+    while ( getline( input, line ) )
+    {
+        if ( !line.empty() && line[line.length() - 1] == '\r' )
+            line.erase( line.length() - 1 );
+
+        fields.clear();
+        for ( first = 0; ( tab = line.find( '\t', first ) ) != string::npos; first = tab + 1 )
+            fields.push_back( line.substr( first, tab - first ) );
+        fields.push_back( line.substr( first ) );
+
+        if ( fields.size() < 4 )
+            continue;
+
+        entry.group = fields[0];
+        entry.name = fields[1];
+        entry.size = ::strtoul( CSTR( fields[2] ), NULL, 10 );
+        entry.recorded = ::strtoul( CSTR( fields[3] ), NULL, 10 );
+        entry.category = uintmin_t;
+        corpus.push_back( entry );
+    }
+
+    if ( corpus.empty() || !Load( rules ) )
+        return;
+
+    // The same corpus is classified by the compiled table, by trying every rule in turn, then by the compiled table across the worker pool
+    for ( pass = 0; pass < 3; pass++ )
+    {
+        start = chrono::high_resolution_clock::now();
+
+        if ( pass < 2 )
+        {
+            for ( i = 0; i < corpus.size(); i++ )
+            {
+                if ( pass == 0 )
+                    corpus[i].category = Search( corpus[i].group, corpus[i].name, corpus[i].size, true );
+                else if ( Search( corpus[i].group, corpus[i].name, corpus[i].size, false ) != corpus[i].category )
+                    mismatched++;
+            }
+        }
+        else
+        {
+            slice = corpus.size() / g_global->m_workers->gThreads() + 1;
+
+            for ( i = 0; i < corpus.size(); i += slice )
+            {
+                g_global->m_workers->Submit( [this, &corpus, &mismatched, i, slice]()
+                {
+                    uint_t y = 0, wrong = 0;
+
+                    for ( y = i; y < i + slice && y < corpus.size(); y++ )
+                        if ( Classify( corpus[y].group, corpus[y].name, corpus[y].size ) != corpus[y].category )
+                            wrong++;
+
+                    if ( wrong > 0 )
+                    {
+                        lock_guard<mutex> lock( m_mutex );
+                        mismatched += wrong;
+                    }
+                } );
+            }
+
+            while ( g_global->m_workers->gPending() > 0 )
+                ::usleep( 1000 );
+        }
+
+        elapsed = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+        LOGFMT( iflags, "Categorizer::Benchmark()-> %s: %lu releases, %.0f releases/sec",
+            pass == 0 ? "compiled" : pass == 1 ? "sequential" : "parallel", corpus.size(), elapsed > 0 ? corpus.size() / elapsed : 0 );
+    }
+
+    if ( mismatched > 0 )
+        LOGFMT( flags, "Categorizer::Benchmark()-> %lu releases were placed differently by the compiled table", mismatched );
+
+    for ( i = 0; i < corpus.size(); i++ )
+    {
+        if ( corpus[i].category == corpus[i].recorded )
+            continue;
+
+        // Only the first few are shown, the total says how far off the rules are
+        if ( disagreed++ < 20 )
+            LOGFMT( iflags, "Categorizer::Benchmark()-> %s %s: recorded %lu, classified %lu", CSTR( corpus[i].group ), CSTR( corpus[i].name ), corpus[i].recorded, corpus[i].category );
+    }
+
+    LOGFMT( iflags, "Categorizer::Benchmark()-> %lu of %lu releases agree with the recorded category, %lu disagree", corpus.size() - disagreed, corpus.size(), disagreed );
+
+    return;
+}
+
+/**
+ * @brief Find the category of a release. Safe to call from any number of threads at once.
+ * @param[in] group The name of the group the release was posted to.
+ * @param[in] name The search name of the release.
+ * @param[in] size Total bytes.
+ * @retval uint_t The categoryid, Misc Other (7010) if no rule matched.
+ */
+const uint_t Categorizer::Classify( const string& group, const string& name, const uint_t& size )
+{
+    return Search( group, name, size, true );
+}
+
+/**
+ * @brief Returns the number of compiled rules.
+ * @retval uint_t The number of compiled rules.
+ */
+const uint_t Categorizer::gRules()
+{
+    return m_rules.size();
+}
+
+/**
+ * @brief Read and compile the category rules.
+ * @param[in] file A text file with one "categoryid<TAB>group<TAB>pattern<TAB>min_size<TAB>max_size" line per rule in the order nZEDb tries them. The group is a regex without delimiters, matched case insensitively, and may be empty to apply to every group. The pattern is a delimited regex as written in Categorize.php, or empty if the group alone decides. Sizes are bytes, 0 for no limit. Lines starting with # are comments.
+ * @retval bool False if the file could not be read or no rule could be compiled.
+ */
+const bool Categorizer::Load( const string& file )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    ifstream input( file );
+    vector<string> fields;
+    string line;
+    string::size_type first = 0, tab = 0;
+    vector<uint_t> captures;
+    vector<string> literals;
+    vector<vector<vector<string>>> required;
+    unordered_map<string,uint_t> ids;
+    Rule rule;
+    uint_t alternative = 0, disabled = 0, i = 0, prefiltered = 0, set = 0, y = 0;
+
+    if ( !m_rules.empty() )
+        return true;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "Categorizer::Load()-> unable to open %s", CSTR( file ) );
+        return false;
+    }
+
+    while ( getline( input, line ) )
+    {
+        i++;
+
+        if ( !line.empty() && line[line.length() - 1] == '\r' )
+            line.erase( line.length() - 1 );
+
+        if ( line.empty() || line[0] == '#' )
+            continue;
+
+        fields.clear();
+        for ( first = 0; ( tab = line.find( '\t', first ) ) != string::npos; first = tab + 1 )
+            fields.push_back( line.substr( first, tab - first ) );
+        fields.push_back( line.substr( first ) );
+
+        if ( fields.size() < 5 || ( rule.category = ::strtoul( CSTR( fields[0] ), NULL, 10 ) ) == 0 )
+        {
+            LOGFMT( flags, "Categorizer::Load()-> %s:%lu: expected categoryid, group, pattern, min_size and max_size", CSTR( file ), i );
+            disabled++;
+            continue;
+        }
+
+        rule.any_group = fields[1].empty();
+        rule.any_name = fields[2].empty();
+        rule.min_size = ::strtoul( CSTR( fields[3] ), NULL, 10 );
+        rule.max_size = ::strtoul( CSTR( fields[4] ), NULL, 10 );
+        rule.required.clear();
+
+        // Group patterns are written without delimiters and matched case insensitively, as in collection_regexes
+        if ( ( !rule.any_group && !CollectionRegex::Compile( "/" + fields[1] + "/i", rule.group, captures, literals ) ) ||
+            ( !rule.any_name && !CollectionRegex::Compile( fields[2], rule.pattern, captures, literals ) ) )
+        {
+            LOGFMT( flags, "Categorizer::Load()-> %s:%lu: rule for category %lu disabled", CSTR( file ), i, rule.category );
+            disabled++;
+            continue;
+        }
+
+        required = rule.any_name ? vector<vector<vector<string>>>() : Required( fields[2] );
+        rule.required.resize( required.size() );
+
+        // Rules often share literals, so each distinct literal is only added to the automaton once
+        for ( alternative = 0; alternative < required.size(); alternative++ )
+        {
+            rule.required[alternative].resize( required[alternative].size() );
+
+            for ( set = 0; set < required[alternative].size(); set++ )
+            {
+                for ( y = 0; y < required[alternative][set].size(); y++ )
+                {
+                    const string& literal = required[alternative][set][y];
+
+                    if ( ids.find( literal ) == ids.end() )
+                    {
+                        ids[literal] = m_literals.gPatterns();
+                        m_literals.Add( literal, m_literals.gPatterns() );
+                    }
+
+                    rule.required[alternative][set].push_back( ids[literal] );
+                }
+            }
+        }
+
+        if ( !rule.required.empty() )
+            prefiltered++;
+
+        m_rules.push_back( rule );
+    }
+
+    m_literals.Build();
+
+    LOGFMT( iflags, "Categorizer::Load()-> %s: %lu rules compiled, %lu prefiltered by %lu literals, %lu disabled", CSTR( file ), m_rules.size(), prefiltered, m_literals.gPatterns(), disabled );
+
+    return !m_rules.empty();
+}
+
+/**
+ * @brief Find what a name must contain for each alternative of a rule to match.
+ * @param[in] source The rule, such as /[ ._-](MP3|FLAC)([ ._-]|$)/i.
+ * @retval vector<vector<vector<string>>> Per top level alternative, sets of literals of which at least one each must appear: a plain literal is a set of one, and a group of plain words such as (MP3|FLAC) is a set of its words. Empty if some alternative requires nothing, as then the regex must always run.
+ */
+const vector<vector<vector<string>>> Categorizer::Required( const string& source )
+{
+    vector<vector<vector<string>>> required;
+    vector<string> branches, literals, words;
+    string body, modifiers;
+    string::size_type end = 0, i = 0, y = 0, start = 0;
+    uint_t b = 0, depth = 0;
+    bool plain = true;
+
+    if ( source.empty() || ( end = source.rfind( source[0] ) ) == 0 )
+        return required;
+
+    body = source.substr( 1, end - 1 );
+    modifiers = source.substr( end + 1 );
+
+    // Extended mode ignores whitespace, so no run of the source can be trusted as a literal
+    if ( modifiers.find( 'x' ) != string::npos )
+        return required;
+
+    for ( i = 0, start = 0; i <= body.length(); i++ )
+    {
+        if ( i == body.length() || ( depth == 0 && body[i] == '|' ) )
+        {
+            branches.push_back( body.substr( start, i - start ) );
+            start = i + 1;
+        }
+        else if ( body[i] == '\\' )
+            i = CollectionRegex::EndEscape( body, i );
+        else if ( body[i] == '[' )
+            i = CollectionRegex::EndClass( body, i );
+        else if ( body[i] == '(' )
+            depth++;
+        else if ( body[i] == ')' && depth > 0 )
+            depth--;
+    }
+
+    for ( b = 0; b < branches.size(); b++ )
+    {
+        const string& branch = branches[b];
+
+        required.push_back( vector<vector<string>>() );
+
+        literals = CollectionRegex::Literals( branch );
+        for ( y = 0; y < literals.size(); y++ )
+            required.back().push_back( vector<string>( 1, literals[y] ) );
+
+        // A group that is nothing but words, and is not itself optional, must contribute one of them
+        for ( i = 0; i < branch.length(); i++ )
+        {
+            if ( branch[i] == '\\' )
+            {
+                i = CollectionRegex::EndEscape( branch, i );
+                continue;
+            }
+
+            if ( branch[i] == '[' )
+            {
+                i = CollectionRegex::EndClass( branch, i );
+                continue;
+            }
+
+            if ( branch[i] != '(' )
+                continue;
+
+            words.clear();
+            plain = true;
+
+            for ( start = y = i + 1; plain && y < branch.length() && branch[y] != ')'; y++ )
+            {
+                if ( branch[y] == '|' )
+                {
+                    words.push_back( branch.substr( start, y - start ) );
+                    start = y + 1;
+                }
+                else
+                    plain = ::isalnum( static_cast<unsigned char>( branch[y] ) );
+            }
+
+            if ( plain && y < branch.length() )
+            {
+                words.push_back( branch.substr( start, y - start ) );
+
+                if ( ( y + 1 >= branch.length() || string( "?*{" ).find( branch[y + 1] ) == string::npos ) &&
+                    find( words.begin(), words.end(), "" ) == words.end() )
+                    required.back().push_back( words );
+            }
+
+            // Only groups at the top of the branch are considered, nested groups are skipped with their parent
+            for ( depth = 0; i < branch.length(); i++ )
+            {
+                if ( branch[i] == '\\' )
+                    i = CollectionRegex::EndEscape( branch, i );
+                else if ( branch[i] == '[' )
+                    i = CollectionRegex::EndClass( branch, i );
+                else if ( branch[i] == '(' )
+                    depth++;
+                else if ( branch[i] == ')' && --depth == 0 )
+                    break;
+            }
+        }
+
+        if ( required.back().empty() )
+            return vector<vector<vector<string>>>();
+    }
+
+    return required;
+}
+
+/**
+ * @brief Returns the indices of the rules that apply to a group, in priority order, resolving them on first use.
+ * @param[in] group The name of the group.
+ * @retval vector<uint_t> The indices into m_rules of the rules that apply to the group.
+ */
+const vector<uint_t>& Categorizer::Rules( const string& group )
+{
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,vector<uint_t>>::iterator mi;
+    uint_t i = 0;
+
+    // References into an unordered_map stay valid as other groups are added
+    if ( ( mi = m_groups.find( group ) ) != m_groups.end() )
+        return mi->second;
+
+    vector<uint_t>& rules = m_groups[group];
+
+    for ( i = 0; i < m_rules.size(); i++ )
+        if ( m_rules[i].any_group || regex_search( group, m_rules[i].group ) )
+            rules.push_back( i );
+
+    return rules;
+}
+
+/**
+ * @brief Try the rules of a group in order against a release.
+ * @param[in] group The name of the group the release was posted to.
+ * @param[in] name The search name of the release.
+ * @param[in] size Total bytes.
+ * @param[in] prefilter Skip rules whose literals are not all in the name; false tries every rule, for comparison.
+ * @retval uint_t The categoryid of the first matching rule, Misc Other (7010) if none matched.
+ */
+const uint_t Categorizer::Search( const string& group, const string& name, const uint_t& size, const bool& prefilter )
+{
+    const vector<uint_t>& rules = Rules( group );
+    vector<uint_t> hits;
+    uint_t alternative = 0, i = 0, set = 0, y = 0;
+    bool seen = true;
+
+    if ( prefilter )
+    {
+        m_literals.Scan( name, hits );
+        sort( hits.begin(), hits.end() );
+    }
+
+    for ( i = 0; i < rules.size(); i++ )
+    {
+        const Rule& rule = m_rules[rules[i]];
+
+        if ( ( rule.min_size > 0 && size < rule.min_size ) || ( rule.max_size > 0 && size > rule.max_size ) )
+            continue;
+
+        if ( rule.any_name )
+            return rule.category;
+
+        // Some alternative must have at least one literal of each of its sets in the name
+        if ( prefilter && !rule.required.empty() )
+        {
+            for ( alternative = 0, seen = false; !seen && alternative < rule.required.size(); alternative++ )
+            {
+                for ( set = 0, seen = true; seen && set < rule.required[alternative].size(); set++ )
+                {
+                    const vector<uint_t>& words = rule.required[alternative][set];
+
+                    for ( y = 0, seen = false; !seen && y < words.size(); y++ )
+                        seen = binary_search( hits.begin(), hits.end(), words[y] );
+                }
+            }
+
+            if ( !seen )
+                continue;
+        }
+
+        if ( regex_search( name, rule.pattern ) )
+            return rule.category;
+    }
+
+    return 7010;
+}
+
+/**
+ * @brief Constructor for the Categorizer class.
+ */
+Categorizer::Categorizer() : m_literals( true )
+{
+    return;
+}
+
+/**
+ * @brief Destructor for the Categorizer class.
+ */
+Categorizer::~Categorizer()
+{
+    return;
+}
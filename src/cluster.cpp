@@ -0,0 +1,398 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file cluster.cpp
+ * @brief All non-template member functions of the Cluster class.
+ *
+ * The Cluster class lets several nzedb-backend instances split the work of
+ * one database. Each instance given a cluster.node name heartbeats into
+ * the backend_nodes table, and the work is divided into cluster.shards
+ * shards: a group belongs to the shard of its id modulo the shard count,
+ * and a release to the shard of its id divided by #CFG_CLUSTER_SPAN, so
+ * each shard holds runs of neighbouring ids. Each shard is wanted by one
+ * live node, chosen by rendezvous hashing so a node joining or leaving
+ * only moves the shards it gains or loses, and is worked on only by the
+ * node holding its row in backend_leases. Leases are renewed every
+ * #CFG_CLUSTER_HEARTBEAT seconds and lapse after #CFG_CLUSTER_EXPIRE, so
+ * the shards of a node that dies are taken over once it stops renewing.
+ * A shard a node no longer wants is dropped from new work at once, but its
+ * lease is only released once every job run begun before then finished,
+ * so two nodes never work on one shard at the same time. Without a node
+ * name the instance runs alone and owns everything.
+ */
+#include "h/includes.h"
+#include "h/cluster.h"
+
+#include "h/configfile.h"
+#include "h/dbconn.h"
+
+/**
+ * @brief Note the start of a job run, so shards it may be working on are not released under it.
+ * @retval uint_t The generation to hand back to End() when the run finishes.
+ */
+const uint_t Cluster::Begin()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    m_runs[m_generation]++;
+
+    return m_generation;
+}
+
+/**
+ * @brief Note the end of a job run.
+ * @param[in] generation The generation returned by Begin() when the run started.
+ * @retval void
+ */
+const void Cluster::End( const uint_t& generation )
+{
+    lock_guard<mutex> lock( m_mutex );
+    map<uint_t,uint_t>::iterator mi;
+
+    if ( ( mi = m_runs.find( generation ) ) != m_runs.end() && --mi->second == 0 )
+        m_runs.erase( mi );
+
+    return;
+}
+
+/**
+ * @brief Returns a condition limiting a query on releases to the shards of this node.
+ * @param[in] column The release id column, qualified if the query needs it.
+ * @retval string A condition starting with " AND ", or an empty string when running alone.
+ */
+const string Cluster::Filter( const string& column )
+{
+    lock_guard<mutex> lock( m_mutex );
+    set<uint_t>::iterator si;
+    string shards;
+
+    if ( m_node.empty() )
+        return "";
+
+    if ( m_owned.empty() )
+        return " AND 0";
+
+    for ( si = m_owned.begin(); si != m_owned.end(); si++ )
+        shards.append( Utils::FormatString( 0, "%s%lu", shards.empty() ? "" : ", ", *si ) );
+
+    return Utils::FormatString( 0, " AND MOD(%s DIV %lu, %lu) IN (%s)", CSTR( column ), static_cast<uint_t>( CFG_CLUSTER_SPAN ), m_shards, CSTR( shards ) );
+}
+
+/**
+ * @brief Returns whether the instance is part of a cluster.
+ * @retval bool False when running alone.
+ */
+const bool Cluster::gEnabled()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return !m_node.empty();
+}
+
+/**
+ * @brief Returns whether this node does the work that cannot be split, such as maintaining tables.
+ * @retval bool True for the node holding shard 0, or when running alone.
+ */
+const bool Cluster::Leader()
+{
+    return Owns( 0 );
+}
+
+/**
+ * @brief Give up every lease and leave the cluster, so the other nodes take the shards over at their next heartbeat rather than once the leases lapse.
+ * @retval void
+ */
+const void Cluster::Leave()
+{
+    UFLAGS_I( flags );
+    DBConn* db = NULL;
+
+    if ( m_node.empty() )
+        return;
+
+    if ( ( db = Main::AcquireDBConn() ) != NULL )
+    {
+        db->Execute( "DELETE FROM backend_leases WHERE node = '" + db->Escape( m_node ) + "'" );
+        db->Execute( "DELETE FROM backend_nodes WHERE node = '" + db->Escape( m_node ) + "'" );
+        Main::ReleaseDBConn( db );
+    }
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+
+        m_draining.clear();
+        m_owned.clear();
+        m_generation++;
+    }
+
+    LOGFMT( flags, "Cluster::Leave()-> %s left the cluster", CSTR( m_node ) );
+
+    return;
+}
+
+/**
+ * @brief Drop every shard once the leases may have lapsed without being renewed, as another node could hold them by now.
+ * @param[in] now The current time.
+ * @retval void
+ */
+const void Cluster::Lost( const chrono::high_resolution_clock::time_point& now )
+{
+    UFLAGS_DE( flags );
+    lock_guard<mutex> lock( m_mutex );
+
+    if ( ( m_owned.empty() && m_draining.empty() ) || chrono::duration_cast<chrono::seconds>( now - m_renewed ).count() < CFG_CLUSTER_EXPIRE )
+        return;
+
+    LOGFMT( flags, "Cluster::Lost()-> leases not renewed for %lus, dropping %lu shards", static_cast<uint_t>( CFG_CLUSTER_EXPIRE ), m_owned.size() + m_draining.size() );
+
+    m_draining.clear();
+    m_owned.clear();
+    m_generation++;
+
+    return;
+}
+
+/**
+ * @brief Returns whether this node works on a group.
+ * @param[in] group The id of the group.
+ * @retval bool True if the shard of the group is leased to this node, or when running alone.
+ */
+const bool Cluster::Owns( const uint_t& group )
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_node.empty() || m_owned.count( group % m_shards ) > 0;
+}
+
+/**
+ * @brief Heartbeat, then claim the shards this node wants, renew those it holds, and release those it no longer wants once no job run could still be using them. Does nothing more often than every #CFG_CLUSTER_HEARTBEAT seconds.
+ * @param[in] force Poll even if the last poll was recent, such as at startup.
+ * @retval void
+ */
+const void Cluster::Poll( const bool& force )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    DBConn* db = NULL;
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+    vector<vector<string>> result;
+    vector<string> nodes;
+    set<uint_t> held, wanted;
+    set<uint_t>::iterator si;
+    map<uint_t,uint_t>::iterator mi;
+    string node = g_global->m_config->gString( "cluster.node" ), name, claims, releases;
+    uint_t shards = g_global->m_config->gNumber( "cluster.shards" ), shard = 0, want = 0, oldest = 0, lost = 0, i = 0, y = 0;
+    bool changed = false;
+
+    if ( !force && node == m_node && shards == m_shards && chrono::duration_cast<chrono::seconds>( now - m_heartbeat ).count() < CFG_CLUSTER_HEARTBEAT )
+        return;
+
+    m_heartbeat = now;
+
+    // Shards are numbered by the old layout, so everything held under it is given up before taking part under the new one
+    if ( node != m_node || shards != m_shards )
+    {
+        if ( shards != m_shards && !m_node.empty() )
+            LOGFMT( flags, "Cluster::Poll()-> cluster.shards changed from %lu to %lu; every node must use the same count", m_shards, shards );
+
+        Leave();
+
+        lock_guard<mutex> lock( m_mutex );
+        m_node = node;
+        m_shards = shards;
+    }
+
+    if ( m_node.empty() )
+        return;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        Lost( now );
+        return;
+    }
+
+    name = "'" + db->Escape( m_node ) + "'";
+
+    if ( !m_tables )
+        m_tables = db->Execute( "CREATE TABLE IF NOT EXISTS backend_nodes (node VARCHAR(64) NOT NULL PRIMARY KEY, heartbeat INT UNSIGNED NOT NULL) ENGINE=InnoDB" ) >= 0 &&
+            db->Execute( "CREATE TABLE IF NOT EXISTS backend_leases (shard INT UNSIGNED NOT NULL PRIMARY KEY, node VARCHAR(64) NOT NULL, expires INT UNSIGNED NOT NULL) ENGINE=InnoDB" ) >= 0;
+
+    // The database clock is used throughout, so the clocks of the nodes need not agree
+    if ( !m_tables || db->Execute( "INSERT INTO backend_nodes (node, heartbeat) VALUES (" + name + ", UNIX_TIMESTAMP()) ON DUPLICATE KEY UPDATE heartbeat = VALUES(heartbeat)" ) < 0 )
+    {
+        Main::ReleaseDBConn( db );
+        Lost( now );
+
+        return;
+    }
+
+    result = db->Query( Utils::FormatString( 0, "SELECT node FROM backend_nodes WHERE heartbeat >= UNIX_TIMESTAMP() - %lu", static_cast<uint_t>( CFG_CLUSTER_EXPIRE ) ) );
+
+    // The first row of a result set is metadata; this node just heartbeat, so no rows means the query failed
+    if ( result.size() < 2 )
+    {
+        Main::ReleaseDBConn( db );
+        Lost( now );
+
+        return;
+    }
+
+    for ( i = 1; i < result.size(); i++ )
+        nodes.push_back( result[i][0] );
+
+    // Each shard goes to the live node that weighs it highest, which only moves the shards of a node that joins or leaves
+    for ( i = 0; i < m_shards; i++ )
+    {
+        for ( y = 1, shard = 0; y < nodes.size(); y++ )
+            if ( Weight( nodes[y], i ) > Weight( nodes[shard], i ) )
+                shard = y;
+
+        if ( nodes[shard] == m_node )
+            wanted.insert( i );
+    }
+
+    want = wanted.size();
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+
+        // Dropped shards take no new work; the oldest run still going decides when their leases can go
+        for ( si = m_owned.begin(); si != m_owned.end(); si++ )
+            if ( wanted.count( *si ) == 0 )
+                m_draining[*si] = m_generation + 1;
+
+        for ( si = wanted.begin(); si != wanted.end(); si++ )
+            m_draining.erase( *si );
+
+        oldest = m_runs.empty() ? m_generation + 1 : m_runs.begin()->first;
+
+        for ( mi = m_draining.begin(); mi != m_draining.end(); mi++ )
+            if ( oldest >= mi->second )
+                releases.append( Utils::FormatString( 0, "%s%lu", releases.empty() ? "" : ", ", mi->first ) );
+            else
+                wanted.insert( mi->first );
+    }
+
+    // A lease changes hands only once it lapsed; one this node holds is renewed either way
+    for ( si = wanted.begin(); si != wanted.end(); si++ )
+        claims.append( Utils::FormatString( 0, "%s(%lu, %s, UNIX_TIMESTAMP() + %lu)", claims.empty() ? "" : ", ", *si, CSTR( name ), static_cast<uint_t>( CFG_CLUSTER_EXPIRE ) ) );
+
+    if ( !claims.empty() && db->Execute( "INSERT INTO backend_leases (shard, node, expires) VALUES " + claims + " ON DUPLICATE KEY UPDATE "
+        "node = IF(expires < UNIX_TIMESTAMP() OR node = VALUES(node), VALUES(node), node), expires = IF(node = VALUES(node), VALUES(expires), expires)" ) < 0 )
+        LOGSTR( flags, "Cluster::Poll()-> failed to claim shards" );
+
+    if ( !releases.empty() )
+        db->Execute( "DELETE FROM backend_leases WHERE node = " + name + " AND shard IN (" + releases + ")" );
+
+    result = db->Query( "SELECT shard FROM backend_leases WHERE node = " + name + " AND expires >= UNIX_TIMESTAMP()" );
+    Main::ReleaseDBConn( db );
+
+    if ( result.empty() )
+    {
+        Lost( now );
+        return;
+    }
+
+    for ( i = 1; i < result.size(); i++ )
+        held.insert( ::strtoul( CSTR( result[i][0] ), NULL, 10 ) );
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+
+        for ( mi = m_draining.begin(); mi != m_draining.end(); )
+        {
+            if ( held.count( mi->first ) == 0 )
+                m_draining.erase( mi++ );
+            else
+                held.erase( ( mi++ )->first );
+        }
+
+        for ( si = m_owned.begin(); si != m_owned.end(); si++ )
+            if ( held.count( *si ) == 0 && m_draining.count( *si ) == 0 && wanted.count( *si ) > 0 )
+                lost++;
+
+        changed = held != m_owned || nodes.size() != m_nodes;
+
+        if ( held != m_owned )
+        {
+            m_owned = held;
+            m_generation++;
+        }
+
+        m_nodes = nodes.size();
+        m_renewed = now;
+    }
+
+    // Another node only takes a lease this node held after it lapsed, which means heartbeats were missed
+    if ( lost > 0 )
+        LOGFMT( flags, "Cluster::Poll()-> %lu shards were taken over by other nodes after their leases lapsed", lost );
+
+    if ( changed )
+        LOGFMT( iflags, "Cluster::Poll()-> %s holds %lu of %lu shards, wants %lu, across %lu nodes", CSTR( m_node ), held.size(), m_shards, want, m_nodes );
+
+    return;
+}
+
+/**
+ * @brief Weigh a shard for a node, for rendezvous hashing. Uses FNV-1a and a final mix rather than std::hash so every build of every node agrees.
+ * @param[in] node Name of the node.
+ * @param[in] shard The shard.
+ * @retval uint64_t The weight; the node weighing a shard highest wants it.
+ */
+const uint64_t Cluster::Weight( const string& node, const uint_t& shard )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    uint_t i = 0;
+
+    for ( i = 0; i < node.length(); i++ )
+        hash = ( hash ^ static_cast<uint8_t>( node[i] ) ) * 1099511628211ULL;
+
+    hash ^= shard * 0x9E3779B97F4A7C15ULL;
+    hash = ( hash ^ ( hash >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    hash = ( hash ^ ( hash >> 27 ) ) * 0x94D049BB133111EBULL;
+
+    return hash ^ ( hash >> 31 );
+}
+
+/**
+ * @brief Constructor for the Cluster class.
+ */
+Cluster::Cluster()
+{
+    m_generation = uintmin_t;
+    m_nodes = uintmin_t;
+    m_shards = CFG_CLUSTER_SHARDS;
+    m_tables = false;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the Cluster class.
+ */
+Cluster::~Cluster()
+{
+    Leave();
+
+    return;
+}
@@ -0,0 +1,484 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file collator.cpp
+ * @brief All non-template member functions of the Collator class.
+ *
+ * The Collator class takes the place of grouping the parts table by SQL.
+ * Parts are hashed into binaries and binaries into collections as headers
+ * arrive. Each flush writes one row per collection and binary, so they are
+ * no longer touched once per part. Completeness is then recounted from the
+ * parts actually stored, since ranges are refetched after failures, crashes
+ * and lease takeovers and a refetched part must not be counted twice.
+ */
+#include "h/includes.h"
+#include "h/collator.h"
+
+#include "h/collectionregex.h"
+#include "h/dbconn.h"
+
+/**
+ * @brief Collate an article into its binary and collection, flushing once #CFG_MEM_MAX_PARTS parts are held.
+ * @param[in] article The parsed overview line.
+ * @retval void
+ */
+const void Collator::Add( const Article& article )
+{
+    unordered_map<string,uint_t>::iterator mi;
+    string group, id, key, name;
+    string::size_type cut = 0;
+    uint_t file = 0, files = 0, total = 0;
+    Collection collection;
+    Binary binary;
+    Part part;
+
+    ParseCounters( article.subject, part.part, total, file, files, cut );
+
+    name = article.subject.substr( 0, cut );
+    while ( !name.empty() && ::isspace( name[name.length() - 1] ) )
+        name.erase( name.length() - 1 );
+
+    group = Utils::FormatString( 0, "%lu", article.group );
+    part.messageid = article.messageid;
+    part.number = article.number;
+    part.size = article.size;
+
+    // Binaries are indexed by what nZEDb hashes so the digest is only computed once per binary
+    id = name + article.from + group;
+
+    if ( ( mi = m_binary_index.find( id ) ) == m_binary_index.end() )
+    {
+        // Subjects only go through the collection regexes once per binary rather than once per part
+        if ( m_regexes == NULL || !m_regexes->Match( article.group_name, article.subject, key ) )
+            key = Clean( name );
+
+        collection.hash = Utils::SHA1( key + article.from + group + Utils::FormatString( 0, "%lu", files ) );
+
+        if ( ( mi = m_collection_index.find( collection.hash ) ) == m_collection_index.end() )
+        {
+            collection.subject = name;
+            collection.from = article.from;
+            collection.date = article.date;
+            collection.xref = article.xref;
+            collection.files = files;
+            collection.group = article.group;
+            collection.size = uintmin_t;
+
+            mi = m_collection_index.insert( make_pair( collection.hash, m_collections.size() ) ).first;
+            m_collections.push_back( collection );
+        }
+
+        binary.name = name;
+        binary.hash = Utils::MD5( id );
+        binary.collection = mi->second;
+        binary.file = file;
+        binary.total = total;
+        binary.size = uintmin_t;
+
+        mi = m_binary_index.insert( make_pair( id, m_binaries.size() ) ).first;
+        m_binaries.push_back( binary );
+    }
+
+    Binary& target = m_binaries[mi->second];
+
+    target.parts.push_back( part );
+    target.size += part.size;
+    m_collections[target.collection].size += part.size;
+    m_total_parts++;
+
+    if ( ++m_parts % CFG_MEM_MAX_PARTS == 0 )
+        Flush();
+
+    return;
+}
+
+/**
+ * @brief Write all collated collections, binaries, and parts. A flush that fails part way resumes where it stopped on the next call.
+ * @retval bool False if any rows could not be written.
+ */
+const bool Collator::Flush()
+{
+    UFLAGS_I( flags );
+    vector<string> hashes;
+    vector<uint_t> numbers;
+    uint_t i = 0, y = 0, current = 0;
+
+    if ( m_stage == COLLATOR_STAGE_NONE )
+    {
+        if ( m_binaries.empty() )
+            return true;
+
+        // Articles that arrive while a flush is retried are collated separately
+        m_pending_collections.swap( m_collections );
+        m_pending_binaries.swap( m_binaries );
+        m_collections.clear();
+        m_binaries.clear();
+        m_collection_index.clear();
+        m_binary_index.clear();
+        m_parts = uintmin_t;
+
+        for ( i = 0; i < m_pending_collections.size(); i++ )
+        {
+            Collection& collection = m_pending_collections[i];
+
+            m_collection_writer.Add( { collection.subject, collection.from, Utils::StrDateTime( collection.date ), collection.xref,
+                Utils::FormatString( 0, "%lu", collection.files ), Utils::FormatString( 0, "%lu", collection.group ), collection.hash,
+                Utils::StrDateTime(), Utils::FormatString( 0, "%lu", collection.size ) } );
+        }
+
+        m_stage = COLLATOR_STAGE_COLLECTIONS;
+    }
+
+    if ( m_stage == COLLATOR_STAGE_COLLECTIONS )
+    {
+        for ( i = 0; i < m_pending_collections.size(); i++ )
+            hashes.push_back( m_pending_collections[i].hash );
+
+        if ( !m_collection_writer.Flush() || !Resolve( "collections", "collectionhash", hashes, m_collection_ids ) )
+            return false;
+
+        for ( i = 0; i < m_pending_binaries.size(); i++ )
+        {
+            Binary& binary = m_pending_binaries[i];
+
+            // Count each part number once in case the provider repeated an article
+            numbers.clear();
+            for ( y = 0; y < binary.parts.size(); y++ )
+                numbers.push_back( binary.parts[y].part );
+            sort( numbers.begin(), numbers.end() );
+            current = unique( numbers.begin(), numbers.end() ) - numbers.begin();
+
+            m_binary_writer.Add( { binary.name, Utils::FormatString( 0, "%lu", m_collection_ids[m_pending_collections[binary.collection].hash] ),
+                Utils::FormatString( 0, "%lu", binary.file ), Utils::FormatString( 0, "%lu", binary.total ), Utils::FormatString( 0, "%lu", current ),
+                binary.hash, binary.total > 0 && current >= binary.total ? "1" : "0", Utils::FormatString( 0, "%lu", binary.size ) } );
+        }
+
+        m_stage = COLLATOR_STAGE_BINARIES;
+    }
+
+    if ( m_stage == COLLATOR_STAGE_BINARIES )
+    {
+        hashes.clear();
+        for ( i = 0; i < m_pending_binaries.size(); i++ )
+            hashes.push_back( m_pending_binaries[i].hash );
+
+        if ( !m_binary_writer.Flush() || !Resolve( "binaries", "binaryhash", hashes, m_binary_ids ) )
+            return false;
+
+        for ( i = 0; i < m_pending_binaries.size(); i++ )
+        {
+            Binary& binary = m_pending_binaries[i];
+
+            for ( y = 0; y < binary.parts.size(); y++ )
+                m_part_writer.Add( { Utils::FormatString( 0, "%lu", m_binary_ids[binary.hash] ), binary.parts[y].messageid,
+                    Utils::FormatString( 0, "%lu", binary.parts[y].number ), Utils::FormatString( 0, "%lu", binary.parts[y].part ),
+                    Utils::FormatString( 0, "%lu", binary.parts[y].size ) } );
+        }
+
+        m_stage = COLLATOR_STAGE_PARTS;
+    }
+
+    if ( m_stage == COLLATOR_STAGE_PARTS )
+    {
+        if ( !m_part_writer.Flush() )
+            return false;
+
+        m_stage = COLLATOR_STAGE_COUNTS;
+    }
+
+    if ( m_stage == COLLATOR_STAGE_COUNTS && !Count() )
+        return false;
+
+    LOGFMT( flags, "Collator::Flush()-> %lu collections, %lu binaries, %lu rows written in total", m_pending_collections.size(), m_pending_binaries.size(), gRows() );
+
+    m_total_collections += m_pending_collections.size();
+    m_total_binaries += m_pending_binaries.size();
+    m_pending_collections.clear();
+    m_pending_binaries.clear();
+    m_collection_ids.clear();
+    m_binary_ids.clear();
+    m_stage = COLLATOR_STAGE_NONE;
+
+    // Anything collated while an earlier flush was being retried is written now
+    return m_binaries.empty() ? true : Flush();
+}
+
+/**
+ * @brief Returns the number of binaries written since construction.
+ * @retval uint_t The number of binaries written since construction.
+ */
+const uint_t Collator::gBinaries()
+{
+    return m_total_binaries;
+}
+
+/**
+ * @brief Returns the number of collections written since construction.
+ * @retval uint_t The number of collections written since construction.
+ */
+const uint_t Collator::gCollections()
+{
+    return m_total_collections;
+}
+
+/**
+ * @brief Returns the number of parts collated since construction.
+ * @retval uint_t The number of parts collated since construction.
+ */
+const uint_t Collator::gParts()
+{
+    return m_total_parts;
+}
+
+/**
+ * @brief Returns the number of collection, binary, and part rows written since construction.
+ * @retval uint_t The number of collection, binary, and part rows written since construction.
+ */
+const uint_t Collator::gRows()
+{
+    return m_collection_writer.gWritten() + m_binary_writer.gWritten() + m_part_writer.gWritten();
+}
+
+/**
+ * @brief Build a collection key from a binary name when no collection regex matched, by removing file counters and the yEnc marker.
+ * @param[in] name The subject without its part counter.
+ * @retval string The collection key.
+ */
+const string Collator::Clean( const string& name )
+{
+    string output;
+    string::size_type i = 0, end = 0;
+
+    for ( i = 0; i < name.length(); i++ )
+    {
+        // Skip [01/20] and (01/20) so every file of a post shares one key
+        if ( name[i] == '[' || name[i] == '(' )
+        {
+            end = name.find_first_not_of( "0123456789/ ", i + 1 );
+
+            if ( end != string::npos && end > i + 1 && name[end] == ( name[i] == '[' ? ']' : ')' ) && name.find( '/', i ) < end )
+            {
+                i = end;
+                continue;
+            }
+        }
+
+        if ( name.compare( i, 4, "yEnc" ) == 0 )
+        {
+            i += 3;
+            continue;
+        }
+
+        output.push_back( name[i] );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Recompute the part count, size, and completeness of each pending binary from its stored parts, then the size of each pending collection from its binaries.
+ * Parts are inserted with IGNORE, so counting them from the table is the only way a refetched range is not counted twice.
+ * @retval bool False if no connector was available or any update failed.
+ */
+const bool Collator::Count()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    string ids;
+    uint_t i = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "Collator::Count()-> no database connector available" );
+        return false;
+    }
+
+    for ( i = 0; i < m_pending_binaries.size(); i++ )
+    {
+        ids.append( ids.empty() ? "" : ", " );
+        ids.append( Utils::FormatString( 0, "%lu", m_binary_ids[m_pending_binaries[i].hash] ) );
+
+        if ( ids.length() < CFG_DB_BULK_BYTES && i + 1 < m_pending_binaries.size() )
+            continue;
+
+        if ( db->Execute( "UPDATE binaries b INNER JOIN (SELECT binaryid, COUNT(DISTINCT partnumber) AS current, SUM(size) AS size FROM parts WHERE binaryid IN (" + ids + ") GROUP BY binaryid) p "
+            "ON p.binaryid = b.id SET b.currentparts = p.current, b.partsize = p.size, b.partcheck = IF(b.totalparts > 0 AND p.current >= b.totalparts, 1, 0)" ) < 0 )
+        {
+            LOGFMT( flags, "Collator::Count()-> recount of %lu binaries failed", m_pending_binaries.size() );
+            return false;
+        }
+
+        ids.clear();
+    }
+
+    // Binaries are counted first so each collection adds up sizes that are already correct
+    for ( i = 0; i < m_pending_collections.size(); i++ )
+    {
+        ids.append( ids.empty() ? "" : ", " );
+        ids.append( Utils::FormatString( 0, "%lu", m_collection_ids[m_pending_collections[i].hash] ) );
+
+        if ( ids.length() < CFG_DB_BULK_BYTES && i + 1 < m_pending_collections.size() )
+            continue;
+
+        if ( db->Execute( "UPDATE collections c INNER JOIN (SELECT collectionid, SUM(partsize) AS size FROM binaries WHERE collectionid IN (" + ids + ") GROUP BY collectionid) b "
+            "ON b.collectionid = c.id SET c.filesize = b.size" ) < 0 )
+        {
+            LOGFMT( flags, "Collator::Count()-> resize of %lu collections failed", m_pending_collections.size() );
+            return false;
+        }
+
+        ids.clear();
+    }
+
+    return true;
+}
+
+/**
+ * @brief Find the part and file counters within a subject.
+ * @param[in] subject The subject of the article.
+ * @param[out] part The part number from the last (n/m) counter, 0 if none.
+ * @param[out] total The number of parts from the last (n/m) counter, 0 if none.
+ * @param[out] file The file number from the first [n/m] or (n/m) counter before the part counter, 0 if none.
+ * @param[out] files The number of files from the same counter as file, 0 if none.
+ * @param[out] cut The position of the part counter, string::npos if none.
+ * @retval void
+ */
+const void Collator::ParseCounters( const string& subject, uint_t& part, uint_t& total, uint_t& file, uint_t& files, string::size_type& cut )
+{
+    string::size_type pos = subject.rfind( '(' );
+    char close = 0;
+
+    part = total = file = files = uintmin_t;
+    cut = string::npos;
+
+    while ( pos != string::npos )
+    {
+        if ( ::sscanf( CSTR( subject ) + pos, "(%lu/%lu%c", &part, &total, &close ) == 3 && close == ')' )
+        {
+            cut = pos;
+            break;
+        }
+
+        part = total = uintmin_t;
+        pos = pos > 0 ? subject.rfind( '(', pos - 1 ) : string::npos;
+    }
+
+    for ( pos = subject.find_first_of( "[(" ); pos != string::npos && pos < cut; pos = subject.find_first_of( "[(", pos + 1 ) )
+    {
+        if ( ::sscanf( CSTR( subject ) + pos + 1, "%lu/%lu%c", &file, &files, &close ) == 3 && close == ( subject[pos] == '[' ? ']' : ')' ) )
+            return;
+
+        file = files = uintmin_t;
+    }
+
+    return;
+}
+
+/**
+ * @brief Look up the database ids of rows by their hash column.
+ * @param[in] table The table to search.
+ * @param[in] column The hash column of the table.
+ * @param[in] hashes The hashes to look up. Those already in ids are skipped.
+ * @param[in,out] ids The ids found, by hash.
+ * @retval bool False if no connector was available or any hash was not found.
+ */
+const bool Collator::Resolve( const string& table, const string& column, const vector<string>& hashes, unordered_map<string,uint_t>& ids )
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    string query;
+    uint_t i = 0, id = 0, missing = 0, y = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGFMT( flags, "Collator::Resolve()-> %s: no database connector available", CSTR( table ) );
+        return false;
+    }
+
+    for ( i = 0; i < hashes.size(); i++ )
+    {
+        if ( ids.find( hashes[i] ) == ids.end() )
+        {
+            query.append( query.empty() ? "SELECT id, `" + column + "` FROM `" + table + "` WHERE `" + column + "` IN (" : ", " );
+            query.append( "'" + db->Escape( hashes[i] ) + "'" );
+        }
+
+        if ( query.empty() || ( query.length() < CFG_DB_BULK_BYTES && i + 1 < hashes.size() ) )
+            continue;
+
+        result = db->Query( query + ")" );
+        query.clear();
+
+        // The first row of a result set is metadata
+        for ( y = 1; y < result.size(); y++ )
+        {
+            id = uintmin_t;
+            stringstream( result[y][0] ) >> id;
+            ids[result[y][1]] = id;
+        }
+    }
+
+    for ( i = 0; i < hashes.size(); i++ )
+        if ( ids.find( hashes[i] ) == ids.end() )
+            missing++;
+
+    if ( missing > 0 )
+    {
+        LOGFMT( flags, "Collator::Resolve()-> %s: %lu of %lu rows not found", CSTR( table ), missing, hashes.size() );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Constructor for the Collator class.
+ * @param[in] regexes Rules used to find the collection key of a subject, or NULL to only use the cleaned subject.
+ */
+Collator::Collator( CollectionRegex* regexes ) :
+    m_regexes( regexes ),
+    m_collection_writer( "collections", { "subject", "fromname", "date", "xref", "totalfiles", "groupid", "collectionhash", "dateadded", "filesize" }, "",
+        "ON DUPLICATE KEY UPDATE dateadded = NOW()" ),
+    m_binary_writer( "binaries", { "name", "collectionid", "filenumber", "totalparts", "currentparts", "binaryhash", "partcheck", "partsize" }, "",
+        "ON DUPLICATE KEY UPDATE id = id" ),
+    m_part_writer( "parts", { "binaryid", "messageid", "number", "partnumber", "size" }, "IGNORE" )
+{
+    m_parts = uintmin_t;
+    m_stage = COLLATOR_STAGE_NONE;
+    m_total_binaries = uintmin_t;
+    m_total_collections = uintmin_t;
+    m_total_parts = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the Collator class.
+ */
+Collator::~Collator()
+{
+    Flush();
+
+    return;
+}
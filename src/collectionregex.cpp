@@ -0,0 +1,697 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file collectionregex.cpp
+ * @brief All non-template member functions of the CollectionRegex class.
+ *
+ * The CollectionRegex class replaces trying each collection regex in turn.
+ * The literals that every match must contain are pulled from each rule and
+ * all of them are compiled into one AhoCorasick automaton. A subject is
+ * scanned once, and only rules whose literals were all seen, or that have
+ * none, run their regex. Rules are still tried in ordinal order and the first match wins,
+ * exactly as nZEDb does.
+ */
+#include "h/includes.h"
+#include "h/collectionregex.h"
+
+#include "h/dbconn.h"
+
+/**
+ * @brief Time matching a recorded corpus with and without the literal prefilter and log subjects/sec for each.
+ * @param[in] file A text file with one "group<TAB>subject" pair per line, such as the output of SELECT g.name, p.subject FROM parts p INNER JOIN groups g ON g.id = p.groupid.
+ * @retval void
+ */
+const void CollectionRegex::Benchmark( const string& file )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    ifstream input( file );
+    vector<pair<string,string>> corpus;
+    vector<string> keys;
+    chrono::high_resolution_clock::time_point start;
+    string line, key;
+    string::size_type tab = 0;
+    uint_t executed = 0, i = 0, matched = 0, mismatched = 0, pass = 0;
+    double elapsed = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "CollectionRegex::Benchmark()-> unable to open %s", CSTR( file ) );
+        return;
+    }
+
+    while ( getline( input, line ) )
+    {
+        if ( !line.empty() && line[line.length() - 1] == '\r' )
+            line.erase( line.length() - 1 );
+
+        if ( ( tab = line.find( '\t' ) ) == string::npos )
+            continue;
+
+        corpus.push_back( make_pair( line.substr( 0, tab ), line.substr( tab + 1 ) ) );
+    }
+
+    if ( corpus.empty() )
+    {
+        LOGFMT( flags, "CollectionRegex::Benchmark()-> no subjects in %s", CSTR( file ) );
+        return;
+    }
+
+    // Resolve the rules of each group up front so only subject matching is timed
+    for ( i = 0; i < corpus.size(); i++ )
+        Rules( corpus[i].first );
+
+    keys.resize( corpus.size() );
+
+    for ( pass = 0; pass < 2; pass++ )
+    {
+        executed = m_executed;
+        matched = uintmin_t;
+        start = chrono::high_resolution_clock::now();
+
+        for ( i = 0; i < corpus.size(); i++ )
+        {
+            if ( !Search( corpus[i].first, corpus[i].second, key, pass == 0 ) )
+                key.clear();
+            else
+                matched++;
+
+            if ( pass == 0 )
+                keys[i] = key;
+            else if ( keys[i] != key )
+                mismatched++;
+        }
+
+        elapsed = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+        LOGFMT( iflags, "CollectionRegex::Benchmark()-> %s: %lu subjects, %lu matched, %.2f regexes/subject, %.0f subjects/sec",
+            pass == 0 ? "prefiltered" : "sequential", corpus.size(), matched,
+            static_cast<double>( m_executed - executed ) / corpus.size(), elapsed > 0 ? corpus.size() / elapsed : 0 );
+    }
+
+    if ( mismatched > 0 )
+        LOGFMT( flags, "CollectionRegex::Benchmark()-> %lu subjects were keyed differently with the prefilter", mismatched );
+
+    return;
+}
+
+/**
+ * @brief Returns the number of regex executions since the rules were loaded.
+ * @retval uint_t The number of regex executions since the rules were loaded.
+ */
+const uint_t CollectionRegex::gExecuted()
+{
+    return m_executed;
+}
+
+/**
+ * @brief Returns the number of subjects that produced a key since the rules were loaded.
+ * @retval uint_t The number of subjects that produced a key since the rules were loaded.
+ */
+const uint_t CollectionRegex::gMatched()
+{
+    return m_matched;
+}
+
+/**
+ * @brief Returns the number of enabled rules.
+ * @retval uint_t The number of enabled rules.
+ */
+const uint_t CollectionRegex::gRules()
+{
+    return m_rules.size();
+}
+
+/**
+ * @brief Returns the number of subjects checked since the rules were loaded.
+ * @retval uint_t The number of subjects checked since the rules were loaded.
+ */
+const uint_t CollectionRegex::gScanned()
+{
+    return m_scanned;
+}
+
+/**
+ * @brief Load and compile the enabled rules from collection_regexes, replacing any already loaded.
+ * @retval bool False if no connector was available or there are no enabled rules.
+ */
+const bool CollectionRegex::Load()
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    vector<uint_t> captures;
+    vector<string> literals;
+    unordered_map<string,uint_t> ids;
+    Rule rule;
+    uint_t disabled = 0, i = 0, prefiltered = 0, y = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "CollectionRegex::Load()-> no database connector available" );
+        return false;
+    }
+
+    // nZEDb tries the rules of a group in this order and keeps the first match
+    result = *db->Cached( "SELECT id, group_regex, regex FROM collection_regexes WHERE status = 1 ORDER BY ordinal ASC, group_regex ASC, id ASC" );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+    {
+        LOGSTR( flags, "CollectionRegex::Load()-> no enabled collection regexes" );
+        return false;
+    }
+
+    m_rules.clear();
+    m_groups.clear();
+    m_literals.Clear();
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        rule.id = uintmin_t;
+        stringstream( result[i][0] ) >> rule.id;
+
+        // Group regexes are stored without delimiters and matched case insensitively
+        if ( !Compile( "/" + result[i][1] + "/i", rule.group, captures, literals ) || !Compile( result[i][2], rule.pattern, rule.captures, literals ) )
+        {
+            LOGFMT( flags, "CollectionRegex::Load()-> rule %lu disabled", rule.id );
+            disabled++;
+            continue;
+        }
+
+        rule.literals.clear();
+
+        // Rules often share literals, so each distinct literal is only added to the automaton once
+        for ( y = 0; y < literals.size(); y++ )
+        {
+            if ( ids.find( literals[y] ) == ids.end() )
+            {
+                ids[literals[y]] = m_literals.gPatterns();
+                m_literals.Add( literals[y], m_literals.gPatterns() );
+            }
+
+            rule.literals.push_back( ids[literals[y]] );
+        }
+
+        if ( !rule.literals.empty() )
+            prefiltered++;
+
+        m_rules.push_back( rule );
+    }
+
+    m_literals.Build();
+    m_seen.assign( m_literals.gPatterns(), 0 );
+    m_stamp = uintmin_t;
+    m_executed = uintmin_t;
+    m_matched = uintmin_t;
+    m_scanned = uintmin_t;
+
+    LOGFMT( iflags, "CollectionRegex::Load()-> %lu rules loaded, %lu prefiltered by %lu literals in %lu automaton states, %lu disabled", m_rules.size(), prefiltered, m_literals.gPatterns(), m_literals.gStates(), disabled );
+
+    return !m_rules.empty();
+}
+
+/**
+ * @brief Find the collection key of a subject using the first rule of the group that matches.
+ * @param[in] group The name of the group the article was posted to.
+ * @param[in] subject The subject of the article.
+ * @param[out] key The match0, match1, ... captures of the rule joined together, or the whole match if the rule has none.
+ * @retval bool False if no rule of the group matched.
+ */
+const bool CollectionRegex::Match( const string& group, const string& subject, string& key )
+{
+    m_scanned++;
+
+    if ( !Search( group, subject, key, true ) )
+        return false;
+
+    m_matched++;
+
+    return true;
+}
+
+/**
+ * @brief Translate a PCRE rule as stored by nZEDb into an ECMAScript regex and find the literals every match contains.
+ * @param[in] source The rule, such as /^(?P<match0>.+?)\s+yEnc$/i.
+ * @param[out] output The compiled regex.
+ * @param[out] captures Capture indices of the named match0, match1, ... groups, in order.
+ * @param[out] literals Literals every match contains, empty if none could be found.
+ * @retval bool False if the rule uses syntax that has no ECMAScript equivalent.
+ */
+const bool CollectionRegex::Compile( const string& source, regex& output, vector<uint_t>& captures, vector<string>& literals )
+{
+    UFLAGS_DE( flags );
+    regex::flag_type options = regex::ECMAScript | regex::optimize;
+    map<uint_t,uint_t> named;
+    map<uint_t,uint_t>::iterator mi;
+    string body, modifiers, name, pattern;
+    string::size_type end = 0, i = 0;
+    uint_t capture = 0, number = 0;
+    bool cls = false;
+
+    captures.clear();
+    literals.clear();
+
+    if ( source.empty() )
+        return false;
+
+    // PCRE rules are wrapped in delimiters with the modifiers following the closing one
+    if ( string( "/#~%@!" ).find( source[0] ) != string::npos && ( end = source.rfind( source[0] ) ) > 0 )
+    {
+        body = source.substr( 1, end - 1 );
+        modifiers = source.substr( end + 1 );
+    }
+    else
+        body = source;
+
+    if ( modifiers.find( 'i' ) != string::npos )
+        options |= regex::icase;
+
+    for ( i = 0; i < body.length(); i++ )
+    {
+        if ( body[i] == '\\' && i + 1 < body.length() )
+        {
+            // Anchors that ECMAScript spells differently
+            if ( !cls && body[i + 1] == 'A' )
+                pattern.append( "^" );
+            else if ( !cls && ( body[i + 1] == 'z' || body[i + 1] == 'Z' ) )
+                pattern.append( "$" );
+            else
+                pattern.append( body, i, 2 );
+
+            i++;
+            continue;
+        }
+
+        if ( cls )
+        {
+            pattern.push_back( body[i] );
+
+            if ( body[i] == ']' )
+                cls = false;
+
+            continue;
+        }
+
+        if ( body[i] == '[' )
+        {
+            cls = true;
+            pattern.push_back( body[i] );
+
+            // A ] straight after the opening bracket is a literal
+            if ( i + 1 < body.length() && body[i + 1] == '^' )
+                pattern.push_back( body[++i] );
+            if ( i + 1 < body.length() && body[i + 1] == ']' )
+                pattern.push_back( body[++i] );
+
+            continue;
+        }
+
+        if ( body[i] == '(' )
+        {
+            end = string::npos;
+
+            if ( body.compare( i, 4, "(?P<" ) == 0 )
+                end = i + 4;
+            else if ( body.compare( i, 3, "(?'" ) == 0 || ( body.compare( i, 3, "(?<" ) == 0 && i + 3 < body.length() && body[i + 3] != '=' && body[i + 3] != '!' ) )
+                end = i + 3;
+
+            if ( end != string::npos )
+            {
+                // ECMAScript has no named groups, so remember which numbered capture each matchN became
+                name = body.substr( end, body.find_first_of( ">'", end ) - end );
+                capture++;
+
+                if ( name.compare( 0, 5, "match" ) == 0 && name.length() > 5 && ::isdigit( name[5] ) )
+                {
+                    number = uintmin_t;
+                    stringstream( name.substr( 5 ) ) >> number;
+                    named[number] = capture;
+                }
+
+                pattern.push_back( '(' );
+                i = end + name.length();
+                continue;
+            }
+
+            if ( i + 1 >= body.length() || body[i + 1] != '?' )
+                capture++;
+        }
+
+        pattern.push_back( body[i] );
+    }
+
+    try
+    {
+        output.assign( pattern, options );
+    }
+    catch ( const regex_error& e )
+    {
+        LOGFMT( flags, "CollectionRegex::Compile()-> %s: %s", CSTR( source ), e.what() );
+        return false;
+    }
+
+    for ( mi = named.begin(); mi != named.end(); mi++ )
+        captures.push_back( mi->second );
+
+    // Extended mode ignores whitespace, so no run of the source can be trusted as a literal
+    if ( modifiers.find( 'x' ) == string::npos )
+        literals = Literals( body );
+
+    return true;
+}
+
+/**
+ * @brief Find the end of a bracket class, treating POSIX classes such as [:alnum:] within it as a unit.
+ * @param[in] source The body of a regex.
+ * @param[in] start The index of the opening [ of the class.
+ * @retval string::size_type The index of the closing ], or the last index of the source if the class is unterminated.
+ */
+const string::size_type CollectionRegex::EndClass( const string& source, const string::size_type& start )
+{
+    string::size_type i = start + 1, close = 0;
+
+    if ( i < source.length() && source[i] == '^' )
+        i++;
+
+    // A ] first in the class is a member of it
+    if ( i < source.length() && source[i] == ']' )
+        i++;
+
+    for ( ; i < source.length(); i++ )
+    {
+        if ( source[i] == '\\' )
+            i = EndEscape( source, i );
+        else if ( source[i] == '[' && i + 1 < source.length() && string( ":.=" ).find( source[i + 1] ) != string::npos &&
+            ( close = source.find( string( 1, source[i + 1] ) + "]", i + 2 ) ) != string::npos )
+            i = close + 1;
+        else if ( source[i] == ']' )
+            return i;
+    }
+
+    return source.length() - 1;
+}
+
+/**
+ * @brief Find the last character of an escape sequence, so hex, octal and control characters, back references and properties are skipped whole.
+ * @param[in] source The body of a regex.
+ * @param[in] start The index of the backslash.
+ * @retval string::size_type The index of the last character of the sequence.
+ */
+const string::size_type CollectionRegex::EndEscape( const string& source, const string::size_type& start )
+{
+    string::size_type i = start + 1, close = 0;
+    uint_t n = 0;
+
+    if ( i >= source.length() )
+        return start;
+
+    switch ( source[i] )
+    {
+        case 'x':
+            if ( i + 1 < source.length() && source[i + 1] == '{' )
+                return ( close = source.find( '}', i ) ) == string::npos ? source.length() - 1 : close;
+
+            for ( n = 0; n < 2 && i + 1 < source.length() && ::isxdigit( static_cast<unsigned char>( source[i + 1] ) ); n++ )
+                i++;
+        break;
+
+        case '0':
+            for ( n = 0; n < 2 && i + 1 < source.length() && source[i + 1] >= '0' && source[i + 1] <= '7'; n++ )
+                i++;
+        break;
+
+        case 'c':
+            if ( i + 1 < source.length() )
+                i++;
+        break;
+
+        case 'Q':
+            // Everything up to \E is quoted
+            return ( close = source.find( "\\E", i ) ) == string::npos ? source.length() - 1 : close + 1;
+
+        case 'g':
+        case 'k':
+        case 'o':
+        case 'p':
+        case 'P':
+        case 'N':
+            if ( i + 1 < source.length() && string( "{<'" ).find( source[i + 1] ) != string::npos )
+            {
+                close = source.find( source[i + 1] == '{' ? '}' : source[i + 1] == '<' ? '>' : '\'', i + 2 );
+                return close == string::npos ? source.length() - 1 : close;
+            }
+
+            if ( ( source[i] == 'p' || source[i] == 'P' ) && i + 1 < source.length() )
+                i++;
+            else if ( source[i] == 'g' )
+            {
+                if ( i + 1 < source.length() && source[i + 1] == '-' )
+                    i++;
+                while ( i + 1 < source.length() && ::isdigit( static_cast<unsigned char>( source[i + 1] ) ) )
+                    i++;
+            }
+        break;
+
+        default:
+            // A back reference, or an octal escape, may run to several digits
+            if ( source[i] >= '1' && source[i] <= '9' )
+                while ( i + 1 < source.length() && ::isdigit( static_cast<unsigned char>( source[i + 1] ) ) )
+                    i++;
+        break;
+    }
+
+    return i;
+}
+
+/**
+ * @brief Find the runs of literal characters that every match of a regex must contain.
+ * @param[in] source The body of the regex, without delimiters or modifiers.
+ * @retval vector<string> The distinct literals, empty if none could be proven.
+ */
+const vector<string> CollectionRegex::Literals( const string& source )
+{
+    vector<string> literals;
+    string run;
+    string::size_type i = 0;
+    uint_t depth = 0;
+    bool last = false;
+
+    // Only characters outside of any group are considered, so optional groups and alternations within them are safe
+    auto end_run = [&]()
+    {
+        if ( !run.empty() && find( literals.begin(), literals.end(), run ) == literals.end() )
+            literals.push_back( run );
+
+        run.clear();
+        last = false;
+    };
+
+    for ( i = 0; i < source.length(); i++ )
+    {
+        if ( source[i] == '\\' && i + 1 < source.length() )
+        {
+            // Escaped punctuation is a literal, any longer sequence is a class, anchor, back reference or encoded character
+            if ( depth == 0 && !::isalnum( static_cast<unsigned char>( source[i + 1] ) ) )
+            {
+                run.push_back( source[++i] );
+                last = true;
+            }
+            else
+            {
+                end_run();
+                i = EndEscape( source, i );
+            }
+
+            continue;
+        }
+
+        switch ( source[i] )
+        {
+            case '[':
+                end_run();
+                i = EndClass( source, i );
+            break;
+
+            case '(':
+                end_run();
+                depth++;
+            break;
+
+            case ')':
+                end_run();
+
+                if ( depth > 0 )
+                    depth--;
+            break;
+
+            case '|':
+                // An alternation outside of any group means no literal is required
+                if ( depth == 0 )
+                    return vector<string>();
+            break;
+
+            case '?':
+            case '*':
+            case '{':
+                // The preceding character may not appear at all
+                if ( depth == 0 && last )
+                    run.erase( run.length() - 1 );
+
+                end_run();
+
+                if ( source[i] == '{' )
+                    while ( i + 1 < source.length() && source[i] != '}' )
+                        i++;
+            break;
+
+            case '+':
+            case '.':
+            case '^':
+            case '$':
+                end_run();
+            break;
+
+            default:
+                if ( depth == 0 )
+                {
+                    run.push_back( source[i] );
+                    last = true;
+                }
+            break;
+        }
+    }
+
+    end_run();
+
+    return literals;
+}
+
+/**
+ * @brief Returns the indices of the rules that apply to a group, in priority order, resolving them on first use.
+ * @param[in] group The name of the group.
+ * @retval vector<uint_t> The indices into m_rules of the rules that apply to the group.
+ */
+const vector<uint_t>& CollectionRegex::Rules( const string& group )
+{
+    unordered_map<string,vector<uint_t>>::iterator mi;
+    uint_t i = 0;
+
+    if ( ( mi = m_groups.find( group ) ) != m_groups.end() )
+        return mi->second;
+
+    vector<uint_t>& rules = m_groups[group];
+
+    for ( i = 0; i < m_rules.size(); i++ )
+        if ( regex_search( group, m_rules[i].group ) )
+            rules.push_back( i );
+
+    return rules;
+}
+
+/**
+ * @brief Try the rules of a group against a subject in priority order.
+ * @param[in] group The name of the group the article was posted to.
+ * @param[in] subject The subject of the article.
+ * @param[out] key The collection key if a rule matched.
+ * @param[in] prefilter If false every rule of the group runs its regex, as nZEDb does.
+ * @retval bool False if no rule of the group matched.
+ */
+const bool CollectionRegex::Search( const string& group, const string& subject, string& key, const bool& prefilter )
+{
+    const vector<uint_t>& rules = Rules( group );
+    smatch match;
+    uint_t i = 0, y = 0;
+    bool seen = true;
+
+    if ( rules.empty() )
+        return false;
+
+    if ( prefilter )
+    {
+        if ( ++m_stamp == 0 )
+        {
+            m_seen.assign( m_seen.size(), 0 );
+            m_stamp = 1;
+        }
+
+        m_hits.clear();
+        m_literals.Scan( subject, m_hits );
+
+        for ( i = 0; i < m_hits.size(); i++ )
+            m_seen[m_hits[i]] = m_stamp;
+    }
+
+    for ( i = 0; i < rules.size(); i++ )
+    {
+        Rule& rule = m_rules[rules[i]];
+
+        if ( prefilter )
+        {
+            for ( y = 0, seen = true; seen && y < rule.literals.size(); y++ )
+                seen = m_seen[rule.literals[y]] == m_stamp;
+
+            if ( !seen )
+                continue;
+        }
+
+        m_executed++;
+
+        if ( !regex_search( subject, match, rule.pattern ) )
+            continue;
+
+        key.clear();
+
+        if ( rule.captures.empty() )
+            key = match.str( 0 );
+        else
+            for ( y = 0; y < rule.captures.size(); y++ )
+                key.append( match.str( rule.captures[y] ) );
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Constructor for the CollectionRegex class.
+ */
+CollectionRegex::CollectionRegex() : m_literals( true )
+{
+    m_stamp = uintmin_t;
+    m_executed = uintmin_t;
+    m_matched = uintmin_t;
+    m_scanned = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the CollectionRegex class.
+ */
+CollectionRegex::~CollectionRegex()
+{
+    return;
+}
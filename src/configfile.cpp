@@ -0,0 +1,517 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file configfile.cpp
+ * @brief All non-template member functions of the ConfigFile class.
+ *
+ * The ConfigFile class reads "key = value" lines, where a line starting
+ * with # is a comment. If nzedb.config names nZEDb's config.php, the
+ * database and NNTP details are read from its define() calls first, and
+ * anything in the configuration file itself takes precedence. A file that
+ * fails to parse or validate leaves the previous settings untouched.
+ * Changed() reports a SIGHUP, or a write or rename of either file, which
+ * inotify notices through the directories that hold them.
+ *
+ * Recognized keys:
+ *   categorize.rules, categorize.write,
+ *   class.cleanup.budget, class.ingest.budget, class.process.budget,
+ *   cluster.node, cluster.shards, db.connect.timeout, db.host, db.name,
+ *   db.pass, db.pool.grow, db.pool.idle, db.pool.max, db.pool.min,
+ *   db.pool.wait, db.replica.lag, db.replica.pool, db.replicas, db.socket,
+ *   db.user, io.engine,
+ *   nntp.host, nntp.pass, nntp.port, nntp.user, nzedb.config,
+ *   server.affinity, server.control, server.sleep, server.state,
+ *   job.<name>.enabled and job.<name>.interval.
+ */
+#include "h/includes.h"
+#include "h/configfile.h"
+
+volatile sig_atomic_t ConfigFile::m_hangup = 0;
+
+/**
+ * @brief Check whether a reload has been asked for since the last call.
+ * @retval bool True after a SIGHUP or a change to a loaded file.
+ */
+const bool ConfigFile::Changed()
+{
+    alignas( struct inotify_event ) char buf[4096];
+    const struct inotify_event* event = NULL;
+    bool changed = false;
+    sint_t length = 0, i = 0;
+    uint_t y = 0;
+
+    if ( m_hangup )
+    {
+        m_hangup = 0;
+        changed = true;
+    }
+
+    if ( m_inotify < 0 )
+        return changed;
+
+    while ( ( length = ::read( m_inotify, buf, sizeof( buf ) ) ) > 0 )
+    {
+        for ( i = 0; i < length; i += sizeof( struct inotify_event ) + event->len )
+        {
+            event = reinterpret_cast<const struct inotify_event*>( buf + i );
+
+            if ( event->len == 0 )
+                continue;
+
+            for ( y = 0; y < m_files.size(); y++ )
+                if ( m_files[y].substr( m_files[y].find_last_of( '/' ) + 1 ) == event->name )
+                    changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Returns the names of the jobs the settings mention.
+ * @retval vector<string> The name of every job with a job.<name>.enabled or job.<name>.interval setting.
+ */
+const vector<string> ConfigFile::gJobs()
+{
+    map<string,string>::const_iterator mi;
+    vector<string> jobs;
+    string name;
+
+    for ( mi = m_values.lower_bound( "job." ); mi != m_values.end() && mi->first.compare( 0, 4, "job." ) == 0; mi++ )
+    {
+        name = mi->first.substr( 4, mi->first.find_last_of( '.' ) - 4 );
+
+        if ( find( jobs.begin(), jobs.end(), name ) == jobs.end() )
+            jobs.push_back( name );
+    }
+
+    return jobs;
+}
+
+/**
+ * @brief Returns a setting holding a comma separated list.
+ * @param[in] key The name of the setting.
+ * @retval vector<string> Each item of the list with surrounding spaces removed, skipping empty ones.
+ */
+const vector<string> ConfigFile::gList( const string& key )
+{
+    stringstream input( gString( key ) );
+    vector<string> items;
+    string item;
+
+    while ( getline( input, item, ',' ) )
+    {
+        item.erase( 0, item.find_first_not_of( " \t" ) == string::npos ? item.length() : item.find_first_not_of( " \t" ) );
+        item.erase( item.find_last_not_of( " \t" ) + 1 );
+
+        if ( !item.empty() )
+            items.push_back( item );
+    }
+
+    return items;
+}
+
+/**
+ * @brief Returns a numeric setting.
+ * @param[in] key The name of the setting.
+ * @param[in] fallback The value returned for an absent job.<name> setting, as each job has its own default.
+ * @retval uint_t The setting, or its default if it was absent.
+ */
+const uint_t ConfigFile::gNumber( const string& key, const uint_t& fallback )
+{
+    map<string,string>::iterator mi;
+
+    if ( ( mi = m_values.find( key ) ) != m_values.end() )
+        return ::strtoul( CSTR( mi->second ), NULL, 10 );
+
+    if ( key.compare( 0, 4, "job." ) == 0 || Find( key ) == NULL )
+        return fallback;
+
+    return ::strtoul( Find( key )->fallback, NULL, 10 );
+}
+
+/**
+ * @brief Returns the configuration file passed to Load().
+ * @retval string The configuration file passed to Load(), or empty if none was loaded.
+ */
+const string ConfigFile::gPath()
+{
+    return m_path;
+}
+
+/**
+ * @brief Returns a setting as text.
+ * @param[in] key The name of the setting.
+ * @retval string The setting, or its default if it was absent.
+ */
+const string ConfigFile::gString( const string& key )
+{
+    map<string,string>::iterator mi;
+
+    if ( ( mi = m_values.find( key ) ) != m_values.end() )
+        return mi->second;
+
+    return Find( key ) == NULL ? "" : Find( key )->fallback;
+}
+
+/**
+ * @brief Load and validate a configuration file, along with nZEDb's config.php if it names one, and start watching both for changes.
+ * @param[in] path The configuration file.
+ * @retval bool False if either file could not be read or a setting was invalid, in which case the previous settings are kept.
+ */
+const bool ConfigFile::Load( const string& path )
+{
+    map<string,string> own, values;
+    map<string,string>::const_iterator mi;
+    vector<string> files;
+
+    if ( !Parse( path, own ) )
+        return false;
+
+    files.push_back( path );
+
+    if ( ( mi = own.find( "nzedb.config" ) ) != own.end() && !mi->second.empty() )
+    {
+        if ( !ParseNZEDb( mi->second, values ) )
+            return false;
+
+        files.push_back( mi->second );
+    }
+
+    for ( mi = own.begin(); mi != own.end(); mi++ )
+        values[mi->first] = mi->second;
+
+    if ( !Validate( values ) )
+        return false;
+
+    m_files.swap( files );
+    m_path = path;
+    m_values.swap( values );
+
+    Watch();
+
+    return true;
+}
+
+/**
+ * @brief Find the description of a setting.
+ * @param[in] name The name of the setting.
+ * @retval Key* The description of the setting, or NULL if there is no such setting.
+ */
+const ConfigFile::Key* ConfigFile::Find( const string& name )
+{
+    static const Key keys[] =
+    {
+        { "categorize.rules",      "",                             0,    0       },
+        { "categorize.write",      "0",                            0,    1       },
+        { "class.cleanup.budget",  SX( CFG_THR_BUDGET_CLEANUP ),   1,    256     },
+        { "class.ingest.budget",   SX( CFG_THR_WORKERS ),          1,    256     },
+        { "class.process.budget",  SX( CFG_THR_WORKERS ),          1,    256     },
+        { "cluster.node",          "",                             0,    0       },
+        { "cluster.shards",        SX( CFG_CLUSTER_SHARDS ),       1,    4096    },
+        { "db.connect.timeout",    SX( CFG_DB_CONNECT_TIMEOUT ),   1,    3600    },
+        { "db.host",               "localhost",                    1,    0       },
+        { "db.name",               "nzedb",                        1,    0       },
+        { "db.pass",               "nzedb",                        1,    0       },
+        { "db.pool.grow",          SX( CFG_DB_POOL_GROW ),         1,    256     },
+        { "db.pool.idle",          SX( CFG_DB_POOL_IDLE ),         1,    86400   },
+        { "db.pool.max",           SX( CFG_MEM_MAX_DBCONN ),       1,    256     },
+        { "db.pool.min",           SX( CFG_MEM_MIN_DBCONN ),       1,    256     },
+        { "db.pool.wait",          SX( CFG_DB_POOL_WAIT ),         1,    60000   },
+        { "db.replica.lag",        SX( CFG_DB_REPLICA_LAG ),       0,    86400   },
+        { "db.replica.pool",       SX( CFG_DB_REPLICA_POOL ),      1,    256     },
+        { "db.replicas",           "",                             0,    0       },
+        { "db.socket",             "/var/run/mysqld/mysqld.sock",  1,    0       },
+        { "db.user",               "nzedb",                        1,    0       },
+        { "io.engine",             CFG_FIO_ENGINE,                 1,    0       },
+        { "job.*.enabled",         "1",                            0,    1       },
+        { "job.*.interval",        "0",                            0,    604800  },
+        { "nntp.host",             "localhost",                    0,    0       },
+        { "nntp.pass",             "nzedb",                        0,    0       },
+        { "nntp.port",             "119",                          1,    65535   },
+        { "nntp.user",             "nzedb",                        0,    0       },
+        { "nzedb.config",          "",                             0,    0       },
+        { "server.affinity",       "0",                            0,    1       },
+        { "server.control",        CFG_CTL_PATH,                   0,    0       },
+        { "server.sleep",          SX( CFG_THR_SLEEP ),            1,    1000000 },
+        { "server.state",          CFG_STATE_PATH,                 0,    0       }
+    };
+    string search = name;
+    uint_t i = 0;
+
+    // Every job shares the same settings, so match them by their suffix
+    if ( search.compare( 0, 4, "job." ) == 0 && search.find_last_of( '.' ) > 4 )
+        search = "job.*" + search.substr( search.find_last_of( '.' ) );
+
+    for ( i = 0; i < sizeof( keys ) / sizeof( keys[0] ); i++ )
+        if ( search == keys[i].name )
+            return &keys[i];
+
+    return NULL;
+}
+
+/**
+ * @brief Returns a numeric setting from a set of settings that has not been loaded yet.
+ * @param[in] values The settings.
+ * @param[in] key The name of the setting, which must have a default.
+ * @retval uint_t The setting, or its default if it was absent.
+ */
+const uint_t ConfigFile::Number( const map<string,string>& values, const string& key )
+{
+    map<string,string>::const_iterator mi;
+
+    if ( ( mi = values.find( key ) ) != values.end() )
+        return ::strtoul( CSTR( mi->second ), NULL, 10 );
+
+    return ::strtoul( Find( key )->fallback, NULL, 10 );
+}
+
+/**
+ * @brief Read a configuration file of "key = value" lines.
+ * @param[in] path The configuration file.
+ * @param[out] values Every setting in the file.
+ * @retval bool False if the file could not be read or held a malformed line or unknown key.
+ */
+const bool ConfigFile::Parse( const string& path, map<string,string>& values )
+{
+    UFLAGS_DE( flags );
+    static const char* space = " \t\r";
+    ifstream input( path );
+    string line, key, value;
+    string::size_type pos = 0;
+    uint_t number = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "ConfigFile::Parse()-> unable to open %s", CSTR( path ) );
+        return false;
+    }
+
+    while ( getline( input, line ) )
+    {
+        number++;
+
+        if ( ( pos = line.find_first_not_of( space ) ) == string::npos || line[pos] == '#' )
+            continue;
+
+        if ( line.find( '=' ) == string::npos )
+        {
+            LOGFMT( flags, "ConfigFile::Parse()-> %s:%lu: expected key = value", CSTR( path ), number );
+            return false;
+        }
+
+        key = line.substr( pos, line.find( '=' ) - pos );
+        key.erase( key.find_last_not_of( space ) + 1 );
+        value = line.substr( line.find( '=' ) + 1 );
+        value.erase( 0, value.find_first_not_of( space ) == string::npos ? value.length() : value.find_first_not_of( space ) );
+        value.erase( value.find_last_not_of( space ) + 1 );
+
+        // Quotes are optional, but allow a value to keep leading or trailing spaces
+        if ( value.length() > 1 && value[0] == '"' && value[value.length() - 1] == '"' )
+            value = value.substr( 1, value.length() - 2 );
+
+        if ( Find( key ) == NULL )
+        {
+            LOGFMT( flags, "ConfigFile::Parse()-> %s:%lu: unknown setting %s", CSTR( path ), number, CSTR( key ) );
+            return false;
+        }
+
+        values[key] = value;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read the database and NNTP details from the define() calls in nZEDb's config.php.
+ * @param[in] path The nZEDb config.php.
+ * @param[out] values The settings the file provided.
+ * @retval bool False if the file could not be read.
+ */
+const bool ConfigFile::ParseNZEDb( const string& path, map<string,string>& values )
+{
+    UFLAGS_DE( flags );
+    static const regex define( "define\\s*\\(\\s*['\"]([A-Z_]+)['\"]\\s*,\\s*(?:'([^']*)'|\"([^\"]*)\"|([0-9]+))\\s*\\)" );
+    static const pair<string,string> names[] =
+    {
+        { "DB_HOST", "db.host" }, { "DB_NAME", "db.name" }, { "DB_PASSWORD", "db.pass" }, { "DB_SOCKET", "db.socket" }, { "DB_USER", "db.user" },
+        { "NNTP_PASSWORD", "nntp.pass" }, { "NNTP_PORT", "nntp.port" }, { "NNTP_SERVER", "nntp.host" }, { "NNTP_USERNAME", "nntp.user" }
+    };
+    ifstream input( path );
+    stringstream text;
+    string content, port;
+    sregex_iterator it, end;
+    uint_t i = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "ConfigFile::ParseNZEDb()-> unable to open %s", CSTR( path ) );
+        return false;
+    }
+
+    text << input.rdbuf();
+    content = text.str();
+
+    for ( it = sregex_iterator( content.begin(), content.end(), define ); it != end; it++ )
+    {
+        string value = ( *it )[2].matched ? ( *it )[2].str() : ( *it )[3].matched ? ( *it )[3].str() : ( *it )[4].str();
+
+        if ( ( *it )[1].str() == "DB_PORT" )
+            port = value;
+
+        for ( i = 0; i < sizeof( names ) / sizeof( names[0] ); i++ )
+            if ( names[i].first == ( *it )[1].str() && !value.empty() )
+                values[names[i].second] = value;
+    }
+
+    // DBConnMySQL takes a numeric socket to be a TCP port, used when nZEDb has no socket set
+    if ( values.find( "db.socket" ) == values.end() && !port.empty() )
+        values["db.socket"] = port;
+
+    return true;
+}
+
+/**
+ * @brief The SIGHUP handler, which only notes the signal for Changed() to report.
+ * @param[in] number The signal received.
+ * @retval void
+ */
+void ConfigFile::Signal( int number )
+{
+    m_hangup = 1;
+
+    return;
+}
+
+/**
+ * @brief Check every numeric setting is a number within range, no required setting is empty, and the pool bounds agree.
+ * @param[in] values The settings to check.
+ * @retval bool False if any setting was invalid.
+ */
+const bool ConfigFile::Validate( const map<string,string>& values )
+{
+    UFLAGS_DE( flags );
+    map<string,string>::const_iterator mi;
+    const Key* key = NULL;
+    uint_t number = 0;
+    bool valid = true;
+
+    for ( mi = values.begin(); mi != values.end(); mi++ )
+    {
+        if ( ( key = Find( mi->first ) ) == NULL )
+            continue;
+
+        // A string setting with a minimum may not be left empty
+        if ( key->max == 0 )
+        {
+            if ( key->min > 0 && mi->second.empty() )
+            {
+                LOGFMT( flags, "ConfigFile::Validate()-> %s may not be empty", CSTR( mi->first ) );
+                valid = false;
+            }
+
+            continue;
+        }
+
+        if ( mi->second.empty() || mi->second.find_first_not_of( "0123456789" ) != string::npos )
+        {
+            LOGFMT( flags, "ConfigFile::Validate()-> %s must be a number, not %s", CSTR( mi->first ), CSTR( mi->second ) );
+            valid = false;
+
+            continue;
+        }
+
+        number = ::strtoul( CSTR( mi->second ), NULL, 10 );
+
+        if ( number < key->min || number > key->max )
+        {
+            LOGFMT( flags, "ConfigFile::Validate()-> %s must be from %lu to %lu, not %lu", CSTR( mi->first ), key->min, key->max, number );
+            valid = false;
+        }
+    }
+
+    // The pool bounds are only checked against each other once both are known to be numbers
+    if ( valid && Number( values, "db.pool.min" ) > Number( values, "db.pool.max" ) )
+    {
+        LOGFMT( flags, "ConfigFile::Validate()-> db.pool.min of %lu exceeds db.pool.max of %lu", Number( values, "db.pool.min" ), Number( values, "db.pool.max" ) );
+        valid = false;
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Watch the directories holding the loaded files, so a file replaced by rename is noticed as well as one written in place.
+ * @retval void
+ */
+const void ConfigFile::Watch()
+{
+    UFLAGS_DE( flags );
+    string directory;
+    uint_t i = 0;
+
+    if ( m_inotify < 0 && ( m_inotify = ::inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ) < 0 )
+    {
+        LOGERRNO( flags, "ConfigFile::Watch()->inotify_init1()->" );
+        return;
+    }
+
+    for ( i = 0; i < m_files.size(); i++ )
+    {
+        directory = m_files[i].find( '/' ) == string::npos ? "." : m_files[i].substr( 0, max( m_files[i].find_last_of( '/' ), static_cast<string::size_type>( 1 ) ) );
+
+        if ( ::inotify_add_watch( m_inotify, CSTR( directory ), IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 )
+            LOGFMT( flags, "ConfigFile::Watch()->inotify_add_watch()-> %s: %s", CSTR( directory ), strerror( errno ) );
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the ConfigFile class.
+ */
+ConfigFile::ConfigFile()
+{
+    struct sigaction action;
+
+    m_inotify = -1;
+
+    ::memset( &action, 0, sizeof( action ) );
+    action.sa_handler = &ConfigFile::Signal;
+    ::sigemptyset( &action.sa_mask );
+    action.sa_flags = SA_RESTART;
+    ::sigaction( SIGHUP, &action, NULL );
+
+    return;
+}
+
+/**
+ * @brief Destructor for the ConfigFile class.
+ */
+ConfigFile::~ConfigFile()
+{
+    if ( m_inotify >= 0 )
+        ::close( m_inotify );
+
+    return;
+}
@@ -0,0 +1,630 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file controlsocket.cpp
+ * @brief All non-template member functions of the ControlSocket class.
+ *
+ * The ControlSocket class listens on the Unix socket named by
+ * server.control and is polled from Main::Update(), so commands act on the
+ * jobs and connectors from the same thread that drives them. A client
+ * sends one command per line and every answer ends with a line holding a
+ * single ".". Commands:
+ *   status               uptime, log level, connector pool and worker queues
+ *   conns                every connector with its role and #DBCONN_STATUS
+ *   jobs                 every job with its schedule and last run
+ *   pause <job|all>      stop a job starting new runs
+ *   resume <job|all>     allow a paused job to run again
+ *   run <job>            start a job now rather than after its interval
+ *   log [error|info|debug] show or change how much is logged
+ *   trace [lines]        the most recent log lines, up to #CFG_CTL_TRACE
+ *   follow               copy every log line to the client as it is written
+ *   quit                 close the connection
+ * Pausing lasts until the configuration is next reloaded, which applies
+ * job.<name>.enabled again. Running nzedb-backend with --control sends
+ * one command and prints the answer.
+ */
+#include "h/includes.h"
+#include "h/controlsocket.h"
+
+#include "h/dbconn.h"
+#include "h/job.h"
+#include "h/list.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Keep a log line for the trace command and copy it to each client following the log. Called by Utils::_Logger() from any thread.
+ * @param[in] line The line as written to the log.
+ * @retval void
+ */
+const void ControlSocket::Monitor( const string& line )
+{
+    lock_guard<mutex> lock( m_mutex );
+    ITER( vector, Client*, ci );
+
+    m_lines.push_back( line );
+
+    while ( m_lines.size() > CFG_CTL_TRACE )
+        m_lines.pop_front();
+
+    for ( ci = m_clients.begin(); ci != m_clients.end(); ci++ )
+    {
+        if ( !( *ci )->follow )
+            continue;
+
+        // A client that stops reading loses lines rather than holding the memory of every one
+        if ( ( *ci )->output.length() + line.length() >= CFG_CTL_BUFFER )
+        {
+            ( *ci )->dropped++;
+            continue;
+        }
+
+        if ( ( *ci )->dropped > 0 )
+        {
+            ( *ci )->output.append( Utils::FormatString( 0, "(%lu lines dropped)\n", ( *ci )->dropped ) );
+            ( *ci )->dropped = uintmin_t;
+        }
+
+        ( *ci )->output.append( line + "\n" );
+    }
+
+    return;
+}
+
+/**
+ * @brief Listen on a Unix socket, closing any socket listened on before. Does nothing if already listening on it.
+ * @param[in] path Path of the socket, or empty to stop listening.
+ * @retval bool False if the socket could not be opened.
+ */
+const bool ControlSocket::Open( const string& path )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    struct sockaddr_un addr;
+    struct stat st;
+    sint_t fd = 0;
+
+    if ( path == m_path && ( m_fd >= 0 || path.empty() ) )
+        return true;
+
+    Close();
+
+    if ( path.empty() )
+        return true;
+
+    if ( path.length() >= sizeof( addr.sun_path ) )
+    {
+        LOGFMT( flags, "ControlSocket::Open()-> %s is too long for a Unix socket", CSTR( path ) );
+        return false;
+    }
+
+    ::memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    ::strncpy( addr.sun_path, CSTR( path ), sizeof( addr.sun_path ) - 1 );
+
+    if ( ( fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 )
+    {
+        LOGERRNO( flags, "ControlSocket::Open()->socket()->" );
+        return false;
+    }
+
+    // A socket left behind by a server that did not exit cleanly is replaced, but not one still answering or anything else
+    if ( ::lstat( CSTR( path ), &st ) == 0 )
+    {
+        if ( !S_ISSOCK( st.st_mode ) || ::connect( fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) ) == 0 || errno == EAGAIN )
+        {
+            LOGFMT( flags, "ControlSocket::Open()-> %s is in use", CSTR( path ) );
+            ::close( fd );
+
+            return false;
+        }
+
+        // The probe leaves the socket unfit to listen on
+        ::close( fd );
+        ::unlink( CSTR( path ) );
+
+        if ( ( fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 ) ) < 0 )
+        {
+            LOGERRNO( flags, "ControlSocket::Open()->socket()->" );
+            return false;
+        }
+    }
+
+    if ( ::bind( fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) ) < 0 || ::listen( fd, CFG_CTL_CLIENTS ) < 0 )
+    {
+        LOGERRNO( flags, "ControlSocket::Open()->bind()->" );
+        ::close( fd );
+
+        return false;
+    }
+
+    // Anyone able to connect can pause jobs, so only the owner and group may
+    ::chmod( CSTR( path ), 0660 );
+
+    m_fd = fd;
+    m_path = path;
+
+    LOGFMT( iflags, "ControlSocket::Open()-> listening on %s", CSTR( path ) );
+
+    return true;
+}
+
+/**
+ * @brief Accept new clients, answer every whole command received, and write what is waiting for each client. Called by Main::Update() each cycle.
+ * @retval void
+ */
+const void ControlSocket::Poll()
+{
+    ITER( vector, Client*, ci );
+    Client* client = NULL;
+    char buf[4096];
+    string line, reply;
+    string::size_type pos = 0;
+    sint_t fd = 0, ret = 0;
+
+    if ( m_fd < 0 )
+        return;
+
+    while ( ( fd = ::accept4( m_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 )
+    {
+        if ( m_clients.size() >= CFG_CTL_CLIENTS )
+        {
+            ::send( fd, "too many clients\n.\n", 19, MSG_NOSIGNAL );
+            ::close( fd );
+
+            continue;
+        }
+
+        client = new Client();
+        client->fd = fd;
+        client->follow = false;
+        client->dropped = uintmin_t;
+        client->closed = false;
+
+        lock_guard<mutex> lock( m_mutex );
+        m_clients.push_back( client );
+    }
+
+    for ( ci = m_clients.begin(); ci != m_clients.end(); ci++ )
+    {
+        client = *ci;
+
+        while ( !client->closed )
+        {
+            if ( ( ret = ::recv( client->fd, buf, sizeof( buf ), 0 ) ) > 0 )
+                client->input.append( buf, ret );
+            else if ( ret == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) )
+                client->closed = true;
+            else if ( errno != EINTR )
+                break;
+        }
+
+        // Commands run without m_mutex held, as most of them log
+        while ( !client->closed && ( pos = client->input.find( '\n' ) ) != string::npos )
+        {
+            line = client->input.substr( 0, pos );
+            client->input.erase( 0, pos + 1 );
+
+            if ( !line.empty() && line[line.length() - 1] == '\r' )
+                line.erase( line.length() - 1 );
+
+            reply = Command( client, line );
+
+            lock_guard<mutex> lock( m_mutex );
+            client->output.append( reply );
+        }
+
+        if ( client->input.length() > CFG_CTL_LINE )
+            client->closed = true;
+
+        lock_guard<mutex> lock( m_mutex );
+
+        while ( !client->output.empty() )
+        {
+            if ( ( ret = ::send( client->fd, client->output.data(), client->output.length(), MSG_NOSIGNAL ) ) > 0 )
+                client->output.erase( 0, ret );
+            else
+            {
+                if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+                    client->closed = true;
+                break;
+            }
+        }
+    }
+
+    lock_guard<mutex> lock( m_mutex );
+
+    for ( ci = m_clients.begin(); ci != m_clients.end(); )
+    {
+        if ( ( *ci )->closed )
+        {
+            ::close( ( *ci )->fd );
+            delete *ci;
+            ci = m_clients.erase( ci );
+        }
+        else
+            ci++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Send a single command to a running server and print the answer, or every log line for follow. Used by --control.
+ * @param[in] path Path of the server's control socket.
+ * @param[in] command The command and its arguments.
+ * @retval bool False if the server could not be reached or did not answer within #CFG_CTL_TIMEOUT seconds.
+ */
+const bool ControlSocket::Request( const string& path, const string& command )
+{
+    UFLAGS_DE( flags );
+    struct sockaddr_un addr;
+    struct pollfd pfd;
+    char buf[16384];
+    string request = command + "\n", response, line;
+    string::size_type pos = 0;
+    sint_t fd = 0, ret = 0;
+    uint_t sent = 0;
+    bool follow = command == "follow", answered = false;
+
+    if ( path.length() >= sizeof( addr.sun_path ) )
+    {
+        LOGFMT( flags, "ControlSocket::Request()-> %s is too long for a Unix socket", CSTR( path ) );
+        return false;
+    }
+
+    ::memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    ::strncpy( addr.sun_path, CSTR( path ), sizeof( addr.sun_path ) - 1 );
+
+    if ( ( fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 || ::connect( fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) ) < 0 )
+    {
+        LOGERRNO( flags, "ControlSocket::Request()->connect()->" );
+        if ( fd >= 0 )
+            ::close( fd );
+
+        return false;
+    }
+
+    while ( sent < request.length() && ( ret = ::send( fd, request.data() + sent, request.length() - sent, MSG_NOSIGNAL ) ) > 0 )
+        sent += ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    // Following the log goes on until the server exits or the client is interrupted; anything else ends at the first "." line
+    while ( sent == request.length() )
+    {
+        pfd.revents = 0;
+
+        if ( ( ret = ::poll( &pfd, 1, follow && answered ? -1 : CFG_CTL_TIMEOUT * 1000 ) ) == 0 )
+        {
+            LOGFMT( flags, "ControlSocket::Request()-> no answer from %s within %lus", CSTR( path ), static_cast<uint_t>( CFG_CTL_TIMEOUT ) );
+            break;
+        }
+
+        if ( ret < 0 && errno == EINTR )
+            continue;
+
+        if ( ret < 0 || ( ret = ::recv( fd, buf, sizeof( buf ), 0 ) ) <= 0 )
+        {
+            ::close( fd );
+
+            return follow && answered;
+        }
+
+        response.append( buf, ret );
+
+        while ( ( pos = response.find( '\n' ) ) != string::npos )
+        {
+            line = response.substr( 0, pos );
+            response.erase( 0, pos + 1 );
+
+            if ( line == "." && !answered )
+            {
+                answered = true;
+
+                if ( !follow )
+                {
+                    ::close( fd );
+
+                    return true;
+                }
+
+                continue;
+            }
+
+            cout << line << endl;
+        }
+    }
+
+    ::close( fd );
+
+    return false;
+}
+
+/**
+ * @brief Stop listening and disconnect every client.
+ * @retval void
+ */
+const void ControlSocket::Close()
+{
+    lock_guard<mutex> lock( m_mutex );
+    ITER( vector, Client*, ci );
+
+    for ( ci = m_clients.begin(); ci != m_clients.end(); ci++ )
+    {
+        ::close( ( *ci )->fd );
+        delete *ci;
+    }
+
+    m_clients.clear();
+
+    if ( m_fd >= 0 )
+    {
+        ::close( m_fd );
+        ::unlink( CSTR( m_path ) );
+    }
+
+    m_fd = -1;
+    m_path.clear();
+
+    return;
+}
+
+/**
+ * @brief Carry out a command from a client.
+ * @param[in] client The client that sent it.
+ * @param[in] line The command and its arguments.
+ * @retval string The answer, ending with a "." line, or nothing for an empty line.
+ */
+const string ControlSocket::Command( Client* client, const string& line )
+{
+    UFLAGS_I( flags );
+    static const string levels[MAX_UTILS_LEVEL] = { "error", "info", "debug" };
+    ITER( vector, Job*, vi );
+    vector<string> args = Utils::StrTokens( line, true );
+    string reply;
+    uint_t i = 0;
+    bool found = false;
+
+    if ( args.empty() )
+        return "";
+
+    if ( args[0] == "help" )
+        reply = "status, conns, jobs, pause <job|all>, resume <job|all>, run <job>, log [error|info|debug], trace [lines], follow, quit\n";
+    else if ( args[0] == "status" )
+        reply = Status();
+    else if ( args[0] == "conns" )
+        reply = Conns();
+    else if ( args[0] == "jobs" )
+        reply = Jobs();
+    else if ( ( args[0] == "pause" || args[0] == "resume" || args[0] == "run" ) && args.size() == 2 )
+    {
+        for ( vi = job_list.begin(); vi != job_list.end(); vi++ )
+        {
+            if ( ( *vi )->gName() != args[1] && ( args[1] != "all" || args[0] == "run" ) )
+                continue;
+
+            found = true;
+
+            if ( args[0] == "run" )
+            {
+                if ( !( *vi )->gEnabled() )
+                    reply.append( ( *vi )->gName() + " is paused\n" );
+                else if ( ( *vi )->gStatus() == JOB_STATUS_RUNNING )
+                    reply.append( ( *vi )->gName() + " is already running\n" );
+                else
+                {
+                    ( *vi )->Trigger();
+                    reply.append( ( *vi )->gName() + " starts at the next poll\n" );
+                    LOGFMT( flags, "ControlSocket::Command()-> %s triggered", CSTR( ( *vi )->gName() ) );
+                }
+
+                continue;
+            }
+
+            if ( ( *vi )->gEnabled() == ( args[0] == "resume" ) )
+                continue;
+
+            ( *vi )->sEnabled( args[0] == "resume" );
+            reply.append( ( *vi )->gName() + ( args[0] == "resume" ? " resumed\n" : " paused\n" ) );
+            LOGFMT( flags, "ControlSocket::Command()-> %s %s", CSTR( ( *vi )->gName() ), args[0] == "resume" ? "resumed" : "paused" );
+        }
+
+        if ( !found )
+            reply = "no job named " + args[1] + "\n";
+        else if ( reply.empty() )
+            reply = "nothing to " + args[0] + "\n";
+    }
+    else if ( args[0] == "log" && args.size() < 3 )
+    {
+        for ( i = 0; args.size() == 2 && i < MAX_UTILS_LEVEL; i++ )
+            if ( levels[i] == args[1] )
+                break;
+
+        if ( args.size() == 2 && i == MAX_UTILS_LEVEL )
+            reply = "unknown level " + args[1] + "\n";
+        else
+        {
+            if ( args.size() == 2 && i != g_global->m_log_level )
+            {
+                g_global->m_log_level = i;
+                LOGFMT( flags, "ControlSocket::Command()-> log level set to %s", CSTR( levels[i] ) );
+            }
+
+            reply = "log level " + levels[g_global->m_log_level] + "\n";
+        }
+    }
+    else if ( args[0] == "trace" && args.size() < 3 )
+        reply = Trace( args.size() == 2 ? ::strtoul( CSTR( args[1] ), NULL, 10 ) : 100 );
+    else if ( args[0] == "follow" )
+    {
+        reply = "following the log until the connection closes\n";
+
+        lock_guard<mutex> lock( m_mutex );
+        client->follow = true;
+    }
+    else if ( args[0] == "quit" )
+        client->closed = true;
+    else
+        reply = "unknown command " + line + ", try help\n";
+
+    return reply + ".\n";
+}
+
+/**
+ * @brief Describe every database connector.
+ * @retval string One line per connector.
+ */
+const string ControlSocket::Conns()
+{
+    static const string roles[MAX_DBCONN_ROLE] = { "primary", "replica" };
+    static const string statuses[MAX_DBCONN_STATUS] = { "none", "error", "ready", "close", "busy", "connect" };
+    lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+    ITER( vector, DBConn*, vi );
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+    string reply;
+
+    for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+    {
+        reply.append( Utils::FormatString( 0, "%-40s %-8s %-8s %-5s idle %lds", CSTR( ( *vi )->gHost() + ":" + ( *vi )->gSocket() ),
+            CSTR( roles[( *vi )->gRole() < MAX_DBCONN_ROLE ? ( *vi )->gRole() : 0] ), CSTR( statuses[( *vi )->gStatus() < MAX_DBCONN_STATUS ? ( *vi )->gStatus() : 0] ),
+            ( *vi )->gOwner() == thread::id() ? "free" : "held", static_cast<sint_t>( chrono::duration_cast<chrono::seconds>( now - ( *vi )->gUsed() ).count() ) ) );
+
+        if ( ( *vi )->gRole() == DBCONN_ROLE_REPLICA )
+            reply.append( Utils::FormatString( 0, ", lag %lds", ( *vi )->gLag() ) );
+
+        reply.append( "\n" );
+    }
+
+    reply.append( Utils::FormatString( 0, "%lu connectors, pool sized to %lu%s\n", dbconn_list.size(), g_global->m_dbconn_target, g_global->m_dbconn_saturated ? ", saturated" : "" ) );
+
+    return reply;
+}
+
+/**
+ * @brief Describe every job.
+ * @retval string One line per job.
+ */
+const string ControlSocket::Jobs()
+{
+    ITER( vector, Job*, vi );
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+    string reply, state;
+    sint_t next = 0;
+
+    for ( vi = job_list.begin(); vi != job_list.end(); vi++ )
+    {
+        next = static_cast<sint_t>( ( *vi )->gInterval() ) - chrono::duration_cast<chrono::seconds>( now - ( *vi )->gLastFinish() ).count();
+
+        if ( ( *vi )->gStatus() == JOB_STATUS_RUNNING )
+            state = Utils::FormatString( 0, "running for %lds", static_cast<sint_t>( chrono::duration_cast<chrono::seconds>( now - ( *vi )->gLastStart() ).count() ) );
+        else if ( !( *vi )->gEnabled() )
+            state = "paused";
+        else if ( ( *vi )->gRuns() == 0 || next <= 0 )
+            state = "due";
+        else
+            state = Utils::FormatString( 0, "next in %lds", next );
+
+        reply.append( Utils::FormatString( 0, "%-12s %-8s every %6lus, %5lu runs", CSTR( ( *vi )->gName() ), CSTR( WorkerPool::gName( ( *vi )->gClass() ) ), ( *vi )->gInterval(), ( *vi )->gRuns() ) );
+
+        if ( ( *vi )->gRuns() > 0 && ( *vi )->gLastFinish() >= ( *vi )->gLastStart() )
+            reply.append( Utils::FormatString( 0, ", last took %8lums", static_cast<uint_t>( chrono::duration_cast<chrono::milliseconds>( ( *vi )->gLastFinish() - ( *vi )->gLastStart() ).count() ) ) );
+
+        reply.append( ", " + state + "\n" );
+    }
+
+    return reply;
+}
+
+/**
+ * @brief Summarize the server.
+ * @retval string Uptime, log level, the connector pool and the worker queues.
+ */
+const string ControlSocket::Status()
+{
+    static const string levels[MAX_UTILS_LEVEL] = { "error", "info", "debug" };
+    string reply;
+    uint_t ready = 0, held = 0, i = 0;
+
+    {
+        lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+        ITER( vector, DBConn*, vi );
+
+        for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+        {
+            if ( ( *vi )->gStatus() == DBCONN_STATUS_READY )
+                ready++;
+            if ( ( *vi )->gOwner() != thread::id() )
+                held++;
+        }
+    }
+
+    reply = Utils::FormatString( 0, "%s, up %lds, log level %s\n", CFG_STR_VERSION,
+        static_cast<sint_t>( chrono::duration_cast<chrono::seconds>( chrono::high_resolution_clock::now() - m_started ).count() ), CSTR( levels[g_global->m_log_level] ) );
+    reply.append( Utils::FormatString( 0, "connectors: %lu ready, %lu held, pool sized to %lu%s\n", ready, held, g_global->m_dbconn_target, g_global->m_dbconn_saturated ? ", saturated" : "" ) );
+    reply.append( Utils::FormatString( 0, "workers: %lu threads\n", g_global->m_workers->gThreads() ) );
+
+    for ( i = 0; i < MAX_JOB_CLASS; i++ )
+        reply.append( Utils::FormatString( 0, "  %-8s %lu running of %lu, %lu queued\n", CSTR( WorkerPool::gName( i ) ), g_global->m_workers->gRunning( i ), g_global->m_workers->gBudget( i ), g_global->m_workers->gQueued( i ) ) );
+
+    return reply;
+}
+
+/**
+ * @brief Returns the most recent log lines.
+ * @param[in] lines How many lines to return, at most #CFG_CTL_TRACE.
+ * @retval string The lines, oldest first.
+ */
+const string ControlSocket::Trace( const uint_t& lines )
+{
+    lock_guard<mutex> lock( m_mutex );
+    deque<string>::iterator di;
+    string reply;
+
+    for ( di = m_lines.end() - min<uint_t>( lines, m_lines.size() ); di != m_lines.end(); di++ )
+        reply.append( *di + "\n" );
+
+    return reply;
+}
+
+/**
+ * @brief Constructor for the ControlSocket class.
+ */
+ControlSocket::ControlSocket()
+{
+    m_fd = -1;
+    m_started = chrono::high_resolution_clock::now();
+
+    return;
+}
+
+/**
+ * @brief Destructor for the ControlSocket class.
+ */
+ControlSocket::~ControlSocket()
+{
+    Close();
+
+    return;
+}
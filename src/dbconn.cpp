@@ -31,6 +31,20 @@
 #include "h/dbconn.h"
 
 #include "h/list.h"
+#include "h/querycache.h"
+
+/**
+ * @brief Run a query through the QueryCache, so results from small, rarely changing tables are shared between threads.
+ * @param[in] query The query.
+ * @retval shared_ptr<const vector<vector<string>>> The result set, which must not be modified.
+ */
+const shared_ptr<const vector<vector<string>>> DBConn::Cached( const string& query )
+{
+    if ( g_global->m_query_cache == NULL )
+        return make_shared<const vector<vector<string>>>( Query( query ) );
+
+    return g_global->m_query_cache->Query( this, query );
+}
 
 /**
  * @brief Returns the current database of the database connector.
@@ -50,6 +64,24 @@ const string DBConn::gHost()
     return m_host;
 }
 
+/**
+ * @brief Returns how far behind the primary a replica was when last measured.
+ * @retval sint_t Seconds behind the primary, -1 if not replicating, or -2 if not yet measured. Always 0 for the primary.
+ */
+const sint_t DBConn::gLag()
+{
+    return m_lag;
+}
+
+/**
+ * @brief Returns the thread the database connector is reserved for.
+ * @retval thread::id The thread the database connector is reserved for, or a default constructed id if it is free.
+ */
+const thread::id DBConn::gOwner()
+{
+    return m_owner;
+}
+
 /**
  * @brief Returns the current pass of the database connector.
  * @retval string The current pass of the database connector.
@@ -59,6 +91,15 @@ const string DBConn::gPass()
     return m_pass;
 }
 
+/**
+ * @brief Returns the role of the server the database connector is connected to from #DBCONN_ROLE.
+ * @retval uint_t A uint_t associated to #DBCONN_ROLE.
+ */
+const uint_t DBConn::gRole()
+{
+    return m_role;
+}
+
 /**
  * @brief Returns the current type of the database connector from #DBCONN_TYPE.
  * @retval uint_t A uint_t associated to #DBCONN_TYPE.
@@ -86,6 +127,15 @@ const uint_t DBConn::gStatus()
     return m_status;
 }
 
+/**
+ * @brief Returns when the database connector was last reserved or released.
+ * @retval chrono::high_resolution_clock::time_point When the database connector was last reserved or released.
+ */
+const chrono::high_resolution_clock::time_point DBConn::gUsed()
+{
+    return m_used;
+}
+
 /**
  * @brief Returns the current user of the database connector.
  * @retval string The current user of the database connector.
@@ -95,6 +145,44 @@ const string DBConn::gUser()
     return m_user;
 }
 
+/**
+ * @brief Check whether a statement only reads, so a replica may run it.
+ * @param[in] query The statement.
+ * @retval bool True for SELECT, SHOW, EXPLAIN and DESCRIBE, unless they lock rows or write a file.
+ */
+const bool DBConn::ReadOnly( const string& query )
+{
+    static const regex reads( "^\\s*\\(?\\s*(SELECT|SHOW|EXPLAIN|DESCRIBE|DESC)\\b", regex::icase );
+    static const regex writes( "\\b(FOR\\s+UPDATE|LOCK\\s+IN\\s+SHARE\\s+MODE|INTO\\s+(OUTFILE|DUMPFILE|@))", regex::icase );
+
+    return regex_search( query, reads ) && !regex_search( query, writes );
+}
+
+/**
+ * @brief Sets how far behind the primary a replica is.
+ * @param[in] lag Seconds behind the primary, or -1 if unknown or not replicating.
+ * @retval void
+ */
+const void DBConn::sLag( const sint_t& lag )
+{
+    m_lag = lag;
+
+    return;
+}
+
+/**
+ * @brief Reserves the database connector for a thread, or frees it when passed a default constructed id.
+ * @param[in] owner The thread to reserve the database connector for.
+ * @retval void
+ */
+const void DBConn::sOwner( const thread::id& owner )
+{
+    m_owner = owner;
+    m_used = chrono::high_resolution_clock::now();
+
+    return;
+}
+
 /**
  * @brief Sets the current status of the database connector from #DBCONN_STATUS.
  * @param[in] status The current status of the database connector from #DBCONN_STATUS.
@@ -118,10 +206,13 @@ const void DBConn::sStatus( const uint_t& status )
 /**
  * @brief Constructor for the DBConn class.
  */
-DBConn::DBConn( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database ) :
-    m_type( type ), m_host( host ), m_socket( socket ), m_user( user ), m_pass( pass ), m_database( database )
+DBConn::DBConn( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database, const uint_t& role ) :
+    m_type( type ), m_host( host ), m_socket( socket ), m_user( user ), m_pass( pass ), m_database( database ), m_role( role )
 {
+    // A replica is not trusted with reads until its lag has been measured
+    m_lag = m_role == DBCONN_ROLE_REPLICA ? -2 : 0;
     m_status = uintmin_t;
+    m_used = chrono::high_resolution_clock::now();
 
     return;
 }
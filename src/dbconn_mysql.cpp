@@ -29,96 +29,206 @@
 #include "h/includes.h"
 #include "h/dbconn_mysql.h"
 
-#include "h/list.h"
+#include "h/querycache.h"
 
 /**
- * @brief Connect to a MySQL database host.
- * @param[in] void* The DBConnMySQL object to connect the database to.
- * @retval void
+ * @brief Connect to a MySQL database host. Blocks for up to the timeout, so Main::OpenDBConn() runs it on a thread of its own.
+ * @param[in] timeout Seconds the server has to accept the connection.
+ * @retval bool True and #DBCONN_STATUS_READY if connected, otherwise false and #DBCONN_STATUS_ERROR.
  */
-const void DBConnMySQL::Connect()
+const bool DBConnMySQL::Connect( const uint_t& timeout )
 {
     UFLAGS_DE( flags );
     uint_t port = uintmin_t;
-    bool valid = true;
+    unsigned int seconds = timeout, reads = CFG_DB_REPLICA_TIMEOUT;
+    string error;
 
     if ( gHost().empty() )
+        error = "-> called with empty host";
+    else if ( gSocket().empty() )
+        error = "-> called with empty socket";
+    else if ( gUser().empty() )
+        error = "-> called with empty user";
+    else if ( gPass().empty() )
+        error = "-> called with empty pass";
+    else if ( gDatabase().empty() )
+        error = "-> called with empty database";
+
+    if ( !error.empty() )
     {
-        LOGSTR( flags, "DBConnMySQL::Connect()-> called with empty host" );
-        return;
+        LOGFMT( flags, "DBConnMySQL::Connect()%s", CSTR( error ) );
+        sStatus( DBCONN_STATUS_ERROR );
+
+        return false;
     }
 
-    if ( gSocket().empty() )
+    if ( mysql_init( &m_sql ) == NULL )
     {
-        LOGSTR( flags, "DBConnMySQL::Connect()-> called with empty socket" );
-        return;
+        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_init()-> %s", mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_ERROR );
+
+        return false;
     }
 
-    if ( gUser().empty() )
+    m_init = true;
+
+    // Replicas are the servers whose lag is measured, and one that hangs must not hold its connector forever
+    if ( mysql_options( &m_sql, MYSQL_OPT_RECONNECT, &m_reconnect ) != 0 || mysql_options( &m_sql, MYSQL_OPT_CONNECT_TIMEOUT, &seconds ) != 0 ||
+        ( gRole() == DBCONN_ROLE_REPLICA && mysql_options( &m_sql, MYSQL_OPT_READ_TIMEOUT, &reads ) != 0 ) )
     {
-        LOGSTR( flags, "DBConnMySQL::Connect()-> called with empty user" );
-        return;
+        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_options()-> %s", mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_ERROR );
+
+        return false;
     }
 
-    if ( gPass().empty() )
+    // Safer than ::stoi(), will output 0 for anything invalid
+    stringstream( gSocket() ) >> port;
+
+    // If port is 0, connect via unix socket
+    if ( mysql_real_connect( &m_sql, CSTR( gHost() ), CSTR( gUser() ), CSTR( gPass() ), CSTR( gDatabase() ), port, port == 0 ? CSTR( gSocket() ) : NULL, 0 ) == NULL )
     {
-        LOGSTR( flags, "DBConnMySQL::Connect()-> called with empty pass" );
-        return;
+        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_real_connect()-> %s: %s", CSTR( gHost() ), mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_ERROR );
+
+        return false;
     }
 
-    if ( gDatabase().empty() )
+    LOGFMT( 0, "MySQL server connected: %s", CSTR( gHost() ) );
+    sStatus( DBCONN_STATUS_READY );
+
+    return true;
+}
+
+/**
+ * @brief Escape a string for use within a quoted SQL literal.
+ * @param[in] input The string to escape.
+ * @retval string The escaped string, without surrounding quotes.
+ */
+const string DBConnMySQL::Escape( const string& input )
+{
+    vector<char> buf( input.length() * 2 + 1 );
+    uint_t length = 0;
+
+    length = mysql_real_escape_string( &m_sql, &buf[0], input.data(), input.length() );
+
+    return string( &buf[0], length );
+}
+
+/**
+ * @brief Run a statement that does not return a result set, such as INSERT, UPDATE or DELETE.
+ * @param[in] query The statement to execute against the database.
+ * @retval sint_t The number of affected rows, or -1 on error.
+ */
+const sint_t DBConnMySQL::Execute( const string& query )
+{
+    UFLAGS_DE( flags );
+    sint_t rows = 0;
+
+    // Busy out to ensure work goes to other threads
+    sStatus( DBCONN_STATUS_BUSY );
+
+    if ( query.empty() )
     {
-        LOGSTR( flags, "DBConnMySQL::Connect()-> called with empty database" );
-        return;
+        sStatus( DBCONN_STATUS_READY );
+        LOGSTR( flags, "DBConnMySQL::Execute()-> called with empty query" );
+
+        return -1;
     }
 
-    if ( mysql_init( &m_sql ) == NULL )
+    // Writes sent to a replica would be lost or break replication, so refuse them outright
+    if ( gRole() == DBCONN_ROLE_REPLICA && !ReadOnly( query ) )
     {
-        sStatus( DBCONN_STATUS_ERROR );
-        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_init()-> %s", mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Execute()-> refused to send a write to replica %s: %s", CSTR( gHost() ), CSTR( query.substr( 0, 64 ) ) );
 
-        return;
+        return -1;
     }
 
-    if ( mysql_options( &m_sql, MYSQL_OPT_RECONNECT, &m_reconnect ) != 0 )
+    if ( mysql_real_query( &m_sql, query.data(), query.length() ) )
     {
-        sStatus( DBCONN_STATUS_ERROR );
-        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_options()-> %s", mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Execute()->mysql_real_query()-> %s", mysql_error( &m_sql ) );
 
-        return;
+        return -1;
     }
 
-    // Safer than ::stoi(), will output 0 for anything invalid
-    stringstream( gSocket() ) >> port;
+    rows = static_cast<sint_t>( mysql_affected_rows( &m_sql ) );
+    sStatus( DBCONN_STATUS_READY );
 
-    // If port is 0, connect via unix socket
-    if ( port == 0 )
-    {
-        if ( mysql_real_connect( &m_sql, CSTR( gHost() ), CSTR( gUser() ), CSTR( gPass() ), CSTR( gDatabase() ), 0, CSTR( gSocket() ), 0 ) == NULL )
-            valid = false;
-    }
-    else
+    // Drop cached reads of anything we just changed, even if no rows matched, since the statement is cheaper to check than the count
+    if ( g_global->m_query_cache != NULL )
+        g_global->m_query_cache->Invalidate( query );
+
+    return rows;
+}
+
+/**
+ * @brief Measure how far the server lags the primary it replicates from. Blocks for up to #CFG_DB_REPLICA_TIMEOUT on a replica, so Main::PollReplicas() runs it on a thread of its own.
+ * @retval sint_t Seconds_Behind_Master, or -1 if the server is not replicating or did not answer, in which case a failed query leaves #DBCONN_STATUS_ERROR.
+ */
+const sint_t DBConnMySQL::Lag()
+{
+    UFLAGS_DE( flags );
+    MYSQL_RES* res;
+    MYSQL_ROW row;
+    MYSQL_FIELD* fields;
+    uint_t column = 0, length = 0;
+    sint_t lag = -1;
+
+    // Busy out to ensure work goes to other threads
+    sStatus( DBCONN_STATUS_BUSY );
+
+    if ( mysql_query( &m_sql, "SHOW SLAVE STATUS" ) != 0 || ( res = mysql_store_result( &m_sql ) ) == NULL )
     {
-        if ( mysql_real_connect( &m_sql, CSTR( gHost() ), CSTR( gUser() ), CSTR( gPass() ), CSTR( gDatabase() ), port, NULL, 0 ) == NULL )
-            valid = false;
+        LOGFMT( flags, "DBConnMySQL::Lag()-> %s: %s", CSTR( gHost() ), mysql_error( &m_sql ) );
+        sStatus( DBCONN_STATUS_ERROR );
+
+        return lag;
     }
 
-    if ( !valid )
+    // The column moves between server versions, and is renamed Seconds_Behind_Source by newer ones
+    length = mysql_num_fields( res );
+    fields = mysql_fetch_fields( res );
+
+    for ( column = 0; column < length; column++ )
+        if ( ::strcmp( fields[column].name, "Seconds_Behind_Master" ) == 0 || ::strcmp( fields[column].name, "Seconds_Behind_Source" ) == 0 )
+            break;
+
+    // No row means the server is not a replica, and the column is NULL while replication is stopped
+    if ( column < length && ( row = mysql_fetch_row( res ) ) != NULL && row[column] != NULL )
+        lag = ::strtol( row[column], NULL, 10 );
+
+    mysql_free_result( res );
+    sStatus( DBCONN_STATUS_READY );
+
+    return lag;
+}
+
+/**
+ * @brief Prove the connection still works. mysql_ping() reconnects one the server dropped, and a trivial query shows the server will still answer.
+ * @retval bool True and #DBCONN_STATUS_READY if healthy, otherwise false and #DBCONN_STATUS_ERROR.
+ */
+const bool DBConnMySQL::Ping()
+{
+    UFLAGS_DE( flags );
+    MYSQL_RES* res;
+
+    // Busy out to ensure work goes to other threads
+    sStatus( DBCONN_STATUS_BUSY );
+
+    if ( mysql_ping( &m_sql ) != 0 || mysql_query( &m_sql, "SELECT 1" ) != 0 || ( res = mysql_store_result( &m_sql ) ) == NULL )
     {
+        LOGFMT( flags, "DBConnMySQL::Ping()-> %s: %s", CSTR( gHost() ), mysql_error( &m_sql ) );
         sStatus( DBCONN_STATUS_ERROR );
-        LOGFMT( flags, "DBConnMySQL::Connect()->mysql_real_connect()-> %s", mysql_error( &m_sql ) );
 
-        return;
+        return false;
     }
 
-    LOGFMT( 0, "MySQL server connected: %s", CSTR( gHost() ) );
-
-    // Assume the thread will be successful; push the obj to list and validate it
-    // during routine update loops to avoid blocking here
+    mysql_free_result( res );
     sStatus( DBCONN_STATUS_READY );
-    dbconn_list.push_back( this );
 
-    return;
+    return true;
 }
 
 /**
@@ -145,6 +255,15 @@ const vector<vector<string>> DBConnMySQL::Query( const string& query )
         return result;
     }
 
+    // Writes sent to a replica would be lost or break replication, so refuse them outright
+    if ( gRole() == DBCONN_ROLE_REPLICA && !ReadOnly( query ) )
+    {
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Query()-> refused to send a write to replica %s: %s", CSTR( gHost() ), CSTR( query.substr( 0, 64 ) ) );
+
+        return result;
+    }
+
     if ( mysql_query( &m_sql, CSTR( query ) ) )
     {
         sStatus( DBCONN_STATUS_READY );
@@ -209,8 +328,9 @@ const vector<vector<string>> DBConnMySQL::Query( const string& query )
             return result;
         }
 
+        // NULL columns are returned as empty strings
         for ( uint_t y = 0; y < length; y++ )
-            result[x][y] = row[y];
+            result[x][y] = row[y] ? row[y] : "";
     }
 
     mysql_free_result( res );
@@ -219,15 +339,104 @@ const vector<vector<string>> DBConnMySQL::Query( const string& query )
     return result;
 }
 
+/**
+ * @brief Run a query and hand each row to a callback as it arrives from the server, rather than holding the whole result set.
+ * @param[in] query The query to execute against the database.
+ * @param[in] callback Called once per row with NULL columns as empty strings. The row is reused between calls, so it must be copied if kept. Returning false skips the remaining rows.
+ * @retval bool False if the query failed or the result was cut short by an error.
+ */
+const bool DBConnMySQL::Stream( const string& query, const function<bool( const vector<string>& )>& callback )
+{
+    UFLAGS_DE( flags );
+    MYSQL_RES* res;
+    MYSQL_ROW row;
+    unsigned long* lengths;
+    vector<string> columns;
+    uint_t length = 0, y = 0;
+    bool more = true;
+
+    // Busy out to ensure work goes to other threads
+    sStatus( DBCONN_STATUS_BUSY );
+
+    if ( query.empty() )
+    {
+        sStatus( DBCONN_STATUS_READY );
+        LOGSTR( flags, "DBConnMySQL::Stream()-> called with empty query" );
+
+        return false;
+    }
+
+    // Writes sent to a replica would be lost or break replication, so refuse them outright
+    if ( gRole() == DBCONN_ROLE_REPLICA && !ReadOnly( query ) )
+    {
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Stream()-> refused to send a write to replica %s: %s", CSTR( gHost() ), CSTR( query.substr( 0, 64 ) ) );
+
+        return false;
+    }
+
+    if ( mysql_real_query( &m_sql, query.data(), query.length() ) )
+    {
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Stream()->mysql_real_query()-> %s", mysql_error( &m_sql ) );
+
+        return false;
+    }
+    else if ( ( res = mysql_use_result( &m_sql ) ) == NULL )
+    {
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Stream()->mysql_use_result()-> %s", mysql_error( &m_sql ) );
+
+        return false;
+    }
+
+    length = mysql_num_fields( res );
+    columns.resize( length );
+
+    // Rows are fetched from the server one at a time, so the connection
+    // stays tied up until the last one has been read or the result freed
+    while ( more && ( row = mysql_fetch_row( res ) ) != NULL )
+    {
+        lengths = mysql_fetch_lengths( res );
+
+        for ( y = 0; y < length; y++ )
+        {
+            if ( row[y] )
+                columns[y].assign( row[y], lengths[y] );
+            else
+                columns[y].clear();
+        }
+
+        more = callback( columns );
+    }
+
+    if ( more && mysql_errno( &m_sql ) != 0 )
+    {
+        mysql_free_result( res );
+        sStatus( DBCONN_STATUS_READY );
+        LOGFMT( flags, "DBConnMySQL::Stream()->mysql_fetch_row()-> %s", mysql_error( &m_sql ) );
+
+        return false;
+    }
+
+    // Freeing the result discards any rows the callback chose to skip
+    mysql_free_result( res );
+    sStatus( DBCONN_STATUS_READY );
+
+    return true;
+}
+
 /**
  * @brief Constructor for the DBConnMySQL clasas.
  */
-DBConnMySQL::DBConnMySQL( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database ) :
-    DBConn::DBConn( type, host, socket, user, pass, database )
+DBConnMySQL::DBConnMySQL( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database, const uint_t& role ) :
+    DBConn::DBConn( type, host, socket, user, pass, database, role )
 {
+    m_init = false;
     m_reconnect = true;
 
-    Connect();
+    // Main::OpenDBConn() calls Connect() on a thread of its own, so a slow server holds up nothing else
+    sStatus( DBCONN_STATUS_CONNECT );
 
     return;
 }
@@ -237,7 +446,9 @@ DBConnMySQL::DBConnMySQL( const uint_t& type, const string& host, const string&
  */
 DBConnMySQL::~DBConnMySQL()
 {
-    mysql_close( &m_sql );
+    if ( m_init )
+        mysql_close( &m_sql );
+
     mysql_thread_end();
 
     return;
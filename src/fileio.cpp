@@ -0,0 +1,1191 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file fileio.cpp
+ * @brief All non-template member functions of the FileIO class.
+ *
+ * The FileIO class takes the output of worker threads, such as the
+ * chunks of an NZB, and writes it out. By default each call is made by
+ * the calling thread as it comes: --bench-io shows small files going into
+ * the page cache faster that way than through either background engine,
+ * which only pay off where the disk makes writers wait.
+ *
+ * The background engines write without the threads waiting on the disk.
+ * Where the kernel has io_uring, each file is opened into a direct
+ * descriptor slot so no descriptor is ever installed in the process, its
+ * chunks are copied into buffers registered with the ring, and operations
+ * are submitted in batches of up to #CFG_FIO_BATCH with one system call.
+ * Elsewhere a few threads of its own make the blocking calls instead,
+ * every operation on a file going to the same thread so they run in order
+ * (regular files are always ready to epoll, so there is nothing to gain
+ * from it). Completions are read by the main loop through Poll(), which
+ * runs the callback of each closed file, or by a thread waiting on a file
+ * in Finish(). A file that fails at any step is removed once closed.
+ */
+#include "h/includes.h"
+#include "h/fileio.h"
+
+#include "h/workerpool.h"
+
+/**
+ * @brief Stop writing a file and remove it. Anything still queued for it is dropped, and whether it was written is never reported.
+ * @param[in] file The id of the file, as returned by Create().
+ * @retval void
+ */
+const void FileIO::Abort( const uint_t& file )
+{
+    unique_lock<mutex> lock( m_mutex );
+    map<uint_t,File>::iterator fi;
+    Request* request = NULL;
+
+    if ( ( fi = m_files.find( file ) ) == m_files.end() )
+        return;
+
+    // Closed already and only waiting on Finish(), so the file is complete on disk
+    if ( fi->second.finished )
+    {
+        if ( !fi->second.failed )
+            ::unlink( CSTR( fi->second.path ) );
+
+        m_files.erase( fi );
+
+        return;
+    }
+
+    fi->second.failed = true;
+    fi->second.abandoned = true;
+    fi->second.callback = nullptr;
+
+    if ( fi->second.closing )
+        return;
+
+    request = new Request();
+    request->file = file;
+    request->op = FILEIO_OP_CLOSE;
+    request->buffer = -1;
+
+    fi->second.closing = true;
+
+    if ( m_engine == FILEIO_ENGINE_BLOCKING )
+        Direct( request, lock );
+    else
+    {
+        fi->second.waiting.push_back( request );
+        Dispatch( file );
+    }
+
+    return;
+}
+
+/**
+ * @brief Time writing a set of files from the WorkerPool with a blocking write() per chunk, then through the engine, and log the rate of each. The files are removed after each.
+ * @param[in] directory Where to write the files.
+ * @param[in] count The number of files to write each way.
+ * @param[in] size The size of each file in bytes.
+ * @retval void
+ */
+const void FileIO::Benchmark( const string& directory, const uint_t& count, const uint_t& size )
+{
+    UFLAGS_I( flags );
+    vector<string> paths;
+    string data;
+    chrono::high_resolution_clock::time_point start;
+    atomic<uint_t> closed, failed;
+    double blocking = 0, engine = 0;
+    uint_t i = 0, blocking_failed = 0;
+
+    for ( i = 0; i < size; i++ )
+        data.push_back( static_cast<char>( 'a' + i % 26 ) );
+
+    for ( i = 0; i < count; i++ )
+        paths.push_back( Utils::FormatString( 0, "%s/bench-%lu", CSTR( directory ), i ) );
+
+    closed = failed = uintmin_t;
+    start = chrono::high_resolution_clock::now();
+
+    // The way NzbWriter used to write, each thread waiting on the disk for every chunk
+    for ( i = 0; i < count; i++ )
+    {
+        const string* path = &paths[i];
+
+        g_global->m_workers->Submit( [path, &data, &failed]()
+        {
+            sint_t fd = -1, written = 0;
+            uint_t done = 0;
+
+            if ( ( fd = ::open( CSTR( *path ), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) < 0 )
+            {
+                failed++;
+                return;
+            }
+
+            for ( done = 0; done < data.length(); done += written )
+                if ( ( written = ::write( fd, data.data() + done, min<uint_t>( data.length() - done, CFG_FIO_BUFFER_SIZE ) ) ) <= 0 )
+                    break;
+
+            if ( ::close( fd ) != 0 || done < data.length() )
+                failed++;
+        } );
+    }
+
+    while ( g_global->m_workers->gPending() > 0 )
+        ::usleep( CFG_THR_SLEEP );
+
+    blocking = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+    blocking_failed = failed;
+
+    // Both ways create the files afresh, rather than the second truncating what the first left
+    for ( i = 0; i < count; i++ )
+        ::unlink( CSTR( paths[i] ) );
+
+    failed = uintmin_t;
+    start = chrono::high_resolution_clock::now();
+
+    // The same files through the engine, the threads only queuing chunks and this one completing them as the main loop would
+    for ( i = 0; i < count; i++ )
+    {
+        const string* path = &paths[i];
+
+        g_global->m_workers->Submit( [path, &data, &closed, &failed]()
+        {
+            uint_t file = g_global->m_fileio->Create( *path ), done = 0;
+
+            if ( file == 0 )
+            {
+                failed++;
+                closed++;
+
+                return;
+            }
+
+            for ( done = 0; done < data.length(); done += CFG_FIO_BUFFER_SIZE )
+                g_global->m_fileio->Write( file, data.data() + done, min<uint_t>( data.length() - done, CFG_FIO_BUFFER_SIZE ) );
+
+            g_global->m_fileio->Close( file, [&closed, &failed]( const bool& result )
+            {
+                if ( !result )
+                    failed++;
+                closed++;
+            } );
+        } );
+    }
+
+    while ( closed < count )
+    {
+        g_global->m_fileio->Poll();
+        ::usleep( CFG_THR_SLEEP );
+    }
+
+    engine = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    for ( i = 0; i < count; i++ )
+        ::unlink( CSTR( paths[i] ) );
+
+    LOGFMT( flags, "FileIO::Benchmark()-> %lu files of %lu bytes on %lu threads: blocking %.0f files/sec (%lu failed), %s %.0f files/sec (%lu failed)",
+        count, size, g_global->m_workers->gThreads(), blocking > 0 ? count / blocking : 0, blocking_failed,
+        CSTR( g_global->m_fileio->gEngineName() ), engine > 0 ? count / engine : 0, static_cast<uint_t>( failed ) );
+
+    return;
+}
+
+/**
+ * @brief Queue the close of a file once everything queued before has been written.
+ * @param[in] file The id of the file, as returned by Create().
+ * @param[in] callback Called from Poll() with whether the file was written, after which the id is no longer valid. If not given, Finish() must be called instead.
+ * @retval void
+ */
+const void FileIO::Close( const uint_t& file, const function<void( const bool& )>& callback )
+{
+    unique_lock<mutex> lock( m_mutex );
+    map<uint_t,File>::iterator fi;
+    Request* request = NULL;
+
+    if ( ( fi = m_files.find( file ) ) == m_files.end() || fi->second.closing )
+        return;
+
+    request = new Request();
+    request->file = file;
+    request->op = FILEIO_OP_CLOSE;
+    request->buffer = -1;
+
+    fi->second.callback = callback;
+    fi->second.closing = true;
+
+    if ( m_engine == FILEIO_ENGINE_BLOCKING )
+    {
+        Direct( request, lock );
+
+        return;
+    }
+
+    fi->second.waiting.push_back( request );
+    Dispatch( file );
+
+    if ( m_prepared >= CFG_FIO_BATCH )
+        Submit();
+
+    return;
+}
+
+/**
+ * @brief Record the result of an operation and release what it held. Must be called with m_mutex held.
+ * @param[in] request The operation, which is deleted or queued again.
+ * @param[in] result What the kernel returned: a descriptor or bytes written, or a negated errno.
+ * @retval void
+ */
+const void FileIO::Complete( Request* request, const sint_t& result )
+{
+    UFLAGS_DE( flags );
+    map<uint_t,File>::iterator fi;
+    File* file = NULL;
+
+    m_cond.notify_all();
+
+    if ( ( fi = m_files.find( request->file ) ) == m_files.end() )
+    {
+        LOGFMT( flags, "FileIO::Complete()-> operation completed for unknown file %lu", request->file );
+        delete request;
+
+        return;
+    }
+
+    file = &fi->second;
+    file->inflight--;
+
+    switch ( request->op )
+    {
+        case FILEIO_OP_OPEN:
+            file->opened = true;
+
+            if ( result < 0 )
+            {
+                if ( !file->failed )
+                    LOGFMT( flags, "FileIO::Complete()-> unable to create %s: %s", CSTR( file->path ), ::strerror( -result ) );
+
+                if ( m_engine == FILEIO_ENGINE_URING )
+                    m_slots.push_back( file->fd );
+
+                file->failed = true;
+                file->fd = -1;
+            }
+            else
+            {
+                file->created = true;
+
+                if ( m_engine != FILEIO_ENGINE_URING )
+                    file->fd = result;
+            }
+            break;
+
+        case FILEIO_OP_WRITE:
+            // The kernel may take less than asked; the rest goes out as an operation of its own
+            if ( result > 0 && request->done + result < request->length && !file->failed )
+            {
+                request->done += result;
+                file->waiting.push_front( request );
+
+                return;
+            }
+
+            if ( ( result < 0 || request->done + result < request->length ) && !file->failed )
+            {
+                LOGFMT( flags, "FileIO::Complete()-> failed writing %s: %s", CSTR( file->path ), ::strerror( result < 0 ? -result : EIO ) );
+                file->failed = true;
+            }
+
+            m_queued -= request->length;
+
+            if ( request->buffer >= 0 )
+                m_free.push_back( request->buffer );
+            break;
+
+        case FILEIO_OP_CLOSE:
+            if ( result < 0 && !file->failed )
+            {
+                LOGFMT( flags, "FileIO::Complete()-> failed closing %s: %s", CSTR( file->path ), ::strerror( -result ) );
+                file->failed = true;
+            }
+
+            if ( m_engine == FILEIO_ENGINE_URING && file->fd >= 0 )
+                m_slots.push_back( file->fd );
+
+            file->fd = -1;
+
+            if ( file->failed && file->created )
+                ::unlink( CSTR( file->path ) );
+
+            if ( file->callback )
+                m_done.push_back( make_pair( file->callback, !file->failed ) );
+
+            if ( file->callback || file->abandoned )
+                m_files.erase( fi );
+            else
+                file->finished = true;
+            break;
+
+        default:
+            break;
+    }
+
+    delete request;
+
+    return;
+}
+
+/**
+ * @brief Queue a file to be created, or truncated if it exists.
+ * @param[in] path Where to write the file. The directory must exist.
+ * @retval uint_t The id to pass to Write() and Close(), or 0 if Open() has not been called. A file that cannot be created is reported when closed.
+ */
+const uint_t FileIO::Create( const string& path )
+{
+    UFLAGS_DE( flags );
+    unique_lock<mutex> lock( m_mutex );
+    Request* request = NULL;
+    File* file = NULL;
+    uint_t id = 0;
+
+    if ( m_engine == FILEIO_ENGINE_NONE )
+    {
+        LOGFMT( flags, "FileIO::Create()-> %s: no engine to write with", CSTR( path ) );
+        return 0;
+    }
+
+    file = &m_files[++m_next];
+    file->path = path;
+    file->fd = -1;
+    file->offset = uintmin_t;
+    file->inflight = uintmin_t;
+    file->opened = false;
+    file->created = false;
+    file->closing = false;
+    file->failed = false;
+    file->finished = false;
+    file->abandoned = false;
+
+    request = new Request();
+    request->file = m_next;
+    request->op = FILEIO_OP_OPEN;
+    request->buffer = -1;
+
+    if ( m_engine == FILEIO_ENGINE_BLOCKING )
+    {
+        // Another thread may create a file while this one is opened, so the id is kept from before
+        id = m_next;
+        Direct( request, lock );
+
+        return id;
+    }
+
+    file->waiting.push_back( request );
+    Dispatch( m_next );
+
+    if ( m_prepared >= CFG_FIO_BATCH )
+        Submit();
+
+    return m_next;
+}
+
+/**
+ * @brief Run an operation in the calling thread, for the blocking engine. Must be called with m_mutex held through lock, which is released while the call is made.
+ * @param[in] request The operation, which is deleted once complete.
+ * @param[in] lock The lock held on m_mutex.
+ * @param[in] data The chunk of a write, written straight from the caller's memory.
+ * @retval void
+ */
+const void FileIO::Direct( Request* request, unique_lock<mutex>& lock, const char* data )
+{
+    File& file = m_files[request->file];
+    string path = file.path;
+    sint_t fd = file.fd, result = 0;
+    bool failed = file.failed;
+
+    // Only the owner of a file operates on it, so the record stays put while the lock is released
+    file.inflight++;
+    lock.unlock();
+    result = Perform( request, path, fd, failed, data );
+    lock.lock();
+    Complete( request, result );
+
+    return;
+}
+
+/**
+ * @brief Hand the operations queued for a file to the kernel or a thread, as far as they may go. Must be called with m_mutex held.
+ * @param[in] file The id of the file.
+ * @retval void
+ */
+const void FileIO::Dispatch( const uint_t& file )
+{
+    map<uint_t,File>::iterator fi;
+    Request* request = NULL;
+
+    if ( ( fi = m_files.find( file ) ) == m_files.end() )
+        return;
+
+    File& target = fi->second;
+
+    while ( !target.waiting.empty() )
+    {
+        request = target.waiting.front();
+
+        // Each thread runs the operations it is given in order, so they can all go at once
+        if ( m_engine == FILEIO_ENGINE_THREADS )
+        {
+            target.waiting.pop_front();
+            target.inflight++;
+            m_work[file % m_work.size()].push_back( request );
+            m_work_cond.notify_all();
+
+            continue;
+        }
+
+        if ( request->op == FILEIO_OP_OPEN )
+        {
+            if ( m_slots.empty() )
+            {
+                m_starved.insert( file );
+                return;
+            }
+
+            target.fd = m_slots.back();
+
+            if ( !Prepare( request ) )
+            {
+                target.fd = -1;
+                m_held.insert( file );
+
+                return;
+            }
+
+            m_slots.pop_back();
+        }
+        // Writes and the close need the direct descriptor the open fills in
+        else if ( !target.opened )
+            return;
+        else if ( request->op == FILEIO_OP_WRITE )
+        {
+            if ( target.failed )
+            {
+                target.waiting.pop_front();
+                m_queued -= request->length;
+
+                if ( request->buffer >= 0 )
+                    m_free.push_back( request->buffer );
+
+                delete request;
+                m_cond.notify_all();
+
+                continue;
+            }
+
+            if ( !Prepare( request ) )
+            {
+                m_held.insert( file );
+                return;
+            }
+        }
+        else
+        {
+            if ( target.inflight > 0 )
+                return;
+
+            // Nothing was opened, so there is nothing to close
+            if ( target.fd < 0 )
+            {
+                target.waiting.pop_front();
+                target.inflight++;
+                Complete( request, 0 );
+
+                return;
+            }
+
+            if ( !Prepare( request ) )
+            {
+                m_held.insert( file );
+                return;
+            }
+        }
+
+        target.waiting.pop_front();
+        target.inflight++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Wait for a file closed without a callback to be written, helping the engine along meanwhile. The id is no longer valid after.
+ * @param[in] file The id of the file, as returned by Create().
+ * @retval bool False if the file could not be written, in which case it has been removed.
+ */
+const bool FileIO::Finish( const uint_t& file )
+{
+    unique_lock<mutex> lock( m_mutex );
+    map<uint_t,File>::iterator fi;
+    bool result = false;
+
+    while ( ( fi = m_files.find( file ) ) != m_files.end() && !fi->second.finished )
+        Progress( lock );
+
+    if ( fi == m_files.end() )
+        return false;
+
+    result = !fi->second.failed;
+    m_files.erase( fi );
+
+    return result;
+}
+
+/**
+ * @brief Returns how files are written.
+ * @retval uint_t How files are written, from #FILEIO_ENGINE.
+ */
+const uint_t FileIO::gEngine()
+{
+    return m_engine;
+}
+
+/**
+ * @brief Returns the name of how files are written, for logging.
+ * @retval string The name of how files are written.
+ */
+const string FileIO::gEngineName()
+{
+    switch ( m_engine )
+    {
+        case FILEIO_ENGINE_URING:   return m_buffers != NULL ? "io_uring" : "io_uring (unregistered buffers)";
+        case FILEIO_ENGINE_THREADS: return Utils::FormatString( 0, "%lu threads", m_threads.size() );
+        case FILEIO_ENGINE_BLOCKING: return "blocking calls";
+        default:                    return "none";
+    }
+}
+
+/**
+ * @brief Choose and start the engine. Only the first call has any effect.
+ * @param[in] engine "blocking" to write from the calling thread, "auto" for io_uring where the kernel has it, "uring" to also warn when it does not, or "threads" to never use it.
+ * @retval void
+ */
+const void FileIO::Open( const string& engine )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    uint_t i = 0;
+
+    if ( m_engine != FILEIO_ENGINE_NONE )
+        return;
+
+    if ( engine != "blocking" && engine != "auto" && engine != "uring" && engine != "threads" )
+        LOGFMT( flags, "FileIO::Open()-> unknown engine %s, using auto", CSTR( engine ) );
+
+    if ( engine == "blocking" )
+        m_engine = FILEIO_ENGINE_BLOCKING;
+    else if ( engine != "threads" && Setup() )
+        m_engine = FILEIO_ENGINE_URING;
+    else
+    {
+        if ( engine == "uring" )
+            LOGSTR( flags, "FileIO::Open()-> io_uring is not available, falling back to threads" );
+
+        m_engine = FILEIO_ENGINE_THREADS;
+        m_work.resize( CFG_FIO_THREADS );
+
+        for ( i = 0; i < CFG_FIO_THREADS; i++ )
+            m_threads.push_back( thread( &FileIO::Work, this, i ) );
+    }
+
+    LOGFMT( iflags, "FileIO::Open()-> writing files with %s", CSTR( gEngineName() ) );
+
+    return;
+}
+
+/**
+ * @brief Make the blocking call for an operation, as a thread of the threads engine or the caller with the blocking engine does.
+ * @param[in] request The operation.
+ * @param[in] path Where the file is written.
+ * @param[in] fd The descriptor of the file, -1 if it is not open.
+ * @param[in] failed Whether the file has already failed, so a write is not worth making.
+ * @param[in] data The chunk of a write, or NULL to write the copy held by the request.
+ * @retval sint_t A descriptor or bytes written, or a negated errno.
+ */
+const sint_t FileIO::Perform( const Request* request, const string& path, const sint_t& fd, const bool& failed, const char* data )
+{
+    sint_t result = 0, written = 0;
+
+    switch ( request->op )
+    {
+        case FILEIO_OP_OPEN:
+            if ( ( result = ::open( CSTR( path ), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) < 0 )
+                result = -errno;
+            break;
+
+        case FILEIO_OP_WRITE:
+            if ( failed )
+            {
+                result = -ECANCELED;
+                break;
+            }
+
+            if ( data == NULL )
+                data = request->data.data();
+
+            for ( result = 0; static_cast<uint_t>( result ) < request->length; result += written )
+            {
+                if ( ( written = ::pwrite( fd, data + result, request->length - result, request->offset + result ) ) > 0 )
+                    continue;
+
+                if ( written < 0 && errno == EINTR )
+                {
+                    written = 0;
+                    continue;
+                }
+
+                result = written < 0 ? -errno : -EIO;
+                break;
+            }
+            break;
+
+        case FILEIO_OP_CLOSE:
+            result = fd >= 0 && ::close( fd ) != 0 ? -errno : 0;
+            break;
+
+        default:
+            result = 0;
+            break;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Submit what the workers queued since the last pass, read any completions, and run the callbacks of the files closed. Called by the main loop.
+ * @retval void
+ */
+const void FileIO::Poll()
+{
+    deque<pair<function<void( const bool& )>,bool>> done;
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+        Submit();
+    }
+
+    // A thread waiting in Finish() may be reading completions already, in which case it runs them for us
+    if ( m_engine == FILEIO_ENGINE_URING && m_reap.try_lock() )
+    {
+        Reap( false );
+        m_reap.unlock();
+    }
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+        done.swap( m_done );
+    }
+
+    while ( !done.empty() )
+    {
+        done.front().first( done.front().second );
+        done.pop_front();
+    }
+
+    return;
+}
+
+/**
+ * @brief Add an operation to the io_uring submission queue. Must be called with m_mutex held.
+ * @param[in] request The operation.
+ * @retval bool False if the queue is full or the completion queue could fill, in which case the operation must be offered again once there is room.
+ */
+const bool FileIO::Prepare( Request* request )
+{
+    uint8_t* ring = static_cast<uint8_t*>( m_sq_ring );
+    uint32_t* head = reinterpret_cast<uint32_t*>( ring + m_params.sq_off.head );
+    uint32_t* tail = reinterpret_cast<uint32_t*>( ring + m_params.sq_off.tail );
+    uint32_t* mask = reinterpret_cast<uint32_t*>( ring + m_params.sq_off.ring_mask );
+    uint32_t* array = reinterpret_cast<uint32_t*>( ring + m_params.sq_off.array );
+    uint32_t index = 0;
+    io_uring_sqe* sqe = NULL;
+    File& file = m_files[request->file];
+
+    // Kept within what the completion queue holds, so no completion ever has to wait in the kernel for room
+    if ( *tail - __atomic_load_n( head, __ATOMIC_ACQUIRE ) >= m_params.sq_entries || m_prepared + m_inflight >= m_params.cq_entries )
+        return false;
+
+    index = *tail & *mask;
+    sqe = &m_sqes[index];
+    memset( sqe, 0, sizeof( *sqe ) );
+
+    switch ( request->op )
+    {
+        case FILEIO_OP_OPEN:
+            // Direct descriptors may not be marked close-on-exec; they are never in the descriptor table to begin with
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uintptr_t>( CSTR( file.path ) );
+            sqe->len = 0644;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+            sqe->file_index = file.fd + 1;
+            break;
+
+        case FILEIO_OP_WRITE:
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->fd = file.fd;
+            sqe->len = request->length - request->done;
+            sqe->off = request->offset + request->done;
+
+            if ( request->buffer >= 0 )
+            {
+                sqe->opcode = IORING_OP_WRITE_FIXED;
+                sqe->addr = reinterpret_cast<uintptr_t>( m_buffers + request->buffer * CFG_FIO_BUFFER_SIZE + request->done );
+                sqe->buf_index = request->buffer;
+            }
+            else
+            {
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->addr = reinterpret_cast<uintptr_t>( request->data.data() + request->done );
+            }
+            break;
+
+        case FILEIO_OP_CLOSE:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = file.fd + 1;
+            break;
+
+        default:
+            break;
+    }
+
+    sqe->user_data = reinterpret_cast<uintptr_t>( request );
+    array[index] = index;
+    __atomic_store_n( tail, *tail + 1, __ATOMIC_RELEASE );
+    m_prepared++;
+
+    return true;
+}
+
+/**
+ * @brief Move the engine along while a caller waits on it: submit what is prepared, then read completions if no other thread is, or else wait for one to. Must be called with m_mutex held through lock.
+ * @param[in] lock The lock held on m_mutex, released while waiting.
+ * @retval void
+ */
+const void FileIO::Progress( unique_lock<mutex>& lock )
+{
+    Submit();
+
+    if ( m_engine == FILEIO_ENGINE_URING && m_inflight > 0 && m_reap.try_lock() )
+    {
+        lock.unlock();
+        Reap( true );
+        m_reap.unlock();
+        lock.lock();
+
+        return;
+    }
+
+    m_cond.wait_for( lock, chrono::milliseconds( 1 ) );
+
+    return;
+}
+
+/**
+ * @brief Read the io_uring completion queue. Must be called with m_reap held and m_mutex not held.
+ * @param[in] wait Whether to wait for at least one completion first.
+ * @retval void
+ */
+const void FileIO::Reap( const bool& wait )
+{
+    UFLAGS_DE( flags );
+    uint8_t* ring = static_cast<uint8_t*>( m_cq_ring );
+    uint32_t* head = reinterpret_cast<uint32_t*>( ring + m_params.cq_off.head );
+    uint32_t* tail = reinterpret_cast<uint32_t*>( ring + m_params.cq_off.tail );
+    uint32_t* mask = reinterpret_cast<uint32_t*>( ring + m_params.cq_off.ring_mask );
+    io_uring_cqe* cqes = reinterpret_cast<io_uring_cqe*>( ring + m_params.cq_off.cqes );
+    vector<uint_t> files;
+    uint32_t next = 0, last = 0;
+    Request* request = NULL;
+    uint_t i = 0;
+
+    if ( wait && ::syscall( __NR_io_uring_enter, m_ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0 && errno != EINTR )
+        LOGERRNO( flags, "FileIO::Reap()->io_uring_enter()->" );
+
+    lock_guard<mutex> lock( m_mutex );
+
+    next = *head;
+    last = __atomic_load_n( tail, __ATOMIC_ACQUIRE );
+
+    for ( ; next != last; next++ )
+    {
+        request = reinterpret_cast<Request*>( cqes[next & *mask].user_data );
+        files.push_back( request->file );
+        m_inflight--;
+        Complete( request, cqes[next & *mask].res );
+    }
+
+    __atomic_store_n( head, next, __ATOMIC_RELEASE );
+
+    // A completion lets the next operation of its file go, and may have freed a slot another file was waiting on
+    for ( i = 0; i < files.size(); i++ )
+        Dispatch( files[i] );
+
+    Submit();
+
+    return;
+}
+
+/**
+ * @brief Set up the io_uring instance, its direct descriptor table and its registered buffers.
+ * @retval bool False if the kernel lacks io_uring or the operations used, in which case nothing is left set up.
+ */
+const bool FileIO::Setup()
+{
+    UFLAGS_DE( flags );
+    vector<uint8_t> space( sizeof( io_uring_probe ) + 256 * sizeof( io_uring_probe_op ) );
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>( &space[0] );
+    vector<int> fds( CFG_FIO_FILES, -1 );
+    vector<iovec> iov( CFG_FIO_BUFFERS );
+    sint_t i = 0;
+
+    memset( &m_params, 0, sizeof( m_params ) );
+
+    if ( ( m_ring = ::syscall( __NR_io_uring_setup, CFG_FIO_DEPTH, &m_params ) ) < 0 )
+    {
+        LOGERRNO( flags, "FileIO::Setup()->io_uring_setup()->" );
+        m_ring = -1;
+
+        return false;
+    }
+
+    m_sq_length = m_params.sq_off.array + m_params.sq_entries * sizeof( uint32_t );
+    m_cq_length = m_params.cq_off.cqes + m_params.cq_entries * sizeof( io_uring_cqe );
+
+    // Since 5.4 both rings come from one mapping
+    if ( m_params.features & IORING_FEAT_SINGLE_MMAP )
+        m_sq_length = m_cq_length = max( m_sq_length, m_cq_length );
+
+    if ( ( m_sq_ring = ::mmap( NULL, m_sq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING ) ) == MAP_FAILED ||
+        ( m_cq_ring = m_params.features & IORING_FEAT_SINGLE_MMAP ? m_sq_ring :
+            ::mmap( NULL, m_cq_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING ) ) == MAP_FAILED ||
+        ( m_sqes = static_cast<io_uring_sqe*>( ::mmap( NULL, m_params.sq_entries * sizeof( io_uring_sqe ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES ) ) ) == MAP_FAILED )
+    {
+        LOGERRNO( flags, "FileIO::Setup()->mmap()->" );
+        Teardown();
+
+        return false;
+    }
+
+    // Opening into and closing direct descriptors came with 5.15, the release that also added linkat
+    if ( ::syscall( __NR_io_uring_register, m_ring, IORING_REGISTER_PROBE, probe, 256 ) < 0 || probe->last_op < IORING_OP_LINKAT ||
+        !( probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED ) || !( probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED ) ||
+        !( probe->ops[IORING_OP_WRITE_FIXED].flags & IO_URING_OP_SUPPORTED ) || !( probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED ) )
+    {
+        LOGSTR( flags, "FileIO::Setup()-> io_uring lacks direct descriptors, needing Linux 5.15 or later" );
+        Teardown();
+
+        return false;
+    }
+
+    if ( ::syscall( __NR_io_uring_register, m_ring, IORING_REGISTER_FILES, &fds[0], fds.size() ) < 0 )
+    {
+        LOGERRNO( flags, "FileIO::Setup()->io_uring_register()->" );
+        Teardown();
+
+        return false;
+    }
+
+    for ( i = CFG_FIO_FILES - 1; i >= 0; i-- )
+        m_slots.push_back( i );
+
+    // Registered buffers count against RLIMIT_MEMLOCK before 5.12; without them chunks are written from memory of their own
+    if ( ( m_buffers = static_cast<uint8_t*>( ::mmap( NULL, CFG_FIO_BUFFERS * CFG_FIO_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) ) == MAP_FAILED )
+        m_buffers = NULL;
+    else
+    {
+        for ( i = 0; i < CFG_FIO_BUFFERS; i++ )
+        {
+            iov[i].iov_base = m_buffers + i * CFG_FIO_BUFFER_SIZE;
+            iov[i].iov_len = CFG_FIO_BUFFER_SIZE;
+        }
+
+        if ( ::syscall( __NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS, &iov[0], iov.size() ) < 0 )
+        {
+            LOGERRNO( flags, "FileIO::Setup()->io_uring_register()->" );
+            ::munmap( m_buffers, CFG_FIO_BUFFERS * CFG_FIO_BUFFER_SIZE );
+            m_buffers = NULL;
+        }
+        else
+            for ( i = CFG_FIO_BUFFERS - 1; i >= 0; i-- )
+                m_free.push_back( i );
+    }
+
+    return true;
+}
+
+/**
+ * @brief Submit whatever is in the io_uring submission queue, then offer anything that was held back for want of a slot or room. Must be called with m_mutex held.
+ * @retval void
+ */
+const void FileIO::Submit()
+{
+    UFLAGS_DE( flags );
+    set<uint_t>* queues[] = { &m_held, &m_starved };
+    set<uint_t>::iterator si;
+    sint_t submitted = 0;
+    uint_t file = 0, i = 0;
+
+    if ( m_engine != FILEIO_ENGINE_URING )
+        return;
+
+    do
+    {
+        // Anything not taken now is taken on the next pass
+        if ( m_prepared > 0 && ( submitted = ::syscall( __NR_io_uring_enter, m_ring, m_prepared, 0, 0, NULL, 0 ) ) < 0 )
+        {
+            if ( errno != EINTR && errno != EAGAIN && errno != EBUSY )
+                LOGERRNO( flags, "FileIO::Submit()->io_uring_enter()->" );
+
+            return;
+        }
+
+        if ( m_prepared > 0 )
+        {
+            m_prepared -= submitted;
+            m_inflight += submitted;
+        }
+
+        // Oldest first, stopping at the first held back again as the rest would be too
+        for ( i = 0; i < 2; i++ )
+        {
+            for ( si = queues[i]->begin(); si != queues[i]->end(); )
+            {
+                file = *si;
+                si = queues[i]->erase( si );
+                Dispatch( file );
+
+                if ( m_held.count( file ) > 0 || m_starved.count( file ) > 0 )
+                    break;
+            }
+        }
+    } while ( m_prepared > 0 );
+
+    return;
+}
+
+/**
+ * @brief Close the io_uring instance and unmap everything mapped for it.
+ * @retval void
+ */
+const void FileIO::Teardown()
+{
+    if ( m_buffers != NULL )
+        ::munmap( m_buffers, CFG_FIO_BUFFERS * CFG_FIO_BUFFER_SIZE );
+
+    if ( m_sqes != NULL && m_sqes != MAP_FAILED )
+        ::munmap( m_sqes, m_params.sq_entries * sizeof( io_uring_sqe ) );
+
+    if ( m_cq_ring != NULL && m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring )
+        ::munmap( m_cq_ring, m_cq_length );
+
+    if ( m_sq_ring != NULL && m_sq_ring != MAP_FAILED )
+        ::munmap( m_sq_ring, m_sq_length );
+
+    if ( m_ring >= 0 )
+        ::close( m_ring );
+
+    m_buffers = NULL;
+    m_sqes = NULL;
+    m_cq_ring = NULL;
+    m_sq_ring = NULL;
+    m_ring = -1;
+    m_slots.clear();
+    m_free.clear();
+
+    return;
+}
+
+/**
+ * @brief The loop of each thread of the threads engine.
+ * @param[in] index The number of the thread, choosing the queue it takes operations from.
+ * @retval void
+ */
+const void FileIO::Work( const uint_t& index )
+{
+    Request* request = NULL;
+    string path;
+    sint_t fd = -1, result = 0;
+    bool failed = false;
+
+    while ( true )
+    {
+        {
+            unique_lock<mutex> lock( m_mutex );
+
+            m_work_cond.wait( lock, [this, &index]()
+            {
+                return !m_work[index].empty() || m_shutdown;
+            } );
+
+            if ( m_work[index].empty() )
+                break;
+
+            request = m_work[index].front();
+            m_work[index].pop_front();
+
+            File& file = m_files[request->file];
+            path = file.path;
+            fd = file.fd;
+            failed = file.failed;
+        }
+
+        result = Perform( request, path, fd, failed, NULL );
+
+        lock_guard<mutex> lock( m_mutex );
+        Complete( request, result );
+    }
+
+    return;
+}
+
+/**
+ * @brief Queue a chunk to be written after everything queued for the file before. Callers are held back while more than #CFG_FIO_QUEUE bytes are queued, so must not be the thread calling Poll().
+ * @param[in] file The id of the file, as returned by Create().
+ * @param[in] data The chunk, which is copied.
+ * @param[in] length The number of bytes of data.
+ * @retval void
+ */
+const void FileIO::Write( const uint_t& file, const char* data, const uint_t& length )
+{
+    unique_lock<mutex> lock( m_mutex );
+    map<uint_t,File>::iterator fi;
+    Request* request = NULL;
+
+    if ( length == 0 )
+        return;
+
+    // The waiting thread helps the queue drain rather than only waiting on it
+    while ( m_queued >= CFG_FIO_QUEUE && m_files.find( file ) != m_files.end() )
+        Progress( lock );
+
+    if ( ( fi = m_files.find( file ) ) == m_files.end() || fi->second.closing )
+        return;
+
+    request = new Request();
+    request->file = file;
+    request->op = FILEIO_OP_WRITE;
+    request->offset = fi->second.offset;
+    request->length = length;
+    request->buffer = -1;
+
+    if ( m_engine == FILEIO_ENGINE_BLOCKING )
+    {
+        fi->second.offset += length;
+        m_queued += length;
+        Direct( request, lock, data );
+
+        return;
+    }
+
+    if ( m_buffers != NULL && length <= CFG_FIO_BUFFER_SIZE && !m_free.empty() )
+    {
+        request->buffer = m_free.back();
+        m_free.pop_back();
+        memcpy( m_buffers + request->buffer * CFG_FIO_BUFFER_SIZE, data, length );
+    }
+    else
+        request->data.assign( data, length );
+
+    fi->second.offset += length;
+    m_queued += length;
+    fi->second.waiting.push_back( request );
+    Dispatch( file );
+
+    if ( m_prepared >= CFG_FIO_BATCH )
+        Submit();
+
+    return;
+}
+
+/**
+ * @brief Constructor for the FileIO class. Nothing is written until Open() is called.
+ */
+FileIO::FileIO()
+{
+    m_engine = FILEIO_ENGINE_NONE;
+    m_next = uintmin_t;
+    m_queued = uintmin_t;
+    m_ring = -1;
+    memset( &m_params, 0, sizeof( m_params ) );
+    m_sq_ring = NULL;
+    m_sq_length = uintmin_t;
+    m_cq_ring = NULL;
+    m_cq_length = uintmin_t;
+    m_sqes = NULL;
+    m_prepared = uintmin_t;
+    m_inflight = uintmin_t;
+    m_buffers = NULL;
+    m_shutdown = false;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the FileIO class. Everything queued is written first; callbacks not yet run by Poll() are dropped.
+ */
+FileIO::~FileIO()
+{
+    ITER( vector, thread, vi );
+    map<uint_t,File>::iterator mi;
+
+    if ( m_engine == FILEIO_ENGINE_URING )
+    {
+        unique_lock<mutex> lock( m_mutex );
+
+        while ( m_prepared > 0 || m_inflight > 0 )
+            Progress( lock );
+
+        lock.unlock();
+        Teardown();
+    }
+
+    if ( m_engine == FILEIO_ENGINE_THREADS )
+    {
+        {
+            lock_guard<mutex> lock( m_mutex );
+            m_shutdown = true;
+        }
+
+        m_work_cond.notify_all();
+
+        for ( vi = m_threads.begin(); vi != m_threads.end(); vi++ )
+            vi->join();
+    }
+
+    // Only files never closed are left with operations waiting
+    for ( mi = m_files.begin(); mi != m_files.end(); mi++ )
+        while ( !mi->second.waiting.empty() )
+        {
+            delete mi->second.waiting.front();
+            mi->second.waiting.pop_front();
+        }
+
+    return;
+}
@@ -0,0 +1,59 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file ahocorasick.h
+ * @brief The AhoCorasick class.
+ *
+ * This file contains the AhoCorasick class and template functions.
+ */
+#ifndef DEC_AHOCORASICK_H
+#define DEC_AHOCORASICK_H
+
+using namespace std;
+
+/**
+ * @brief A multi-pattern literal matcher. Every pattern is found in a single pass over the text.
+ */
+class AhoCorasick
+{
+    public:
+        const void Add( const string& pattern, const uint_t& id );
+        const void Build();
+        const void Clear();
+        const uint_t gPatterns();
+        const uint_t gStates();
+        const void Scan( const string& text, vector<uint_t>& hits );
+
+        AhoCorasick( const bool& fold = false );
+        ~AhoCorasick();
+
+    private:
+        bool m_fold; /**< Match ASCII letters without regard to case. */
+        uint16_t m_class[256]; /**< Maps each byte to its column in m_next, 0 for bytes in no pattern. */
+        uint_t m_width; /**< Number of byte classes, and so columns per state. */
+        vector<pair<string,uint_t>> m_patterns; /**< Patterns and their ids, in the order added. */
+        vector<uint_t> m_next; /**< Transition table of m_width columns per state, with failures resolved. */
+        vector<vector<uint_t>> m_output; /**< Ids of the patterns that end at each state. */
+};
+
+#endif
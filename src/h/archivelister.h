@@ -0,0 +1,90 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file archivelister.h
+ * @brief The ArchiveLister class.
+ *
+ * This file contains the ArchiveLister class and template functions.
+ */
+#ifndef DEC_ARCHIVELISTER_H
+#define DEC_ARCHIVELISTER_H
+
+using namespace std;
+
+/**
+ * @brief Lists the files of a RAR4, RAR5, 7-Zip or zip archive from as little of it as possible. Data is fed as it is downloaded and the lister says where it needs to continue from.
+ */
+class ArchiveLister
+{
+    public:
+        /**
+         * @brief A file stored within the archive.
+         */
+        struct File
+        {
+            string name; /**< Path of the file within the archive. */
+            uint_t size; /**< Unpacked size in bytes. */
+            uint_t packed; /**< Packed size in bytes, 0 if not known. */
+            bool directory; /**< Whether the entry is a directory. */
+            bool encrypted; /**< Whether the data of the file is encrypted. */
+        };
+
+        static const void Benchmark( const vector<string>& files );
+        const bool Feed( const uint_t& offset, const char* data, const uint_t& length );
+        const vector<File> gFiles();
+        const uint_t gNeed();
+        const uint_t gOffset();
+        const uint_t gStatus();
+        const uint_t gType();
+        const void Reset();
+
+        ArchiveLister();
+        ~ArchiveLister();
+
+    private:
+        const void Consume( const uint_t& length );
+        const uint8_t* Peek( const uint_t& length );
+        const bool Rar4();
+        const bool Rar5();
+        static const bool Rar5Number( const uint8_t* data, const uint_t& length, uint_t& pos, uint64_t& value );
+        const bool SevenZip();
+        const uint_t SevenZipHeader( const uint8_t* data, const uint_t& length );
+        static const bool SevenZipNumber( const uint8_t* data, const uint_t& length, uint_t& pos, uint64_t& value );
+        static const bool SevenZipStreams( const uint8_t* data, const uint_t& length, uint_t& pos, vector<uint64_t>& sizes, bool& encrypted );
+        const bool Signature();
+        static const string Utf16( const uint8_t* data, const uint_t& length );
+        const bool Zip();
+
+        uint_t m_type; /**< The format of the archive from #ARCHIVE_TYPE. */
+        uint_t m_status; /**< The verdict so far from #ARCHIVE_STATUS. */
+        string m_buffer; /**< Data fed but not yet consumed, from m_head on. */
+        uint_t m_head; /**< Index in m_buffer of the byte at m_pos. */
+        uint_t m_pos; /**< Offset within the archive of the next header. */
+        uint_t m_need; /**< Bytes needed from m_pos for the next header to be parsed. */
+        uint_t m_header_size; /**< Size of the 7-Zip header once its start header has been read. */
+        uint32_t m_header_crc; /**< Expected CRC32 of the 7-Zip header. */
+        bool m_descriptor; /**< Whether a zip data descriptor follows the entry just skipped. */
+        vector<File> m_files; /**< Files listed so far. */
+};
+
+#endif
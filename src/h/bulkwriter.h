@@ -0,0 +1,58 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file bulkwriter.h
+ * @brief The BulkWriter class.
+ *
+ * This file contains the BulkWriter class and template functions.
+ */
+#ifndef DEC_BULKWRITER_H
+#define DEC_BULKWRITER_H
+
+using namespace std;
+
+/**
+ * @brief Buffers rows for a single table and writes them with multi-row INSERT statements.
+ */
+class BulkWriter
+{
+    public:
+        const void Add( const vector<string>& row );
+        const void Clear();
+        const bool Flush();
+        const uint_t gPending();
+        const uint_t gWritten();
+
+        BulkWriter( const string& table, const vector<string>& columns, const string& modifier = "", const string& suffix = "" );
+        ~BulkWriter();
+
+    private:
+        string m_table; /**< Table to insert into. */
+        vector<string> m_columns; /**< Columns to insert, in the order values are added. */
+        string m_modifier; /**< Placed between INSERT and INTO, such as IGNORE. */
+        string m_suffix; /**< Appended to each statement, such as ON DUPLICATE KEY UPDATE. */
+        vector<vector<string>> m_rows; /**< Rows waiting to be written. */
+        uint_t m_written; /**< Total rows written since construction. */
+};
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file categorizer.h
+ * @brief The Categorizer class.
+ *
+ * This file contains the Categorizer class and template functions.
+ */
+#ifndef DEC_CATEGORIZER_H
+#define DEC_CATEGORIZER_H
+
+#include "ahocorasick.h"
+
+using namespace std;
+
+/**
+ * @brief Places releases into nZEDb categories from their group, name, and size, resolving which rules apply to each group once and scanning each name once to decide which rules can match.
+ */
+class Categorizer
+{
+    public:
+        const void Benchmark( const string& rules, const string& file );
+        const uint_t Classify( const string& group, const string& name, const uint_t& size );
+        const uint_t gRules();
+        const bool Load( const string& file );
+
+        Categorizer();
+        ~Categorizer();
+
+    private:
+        /**
+         * @brief A compiled category rule.
+         */
+        struct Rule
+        {
+            uint_t category; /**< The categoryid given to a matching release. */
+            bool any_group; /**< The rule applies to every group. */
+            regex group; /**< Matches the names of the groups the rule applies to. */
+            bool any_name; /**< The group alone decides, with no name regex to run. */
+            regex pattern; /**< The name regex. */
+            uint_t min_size; /**< Smallest matching release in bytes, 0 for no limit. */
+            uint_t max_size; /**< Largest matching release in bytes, 0 for no limit. */
+            vector<vector<vector<uint_t>>> required; /**< Per alternative of the regex, sets of literal indices of which at least one each must be seen; the regex only runs once some alternative is satisfied, or always if empty. */
+        };
+
+        static const vector<vector<vector<string>>> Required( const string& source );
+        const vector<uint_t>& Rules( const string& group );
+        const uint_t Search( const string& group, const string& name, const uint_t& size, const bool& prefilter );
+
+        AhoCorasick m_literals; /**< Required literals of every rule, reporting the literal index. */
+        mutex m_mutex; /**< Guards m_groups, which is filled in as groups are first seen by any thread. */
+        unordered_map<string,vector<uint_t>> m_groups; /**< Indices of the rules that apply to each group name seen. */
+        vector<Rule> m_rules; /**< Compiled rules in priority order. */
+};
+
+#endif
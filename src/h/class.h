@@ -30,8 +30,38 @@
 #ifndef DEC_CLASS_H
 #define DEC_CLASS_H
 
+class AhoCorasick;
+class ArchiveLister;
+class BulkWriter;
+class Categorizer;
+class Cluster;
+class Collator;
+class CollectionRegex;
+class ConfigFile;
+class ControlSocket;
 class DBConn;
     class DBConnMySQL;
+class FileIO;
 class HashDecrypter;
+class Job;
+    class JobBinaries;
+    class JobCategorize;
+    class JobFixNames;
+    class JobOptimize;
+    class JobPreDBMatch;
+    class JobReleases;
+    class JobRemoveCrap;
+    class JobRequestID;
+class NNTPConn;
+class NzbWriter;
+class Par2Parser;
+class QueryCache;
+class RequestIDCache;
+class RequestIDService;
+class StateFile;
+class Topology;
+class TrigramIndex;
+class WorkerPool;
+class YEncDecoder;
 
 #endif
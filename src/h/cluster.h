@@ -0,0 +1,69 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file cluster.h
+ * @brief The Cluster class.
+ *
+ * This file contains the Cluster class and template functions.
+ */
+#ifndef DEC_CLUSTER_H
+#define DEC_CLUSTER_H
+
+using namespace std;
+
+/**
+ * @brief Splits the work of the jobs between several nzedb-backend instances sharing one database, through leases on shards of it.
+ */
+class Cluster
+{
+    public:
+        const uint_t Begin();
+        const void End( const uint_t& generation );
+        const string Filter( const string& column );
+        const bool gEnabled();
+        const bool Leader();
+        const void Leave();
+        const bool Owns( const uint_t& group );
+        const void Poll( const bool& force = false );
+
+        Cluster();
+        ~Cluster();
+
+    private:
+        const void Lost( const chrono::high_resolution_clock::time_point& now );
+        static const uint64_t Weight( const string& node, const uint_t& shard );
+
+        map<uint_t,uint_t> m_draining; /**< Shards still leased but no longer wanted, mapped to the generation they were dropped in. */
+        uint_t m_generation; /**< Bumped each time the shards work is taken from change. */
+        chrono::high_resolution_clock::time_point m_heartbeat; /**< When the node last polled the database. */
+        mutex m_mutex; /**< Guards every member read by job threads: m_draining, m_generation, m_owned and m_runs. */
+        string m_node; /**< Name of this node, or empty when running alone. */
+        uint_t m_nodes; /**< Live nodes seen by the last poll. */
+        set<uint_t> m_owned; /**< Shards leased to this node that work is taken from. */
+        chrono::high_resolution_clock::time_point m_renewed; /**< When the leases were last renewed. */
+        map<uint_t,uint_t> m_runs; /**< Job runs in progress, by the generation they began in. */
+        uint_t m_shards; /**< Number of shards the work is split into. */
+        bool m_tables; /**< Whether the node and lease tables are known to exist. */
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file collator.h
+ * @brief The Collator class.
+ *
+ * This file contains the Collator class and template functions.
+ */
+#ifndef DEC_COLLATOR_H
+#define DEC_COLLATOR_H
+
+#include "bulkwriter.h"
+
+using namespace std;
+
+/**
+ * @brief Groups article parts into binaries and binaries into collections in memory, writing only the aggregated rows.
+ */
+class Collator
+{
+    public:
+        /**
+         * @brief A single parsed overview line.
+         */
+        struct Article
+        {
+            uint_t group; /**< The id of the group in the groups table. */
+            string group_name; /**< The name of the group. */
+            string subject; /**< The subject of the article. */
+            string from; /**< The poster of the article. */
+            time_t date; /**< When the article was posted. */
+            string messageid; /**< The message-id, without angle brackets. */
+            uint_t number; /**< The article number within the group. */
+            uint_t size; /**< The size of the article in bytes. */
+            string xref; /**< The Xref header, if the provider sent one. */
+        };
+
+        const void Add( const Article& article );
+        const bool Flush();
+        const uint_t gBinaries();
+        const uint_t gCollections();
+        const uint_t gParts();
+        const uint_t gRows();
+
+        Collator( CollectionRegex* regexes );
+        ~Collator();
+
+    private:
+        /**
+         * @brief An article that belongs to a binary.
+         */
+        struct Part
+        {
+            string messageid; /**< The message-id, without angle brackets. */
+            uint_t number; /**< The article number within the group. */
+            uint_t part; /**< The part number from the subject. */
+            uint_t size; /**< The size of the article in bytes. */
+        };
+
+        /**
+         * @brief A single file made up of parts.
+         */
+        struct Binary
+        {
+            string name; /**< The subject without its part counter. */
+            string hash; /**< MD5 of the name, poster, and group as nZEDb computes binaryhash. */
+            uint_t collection; /**< Index of the collection the binary belongs to. */
+            uint_t file; /**< The file number from the subject. */
+            uint_t total; /**< The number of parts the subject says the binary has. */
+            uint_t size; /**< Sum of the part sizes. */
+            vector<Part> parts; /**< Parts received. */
+        };
+
+        /**
+         * @brief A set of binaries posted together.
+         */
+        struct Collection
+        {
+            string subject; /**< The name of the first binary seen. */
+            string from; /**< The poster. */
+            time_t date; /**< When the first part seen was posted. */
+            string xref; /**< The Xref header of the first part seen. */
+            uint_t files; /**< The number of files the subject says the collection has. */
+            uint_t group; /**< The id of the group in the groups table. */
+            string hash; /**< SHA1 of the collection key, poster, group, and file count as nZEDb computes collectionhash. */
+            uint_t size; /**< Sum of the binary sizes. */
+        };
+
+        static const string Clean( const string& name );
+        const bool Count();
+        static const void ParseCounters( const string& subject, uint_t& part, uint_t& total, uint_t& file, uint_t& files, string::size_type& cut );
+        const bool Resolve( const string& table, const string& column, const vector<string>& hashes, unordered_map<string,uint_t>& ids );
+
+        CollectionRegex* m_regexes; /**< Rules used to find the collection key of a subject. */
+        vector<Collection> m_collections; /**< Collections being collated. */
+        unordered_map<string,uint_t> m_collection_index; /**< Indices into m_collections by hash. */
+        vector<Binary> m_binaries; /**< Binaries being collated. */
+        unordered_map<string,uint_t> m_binary_index; /**< Indices into m_binaries by name, poster, and group. */
+        uint_t m_parts; /**< Parts held in m_binaries. */
+        vector<Collection> m_pending_collections; /**< Collections of the flush in progress. */
+        vector<Binary> m_pending_binaries; /**< Binaries of the flush in progress. */
+        uint_t m_stage; /**< How far the flush in progress got from #COLLATOR_STAGE. */
+        BulkWriter m_collection_writer; /**< Writes collection rows. */
+        BulkWriter m_binary_writer; /**< Writes binary rows. */
+        BulkWriter m_part_writer; /**< Writes part rows. */
+        unordered_map<string,uint_t> m_collection_ids; /**< Database ids of the pending collections by hash. */
+        unordered_map<string,uint_t> m_binary_ids; /**< Database ids of the pending binaries by hash. */
+        uint_t m_total_binaries; /**< Binaries written since construction. */
+        uint_t m_total_collections; /**< Collections written since construction. */
+        uint_t m_total_parts; /**< Parts collated since construction. */
+};
+
+#endif
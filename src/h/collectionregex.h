@@ -0,0 +1,84 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file collectionregex.h
+ * @brief The CollectionRegex class.
+ *
+ * This file contains the CollectionRegex class and template functions.
+ */
+#ifndef DEC_COLLECTIONREGEX_H
+#define DEC_COLLECTIONREGEX_H
+
+#include "ahocorasick.h"
+
+using namespace std;
+
+/**
+ * @brief Turns article subjects into collection keys using the collection_regexes table, scanning each subject once to decide which rules can match.
+ */
+class CollectionRegex
+{
+    public:
+        const void Benchmark( const string& file );
+        static const bool Compile( const string& source, regex& output, vector<uint_t>& captures, vector<string>& literals );
+        static const string::size_type EndClass( const string& source, const string::size_type& start );
+        static const string::size_type EndEscape( const string& source, const string::size_type& start );
+        const uint_t gExecuted();
+        const uint_t gMatched();
+        const uint_t gRules();
+        const uint_t gScanned();
+        static const vector<string> Literals( const string& source );
+        const bool Load();
+        const bool Match( const string& group, const string& subject, string& key );
+
+        CollectionRegex();
+        ~CollectionRegex();
+
+    private:
+        /**
+         * @brief A compiled row of the collection_regexes table.
+         */
+        struct Rule
+        {
+            uint_t id; /**< The id of the row in collection_regexes. */
+            regex group; /**< Matches the names of the groups the rule applies to. */
+            regex pattern; /**< The subject regex. */
+            vector<uint_t> captures; /**< Capture indices of the match0, match1, ... groups, in order. */
+            vector<uint_t> literals; /**< Indices of the literals every match contains; the regex only runs once all have been seen. */
+        };
+
+        const vector<uint_t>& Rules( const string& group );
+        const bool Search( const string& group, const string& subject, string& key, const bool& prefilter );
+
+        AhoCorasick m_literals; /**< Required literals of every rule, reporting the literal index. */
+        unordered_map<string,vector<uint_t>> m_groups; /**< Indices of the rules that apply to each group name seen. */
+        vector<Rule> m_rules; /**< Enabled rules in priority order. */
+        vector<uint_t> m_seen; /**< Per literal, the value of m_stamp when it was last found. */
+        uint_t m_stamp; /**< Incremented per subject so m_seen never needs clearing. */
+        vector<uint_t> m_hits; /**< Scratch space for AhoCorasick::Scan(). */
+        uint_t m_executed; /**< Number of regex executions. */
+        uint_t m_matched; /**< Number of subjects that produced a key. */
+        uint_t m_scanned; /**< Number of subjects checked. */
+};
+
+#endif
@@ -31,10 +31,303 @@
 #ifndef DEC_CONFIG_H
 #define DEC_CONFIG_H
 
+/***************************************************************************
+ *                             CLUSTER OPTIONS                             *
+ ***************************************************************************/
+/** @name Cluster Options */ /**@{*/
+/**
+ * @def CFG_CLUSTER_EXPIRE
+ * @brief Seconds a shard lease or node heartbeat lasts without being renewed, after which the shards of the node are taken over.
+ * @par Default: 30
+ */
+#define CFG_CLUSTER_EXPIRE 30
+
+/**
+ * @def CFG_CLUSTER_HEARTBEAT
+ * @brief Seconds between heartbeats, each renewing the leases of the node. Keep well below #CFG_CLUSTER_EXPIRE.
+ * @par Default: 10
+ */
+#define CFG_CLUSTER_HEARTBEAT 10
+
+/**
+ * @def CFG_CLUSTER_SHARDS
+ * @brief Number of shards the work is split into across the nodes of a cluster. Every node must use the same count.
+ * @par Default: 64
+ */
+#define CFG_CLUSTER_SHARDS 64
+
+/**
+ * @def CFG_CLUSTER_SPAN
+ * @brief Number of consecutive release ids in the same shard, so each node reads runs of neighbouring rows.
+ * @par Default: 10000
+ */
+#define CFG_CLUSTER_SPAN 10000
+/**@}*/
+
+/***************************************************************************
+ *                             CONTROL OPTIONS                             *
+ ***************************************************************************/
+/** @name Control Options */ /**@{*/
+/**
+ * @def CFG_CTL_BUFFER
+ * @brief Most bytes of output held for a control client that is not reading it. Log lines for a client following the log past this are dropped.
+ * @par Default: 1048576
+ */
+#define CFG_CTL_BUFFER 1048576
+
+/**
+ * @def CFG_CTL_CLIENTS
+ * @brief Most control clients connected at once.
+ * @par Default: 16
+ */
+#define CFG_CTL_CLIENTS 16
+
+/**
+ * @def CFG_CTL_LINE
+ * @brief Longest command (in bytes) a control client may send.
+ * @par Default: 4096
+ */
+#define CFG_CTL_LINE 4096
+
+/**
+ * @def CFG_CTL_PATH
+ * @brief Unix socket the ControlSocket listens on, relative to the working directory unless absolute.
+ * @par Default: "nzedb-backend.sock"
+ */
+#define CFG_CTL_PATH "nzedb-backend.sock"
+
+/**
+ * @def CFG_CTL_TIMEOUT
+ * @brief Seconds the --control client waits for an answer.
+ * @par Default: 10
+ */
+#define CFG_CTL_TIMEOUT 10
+
+/**
+ * @def CFG_CTL_TRACE
+ * @brief Number of recent log lines kept for the trace command.
+ * @par Default: 1000
+ */
+#define CFG_CTL_TRACE 1000
+/**@}*/
+
+/***************************************************************************
+ *                             DATABASE OPTIONS                            *
+ ***************************************************************************/
+/** @name Database Options */ /**@{*/
+/**
+ * @def CFG_DB_BACKOFF_MAX
+ * @brief Most seconds to wait before trying a database server again after failed connects, however many there were in a row.
+ * @par Default: 300
+ */
+#define CFG_DB_BACKOFF_MAX 300
+
+/**
+ * @def CFG_DB_BACKOFF_MIN
+ * @brief Seconds to wait before trying a database server again after a failed connect, doubling with each further failure.
+ * @par Default: 1
+ */
+#define CFG_DB_BACKOFF_MIN 1
+
+/**
+ * @def CFG_DB_BULK_BYTES
+ * @brief Size (in bytes) at which a BulkWriter statement is split. Keep well below the server's max_allowed_packet.
+ * @par Default: 1048576
+ */
+#define CFG_DB_BULK_BYTES 1048576
+
+/**
+ * @def CFG_DB_BULK_ROWS
+ * @brief Number of rows a BulkWriter buffers before flushing.
+ * @par Default: 5000
+ */
+#define CFG_DB_BULK_ROWS 5000
+
+/**
+ * @def CFG_DB_CACHE_REPORT
+ * @brief Number of seconds between logging the QueryCache hit rate.
+ * @par Default: 600
+ */
+#define CFG_DB_CACHE_REPORT 600
+
+/**
+ * @def CFG_DB_CONNECT_TIMEOUT
+ * @brief Seconds a database connection may take to establish before it is abandoned.
+ * @par Default: 10
+ */
+#define CFG_DB_CONNECT_TIMEOUT 10
+
+/**
+ * @def CFG_DB_HEALTH_CHECK
+ * @brief Seconds a database connection may sit unused before it is pinged in the background to prove it still works.
+ * @par Default: 30
+ */
+#define CFG_DB_HEALTH_CHECK 30
+
+/**
+ * @def CFG_DB_OPT_COOLDOWN
+ * @brief Seconds before JobOptimize will rebuild the same table again, as shared tablespaces report the same free space for every table.
+ * @par Default: 86400
+ */
+#define CFG_DB_OPT_COOLDOWN 86400
+
+/**
+ * @def CFG_DB_OPT_FREE_MIN
+ * @brief Least free space (in bytes) within a table before JobOptimize considers rebuilding it.
+ * @par Default: 67108864
+ */
+#define CFG_DB_OPT_FREE_MIN 67108864
+
+/**
+ * @def CFG_DB_OPT_FREE_RATIO
+ * @brief Least share of a table, from 0 to 1, that must be free space before JobOptimize considers rebuilding it.
+ * @par Default: 0.10
+ */
+#define CFG_DB_OPT_FREE_RATIO 0.10
+
+/**
+ * @def CFG_DB_OPT_MAX_DEFER
+ * @brief Seconds JobOptimize waits for every other job to be idle before settling for a time when only the queue and replication lag are low.
+ * @par Default: 21600
+ */
+#define CFG_DB_OPT_MAX_DEFER 21600
+
+/**
+ * @def CFG_DB_OPT_MAX_LAG
+ * @brief Most seconds of replication lag at which JobOptimize will start rebuilding a table.
+ * @par Default: 30
+ */
+#define CFG_DB_OPT_MAX_LAG 30
+
+/**
+ * @def CFG_DB_OPT_MAX_PENDING
+ * @brief Most tasks waiting on the WorkerPool at which JobOptimize will start rebuilding a table.
+ * @par Default: 0
+ */
+#define CFG_DB_OPT_MAX_PENDING 0
+
+/**
+ * @def CFG_DB_POOL_GROW
+ * @brief Most database connections the pool opens per second, so a burst of demand cannot stampede the server.
+ * @par Default: 2
+ */
+#define CFG_DB_POOL_GROW 2
+
+/**
+ * @def CFG_DB_POOL_IDLE
+ * @brief Seconds a database connection may sit unused before the pool closes it, down to #CFG_MEM_MIN_DBCONN.
+ * @par Default: 60
+ */
+#define CFG_DB_POOL_IDLE 60
+
+/**
+ * @def CFG_DB_POOL_WAIT
+ * @brief Milliseconds threads must have been waiting for a database connection before the pool grows.
+ * @par Default: 250
+ */
+#define CFG_DB_POOL_WAIT 250
+
+/**
+ * @def CFG_DB_REPLICA_CHECK
+ * @brief Seconds between measurements of how far each replica lags the primary.
+ * @par Default: 5
+ */
+#define CFG_DB_REPLICA_CHECK 5
+
+/**
+ * @def CFG_DB_REPLICA_LAG
+ * @brief Most seconds a replica may lag the primary before its reads fall back to the primary.
+ * @par Default: 30
+ */
+#define CFG_DB_REPLICA_LAG 30
+
+/**
+ * @def CFG_DB_REPLICA_POOL
+ * @brief Number of database connections kept open to each replica.
+ * @par Default: 4
+ */
+#define CFG_DB_REPLICA_POOL 4
+
+/**
+ * @def CFG_DB_REPLICA_TIMEOUT
+ * @brief Seconds a replica connector waits on each read before giving up, so a hung replica cannot hold a connector forever.
+ * @par Default: 60
+ */
+#define CFG_DB_REPLICA_TIMEOUT 60
+/**@}*/
+
+/***************************************************************************
+ *                             FILE I/O OPTIONS                            *
+ ***************************************************************************/
+/** @name File I/O Options */ /**@{*/
+/**
+ * @def CFG_FIO_BATCH
+ * @brief Operations prepared before they are submitted without waiting for the next pass of the main loop.
+ * @par Default: 32
+ */
+#define CFG_FIO_BATCH 32
+
+/**
+ * @def CFG_FIO_BUFFER_SIZE
+ * @brief Size (in bytes) of each buffer registered with io_uring. Chunks larger than this are written from memory of their own.
+ * @par Default: #CFG_MEM_NZB_CHUNK
+ */
+#define CFG_FIO_BUFFER_SIZE CFG_MEM_NZB_CHUNK
+
+/**
+ * @def CFG_FIO_BUFFERS
+ * @brief Number of buffers registered with io_uring.
+ * @par Default: 64
+ */
+#define CFG_FIO_BUFFERS 64
+
+/**
+ * @def CFG_FIO_DEPTH
+ * @brief Entries of the io_uring submission queue.
+ * @par Default: 256
+ */
+#define CFG_FIO_DEPTH 256
+
+/**
+ * @def CFG_FIO_ENGINE
+ * @brief How files are written: "blocking" by the caller, "auto" for io_uring where the kernel has it, "uring" to warn when it does not, or "threads" to never use it.
+ * @par Default: "blocking"
+ */
+#define CFG_FIO_ENGINE "blocking"
+
+/**
+ * @def CFG_FIO_FILES
+ * @brief Files open through io_uring at once. Any more wait for one to close.
+ * @par Default: 256
+ */
+#define CFG_FIO_FILES 256
+
+/**
+ * @def CFG_FIO_QUEUE
+ * @brief Most bytes queued to be written before callers are held back.
+ * @par Default: 67108864
+ */
+#define CFG_FIO_QUEUE 67108864
+
+/**
+ * @def CFG_FIO_THREADS
+ * @brief Threads making blocking calls when io_uring is not used.
+ * @par Default: 4
+ */
+#define CFG_FIO_THREADS 4
+/**@}*/
+
 /***************************************************************************
  *                              MEMORY OPTIONS                             *
  ***************************************************************************/
 /** @name Memory Options */ /**@{*/
+/**
+ * @def CFG_MEM_MAX_ARCHIVE_HEADER
+ * @brief Largest archive header the ArchiveLister will buffer. 7-Zip keeps the whole file list in one header at the end of the archive.
+ * @par Default: 1048576
+ */
+#define CFG_MEM_MAX_ARCHIVE_HEADER 1048576
+
 /**
  * @def CFG_MEM_MAX_BITSET
  * @brief Maximum size of all bitset elements.
@@ -44,10 +337,270 @@
 
 /**
  * @def CFG_MEM_MAX_DBCONN
- * @brief Maximum number of database connections to open at once.
+ * @brief Maximum number of database connections the pool may grow to.
+ * @par Default: 24
+ */
+#define CFG_MEM_MAX_DBCONN 24
+
+/**
+ * @def CFG_MEM_MAX_PAR2_PACKET
+ * @brief Largest par2 packet the Par2Parser will hold to check its MD5. Recovery slices are skipped without being held.
+ * @par Default: 65536
+ */
+#define CFG_MEM_MAX_PAR2_PACKET 65536
+
+/**
+ * @def CFG_MEM_MAX_PARTS
+ * @brief Maximum number of article parts held by the Collator before they are written out.
+ * @par Default: 250000
+ */
+#define CFG_MEM_MAX_PARTS 250000
+
+/**
+ * @def CFG_MEM_MAX_QUERY_CACHE
+ * @brief Maximum number of results kept in the QueryCache.
+ * @par Default: 1000
+ */
+#define CFG_MEM_MAX_QUERY_CACHE 1000
+
+/**
+ * @def CFG_MEM_MAX_REQID_CACHE
+ * @brief Maximum number of request id results, found or not, kept in the RequestIDCache.
+ * @par Default: 100000
+ */
+#define CFG_MEM_MAX_REQID_CACHE 100000
+
+/**
+ * @def CFG_MEM_MIN_DBCONN
+ * @brief Number of database connections the pool keeps open however idle it is.
+ * @par Default: 2
+ */
+#define CFG_MEM_MIN_DBCONN 2
+
+/**
+ * @def CFG_MEM_NZB_CHUNK
+ * @brief Size in bytes of the XML and compressed buffers held by each NzbWriter.
+ * @par Default: 65536
+ */
+#define CFG_MEM_NZB_CHUNK 65536
+/**@}*/
+
+/***************************************************************************
+ *                               NNTP OPTIONS                              *
+ ***************************************************************************/
+/** @name NNTP Options */ /**@{*/
+/**
+ * @def CFG_NNTP_BATCH
+ * @brief Number of articles requested by each XOVER / XZVER command.
+ * @par Default: 5000
+ */
+#define CFG_NNTP_BATCH 5000
+
+/**
+ * @def CFG_NNTP_BUF_SIZE
+ * @brief Size (in bytes) of the buffer used for each socket read.
+ * @par Default: 65536
+ */
+#define CFG_NNTP_BUF_SIZE 65536
+
+/**
+ * @def CFG_NNTP_CHECKPOINT
+ * @brief Seconds between flushing the headers collated so far and checkpointing the last article of each group, so a restart resumes there.
+ * @par Default: 60
+ */
+#define CFG_NNTP_CHECKPOINT 60
+
+/**
+ * @def CFG_NNTP_MAX_ARTICLES
+ * @brief Maximum number of articles fetched per group in a single run.
+ * @par Default: 500000
+ */
+#define CFG_NNTP_MAX_ARTICLES 500000
+
+/**
+ * @def CFG_NNTP_MAX_CONN
+ * @brief Number of connections opened to the usenet provider.
+ * @par Default: 4
+ */
+#define CFG_NNTP_MAX_CONN 4
+
+/**
+ * @def CFG_NNTP_NEW_ARTICLES
+ * @brief Number of the newest articles fetched for a group that has never been updated.
+ * @par Default: 20000
+ */
+#define CFG_NNTP_NEW_ARTICLES 20000
+
+/**
+ * @def CFG_NNTP_PIPELINE
+ * @brief Number of commands a connection sends before waiting on a response.
  * @par Default: 4
  */
-#define CFG_MEM_MAX_DBCONN 4
+#define CFG_NNTP_PIPELINE 4
+
+/**
+ * @def CFG_NNTP_RETRY
+ * @brief Number of attempts made at a range, and reconnects made per connection, before giving up for the run.
+ * @par Default: 3
+ */
+#define CFG_NNTP_RETRY 3
+/**@}*/
+
+/***************************************************************************
+ *                             RELEASE OPTIONS                             *
+ ***************************************************************************/
+/** @name Release Options */ /**@{*/
+/**
+ * @def CFG_REL_BATCH
+ * @brief Maximum number of collections turned into releases within one transaction.
+ * @par Default: 100
+ */
+#define CFG_REL_BATCH 100
+
+/**
+ * @def CFG_REL_CAT_BATCH
+ * @brief Number of releases JobCategorize loads and writes back at once.
+ * @par Default: 1000
+ */
+#define CFG_REL_CAT_BATCH 1000
+
+/**
+ * @def CFG_REL_CAT_SAMPLE
+ * @brief Number of releases nZEDb already categorized that JobCategorize checks its rules against while categorize.write is off.
+ * @par Default: 10000
+ */
+#define CFG_REL_CAT_SAMPLE 10000
+
+/**
+ * @def CFG_REL_CRAP_BATCH
+ * @brief Number of releases JobRemoveCrap loads into one columnar batch.
+ * @par Default: 5000
+ */
+#define CFG_REL_CRAP_BATCH 5000
+
+/**
+ * @def CFG_REL_CRAP_HOURS
+ * @brief Only releases added within this many hours are checked, as removeCrapReleases.php true 2 does.
+ * @par Default: 2
+ */
+#define CFG_REL_CRAP_HOURS 2
+
+/**
+ * @def CFG_REL_CRAP_HUGE
+ * @brief Bytes above which a single part release is removed.
+ * @par Default: 500000000
+ */
+#define CFG_REL_CRAP_HUGE 500000000
+
+/**
+ * @def CFG_REL_CRAP_SAMPLE
+ * @brief Bytes below which a lone sample is removed.
+ * @par Default: 40000000
+ */
+#define CFG_REL_CRAP_SAMPLE 40000000
+
+/**
+ * @def CFG_REL_CRAP_SIZE
+ * @brief Bytes below which a single part release is removed.
+ * @par Default: 2097152
+ */
+#define CFG_REL_CRAP_SIZE 2097152
+
+/**
+ * @def CFG_REL_DELAY
+ * @brief Minutes without new parts after which an incomplete collection is released anyway.
+ * @par Default: 120
+ */
+#define CFG_REL_DELAY 120
+
+/**
+ * @def CFG_REL_FIX_BATCH
+ * @brief Number of releases JobFixNames loads and checks at once.
+ * @par Default: 1000
+ */
+#define CFG_REL_FIX_BATCH 1000
+
+/**
+ * @def CFG_REL_FIX_OTHER
+ * @brief The "other" categories whose releases may also be renamed from file names and PreDB hashes, as fixReleaseNames.php other does.
+ * @par Default: "1090, 2020, 3050, 5050, 6050, 7010, 8050"
+ */
+#define CFG_REL_FIX_OTHER "1090, 2020, 3050, 5050, 6050, 7010, 8050"
+
+/**
+ * @def CFG_REL_MAX_BATCHES
+ * @brief Maximum number of batches per group in a single run.
+ * @par Default: 50
+ */
+#define CFG_REL_MAX_BATCHES 50
+
+/**
+ * @def CFG_REL_PRE_BATCH
+ * @brief Number of releases JobPreDBMatch loads and matches at once.
+ * @par Default: 10000
+ */
+#define CFG_REL_PRE_BATCH 10000
+
+/**
+ * @def CFG_REL_PRE_SIMILARITY
+ * @brief Lowest trigram similarity, from 0 to 1, at which a release name is taken to be a PreDB title.
+ * @par Default: 0.85
+ */
+#define CFG_REL_PRE_SIMILARITY 0.85
+
+/**
+ * @def CFG_REL_REQID_BATCH
+ * @brief Number of releases of a group JobRequestID loads and resolves at once.
+ * @par Default: 1000
+ */
+#define CFG_REL_REQID_BATCH 1000
+
+/**
+ * @def CFG_REL_REQID_HIT_TTL
+ * @brief Seconds a request id that resolved to a title is cached.
+ * @par Default: 86400
+ */
+#define CFG_REL_REQID_HIT_TTL 86400
+
+/**
+ * @def CFG_REL_REQID_MISS_TTL
+ * @brief Seconds a request id that did not resolve is cached before it is looked up again.
+ * @par Default: 3600
+ */
+#define CFG_REL_REQID_MISS_TTL 3600
+
+/**
+ * @def CFG_REL_REQID_TIMEOUT
+ * @brief Seconds to wait on the request id web service before giving up on a lookup.
+ * @par Default: 10
+ */
+#define CFG_REL_REQID_TIMEOUT 10
+/**@}*/
+
+/***************************************************************************
+ *                              STATE OPTIONS                              *
+ ***************************************************************************/
+/** @name State Options */ /**@{*/
+/**
+ * @def CFG_STATE_PATH
+ * @brief File the StateFile keeps checkpoints in, relative to the working directory unless absolute.
+ * @par Default: "nzedb-backend.state"
+ */
+#define CFG_STATE_PATH "nzedb-backend.state"
+
+/**
+ * @def CFG_STATE_RECORDS
+ * @brief Number of checkpoints the StateFile has room for. Changing it discards every checkpoint in an existing file.
+ * @par Default: 1024
+ */
+#define CFG_STATE_RECORDS 1024
+
+/**
+ * @def CFG_STATE_SYNC
+ * @brief Most seconds a checkpoint may wait before it is flushed to disk.
+ * @par Default: 5
+ */
+#define CFG_STATE_SYNC 5
 /**@}*/
 
 /***************************************************************************
@@ -87,12 +640,33 @@
  *                              THREAD OPTIONS                             *
  ***************************************************************************/
 /** @name Thread Options */ /**@{*/
+/**
+ * @def CFG_THR_BUDGET_CLEANUP
+ * @brief Most #JOB_CLASS_CLEANUP tasks the WorkerPool runs at once.
+ * @par Default: 1
+ */
+#define CFG_THR_BUDGET_CLEANUP 1
+
+/**
+ * @def CFG_THR_QUEUE_REPORT
+ * @brief Number of seconds between logging how long tasks of each #JOB_CLASS waited on the WorkerPool.
+ * @par Default: 600
+ */
+#define CFG_THR_QUEUE_REPORT 600
+
 /**
  * @def CFG_THR_SLEEP
  * @brief The amount of time (in microseconds) to sleep a thread while waiting for work.
  * @par Default: 5
  */
 #define CFG_THR_SLEEP 5
+
+/**
+ * @def CFG_THR_WORKERS
+ * @brief Number of worker threads that jobs may split their work across.
+ * @par Default: 4
+ */
+#define CFG_THR_WORKERS 4
 /**@}*/
 
 #endif
@@ -0,0 +1,78 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file configfile.h
+ * @brief The ConfigFile class.
+ *
+ * This file contains the ConfigFile class and template functions.
+ */
+#ifndef DEC_CONFIGFILE_H
+#define DEC_CONFIGFILE_H
+
+using namespace std;
+
+/**
+ * @brief Settings loaded from a configuration file and nZEDb's config.php, reloaded on SIGHUP or when either file changes.
+ */
+class ConfigFile
+{
+    public:
+        const bool Changed();
+        const vector<string> gJobs();
+        const vector<string> gList( const string& key );
+        const uint_t gNumber( const string& key, const uint_t& fallback = 0 );
+        const string gPath();
+        const string gString( const string& key );
+        const bool Load( const string& path );
+
+        ConfigFile();
+        ~ConfigFile();
+
+    private:
+        /**
+         * @brief A setting the configuration file may hold.
+         */
+        struct Key
+        {
+            const char* name; /**< The name of the setting. */
+            const char* fallback; /**< The value used when the setting is absent. */
+            uint_t min; /**< The lowest value of a numeric setting, or for a string setting 1 if it may not be empty. */
+            uint_t max; /**< The highest value of a numeric setting, or 0 if the setting is a string. */
+        };
+
+        static const Key* Find( const string& name );
+        static const uint_t Number( const map<string,string>& values, const string& key );
+        static const bool Parse( const string& path, map<string,string>& values );
+        static const bool ParseNZEDb( const string& path, map<string,string>& values );
+        static void Signal( int number );
+        static const bool Validate( const map<string,string>& values );
+        const void Watch();
+
+        static volatile sig_atomic_t m_hangup; /**< Set by the SIGHUP handler, cleared once noticed. */
+        sint_t m_inotify; /**< The inotify instance watching the directories of the loaded files, or -1. */
+        vector<string> m_files; /**< The files the current settings were loaded from. */
+        string m_path; /**< The configuration file passed to Load(). */
+        map<string,string> m_values; /**< Every setting that was present, validated. */
+};
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file controlsocket.h
+ * @brief The ControlSocket class.
+ *
+ * This file contains the ControlSocket class and template functions.
+ */
+#ifndef DEC_CONTROLSOCKET_H
+#define DEC_CONTROLSOCKET_H
+
+using namespace std;
+
+/**
+ * @brief Serves operator commands and status over a Unix socket from the main loop, and keeps recent log lines for them.
+ */
+class ControlSocket
+{
+    public:
+        const void Monitor( const string& line );
+        const bool Open( const string& path );
+        const void Poll();
+
+        static const bool Request( const string& path, const string& command );
+
+        ControlSocket();
+        ~ControlSocket();
+
+    private:
+        /**
+         * @brief A connected control client.
+         */
+        struct Client
+        {
+            sint_t fd; /**< The socket. */
+            string input; /**< Bytes read that do not yet make up a whole command. */
+            string output; /**< Bytes waiting to be written. Guarded by m_mutex. */
+            bool follow; /**< Whether log lines are copied to the client as they are written. Guarded by m_mutex. */
+            uint_t dropped; /**< Log lines not copied since the client last caught up. Guarded by m_mutex. */
+            bool closed; /**< Whether the client hung up or asked to quit. */
+        };
+
+        const void Close();
+        const string Command( Client* client, const string& line );
+        const string Conns();
+        const string Jobs();
+        const string Status();
+        const string Trace( const uint_t& lines );
+
+        vector<Client*> m_clients; /**< Connected clients. Only changed by the main thread, with m_mutex held. */
+        sint_t m_fd; /**< The listening socket, or -1. */
+        deque<string> m_lines; /**< The most recent #CFG_CTL_TRACE log lines. Guarded by m_mutex. */
+        mutex m_mutex; /**< Guards m_lines and the output of each client against threads logging. */
+        string m_path; /**< Path of the listening socket. */
+        chrono::high_resolution_clock::time_point m_started; /**< When the server started, for uptime. */
+};
+
+#endif
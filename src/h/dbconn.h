@@ -37,16 +37,31 @@ using namespace std;
 class DBConn
 {
     public:
+        virtual const bool Connect( const uint_t& timeout ) = 0;
+        virtual const string Escape( const string& input ) = 0;
+        virtual const sint_t Execute( const string& query ) = 0;
+        virtual const sint_t Lag() = 0;
+        virtual const bool Ping() = 0;
         virtual const vector<vector<string>> Query( const string& query ) = 0;
+        virtual const bool Stream( const string& query, const function<bool( const vector<string>& )>& callback ) = 0;
+        const shared_ptr<const vector<vector<string>>> Cached( const string& query );
         const string gDatabase();
         const string gHost();
+        const sint_t gLag();
+        const thread::id gOwner();
         const string gPass();
+        const uint_t gRole();
         const string gSocket();
         const uint_t gStatus();
         const uint_t gType();
+        const chrono::high_resolution_clock::time_point gUsed();
         const string gUser();
+        const void sLag( const sint_t& lag );
+        const void sOwner( const thread::id& owner );
 
-        DBConn( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database );
+        static const bool ReadOnly( const string& query );
+
+        DBConn( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database, const uint_t& role = DBCONN_ROLE_PRIMARY );
         virtual ~DBConn();
 
     protected:
@@ -59,7 +74,11 @@ class DBConn
         string m_user; /**< Username to login to the database server with. */
         string m_pass; /**< Password to login to the database server with. */
         string m_database; /**< Database to access on the database server. */
-        uint_t m_status; /**< Callback to check if the thread made a successful connection. */
+        uint_t m_role; /**< Whether the server is the primary or a replica, from #DBCONN_ROLE. */
+        atomic<sint_t> m_lag; /**< Seconds a replica was last measured behind the primary, -1 if not replicating, or -2 if not yet measured. */
+        atomic<uint_t> m_status; /**< Callback to check if the thread made a successful connection. */
+        thread::id m_owner; /**< The thread the connector is reserved for, or a default id if none. Only changed with Main::Global::m_dbconn_mutex held. */
+        chrono::high_resolution_clock::time_point m_used; /**< When the connector was last reserved or released, to find those sitting idle. */
 };
 
 #endif
@@ -39,15 +39,20 @@ using namespace std;
 class DBConnMySQL : public DBConn
 {
     public:
+        const bool Connect( const uint_t& timeout );
+        const string Escape( const string& input );
+        const sint_t Execute( const string& query );
+        const sint_t Lag();
+        const bool Ping();
         const vector<vector<string>> Query( const string& query );
+        const bool Stream( const string& query, const function<bool( const vector<string>& )>& callback );
 
-        DBConnMySQL( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database );
+        DBConnMySQL( const uint_t& type, const string& host, const string& socket, const string& user, const string& pass, const string& database, const uint_t& role = DBCONN_ROLE_PRIMARY );
         ~DBConnMySQL();
 
     private:
-        const void Connect();
-
         MYSQL m_sql; /**< Connection to the MySQL database. */
+        bool m_init; /**< Whether m_sql was initialized and must be closed. */
         my_bool m_reconnect; /**< Determine if the handler will attempt to reconnect when disconnected. */
 };
 
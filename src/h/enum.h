@@ -31,18 +31,74 @@
 #ifndef DEC_ENUM_H
 #define DEC_ENUM_H
 
+/** @name ArchiveLister */ /**@{*/
+/**
+ * @enum ARCHIVE_STATUS
+ */
+enum ARCHIVE_STATUS
+{
+    ARCHIVE_STATUS_NEED      = 0, /**< More data is needed; see ArchiveLister::gOffset() and ArchiveLister::gNeed(). */
+    ARCHIVE_STATUS_LISTED    = 1, /**< Every header has been read. */
+    ARCHIVE_STATUS_PARTIAL   = 2, /**< Headers were read until the next could not be located, such as after a zip entry with a data descriptor. */
+    ARCHIVE_STATUS_ENCRYPTED = 3, /**< The headers or at least one file are encrypted. */
+    ARCHIVE_STATUS_UNLISTED  = 4, /**< The file list is compressed, as 7-Zip does by default, so only encryption could be checked. */
+    ARCHIVE_STATUS_UNKNOWN   = 5, /**< The data does not start with a known archive signature. */
+    ARCHIVE_STATUS_ERROR     = 6, /**< A header failed its CRC or could not be parsed. */
+    MAX_ARCHIVE_STATUS       = 7  /**< Safety limit for looping. */
+};
+
+/**
+ * @enum ARCHIVE_TYPE
+ */
+enum ARCHIVE_TYPE
+{
+    ARCHIVE_TYPE_NONE     = 0, /**< Not yet known. */
+    ARCHIVE_TYPE_RAR4     = 1, /**< RAR 1.5 to 4.x. */
+    ARCHIVE_TYPE_RAR5     = 2, /**< RAR 5.0 and later. */
+    ARCHIVE_TYPE_SEVENZIP = 3, /**< 7-Zip. */
+    ARCHIVE_TYPE_ZIP      = 4, /**< Zip, read through its local file headers. */
+    MAX_ARCHIVE_TYPE      = 5  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name Collator */ /**@{*/
+/**
+ * @enum COLLATOR_STAGE
+ */
+enum COLLATOR_STAGE
+{
+    COLLATOR_STAGE_NONE        = 0, /**< No flush is in progress. */
+    COLLATOR_STAGE_COLLECTIONS = 1, /**< Collection rows are being written. */
+    COLLATOR_STAGE_BINARIES    = 2, /**< Binary rows are being written. */
+    COLLATOR_STAGE_PARTS       = 3, /**< Part rows are being written. */
+    COLLATOR_STAGE_COUNTS      = 4, /**< Binary part counts and collection sizes are being recomputed from the stored rows. */
+    MAX_COLLATOR_STAGE         = 5  /**< Safety limit for looping. */
+};
+/**@}*/
+
 /** @name DBConn */ /**@{*/
+/**
+ * @enum DBCONN_ROLE
+ */
+enum DBCONN_ROLE
+{
+    DBCONN_ROLE_PRIMARY = 0, /**< Connector to the primary server, for reads and writes. */
+    DBCONN_ROLE_REPLICA = 1, /**< Connector to a replica, refusing anything but reads. */
+    MAX_DBCONN_ROLE     = 2  /**< Safety limit for looping. */
+};
+
 /**
  * @enum DBCONN_STATUS
  */
 enum DBCONN_STATUS
 {
-    DBCONN_STATUS_NONE  = 0, /**< A newly initialized connector. */
-    DBCONN_STATUS_ERROR = 1, /**< Connector failed to initialize or connect to the database. */
-    DBCONN_STATUS_READY = 2, /**< Connector successfully connected to the database and is available for work. */
-    DBCONN_STATUS_CLOSE = 3, /**< Connector is shutting down. */
-    DBCONN_STATUS_BUSY  = 4, /**< Connector is busy processing a task. */
-    MAX_DBCONN_STATUS   = 5  /**< Safety limit for looping. */
+    DBCONN_STATUS_NONE    = 0, /**< A newly initialized connector. */
+    DBCONN_STATUS_ERROR   = 1, /**< Connector failed to initialize or connect to the database. */
+    DBCONN_STATUS_READY   = 2, /**< Connector successfully connected to the database and is available for work. */
+    DBCONN_STATUS_CLOSE   = 3, /**< Connector is shutting down. */
+    DBCONN_STATUS_BUSY    = 4, /**< Connector is busy processing a task. */
+    DBCONN_STATUS_CONNECT = 5, /**< Connector is still connecting in the background. */
+    MAX_DBCONN_STATUS     = 6  /**< Safety limit for looping. */
 };
 
 /**
@@ -55,6 +111,134 @@ enum DBCONN_TYPE
 };
 /**@}*/
 
+/** @name FileIO */ /**@{*/
+/**
+ * @enum FILEIO_ENGINE
+ */
+enum FILEIO_ENGINE
+{
+    FILEIO_ENGINE_NONE     = 0, /**< Not yet opened. */
+    FILEIO_ENGINE_URING    = 1, /**< Batched io_uring submissions with registered buffers and direct descriptors. */
+    FILEIO_ENGINE_THREADS  = 2, /**< Blocking calls made by a few threads of its own, for kernels without io_uring. */
+    FILEIO_ENGINE_BLOCKING = 3, /**< Blocking calls made by the caller itself. */
+    MAX_FILEIO_ENGINE      = 4  /**< Safety limit for looping. */
+};
+
+/**
+ * @enum FILEIO_OP
+ */
+enum FILEIO_OP
+{
+    FILEIO_OP_OPEN  = 0, /**< Create or truncate the file. */
+    FILEIO_OP_WRITE = 1, /**< Write a chunk at the offset it was given when queued. */
+    FILEIO_OP_CLOSE = 2, /**< Close the file, removing it if anything before failed. */
+    MAX_FILEIO_OP   = 3  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name Job */ /**@{*/
+/**
+ * @enum JOB_CLASS
+ */
+enum JOB_CLASS
+{
+    JOB_CLASS_INGEST  = 0, /**< Header ingest, which loses articles that expire from the provider if it falls behind. Runs before anything else. */
+    JOB_CLASS_PROCESS = 1, /**< Turning collections into releases and improving them. */
+    JOB_CLASS_CLEANUP = 2, /**< Housekeeping that can always wait, held back entirely while the database is saturated. */
+    MAX_JOB_CLASS     = 3  /**< Safety limit for looping. */
+};
+
+/**
+ * @enum JOB_STATUS
+ */
+enum JOB_STATUS
+{
+    JOB_STATUS_IDLE    = 0, /**< Job is waiting for its interval to elapse. */
+    JOB_STATUS_RUNNING = 1, /**< Job is in the middle of a run. */
+    MAX_JOB_STATUS     = 2  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name JobFixNames */ /**@{*/
+/**
+ * @enum FIXNAMES_SOURCE
+ */
+enum FIXNAMES_SOURCE
+{
+    FIXNAMES_SOURCE_PREDB = 0, /**< A candidate name or the MD5 in the current name matched PreDB. */
+    FIXNAMES_SOURCE_NFO   = 1, /**< A release name found in the NFO. */
+    FIXNAMES_SOURCE_FILES = 2, /**< A release name found in the file names from par2 or archive listings. */
+    MAX_FIXNAMES_SOURCE   = 3  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name JobRemoveCrap */ /**@{*/
+/**
+ * @enum CRAP_RULE
+ */
+enum CRAP_RULE
+{
+    CRAP_RULE_BLACKLIST   = 0,  /**< The name matches an active binaryblacklist regex of its group. */
+    CRAP_RULE_CODEC       = 1,  /**< A .wmv packaged with an executable "codec". */
+    CRAP_RULE_EXECUTABLE  = 2,  /**< Contains an .exe outside of the PC categories. */
+    CRAP_RULE_GIBBERISH   = 3,  /**< A name of 15 or more letters and digits only, with no NFO or archive contents. */
+    CRAP_RULE_HASHED      = 4,  /**< A run of 25 or more letters and digits in the name, with no NFO or archive contents. */
+    CRAP_RULE_HUGE        = 5,  /**< A single part larger than #CFG_REL_CRAP_HUGE. */
+    CRAP_RULE_INSTALLBIN  = 6,  /**< Contains an install.bin. */
+    CRAP_RULE_PASSWORDED  = 7,  /**< The name says the release is password protected. */
+    CRAP_RULE_PASSWORDURL = 8,  /**< Contains a password.url. */
+    CRAP_RULE_SAMPLE      = 9,  /**< A sample of less than #CFG_REL_CRAP_SAMPLE bytes posted on its own. */
+    CRAP_RULE_SCR         = 10, /**< Contains a .scr. */
+    CRAP_RULE_SHORT       = 11, /**< A name of 5 or fewer letters and digits only, with no NFO or archive contents. */
+    CRAP_RULE_SIZE        = 12, /**< A single part smaller than #CFG_REL_CRAP_SIZE. */
+    MAX_CRAP_RULE         = 13  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name NNTPConn */ /**@{*/
+/**
+ * @enum NNTPCONN_STATUS
+ */
+enum NNTPCONN_STATUS
+{
+    NNTPCONN_STATUS_NONE       = 0, /**< A newly initialized connection. */
+    NNTPCONN_STATUS_ERROR      = 1, /**< Connection failed or was lost. */
+    NNTPCONN_STATUS_CONNECTING = 2, /**< Waiting for the TCP connection to complete. */
+    NNTPCONN_STATUS_AUTH       = 3, /**< Waiting on the greeting or AUTHINFO exchange. */
+    NNTPCONN_STATUS_READY      = 4, /**< Connection is logged in and accepting commands. */
+    NNTPCONN_STATUS_CLOSE      = 5, /**< Connection is shutting down. */
+    MAX_NNTPCONN_STATUS        = 6  /**< Safety limit for looping. */
+};
+/**@}*/
+
+/** @name YEncDecoder */ /**@{*/
+/**
+ * @enum YENC_KERNEL
+ */
+enum YENC_KERNEL
+{
+    YENC_KERNEL_SCALAR = 0, /**< No vector unit available; every byte goes through the state machine. */
+    YENC_KERNEL_SSE2   = 1, /**< 16 bytes per step up to the next escape or line break, baseline on x86-64. */
+    YENC_KERNEL_SSSE3  = 2, /**< 16 bytes per step with escapes and line breaks handled in registers. */
+    YENC_KERNEL_AVX2   = 3, /**< As SSSE3, with 32 bytes per step through plain data. */
+    YENC_KERNEL_NEON   = 4, /**< 16 bytes per step up to the next escape or line break on AArch64. */
+    MAX_YENC_KERNEL    = 5  /**< Safety limit for looping. */
+};
+
+/**
+ * @enum YENC_STATE
+ */
+enum YENC_STATE
+{
+    YENC_STATE_LINE        = 0, /**< At the start of a line. */
+    YENC_STATE_LINE_ESCAPE = 1, /**< Read '=' at the start of a line; either an escape or a =y header. */
+    YENC_STATE_HEADER      = 2, /**< Collecting a =ybegin, =ypart or =yend line. */
+    YENC_STATE_ESCAPE      = 3, /**< Read '=' within a line; the next byte is escaped. */
+    YENC_STATE_DATA        = 4, /**< Within a line of data. */
+    MAX_YENC_STATE         = 5  /**< Safety limit for looping. */
+};
+/**@}*/
+
 /** @name Utils */ /**@{*/
 /**
  * @enum UTILS_OPTS
@@ -72,6 +256,17 @@ enum UTILS_OPTS
     MAX_UTILS         = 8  /**< Safety limit for looping. */
 };
 
+/**
+ * @enum UTILS_LEVEL
+ */
+enum UTILS_LEVEL
+{
+    UTILS_LEVEL_ERROR = 0, /**< Only lines flagged #UTILS_TYPE_ERROR are logged. */
+    UTILS_LEVEL_INFO  = 1, /**< Every line is logged. The default. */
+    UTILS_LEVEL_DEBUG = 2, /**< Every line is logged with its caller, as if flagged #UTILS_DEBUG. */
+    MAX_UTILS_LEVEL   = 3  /**< Safety limit for looping. */
+};
+
 /**
  * @def UTILS_IS_DIRECTORY
  */
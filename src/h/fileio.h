@@ -0,0 +1,131 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file fileio.h
+ * @brief The FileIO class.
+ *
+ * This file contains the FileIO class and template functions.
+ */
+#ifndef DEC_FILEIO_H
+#define DEC_FILEIO_H
+
+using namespace std;
+
+/**
+ * @brief Writes whole files, by default from the calling thread, or in the background through io_uring or a few threads of its own.
+ */
+class FileIO
+{
+    public:
+        const void Abort( const uint_t& file );
+        const void Close( const uint_t& file, const function<void( const bool& )>& callback = nullptr );
+        const uint_t Create( const string& path );
+        const bool Finish( const uint_t& file );
+        const uint_t gEngine();
+        const string gEngineName();
+        const void Open( const string& engine );
+        const void Poll();
+        const void Write( const uint_t& file, const char* data, const uint_t& length );
+
+        static const void Benchmark( const string& directory, const uint_t& count, const uint_t& size );
+
+        FileIO();
+        ~FileIO();
+
+    private:
+        /**
+         * @brief One operation on a file, from the moment it is queued until it completes.
+         */
+        struct Request
+        {
+            uint_t file; /**< The id of the file, as returned by Create(). */
+            uint_t op; /**< What to do, from #FILEIO_OP. */
+            uint_t offset; /**< Where in the file a write starts. */
+            uint_t length; /**< Bytes to write. */
+            uint_t done; /**< Bytes written so far, when the kernel took less than asked. */
+            sint_t buffer; /**< The registered buffer holding the data, or -1 if it is held in data. */
+            string data; /**< The data, if no registered buffer was free or it did not fit one. */
+        };
+
+        /**
+         * @brief A file being written.
+         */
+        struct File
+        {
+            string path; /**< Where the file is written. */
+            sint_t fd; /**< The descriptor with the threads engine, the direct descriptor slot with io_uring, or -1 if not open. */
+            uint_t offset; /**< Where the next write queued goes. */
+            uint_t inflight; /**< Operations handed to the kernel or a thread and not yet complete. */
+            bool opened; /**< Whether the open has completed, successfully or not. */
+            bool created; /**< Whether the open succeeded, making the file ours to remove. */
+            bool closing; /**< Whether the close has been queued. */
+            bool failed; /**< Whether any operation failed, or the file was aborted; it is removed once closed. */
+            bool finished; /**< Whether the close has completed, leaving the result for Finish(). */
+            bool abandoned; /**< Whether nobody is waiting on the result, so the record goes once closed. */
+            deque<Request*> waiting; /**< Operations not yet handed over, in the order they were queued. */
+            function<void( const bool& )> callback; /**< Called from Poll() with the result once closed, if given. */
+        };
+
+        const void Complete( Request* request, const sint_t& result );
+        const void Direct( Request* request, unique_lock<mutex>& lock, const char* data = NULL );
+        const void Dispatch( const uint_t& file );
+        static const sint_t Perform( const Request* request, const string& path, const sint_t& fd, const bool& failed, const char* data );
+        const bool Prepare( Request* request );
+        const void Progress( unique_lock<mutex>& lock );
+        const void Reap( const bool& wait );
+        const bool Setup();
+        const void Submit();
+        const void Teardown();
+        const void Work( const uint_t& index );
+
+        uint_t m_engine; /**< How files are written, from #FILEIO_ENGINE. */
+        map<uint_t,File> m_files; /**< Files not yet closed, or closed and waiting on Finish(), by id. Guarded by m_mutex. */
+        uint_t m_next; /**< The id given to the next file created. */
+        mutex m_mutex; /**< Guards everything but the completion queue. */
+        condition_variable m_cond; /**< Signalled whenever operations complete. */
+        mutex m_reap; /**< Held by the one thread reading the completion queue. */
+        deque<pair<function<void( const bool& )>,bool>> m_done; /**< Callbacks of files closed since the last Poll(), with their results. Guarded by m_mutex. */
+        uint_t m_queued; /**< Bytes queued to be written and not yet written. Guarded by m_mutex. */
+
+        sint_t m_ring; /**< The io_uring descriptor, or -1 if not set up. */
+        io_uring_params m_params; /**< What the kernel reported when the ring was set up. */
+        void* m_sq_ring; /**< The mapped submission queue ring. */
+        uint_t m_sq_length; /**< Bytes mapped for the submission queue ring. */
+        void* m_cq_ring; /**< The mapped completion queue ring, which may share the mapping of the submission queue. */
+        uint_t m_cq_length; /**< Bytes mapped for the completion queue ring. */
+        io_uring_sqe* m_sqes; /**< The mapped submission queue entries. */
+        uint_t m_prepared; /**< Entries added to the submission queue and not yet submitted. Guarded by m_mutex. */
+        uint_t m_inflight; /**< Entries submitted and not yet reaped. Guarded by m_mutex. */
+        vector<sint_t> m_slots; /**< Free direct descriptor slots. Guarded by m_mutex. */
+        set<uint_t> m_held; /**< Files with an operation held back for want of room in the rings, oldest first. Guarded by m_mutex. */
+        set<uint_t> m_starved; /**< Files waiting on a free slot to be opened into, oldest first. Guarded by m_mutex. */
+        uint8_t* m_buffers; /**< The registered buffers, #CFG_FIO_BUFFER_SIZE bytes each, or NULL if none could be registered. */
+        vector<sint_t> m_free; /**< Free registered buffers. Guarded by m_mutex. */
+
+        vector<thread> m_threads; /**< Threads of the threads engine. */
+        vector<deque<Request*>> m_work; /**< Operations for each thread, which takes every operation on a file so they run in order. Guarded by m_mutex. */
+        condition_variable m_work_cond; /**< Signalled when an operation is queued for a thread. */
+        bool m_shutdown; /**< Tells the threads to exit once their queues are empty. Guarded by m_mutex. */
+};
+
+#endif
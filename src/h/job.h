@@ -0,0 +1,78 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job.h
+ * @brief The Job class.
+ *
+ * This file contains the Job class and template functions.
+ */
+#ifndef DEC_JOB_H
+#define DEC_JOB_H
+
+using namespace std;
+
+/**
+ * @brief Functions and common interface to all scheduled native jobs.
+ */
+class Job
+{
+    public:
+        virtual const void Run() = 0;
+        virtual const void Update();
+        const uint_t gClass();
+        const uint_t gDefault();
+        const bool gEnabled();
+        const uint_t gInterval();
+        const chrono::high_resolution_clock::time_point gLastFinish();
+        const chrono::high_resolution_clock::time_point gLastStart();
+        const string gName();
+        const uint_t gRuns();
+        const uint_t gStatus();
+        const void Poll();
+        const void sEnabled( const bool& enabled );
+        const void sInterval( const uint_t& interval );
+        const void Trigger();
+
+        Job( const string& name, const uint_t& interval, const uint_t& cls = JOB_CLASS_PROCESS );
+        virtual ~Job();
+
+    protected:
+        const void Finish();
+        const void sStatus( const uint_t& status );
+
+    private:
+        string m_name; /**< Name of the job as it appears in logs. */
+        uint_t m_class; /**< How urgent the work of the job is, from #JOB_CLASS. */
+        uint_t m_default; /**< The interval the job was constructed with, restored when the configuration stops overriding it. */
+        chrono::high_resolution_clock::time_point m_deferred; /**< When a due run was first held back because the database was saturated, or the epoch if none is. */
+        bool m_enabled; /**< Whether the job may start new runs. */
+        uint_t m_generation; /**< The Cluster generation the current run began in, so no shard it may use is released under it. */
+        uint_t m_interval; /**< Seconds to wait between the end of one run and the start of the next. */
+        chrono::high_resolution_clock::time_point m_last_finish; /**< When the job last finished a run. */
+        chrono::high_resolution_clock::time_point m_last_start; /**< When the job last started a run. */
+        uint_t m_runs; /**< Number of runs started since the server started. */
+        uint_t m_status; /**< The current status of the job from #JOB_STATUS. */
+        bool m_triggered; /**< Whether the next run was asked for ahead of its interval. */
+};
+
+#endif
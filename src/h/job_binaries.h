@@ -0,0 +1,105 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_binaries.h
+ * @brief The JobBinaries class.
+ *
+ * This file contains the JobBinaries class and template functions.
+ */
+#ifndef DEC_JOBBINARIES_H
+#define DEC_JOBBINARIES_H
+
+#include "collectionregex.h"
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobBinaries extends the Job class to fetch new headers for every active group, replacing update_binaries.php.
+ */
+class JobBinaries : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobBinaries( const string& host, const string& port, const string& user, const string& pass );
+        ~JobBinaries();
+
+    private:
+        /**
+         * @brief Progress of one active group during a run.
+         */
+        struct Group
+        {
+            uint_t id; /**< The id of the group in the groups table. */
+            string name; /**< The name of the group. */
+            uint_t last_record; /**< The last article fetched by a previous run. */
+            uint_t target; /**< The last article this run will fetch, 0 until the GROUP response arrives. */
+            uint_t failed; /**< The first article of the lowest range that could not be fetched, 0 if none. */
+            uint_t done; /**< The last article such that every range of this run up to it was fetched. */
+            uint_t saved; /**< The last article checkpointed to the StateFile. */
+            map<uint_t,uint_t> fetched; /**< Ranges fetched beyond done, by first article, to their last. */
+        };
+
+        /**
+         * @brief A range of articles fetched with a single XOVER / XZVER command.
+         */
+        struct Range
+        {
+            uint_t group; /**< Index into m_groups. */
+            uint_t first; /**< First article number of the range. */
+            uint_t last; /**< Last article number of the range. */
+            uint_t attempts; /**< Number of times the range has been lost or rejected. */
+        };
+
+        const void Advance( const Range& range );
+        const void Checkpoint();
+        const void Complete();
+        const string Decompress( const string& body );
+        const void Dispatch( NNTPConn* conn );
+        const void Fetched( NNTPConn* conn, Range range, const bool& xzver, const uint_t& code, const string& body );
+        const time_t ParseDate( const string& input );
+        const void Probed( NNTPConn* conn, const uint_t& group, const uint_t& code, const string& line );
+        const void Retry( Range range );
+        const void Store( const uint_t& group, const string& body );
+
+        string m_host; /**< Hostname of the usenet provider. */
+        string m_port; /**< Port of the usenet provider. */
+        string m_user; /**< Username for the usenet provider. */
+        string m_pass; /**< Password for the usenet provider. */
+        vector<NNTPConn*> m_conns; /**< Connections used by the current run. */
+        uint_t m_reconnects; /**< Connections replaced during the current run. */
+        vector<Group> m_groups; /**< Active groups for the current run. */
+        deque<uint_t> m_probes; /**< Indexes into m_groups still waiting to send GROUP. */
+        deque<Range> m_ranges; /**< Ranges waiting to be sent. */
+        uint_t m_outstanding; /**< Commands sent by this job that have not completed. */
+        CollectionRegex m_regexes; /**< Collection regexes, reloaded at the start of each run. */
+        Collator* m_collator; /**< Groups parsed headers into binaries and collections before they are written. */
+        uint_t m_articles; /**< Headers parsed during the current run. */
+        uint_t m_bytes; /**< Overview bytes received during the current run. */
+        chrono::high_resolution_clock::time_point m_checkpoint; /**< When the last article of each group was last checkpointed. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+};
+
+#endif
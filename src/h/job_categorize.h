@@ -0,0 +1,64 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_categorize.h
+ * @brief The JobCategorize class.
+ *
+ * This file contains the JobCategorize class and template functions.
+ */
+#ifndef DEC_JOBCATEGORIZE_H
+#define DEC_JOBCATEGORIZE_H
+
+#include "categorizer.h"
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobCategorize extends the Job class to categorize new and renamed releases in parallel, replacing the categorization step of the PHP release processing.
+ */
+class JobCategorize : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobCategorize();
+        ~JobCategorize();
+
+    private:
+        const uint_t Batch( DBConn* db, uint_t& last, const uint_t& end );
+        const void Range( const uint_t& first, const uint_t& last );
+        const void Verify();
+
+        Categorizer* m_categorizer; /**< The compiled rules, shared read only by every task. */
+        bool m_loaded; /**< Whether m_categorizer has been loaded. */
+        string m_rules; /**< The rules file m_categorizer was loaded from. */
+        time_t m_modified; /**< When the rules file was last modified as of loading it. */
+        bool m_verified; /**< Whether the loaded rules were checked against recorded releases. */
+        atomic<uint_t> m_outstanding; /**< Range tasks queued or running on the worker pool. */
+        atomic<uint_t> m_categorized; /**< Releases categorized during the current run. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+};
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_fixnames.h
+ * @brief The JobFixNames class.
+ *
+ * This file contains the JobFixNames class and template functions.
+ */
+#ifndef DEC_JOBFIXNAMES_H
+#define DEC_JOBFIXNAMES_H
+
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobFixNames extends the Job class to rename releases from their NFOs, file names, and PreDB in a single pass, replacing fixReleaseNames.php.
+ */
+class JobFixNames : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobFixNames();
+        ~JobFixNames();
+
+    private:
+        /**
+         * @brief A release being checked for a better name.
+         */
+        struct Release
+        {
+            uint_t id; /**< The id of the release in the releases table. */
+            string searchname; /**< The current search name. */
+            bool other; /**< Whether the release is in one of #CFG_REL_FIX_OTHER. */
+            vector<string> nfo; /**< Release names found in the NFO, in order. */
+            vector<string> files; /**< Release names found in the file names, in order. */
+            string name; /**< The new name, empty if none was found. */
+            uint_t pre; /**< The id of the matching PreDB entry, 0 if none. */
+            uint_t source; /**< Where the new name came from, from #FIXNAMES_SOURCE. */
+            bool has_nfo; /**< Whether the release has an NFO that was checked. */
+            bool has_files; /**< Whether the file names of the release were checked. */
+        };
+
+        const void Apply( DBConn* db, const vector<Release>& releases );
+        const uint_t Batch( DBConn* db, uint_t& last, const uint_t& end );
+        static const void Candidates( const string& text, vector<string>& names );
+        static const string Pending();
+        const void Range( const uint_t& first, const uint_t& last );
+
+        atomic<uint_t> m_outstanding; /**< Range tasks queued or running on the worker pool. */
+        mutex m_mutex; /**< Guards the statistics below, which every range task updates. */
+        uint_t m_checked; /**< Releases checked during the current run. */
+        uint_t m_renamed[MAX_FIXNAMES_SOURCE]; /**< Releases renamed during the current run, by source. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+};
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_optimize.h
+ * @brief The JobOptimize class.
+ *
+ * This file contains the JobOptimize class and template functions.
+ */
+#ifndef DEC_JOBOPTIMIZE_H
+#define DEC_JOBOPTIMIZE_H
+
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobOptimize extends the Job class to rebuild fragmented tables one at a time while the server is quiet, replacing optimize_db.php.
+ */
+class JobOptimize : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobOptimize();
+        ~JobOptimize();
+
+    private:
+        const bool Busy( bool& quiet, string& unknown );
+        const void Optimize( const string& table );
+
+        atomic<uint_t> m_after; /**< Free bytes left in the table once rebuilt. */
+        uint_t m_before; /**< Free bytes in the table before it was rebuilt. */
+        unordered_map<string,chrono::high_resolution_clock::time_point> m_done; /**< When each table was last rebuilt. */
+        atomic<bool> m_running; /**< Whether a table is being rebuilt on the worker pool. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current rebuild started. */
+        string m_table; /**< The table being rebuilt. */
+        chrono::high_resolution_clock::time_point m_waiting; /**< When a table first needed rebuilding but the server was busy, or the epoch if none is waiting. */
+};
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_predbmatch.h
+ * @brief The JobPreDBMatch class.
+ *
+ * This file contains the JobPreDBMatch class and template functions.
+ */
+#ifndef DEC_JOBPREDBMATCH_H
+#define DEC_JOBPREDBMATCH_H
+
+#include "job.h"
+#include "trigramindex.h"
+
+using namespace std;
+
+/**
+ * @brief JobPreDBMatch extends the Job class to match releases to PreDB titles through an in memory TrigramIndex, replacing predbftmatch.php.
+ */
+class JobPreDBMatch : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobPreDBMatch();
+        ~JobPreDBMatch();
+
+    private:
+        const uint_t Batch( DBConn* reader, DBConn* db, const TrigramIndex& index, uint_t& last, const uint_t& end );
+        const void Load();
+        const void Range( const TrigramIndex& index, const uint_t& first, const uint_t& last );
+        const void Split( const TrigramIndex& index, const uint_t& first, const uint_t& last );
+
+        TrigramIndex m_fresh; /**< Only the PreDB rows added this run, for releases already checked against the rest. */
+        TrigramIndex m_index; /**< Every PreDB row loaded so far. */
+        atomic<uint_t> m_checked; /**< Releases checked during the current run. */
+        atomic<uint_t> m_matched; /**< Releases matched during the current run. */
+        atomic<uint_t> m_outstanding; /**< Load and range tasks queued or running on the worker pool. */
+        uint_t m_predb_last; /**< The highest predb id in m_index. */
+        uint_t m_predb_matched; /**< The highest predb id every release up to m_release_last was checked against by a finished run. */
+        uint_t m_release_last; /**< The highest release id checked against all of m_index. */
+        string m_shards; /**< The Cluster condition releases were read with, so a change of shards is noticed. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+};
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_releases.h
+ * @brief The JobReleases class.
+ *
+ * This file contains the JobReleases class and template functions.
+ */
+#ifndef DEC_JOBRELEASES_H
+#define DEC_JOBRELEASES_H
+
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobReleases extends the Job class to turn complete collections into releases and NZBs, replacing update_releases.php.
+ */
+class JobReleases : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobReleases();
+        ~JobReleases();
+
+    private:
+        /**
+         * @brief A complete collection being turned into a release.
+         */
+        struct Collection
+        {
+            uint_t id; /**< The id of the collection in the collections table. */
+            string subject; /**< The subject of the collection. */
+            string from; /**< The poster. */
+            string date; /**< When the collection was posted, as a DATETIME. */
+            time_t posted; /**< When the collection was posted. */
+            time_t complete; /**< When the last part arrived. */
+            uint_t files; /**< Number of binaries received. */
+            uint_t size; /**< Sum of the binary sizes. */
+            uint_t parts; /**< Parts received across all binaries. */
+            uint_t total; /**< Parts expected across all binaries. */
+            string guid; /**< The guid of the release. */
+            string nzb; /**< Path of the NZB written for the release. */
+        };
+
+        /**
+         * @brief A binary of a collection being turned into a release.
+         */
+        struct Binary
+        {
+            uint_t id; /**< The id of the binary in the binaries table. */
+            uint_t collection; /**< Index into the batch of the collection the binary belongs to. */
+            string name; /**< The subject of the binary without its part counter. */
+            uint_t total; /**< The number of parts the binary should have. */
+        };
+
+        const uint_t Assemble( DBConn* db, const uint_t& group, const string& name );
+        const void Group( const uint_t& group, const string& name );
+        static const string Name( const string& subject );
+        const bool Nzb( DBConn* db, vector<Collection>& collections, const vector<Binary>& binaries, const string& ids, const string& group );
+        const string Path( const string& guid );
+
+        atomic<uint_t> m_outstanding; /**< Group tasks queued or running on the worker pool. */
+        mutex m_mutex; /**< Guards the statistics below, which every group task updates. */
+        uint_t m_collections; /**< Collections turned into releases during the current run. */
+        double m_latency_max; /**< Longest time in seconds from a collection completing to its release being committed. */
+        double m_latency_total; /**< Sum of the latencies of every release in the current run. */
+        uint_t m_failed; /**< Batches rolled back during the current run. */
+        string m_nzb_path; /**< The nzbpath setting of nZEDb. */
+        uint_t m_split_level; /**< The nzbsplitlevel setting of nZEDb. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_removecrap.h
+ * @brief The JobRemoveCrap class.
+ *
+ * This file contains the JobRemoveCrap class and template functions.
+ */
+#ifndef DEC_JOBREMOVECRAP_H
+#define DEC_JOBREMOVECRAP_H
+
+#include "job.h"
+
+using namespace std;
+
+/**
+ * @brief JobRemoveCrap extends the Job class to check recent releases against every crap rule in one scan and delete those flagged, replacing removeCrapReleases.php.
+ */
+class JobRemoveCrap : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobRemoveCrap( const bool& dryrun = false );
+        ~JobRemoveCrap();
+
+    private:
+        /**
+         * @brief A batch of releases held one column per field so each rule runs as a tight loop over the columns it needs.
+         */
+        struct Batch
+        {
+            vector<uint_t> id; /**< The id of each release in the releases table. */
+            vector<uint_t> size; /**< Total bytes. */
+            vector<uint_t> parts; /**< Value of totalpart. */
+            vector<uint_t> category; /**< Value of categoryid. */
+            vector<uint8_t> bare; /**< 1 if there is no NFO and no archive contents to back the name up. */
+            vector<uint8_t> pc; /**< 1 if the release is in a PC category, where executables are expected. */
+            vector<uint_t> group; /**< Index into m_groups. */
+            vector<string> name; /**< The search name. */
+            vector<string> guid; /**< The guid, which names the NZB. */
+            vector<uint32_t> files; /**< CRAP_RULE bits taken from the file names, plus #FILE_WMV. */
+            vector<uint32_t> hits; /**< CRAP_RULE bits of the rules that flagged the release. */
+        };
+
+        /**
+         * @brief A compiled row of the binaryblacklist table.
+         */
+        struct Blacklist
+        {
+            regex group; /**< Matches the names of the groups the rule applies to. */
+            regex pattern; /**< The name regex. */
+        };
+
+        static const uint32_t FILE_WMV = 1u << MAX_CRAP_RULE; /**< Marks a release that contains a .wmv. */
+
+        static const uint_t Alnum( const string& name );
+        const void Delete( DBConn* db, const Batch& batch );
+        const void Evaluate( Batch& batch );
+        const uint_t Load( DBConn* db, Batch& batch, const uint_t& last );
+        const void Scan();
+
+        vector<Blacklist> m_blacklist; /**< Active blacklist rules, loaded at the start of each run. */
+        uint_t m_deleted; /**< Releases deleted during the current run. */
+        bool m_dryrun; /**< Report what would be deleted without deleting anything. */
+        vector<string> m_groups; /**< Names of the groups seen during the current run. */
+        vector<vector<uint_t>> m_group_rules; /**< Indices into m_blacklist that apply to each group of m_groups. */
+        uint_t m_hits[MAX_CRAP_RULE]; /**< Releases flagged by each rule during the current run. */
+        string m_nzb_path; /**< The nzbpath setting of nZEDb. */
+        atomic<uint_t> m_outstanding; /**< Scan tasks queued or running on the worker pool. */
+        uint_t m_scanned; /**< Releases checked during the current run. */
+        uint_t m_split_level; /**< The nzbsplitlevel setting of nZEDb. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+        double m_time[MAX_CRAP_RULE]; /**< Seconds spent evaluating each rule during the current run. */
+};
+
+#endif
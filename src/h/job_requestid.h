@@ -0,0 +1,66 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_requestid.h
+ * @brief The JobRequestID class.
+ *
+ * This file contains the JobRequestID class and template functions.
+ */
+#ifndef DEC_JOBREQUESTID_H
+#define DEC_JOBREQUESTID_H
+
+#include "job.h"
+#include "requestidcache.h"
+
+using namespace std;
+
+/**
+ * @brief JobRequestID extends the Job class to name releases from the request ids in their subjects, replacing requestid.php.
+ */
+class JobRequestID : public Job
+{
+    public:
+        const void Run();
+        const void Update();
+
+        JobRequestID();
+        ~JobRequestID();
+
+    private:
+        const uint_t Batch( DBConn* db, const uint_t& group, const string& name, uint_t& last );
+        const void Group( const uint_t& group, const string& name );
+        const void Write( DBConn* db, const vector<pair<uint_t,RequestIDCache::Result>>& found, const vector<pair<uint_t,sint_t>>& status );
+
+        static const uint_t Extract( const string& name );
+
+        RequestIDCache m_cache; /**< Results kept between runs, shared by every group's task. */
+        atomic<uint_t> m_checked; /**< Releases checked during the current run. */
+        atomic<uint_t> m_found; /**< Releases named during the current run. */
+        atomic<uint_t> m_local; /**< Request ids resolved from predb during the current run. */
+        atomic<uint_t> m_outstanding; /**< Group tasks queued or running on the worker pool. */
+        atomic<uint_t> m_remote; /**< Request ids resolved by the web service during the current run. */
+        chrono::high_resolution_clock::time_point m_start; /**< When the current run started. */
+        string m_url; /**< The request_url setting, empty to resolve from predb only. */
+};
+
+#endif
@@ -40,4 +40,11 @@ using namespace std;
  */
 extern vector<DBConn*> dbconn_list;
 
+/**
+ * @var job_list
+ * @brief All native jobs that are scheduled within the server.
+ * @param Job* A pointer to a Job object in memory.
+ */
+extern vector<Job*> job_list;
+
 #endif
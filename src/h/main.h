@@ -47,14 +47,51 @@ namespace Main
             Global();
             ~Global();
 
+            Cluster* m_cluster; /**< Leases on the shards of the work this instance does, when several share the database. */
+            ConfigFile* m_config; /**< Settings from the configuration file, or the defaults if none was given. */
+            ControlSocket* m_control; /**< Operator commands and status over a Unix socket, and a copy of every log line for it. */
+            chrono::high_resolution_clock::time_point m_dbconn_checked; /**< When idle connectors were last health checked. */
+            map<string,uint_t> m_dbconn_failures; /**< Failed connects in a row to each host:socket. Guarded by m_dbconn_mutex. */
+            condition_variable m_dbconn_freed; /**< Signalled when a connector is released or finishes connecting, for threads in Main::WaitDBConn(). */
+            uint_t m_dbconn_misses; /**< Times Main::AcquireDBConn() found no connector free since the last Main::PollDBConn(). Guarded by m_dbconn_mutex. */
+            mutex m_dbconn_mutex; /**< Guards reserving DBConn objects for threads and removing them from dbconn_list. */
+            chrono::high_resolution_clock::time_point m_dbconn_opened; /**< When the pool last opened connectors, to limit how fast it grows. */
+            chrono::high_resolution_clock::time_point m_dbconn_starved; /**< When threads started waiting for a connector, or the epoch if none are. */
+            bool m_dbconn_saturated; /**< Whether the pool is at db.pool.max and threads are still kept waiting for a connector. */
+            map<string,chrono::high_resolution_clock::time_point> m_dbconn_retry; /**< When each host:socket that failed to connect may be tried again. Guarded by m_dbconn_mutex. */
+            uint_t m_dbconn_released; /**< Counts connectors released or connected, so a thread in Main::WaitDBConn() can tell it missed none. Guarded by m_dbconn_mutex. */
+            uint_t m_dbconn_target; /**< The number of connectors the pool is sized to, between db.pool.min and db.pool.max. */
+            uint_t m_dbconn_waiting; /**< Threads blocked in Main::WaitDBConn(). Guarded by m_dbconn_mutex. */
+            chrono::high_resolution_clock::time_point m_dbconn_wanted[MAX_JOB_CLASS]; /**< When a thread of each #JOB_CLASS last found no connector free, or the epoch once it got one. Guarded by m_dbconn_mutex. */
+            FileIO* m_fileio; /**< Writes NZBs and other output without holding up the threads producing it. */
+            atomic<uint_t> m_log_level; /**< How much is logged, from #UTILS_LEVEL. */
+            QueryCache* m_query_cache; /**< Results of reads from small, rarely changing tables, shared by every thread. */
+            chrono::high_resolution_clock::time_point m_replica_checked; /**< When replica lag was last measured. */
+            uint_t m_replica_lag; /**< The db.replica.lag setting, copied for threads that must not read the configuration. Guarded by m_dbconn_mutex. */
+            set<string> m_replica_probes; /**< The host:port of each replica whose lag is being measured. Guarded by m_dbconn_mutex. */
             vector<DBConn*>::iterator m_next_dbconn; /**< Used as the next iterator in all loops dealing with DBConn objects to prevent nested processing loop problems. */
             bool m_shutdown; /**< Control server shutdown. */
+            StateFile* m_state; /**< Checkpoints that let jobs resume where they stopped after a restart. */
+            static volatile sig_atomic_t m_terminate; /**< Set by the SIGTERM and SIGINT handler for Main::Update() to notice. */
             chrono::high_resolution_clock::time_point m_time_current; /**< Current time from the host OS. */
+            Topology* m_topology; /**< The CPUs and NUMA nodes of the host, and which of them each thread runs on. */
+            WorkerPool* m_workers; /**< Threads that jobs may split their work across. */
     };
 
-    const void Startup( const string& config = "" );
+    DBConn* AcquireDBConn( const uint_t& role = DBCONN_ROLE_PRIMARY );
+    const void Configure();
+    const void OpenDBConn( const string& key, const uint_t& role );
+    const void RecordLag( const string& key, const sint_t& lag );
+    const void ReleaseDBConn( DBConn* db );
+    const bool Saturated();
+    void Signal( int number );
+    const void Startup( const string& config = "", const bool& server = true );
     const void Update();
+    DBConn* WaitDBConn( const uint_t& role = DBCONN_ROLE_PRIMARY );
+    const void PollConfig();
     const void PollDBConn();
+    const void PollJob();
+    const void PollReplicas();
 };
 
 #endif
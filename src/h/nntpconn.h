@@ -0,0 +1,98 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file nntpconn.h
+ * @brief The NNTPConn class.
+ *
+ * This file contains the NNTPConn class and template functions.
+ */
+#ifndef DEC_NNTPCONN_H
+#define DEC_NNTPCONN_H
+
+using namespace std;
+
+/**
+ * @typedef NNTPCallback
+ * @brief Invoked with the response code, status line and (dot-unstuffed) body of a command. A code of 0 means the connection was lost before a response arrived.
+ */
+typedef function<void( NNTPConn* conn, const uint_t& code, const string& line, const string& body )> NNTPCallback;
+
+/**
+ * @brief A single non-blocking connection to a usenet provider. Commands are pipelined up to #CFG_NNTP_PIPELINE deep and driven by Update() from the main loop.
+ */
+class NNTPConn
+{
+    public:
+        const string gGroup();
+        const string gHost();
+        const uint_t gPending();
+        const uint_t gStatus();
+        const bool gXZVER();
+        const void Send( const string& command, const bool& multi, const NNTPCallback& callback );
+        static const bool Serve( const string& port, const string& file );
+        const void sGroup( const string& group );
+        const void sXZVER( const bool& xzver );
+        const void Update();
+
+        NNTPConn( const string& host, const string& port, const string& user, const string& pass );
+        ~NNTPConn();
+
+    private:
+        /**
+         * @brief A command waiting to be sent or waiting on its response.
+         */
+        struct Command
+        {
+            string line; /**< The command, without CRLF. */
+            bool multi; /**< Whether a 2xx response carries a multi-line body. */
+            NNTPCallback callback; /**< Invoked once the response is complete. */
+        };
+
+        const void Connect();
+        const void Fail( const string& reason );
+        const void Login( const uint_t& code );
+        const void Parse();
+        const void Read();
+        static const void Replay( const sint_t& fd, const map<string,map<uint_t,string>>& groups );
+        const void Write();
+        const void sStatus( const uint_t& status );
+
+        string m_host; /**< Hostname of the usenet provider. */
+        string m_port; /**< Port or service name of the usenet provider. */
+        string m_user; /**< Username for AUTHINFO, empty to skip authentication. */
+        string m_pass; /**< Password for AUTHINFO. */
+        sint_t m_fd; /**< Socket descriptor of the connection. */
+        uint_t m_status; /**< The current status of the connection from #NNTPCONN_STATUS. */
+        string m_group; /**< The group selected by the most recently sent GROUP command. */
+        bool m_xzver; /**< Whether the provider is believed to support XZVER. */
+        deque<Command> m_queue; /**< Commands waiting to be sent. */
+        deque<Command> m_sent; /**< Commands sent and waiting on a response, in order. */
+        string m_input; /**< Received data not yet parsed. */
+        string m_output; /**< Data waiting to be written to the socket. */
+        bool m_body_open; /**< Whether a multi-line body is being received for m_sent.front(). */
+        uint_t m_code; /**< Response code of the multi-line body being received. */
+        string m_line; /**< Status line of the multi-line body being received. */
+        string m_body; /**< The multi-line body received so far. */
+};
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file nzbwriter.h
+ * @brief The NzbWriter class.
+ *
+ * This file contains the NzbWriter class and template functions.
+ */
+#ifndef DEC_NZBWRITER_H
+#define DEC_NZBWRITER_H
+
+using namespace std;
+
+/**
+ * @brief Streams NZBs to disk through gzip, holding no more than #CFG_MEM_NZB_CHUNK bytes of XML at a time regardless of how many segments they list.
+ */
+class NzbWriter
+{
+    public:
+        const void Abort();
+        const bool Close();
+        const bool File( const string& poster, const time_t& date, const string& subject, const uint_t& total, const string& group );
+        const bool Finish();
+        const uint_t gSegments();
+        const uint_t gWritten();
+        const bool Open( const string& path, const string& name );
+        const bool Segment( const uint_t& bytes, const uint_t& number, const string& messageid );
+
+        NzbWriter();
+        ~NzbWriter();
+
+    private:
+        const void Append( const char* data, const uint_t& length );
+        const void Append( const string& data );
+        const bool Deflate( const int& flush );
+        static const char* Entity( const char& c );
+        const void Escape( const string& data );
+        const void Reserve( const uint_t& length );
+
+        uint_t m_file; /**< The id the FileIO engine gave the file being written, or 0 if none is open. */
+        vector<uint_t> m_closed; /**< Files closed since the last Finish(), which may still be being written. */
+        string m_path; /**< Path of the file being written. */
+        z_stream m_zstream; /**< The gzip stream the XML is compressed through. */
+        vector<uint8_t> m_xml; /**< XML waiting to be compressed. */
+        uint_t m_xml_length; /**< Bytes of m_xml in use. */
+        vector<uint8_t> m_out; /**< Compressed output, handed to the FileIO engine each time it fills. */
+        bool m_in_file; /**< Whether a file element is open. */
+        bool m_valid; /**< False once compression or a write has failed. */
+        uint_t m_segments; /**< Segments written to the current NZB. */
+        uint_t m_written; /**< Compressed bytes written to the current NZB. */
+};
+
+#endif
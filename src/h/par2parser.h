@@ -0,0 +1,79 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file par2parser.h
+ * @brief The Par2Parser class.
+ *
+ * This file contains the Par2Parser class and template functions.
+ */
+#ifndef DEC_PAR2PARSER_H
+#define DEC_PAR2PARSER_H
+
+using namespace std;
+
+/**
+ * @brief Pulls file descriptions out of par2 data without a par2 library. Data may be fed in arbitrary chunks, such as each article body as the YEncDecoder produces it.
+ */
+class Par2Parser
+{
+    public:
+        /**
+         * @brief A file described by the recovery set.
+         */
+        struct File
+        {
+            string id; /**< The par2 file id as hex. */
+            string hash; /**< MD5 of the whole file as hex. */
+            string hash16k; /**< MD5 of the first 16KiB of the file as hex. */
+            uint_t size; /**< Size of the file in bytes. */
+            string name; /**< Name of the file. */
+        };
+
+        static const void Benchmark( const vector<string>& files );
+        const bool gComplete();
+        const uint_t gCorrupt();
+        const vector<File> gFiles();
+        const uint_t gPackets();
+        const string gSet();
+        const void Parse( const char* data, const uint_t& length );
+        const void Parse( const string& data );
+        const void Reset();
+
+        Par2Parser();
+        ~Par2Parser();
+
+    private:
+        const uint_t Scan( const uint8_t* data, const uint_t& length );
+
+        string m_pending; /**< The start of a packet cut off at the end of the last chunk. */
+        uint_t m_skip; /**< Bytes still to be skipped of a packet that is not needed. */
+        uint_t m_packets; /**< Packets found and, where needed, verified. */
+        uint_t m_corrupt; /**< Packet headers found with an impossible length or a bad MD5. */
+        string m_set; /**< The recovery set id as hex, from the first verified packet. */
+        vector<File> m_files; /**< Files described so far, in the order first seen. */
+        unordered_map<string,uint_t> m_index; /**< File id to its index in m_files, as every volume repeats the descriptions. */
+        vector<string> m_expected; /**< File ids in the recovery set according to the main packet. */
+        bool m_main; /**< Whether the main packet has been seen. */
+};
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file querycache.h
+ * @brief The QueryCache class.
+ *
+ * This file contains the QueryCache class and template functions.
+ */
+#ifndef DEC_QUERYCACHE_H
+#define DEC_QUERYCACHE_H
+
+using namespace std;
+
+/**
+ * @brief Shares the results of reads from small, rarely changing tables between every thread until they expire or one of our own writes touches the table.
+ */
+class QueryCache
+{
+    public:
+        const uint_t gHits();
+        const uint_t gMisses();
+        const void Invalidate( const string& query );
+        const shared_ptr<const vector<vector<string>>> Query( DBConn* db, const string& query );
+
+        QueryCache();
+        ~QueryCache();
+
+    private:
+        /**
+         * @brief A cached result and the tables it was read from.
+         */
+        struct Entry
+        {
+            shared_ptr<const vector<vector<string>>> result; /**< The result, shared with every caller. */
+            vector<string> tables; /**< The tables the query read, any of which being written drops the entry. */
+            chrono::steady_clock::time_point expires; /**< When the result must be read again. */
+        };
+
+        static const string Head( const string& query );
+        static const string Normalize( const string& query );
+        static const vector<string> Tables( const string& query );
+        static const uint_t TTL( const string& table );
+
+        unordered_map<string,Entry> m_entries; /**< Cached results by database and normalized query. */
+        unordered_map<string,uint_t> m_generations; /**< Writes seen per cached table, so a read that overlapped one is not stored. */
+        uint_t m_hits; /**< Queries answered from the cache. */
+        uint_t m_invalidated; /**< Entries dropped because our own writes touched their tables. */
+        uint_t m_misses; /**< Cacheable queries that had to be run. */
+        mutex m_mutex; /**< Guards every member. */
+        chrono::steady_clock::time_point m_reported; /**< When the hit rate was last logged. */
+};
+
+#endif
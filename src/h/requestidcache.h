@@ -0,0 +1,78 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file requestidcache.h
+ * @brief The RequestIDCache class.
+ *
+ * This file contains the RequestIDCache class and template functions.
+ */
+#ifndef DEC_REQUESTIDCACHE_H
+#define DEC_REQUESTIDCACHE_H
+
+using namespace std;
+
+/**
+ * @brief A least recently used cache of request id lookups, remembering misses as well as titles so neither is asked for again until it expires.
+ */
+class RequestIDCache
+{
+    public:
+        /**
+         * @brief The result of looking up one request id.
+         */
+        struct Result
+        {
+            bool found; /**< Whether the request id resolved to a title. */
+            uint_t pre; /**< The id of the predb row, 0 if the title came from the web service. */
+            string title; /**< The release name the request id resolved to. */
+        };
+
+        const bool Get( const string& group, const uint_t& request, Result& result );
+        const uint_t gHits();
+        const uint_t gMisses();
+        const uint_t gSize();
+        const void Put( const string& group, const uint_t& request, const Result& result );
+
+        RequestIDCache( const uint_t& capacity = CFG_MEM_MAX_REQID_CACHE );
+        ~RequestIDCache();
+
+    private:
+        /**
+         * @brief A cached result and when it stops being trusted.
+         */
+        struct Entry
+        {
+            string key; /**< The group and request id, as used in m_index. */
+            Result result; /**< The cached result. */
+            chrono::steady_clock::time_point expires; /**< When the result must be looked up again. */
+        };
+
+        uint_t m_capacity; /**< Most entries kept before the least recently used is dropped. */
+        uint_t m_hits; /**< Lookups answered from the cache. */
+        unordered_map<string,list<Entry>::iterator> m_index; /**< Position of each key within m_order. */
+        uint_t m_misses; /**< Lookups that were not cached or had expired. */
+        mutex m_mutex; /**< Guards every member, as each group's task shares the cache. */
+        list<Entry> m_order; /**< Entries from most to least recently used. */
+};
+
+#endif
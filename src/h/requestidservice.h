@@ -0,0 +1,54 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file requestidservice.h
+ * @brief The RequestIDService class.
+ *
+ * This file contains the RequestIDService class and template functions.
+ */
+#ifndef DEC_REQUESTIDSERVICE_H
+#define DEC_REQUESTIDSERVICE_H
+
+using namespace std;
+
+/**
+ * @brief Resolves batches of request ids through the web service named by the request_url setting, and can stand in for it offline.
+ */
+class RequestIDService
+{
+    public:
+        static const bool Fetch( const string& url, const string& group, const vector<uint_t>& requests, unordered_map<uint_t,string>& titles );
+        static const bool Serve( const string& port, const string& file );
+
+    private:
+        static const string Decode( const string& text );
+        static const string Encode( const string& text );
+        static const string Escape( const string& text );
+        static const bool Exchange( const sint_t& fd, const string& request, string& response );
+        static const string Parameter( const string& query, const string& name );
+
+        RequestIDService();
+        ~RequestIDService();
+};
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file statefile.h
+ * @brief The StateFile class.
+ *
+ * This file contains the StateFile class and template functions.
+ */
+#ifndef DEC_STATEFILE_H
+#define DEC_STATEFILE_H
+
+using namespace std;
+
+/**
+ * @brief A small memory mapped file of named checkpoints, so long running stages resume where they stopped after a restart.
+ */
+class StateFile
+{
+    public:
+        const void Erase( const string& key );
+        const uint_t Get( const string& key, const uint_t& fallback = 0 );
+        const bool Open( const string& path );
+        const void Set( const string& key, const uint_t& value );
+        const void Sync( const bool& force = false );
+
+        StateFile();
+        ~StateFile();
+
+    private:
+        /**
+         * @brief The start of the file, identifying its layout.
+         */
+        struct Header
+        {
+            char magic[8]; /**< Always "NZBSTATE". */
+            uint32_t version; /**< Layout of the file, bumped if it ever changes. */
+            uint32_t records; /**< Number of checkpoints the file has room for. */
+            uint32_t crc; /**< CRC-32 of the fields above. */
+            char padding[44]; /**< Pads the header to 64 bytes. */
+        };
+
+        /**
+         * @brief One copy of a checkpoint. Each checkpoint has two, and a write always replaces the older, so one torn by a crash leaves the other intact.
+         */
+        struct Record
+        {
+            char key[40]; /**< Name of the checkpoint, NUL terminated, or empty if the slot is free. */
+            uint64_t value; /**< The checkpoint. */
+            uint64_t sequence; /**< Increases with every write to the file, so the newer copy wins. */
+            uint32_t crc; /**< CRC-32 of the fields above, so a torn write is never read back. */
+            uint32_t padding; /**< Pads the record to 64 bytes. */
+        };
+
+        static const uint32_t Checksum( const void* data, const uint_t& length );
+        static const bool Valid( const Record& record );
+        const void Close();
+        const void Write( const uint_t& index, const string& key, const uint_t& value );
+
+        bool m_dirty; /**< Whether anything was written since the last sync. */
+        sint_t m_fd; /**< The open file, or -1. */
+        vector<uint_t> m_free; /**< Checkpoints with no name, available to new keys. */
+        Header* m_header; /**< The mapped file, or NULL if none is open. */
+        unordered_map<string,uint_t> m_index; /**< The checkpoint holding each key. */
+        mutex m_mutex; /**< Guards every member. */
+        string m_path; /**< Path of the open file. */
+        Record* m_records; /**< Two copies of each checkpoint, following the header. */
+        uint64_t m_sequence; /**< The sequence of the newest write. */
+        uint_t m_size; /**< Bytes mapped. */
+        chrono::high_resolution_clock::time_point m_synced; /**< When the file was last flushed to disk. */
+};
+
+#endif
@@ -33,18 +33,57 @@
 #define DEC_SYSINCLUDES_H
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdarg>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <set>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/mempolicy.h>
 #include <mysql/mysql.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
+
+#if defined( __x86_64__ )
+    #include <cpuid.h>
+    #include <immintrin.h>
+#elif defined( __aarch64__ )
+    #include <arm_neon.h>
+#endif
 
 #endif
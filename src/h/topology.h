@@ -0,0 +1,81 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file topology.h
+ * @brief The Topology class.
+ *
+ * This file contains the Topology class and template functions.
+ */
+#ifndef DEC_TOPOLOGY_H
+#define DEC_TOPOLOGY_H
+
+using namespace std;
+
+/**
+ * @brief The CPU and NUMA layout of the host, and the placement of the main loop and worker threads on it.
+ */
+class Topology
+{
+    public:
+        /**
+         * @brief The memory policy a thread had before Interleave(), for Restore().
+         */
+        struct Placement
+        {
+            sint_t mode; /**< The policy mode, or -1 if Interleave() left the policy alone. */
+            unsigned long mask; /**< The nodes the policy covered. */
+        };
+
+        const uint_t gCpus();
+        const uint_t gNodes();
+        const Placement Interleave();
+        const bool Load();
+        const void PinReactor();
+        const void PinWorker( const uint_t& index );
+        const void Restore( const Placement& placement );
+
+        static const vector<uint_t> ParseList( const string& list );
+
+        Topology();
+        ~Topology();
+
+    private:
+        /**
+         * @brief A NUMA node and the CPUs of it this process may run on.
+         */
+        struct Node
+        {
+            uint_t id; /**< The node number the kernel knows it by. */
+            vector<uint_t> cpus; /**< CPUs of the node in the affinity mask the process started with. */
+        };
+
+        static const bool Pin( const vector<uint_t>& cpus );
+        static const bool Policy( const sint_t& mode, const vector<uint_t>& nodes );
+        static const string Print( const vector<uint_t>& cpus );
+
+        bool m_loaded; /**< Whether a layout was read and threads are to be placed on it. */
+        vector<Node> m_nodes; /**< Nodes with at least one usable CPU. */
+        uint_t m_reactor; /**< The CPU the main loop, and the I/O threads it starts, run on. */
+};
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file trigramindex.h
+ * @brief The TrigramIndex class.
+ *
+ * This file contains the TrigramIndex class and template functions.
+ */
+#ifndef DEC_TRIGRAMINDEX_H
+#define DEC_TRIGRAMINDEX_H
+
+using namespace std;
+
+/**
+ * @brief An in memory inverted index from character trigrams to titles, finding the title most similar to a name without a database round trip.
+ */
+class TrigramIndex
+{
+    public:
+        const void Add( const uint_t& id, const string& title );
+        const void Clear();
+        const uint_t gBytes();
+        const uint_t gTitles();
+        const uint_t gTrigrams();
+        const bool Match( const string& name, const double& threshold, uint_t& id, string& title, double& score ) const;
+
+        TrigramIndex();
+        ~TrigramIndex();
+
+    private:
+        /**
+         * @brief The titles containing one trigram.
+         */
+        struct Posting
+        {
+            vector<uint8_t> data; /**< Title indices as variable length deltas, in ascending order, #BLOCK to a block. */
+            vector<pair<uint32_t,uint32_t>> skips; /**< The first title index of each block and the offset into data of the deltas that follow it. */
+            uint32_t count; /**< Number of titles in data. */
+            uint32_t last; /**< The last title index added, which the next delta is taken from. */
+        };
+
+        static const uint_t BLOCK = 128; /**< Title indices per block of a posting list. */
+
+        static const void Count( const Posting& posting, const vector<uint32_t>& candidates, vector<uint16_t>& counts );
+        static const uint_t Decode( const Posting& posting, const uint_t& block, vector<uint32_t>& list );
+        static const void Intersect( const uint32_t* candidates, const uint_t& count, const uint32_t* list, const uint_t& length, uint16_t* counts );
+        static const void Trigrams( const string& text, vector<uint32_t>& trigrams );
+
+        uint_t m_bytes; /**< Bytes used by every posting list. */
+        vector<uint_t> m_ids; /**< The caller's id of each title, by title index. */
+        unordered_map<uint32_t,Posting> m_postings; /**< Posting list of each trigram seen. */
+        vector<uint16_t> m_sizes; /**< Number of distinct trigrams in each title, by title index. */
+        vector<string> m_titles; /**< Each title as added, by title index. */
+};
+
+#endif
@@ -38,7 +38,12 @@ namespace Utils
 {
     #define FormatString( flags, fmt, ... ) _FormatString( PP_NARG( __VA_ARGS__ ), flags, _caller_, fmt, ##__VA_ARGS__ )
     #define Logger( flags, fmt, ... ) _Logger( PP_NARG( __VA_ARGS__ ), flags, _caller_, fmt, ##__VA_ARGS__ )
+    const void MD5( const uint8_t* data, const uint_t& length, uint8_t* digest );
+    const string MD5( const string& input );
     const uint_t NumChar( const string& input, const string& item );
+    const string SHA1( const string& input );
+    const string StrDateTime( const time_t& now = chrono::high_resolution_clock::to_time_t( chrono::high_resolution_clock::now() ) );
+    const string StrHex( const uint8_t* data, const uint_t& length );
     const string StrTime( const time_t& now = chrono::high_resolution_clock::to_time_t( chrono::high_resolution_clock::now() ) );
     const vector<string> StrTokens( const string& input, const bool& quiet = false );
     const string _FormatString( const uint_t& narg, const bitset<CFG_MEM_MAX_BITSET>& flags, const string& caller, const string& fmt, ... );
@@ -0,0 +1,81 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file workerpool.h
+ * @brief The WorkerPool class.
+ *
+ * This file contains the WorkerPool class and template functions.
+ */
+#ifndef DEC_WORKERPOOL_H
+#define DEC_WORKERPOOL_H
+
+using namespace std;
+
+/**
+ * @brief A fixed set of threads that run queued tasks for jobs whose work can be split, such as per group, most urgent #JOB_CLASS first.
+ */
+class WorkerPool
+{
+    public:
+        const uint_t gBudget( const uint_t& cls );
+        const uint_t gPending();
+        const uint_t gQueued( const uint_t& cls );
+        const uint_t gRunning( const uint_t& cls );
+        const uint_t gThreads();
+        const void sBudget( const uint_t& cls, const uint_t& budget );
+        const void Submit( const function<void()>& task, const uint_t& cls = JOB_CLASS_PROCESS );
+
+        static const uint_t gCurrent();
+        static const string gName( const uint_t& cls );
+
+        WorkerPool( const uint_t& threads );
+        ~WorkerPool();
+
+    private:
+        /**
+         * @brief A queued task and when it was queued.
+         */
+        struct Task
+        {
+            function<void()> run; /**< The task. */
+            chrono::high_resolution_clock::time_point queued; /**< When the task was submitted. */
+        };
+
+        const bool Next( uint_t& cls );
+        const void Report( const uint_t& cls, const chrono::high_resolution_clock::time_point& queued );
+        const void Work( const uint_t& index );
+
+        uint_t m_budget[MAX_JOB_CLASS]; /**< Most tasks of each class run at once. */
+        condition_variable m_cond; /**< Signalled when a task is queued or finished, or the pool shuts down. */
+        uint_t m_longest[MAX_JOB_CLASS]; /**< Longest wait (in milliseconds) of a task of each class since the last report. */
+        mutex m_mutex; /**< Guards every member but m_threads. */
+        chrono::high_resolution_clock::time_point m_reported; /**< When queue times were last logged. */
+        uint_t m_running[MAX_JOB_CLASS]; /**< Tasks of each class currently being run. */
+        bool m_shutdown; /**< Set to stop the threads once the queue is empty. */
+        uint_t m_started[MAX_JOB_CLASS]; /**< Tasks of each class started since the last report. */
+        deque<Task> m_tasks[MAX_JOB_CLASS]; /**< Tasks of each class waiting for a thread. */
+        vector<thread> m_threads; /**< The worker threads. */
+        uint_t m_waited[MAX_JOB_CLASS]; /**< Total wait (in milliseconds) of the tasks of each class started since the last report. */
+};
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file yencdecoder.h
+ * @brief The YEncDecoder class.
+ *
+ * This file contains the YEncDecoder class and template functions.
+ */
+#ifndef DEC_YENCDECODER_H
+#define DEC_YENCDECODER_H
+
+using namespace std;
+
+/**
+ * @brief A streaming yEnc decoder. Article bodies may be fed in arbitrary chunks, one part after another, and each part and the whole file are verified by CRC32.
+ */
+class YEncDecoder
+{
+    public:
+        const uint32_t Checksum( const uint32_t& crc, const char* data, const uint_t& length );
+        const bool Decode( const char* input, const uint_t& length, string& output );
+        const bool Decode( const string& input, string& output );
+        const uint_t gBegin();
+        const bool gComplete();
+        const uint32_t gCRC();
+        const uint_t gKernel();
+        const string gName();
+        const uint_t gPart();
+        const uint_t gSize();
+        const bool gValid();
+        const void Reset();
+
+        YEncDecoder( const bool& raw = false );
+        ~YEncDecoder();
+
+    private:
+        /**
+         * @brief A part that has been fully decoded and checked.
+         */
+        struct Part
+        {
+            uint_t begin; /**< Offset of the part within the file, from 0. */
+            uint_t size; /**< Number of decoded bytes in the part. */
+            uint32_t crc; /**< CRC32 of the decoded bytes. */
+        };
+
+        const void Header( const string& line );
+        const uint_t Kernel( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line );
+        const void Verify();
+
+        bool m_raw; /**< Input is straight off the wire and still dot-stuffed. */
+        uint_t m_kernel; /**< The vector kernel chosen for this CPU from #YENC_KERNEL. */
+        bool m_clmul; /**< Whether the CPU supports carry-less multiplication for CRC32. */
+        uint_t m_state; /**< Position within the current line from #YENC_STATE. */
+        string m_header; /**< The =y line being collected. */
+        bool m_in_part; /**< Whether data lines belong to an open =ybegin. */
+        string m_name; /**< File name from =ybegin. */
+        uint_t m_size; /**< File size from =ybegin. */
+        uint_t m_part; /**< Part number from =ybegin, 0 for single part files. */
+        uint_t m_begin; /**< Offset of the current part from =ypart, from 0. */
+        uint_t m_part_size; /**< Bytes decoded in the current part. */
+        uint32_t m_part_crc; /**< Running CRC32 of the current part. */
+        uint32_t m_file_crc; /**< Expected CRC32 of the whole file from =yend, 0 if not given. */
+        uint32_t m_crc; /**< CRC32 of the whole file once complete. */
+        vector<Part> m_parts; /**< Parts decoded so far. */
+        uint_t m_decoded; /**< Total bytes decoded across all parts. */
+        bool m_valid; /**< False once any size or CRC32 check fails. */
+};
+
+#endif
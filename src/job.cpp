@@ -0,0 +1,271 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job.cpp
+ * @brief All non-template member functions of the Job class.
+ *
+ * The Job class provides the scheduling interface shared by every native
+ * job that replaces one of the nZEDb PHP scripts.
+ */
+#include "h/includes.h"
+#include "h/job.h"
+
+#include "h/cluster.h"
+#include "h/list.h"
+
+/**
+ * @brief Returns how urgent the work of the job is.
+ * @retval uint_t How urgent the work of the job is, from #JOB_CLASS.
+ */
+const uint_t Job::gClass()
+{
+    return m_class;
+}
+
+/**
+ * @brief Returns the interval the job was constructed with.
+ * @retval uint_t The number of seconds between runs when the configuration does not say otherwise.
+ */
+const uint_t Job::gDefault()
+{
+    return m_default;
+}
+
+/**
+ * @brief Returns whether the job may start new runs.
+ * @retval bool Whether the job may start new runs.
+ */
+const bool Job::gEnabled()
+{
+    return m_enabled;
+}
+
+/**
+ * @brief Returns the interval between runs of the job.
+ * @retval uint_t The number of seconds to wait between the end of one run and the start of the next.
+ */
+const uint_t Job::gInterval()
+{
+    return m_interval;
+}
+
+/**
+ * @brief Returns when the job last finished a run.
+ * @retval chrono::high_resolution_clock::time_point When the job last finished a run, or the epoch if it never has.
+ */
+const chrono::high_resolution_clock::time_point Job::gLastFinish()
+{
+    return m_last_finish;
+}
+
+/**
+ * @brief Returns when the job last started a run.
+ * @retval chrono::high_resolution_clock::time_point When the job last started a run, or the epoch if it never has.
+ */
+const chrono::high_resolution_clock::time_point Job::gLastStart()
+{
+    return m_last_start;
+}
+
+/**
+ * @brief Returns the name of the job.
+ * @retval string The name of the job.
+ */
+const string Job::gName()
+{
+    return m_name;
+}
+
+/**
+ * @brief Returns the number of runs the job has started.
+ * @retval uint_t The number of runs started since the server started.
+ */
+const uint_t Job::gRuns()
+{
+    return m_runs;
+}
+
+/**
+ * @brief Returns the current status of the job from #JOB_STATUS.
+ * @retval uint_t A uint_t associated to #JOB_STATUS.
+ */
+const uint_t Job::gStatus()
+{
+    return m_status;
+}
+
+/**
+ * @brief Called by Main::PollJob() each cycle. Starts a new run once the interval has elapsed, otherwise updates the run in progress.
+ * @retval void
+ */
+const void Job::Poll()
+{
+    UFLAGS_I( flags );
+
+    if ( m_status == JOB_STATUS_RUNNING )
+    {
+        Update();
+        return;
+    }
+
+    // A disabled job is still allowed to finish a run already in progress
+    if ( !m_enabled )
+        return;
+
+    if ( !m_triggered && m_runs > 0 && chrono::duration_cast<chrono::seconds>( g_global->m_time_current - m_last_finish ).count() < static_cast<sint_t>( m_interval ) )
+        return;
+
+    // Cleanup waits until it would not take connectors or threads from more urgent work, unless an operator asked for it
+    if ( !m_triggered && m_class == JOB_CLASS_CLEANUP && Main::Saturated() )
+    {
+        if ( m_deferred == chrono::high_resolution_clock::time_point() )
+        {
+            m_deferred = g_global->m_time_current;
+            LOGFMT( flags, "Job::Poll()-> %s deferred while the database is saturated", CSTR( m_name ) );
+        }
+
+        return;
+    }
+
+    if ( m_deferred != chrono::high_resolution_clock::time_point() )
+    {
+        LOGFMT( flags, "Job::Poll()-> %s starting after being deferred for %lus", CSTR( m_name ),
+            static_cast<uint_t>( chrono::duration_cast<chrono::seconds>( g_global->m_time_current - m_deferred ).count() ) );
+        m_deferred = chrono::high_resolution_clock::time_point();
+    }
+
+    m_triggered = false;
+    m_last_start = g_global->m_time_current;
+    m_generation = g_global->m_cluster->Begin();
+    m_runs++;
+    sStatus( JOB_STATUS_RUNNING );
+    Run();
+
+    return;
+}
+
+/**
+ * @brief Updates a run in progress. Jobs that finish within Run() have no need to override this.
+ * @retval void
+ */
+const void Job::Update()
+{
+    return;
+}
+
+/**
+ * @brief Marks the current run as finished so the job is rescheduled after its interval.
+ * @retval void
+ */
+const void Job::Finish()
+{
+    UFLAGS_I( flags );
+
+    m_last_finish = chrono::high_resolution_clock::now();
+    g_global->m_cluster->End( m_generation );
+    sStatus( JOB_STATUS_IDLE );
+
+    LOGFMT( flags, "Job::Finish()-> %s finished in %lums", CSTR( m_name ), static_cast<uint_t>( chrono::duration_cast<chrono::milliseconds>( m_last_finish - m_last_start ).count() ) );
+
+    return;
+}
+
+/**
+ * @brief Allow or prevent new runs of the job.
+ * @param[in] enabled Whether the job may start new runs.
+ * @retval void
+ */
+const void Job::sEnabled( const bool& enabled )
+{
+    m_enabled = enabled;
+
+    return;
+}
+
+/**
+ * @brief Sets the interval between runs of the job, taking effect from the end of the current or last run.
+ * @param[in] interval The number of seconds to wait between the end of one run and the start of the next.
+ * @retval void
+ */
+const void Job::sInterval( const uint_t& interval )
+{
+    m_interval = interval;
+
+    return;
+}
+
+/**
+ * @brief Start a run at the next poll rather than once the interval has elapsed. A disabled job still does not start.
+ * @retval void
+ */
+const void Job::Trigger()
+{
+    m_triggered = true;
+
+    return;
+}
+
+/**
+ * @brief Sets the current status of the job from #JOB_STATUS.
+ * @param[in] status The current status of the job from #JOB_STATUS.
+ * @retval void
+ */
+const void Job::sStatus( const uint_t& status )
+{
+    UFLAGS_DE( flags );
+
+    if ( status < uintmin_t || status >= MAX_JOB_STATUS )
+    {
+        LOGFMT( flags, "Job::sStatus()-> called with invalid status: %lu", status );
+        return;
+    }
+
+    m_status = status;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the Job class.
+ */
+Job::Job( const string& name, const uint_t& interval, const uint_t& cls ) :
+    m_name( name ), m_class( cls ), m_default( interval ), m_interval( interval )
+{
+    m_enabled = true;
+    m_generation = uintmin_t;
+    m_runs = uintmin_t;
+    m_status = JOB_STATUS_IDLE;
+    m_triggered = false;
+
+    job_list.push_back( this );
+
+    return;
+}
+
+/**
+ * @brief Destructor for the Job class.
+ */
+Job::~Job()
+{
+    return;
+}
@@ -0,0 +1,666 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_binaries.cpp
+ * @brief All non-template member functions of the JobBinaries class.
+ *
+ * The JobBinaries class fetches new headers for every active group over
+ * several pipelined connections and feeds them to the bulk insert path.
+ */
+#include "h/includes.h"
+#include "h/job_binaries.h"
+
+#include "h/cluster.h"
+#include "h/collator.h"
+#include "h/dbconn.h"
+#include "h/nntpconn.h"
+#include "h/statefile.h"
+#include "h/yencdecoder.h"
+
+/**
+ * @brief Start a run by loading the active groups and opening connections to the provider.
+ * @retval void
+ */
+const void JobBinaries::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    Group group;
+    uint_t i = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobBinaries::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    // Not cached: another node may have moved last_record since this one last read it
+    result = db->Query( "SELECT id, name, last_record FROM groups WHERE active = 1" );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+    {
+        LOGSTR( flags, "JobBinaries::Run()-> no active groups" );
+        Finish();
+
+        return;
+    }
+
+    m_groups.clear();
+    m_probes.clear();
+    m_ranges.clear();
+
+    // Pick up any collection regexes changed since the last run; subjects are still collated if none load
+    m_regexes.Load();
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        group.id = uintmin_t;
+        group.last_record = uintmin_t;
+        stringstream( result[i][0] ) >> group.id;
+
+        // Other nodes of a cluster fetch the groups of their own shards
+        if ( !g_global->m_cluster->Owns( group.id ) )
+            continue;
+
+        stringstream( result[i][2] ) >> group.last_record;
+        group.name = result[i][1];
+        group.target = uintmin_t;
+        group.failed = uintmin_t;
+
+        // A run cut short by a restart checkpointed further than it got to record in the groups table
+        group.last_record = max( group.last_record, g_global->m_state->Get( Utils::FormatString( 0, "binaries.%lu", group.id ), 0 ) );
+        group.done = group.last_record;
+        group.saved = group.last_record;
+        group.fetched.clear();
+
+        m_probes.push_back( m_groups.size() );
+        m_groups.push_back( group );
+    }
+
+    if ( m_groups.empty() )
+    {
+        Finish();
+
+        return;
+    }
+
+    m_outstanding = uintmin_t;
+    m_reconnects = uintmin_t;
+    m_articles = uintmin_t;
+    m_bytes = uintmin_t;
+    m_start = chrono::high_resolution_clock::now();
+    m_checkpoint = m_start;
+
+    for ( i = 0; i < CFG_NNTP_MAX_CONN; i++ )
+        m_conns.push_back( new NNTPConn( m_host, m_port, m_user, m_pass ) );
+
+    return;
+}
+
+/**
+ * @brief Drive every connection, keep their pipelines full, and replace any that fail.
+ * @retval void
+ */
+const void JobBinaries::Update()
+{
+    UFLAGS_DE( flags );
+    ITER( vector, NNTPConn*, vi );
+    NNTPConn* conn;
+
+    for ( vi = m_conns.begin(); vi != m_conns.end(); )
+    {
+        conn = *vi;
+
+        if ( conn->gStatus() == NNTPCONN_STATUS_ERROR )
+        {
+            // Outstanding work was already requeued by the connection's callbacks
+            delete conn;
+
+            if ( m_reconnects < CFG_NNTP_MAX_CONN * CFG_NNTP_RETRY )
+            {
+                m_reconnects++;
+                *vi = new NNTPConn( m_host, m_port, m_user, m_pass );
+            }
+            else
+                vi = m_conns.erase( vi );
+
+            continue;
+        }
+
+        Dispatch( conn );
+        conn->Update();
+        vi++;
+    }
+
+    if ( m_conns.empty() && ( !m_probes.empty() || !m_ranges.empty() ) )
+    {
+        LOGFMT( flags, "JobBinaries::Update()-> %s: giving up after %lu reconnects", CSTR( m_host ), m_reconnects );
+
+        while ( !m_ranges.empty() )
+        {
+            if ( m_groups[m_ranges.front().group].failed == 0 || m_ranges.front().first < m_groups[m_ranges.front().group].failed )
+                m_groups[m_ranges.front().group].failed = m_ranges.front().first;
+            m_ranges.pop_front();
+        }
+
+        m_probes.clear();
+    }
+
+    if ( m_probes.empty() && m_ranges.empty() && m_outstanding == 0 )
+        Complete();
+    else if ( chrono::duration_cast<chrono::seconds>( g_global->m_time_current - m_checkpoint ).count() >= CFG_NNTP_CHECKPOINT )
+        Checkpoint();
+
+    return;
+}
+
+/**
+ * @brief Record a range as fetched, moving the last article every earlier range was fetched up to past any ranges that now follow on.
+ * @param[in] range The range that was fetched, or found to be empty.
+ * @retval void
+ */
+const void JobBinaries::Advance( const Range& range )
+{
+    Group& g = m_groups[range.group];
+    map<uint_t,uint_t>::iterator mi;
+
+    g.fetched[range.first] = range.last;
+
+    while ( ( mi = g.fetched.find( g.done + 1 ) ) != g.fetched.end() )
+    {
+        g.done = mi->second;
+        g.fetched.erase( mi );
+    }
+
+    return;
+}
+
+/**
+ * @brief Write the headers collated so far, then checkpoint the last article of each group that every range up to was fetched, so a restart resumes there rather than at the start of the run.
+ * @retval void
+ */
+const void JobBinaries::Checkpoint()
+{
+    UFLAGS_DE( flags );
+    uint_t i = 0;
+    bool moved = false;
+
+    m_checkpoint = g_global->m_time_current;
+
+    for ( i = 0; i < m_groups.size(); i++ )
+        if ( m_groups[i].done > m_groups[i].saved )
+            moved = true;
+
+    if ( !moved )
+        return;
+
+    // Only headers already in the database may be skipped after a restart
+    if ( !m_collator->Flush() )
+    {
+        LOGSTR( flags, "JobBinaries::Checkpoint()-> collated headers not written, nothing checkpointed" );
+        return;
+    }
+
+    for ( i = 0; i < m_groups.size(); i++ )
+    {
+        if ( m_groups[i].done > m_groups[i].saved )
+        {
+            g_global->m_state->Set( Utils::FormatString( 0, "binaries.%lu", m_groups[i].id ), m_groups[i].done );
+            m_groups[i].saved = m_groups[i].done;
+        }
+    }
+
+    return;
+}
+
+/**
+ * @brief Flush the remaining headers, record the new last article of each group, and report throughput.
+ * @retval void
+ */
+const void JobBinaries::Complete()
+{
+    UFLAGS_I( flags );
+    DBConn* db = NULL;
+    ITER( vector, NNTPConn*, vi );
+    uint_t i = 0, last = 0;
+    double seconds = 0;
+
+    for ( vi = m_conns.begin(); vi != m_conns.end(); vi++ )
+        delete *vi;
+    m_conns.clear();
+
+    // Headers that were not written must be fetched again, so last_record stays put
+    if ( !m_collator->Flush() )
+        LOGSTR( flags, "JobBinaries::Complete()-> collated headers not written, last_record not updated" );
+    else if ( ( db = Main::AcquireDBConn() ) != NULL )
+    {
+        for ( i = 0; i < m_groups.size(); i++ )
+        {
+            // Stop short of the first failed range so it is fetched again next run
+            last = m_groups[i].failed ? m_groups[i].failed - 1 : m_groups[i].target;
+
+            // Once the groups table has it, the checkpoint would only hide a later change made to last_record by hand
+            if ( last > m_groups[i].last_record && db->Execute( Utils::FormatString( 0, "UPDATE groups SET last_record = %lu, last_updated = NOW() WHERE id = %lu", last, m_groups[i].id ) ) >= 0 )
+                g_global->m_state->Erase( Utils::FormatString( 0, "binaries.%lu", m_groups[i].id ) );
+        }
+    }
+    else
+        LOGSTR( flags, "JobBinaries::Complete()-> no database connector available, last_record not updated" );
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+    LOGFMT( flags, "JobBinaries::Complete()-> %lu articles (%lu KiB) from %lu groups in %.2fs: %.0f articles/sec", m_articles, m_bytes / 1024, m_groups.size(), seconds, seconds > 0 ? m_articles / seconds : 0 );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Decode a compressed XZVER body: yEnc wrapped around a deflate stream.
+ * @param[in] body The dot-unstuffed multi-line body of an XZVER response.
+ * @retval string The plain overview data, empty on error.
+ */
+const string JobBinaries::Decompress( const string& body )
+{
+    UFLAGS_DE( flags );
+    YEncDecoder decoder;
+    string data, output;
+    z_stream zs;
+    char buf[CFG_NNTP_BUF_SIZE];
+    sint_t ret = Z_OK;
+
+    data.reserve( body.length() );
+
+    // Some providers send the yEnc data without a =ybegin line
+    if ( body.compare( 0, 7, "=ybegin" ) != 0 )
+        decoder.Decode( "=ybegin" CRLF, data );
+
+    if ( !decoder.Decode( body, data ) )
+    {
+        LOGSTR( flags, "JobBinaries::Decompress()-> yEnc CRC32 or size mismatch" );
+        return output;
+    }
+
+    ::memset( &zs, 0, sizeof( zs ) );
+
+    // Providers differ on whether the zlib header is present
+    if ( inflateInit2( &zs, !data.empty() && static_cast<unsigned char>( data[0] ) == 0x78 ? 15 : -15 ) != Z_OK )
+    {
+        LOGSTR( flags, "JobBinaries::Decompress()->inflateInit2()-> failed" );
+        return output;
+    }
+
+    zs.next_in = reinterpret_cast<Bytef*>( &data[0] );
+    zs.avail_in = data.length();
+
+    while ( ret == Z_OK )
+    {
+        zs.next_out = reinterpret_cast<Bytef*>( buf );
+        zs.avail_out = sizeof( buf );
+        ret = inflate( &zs, Z_NO_FLUSH );
+        output.append( buf, sizeof( buf ) - zs.avail_out );
+    }
+
+    if ( ret != Z_STREAM_END )
+    {
+        LOGFMT( flags, "JobBinaries::Decompress()->inflate()-> returned %ld", ret );
+        output.clear();
+    }
+
+    inflateEnd( &zs );
+
+    return output;
+}
+
+/**
+ * @brief Fill a connection's pipeline with GROUP probes and overview ranges, preferring ranges of the group it already has selected.
+ * @param[in] conn The connection to fill.
+ * @retval void
+ */
+const void JobBinaries::Dispatch( NNTPConn* conn )
+{
+    ITER( deque, Range, ri );
+    Range range;
+    uint_t group = 0;
+    bool xzver = false;
+
+    while ( conn->gPending() < CFG_NNTP_PIPELINE )
+    {
+        if ( !m_probes.empty() )
+        {
+            group = m_probes.front();
+            m_probes.pop_front();
+            m_outstanding++;
+
+            conn->Send( "GROUP " + m_groups[group].name, false, [this, group]( NNTPConn* c, const uint_t& code, const string& line, const string& body ) { Probed( c, group, code, line ); } );
+            conn->sGroup( m_groups[group].name );
+
+            continue;
+        }
+
+        if ( m_ranges.empty() )
+            break;
+
+        for ( ri = m_ranges.begin(); ri != m_ranges.end(); ri++ )
+            if ( m_groups[ri->group].name == conn->gGroup() )
+                break;
+
+        if ( ri == m_ranges.end() )
+            ri = m_ranges.begin();
+
+        range = *ri;
+        m_ranges.erase( ri );
+        m_outstanding++;
+
+        if ( m_groups[range.group].name != conn->gGroup() )
+        {
+            // A failed GROUP leaves the pipelined ranges behind it to fail with 412 and be retried
+            conn->Send( "GROUP " + m_groups[range.group].name, false, []( NNTPConn* c, const uint_t& code, const string& line, const string& body ) { if ( code != 211 && code != 0 ) c->sGroup( "" ); } );
+            conn->sGroup( m_groups[range.group].name );
+        }
+
+        xzver = conn->gXZVER();
+        conn->Send( Utils::FormatString( 0, "%s %lu-%lu", xzver ? "XZVER" : "XOVER", range.first, range.last ), true,
+            [this, range, xzver]( NNTPConn* c, const uint_t& code, const string& line, const string& body ) { Fetched( c, range, xzver, code, body ); } );
+    }
+
+    return;
+}
+
+/**
+ * @brief Handle the response to an XOVER / XZVER command.
+ * @param[in] conn The connection the range was sent on.
+ * @param[in] range The range that was requested.
+ * @param[in] xzver Whether the range was requested with XZVER.
+ * @param[in] code The response code, 0 if the connection was lost.
+ * @param[in] body The multi-line body of the response.
+ * @retval void
+ */
+const void JobBinaries::Fetched( NNTPConn* conn, Range range, const bool& xzver, const uint_t& code, const string& body )
+{
+    UFLAGS_DE( flags );
+    string overview;
+    bool stored = true;
+
+    m_outstanding--;
+
+    switch ( code )
+    {
+        // Overview follows
+        case 224:
+            m_bytes += body.length();
+
+            if ( !xzver )
+            {
+                Store( range.group, body );
+                break;
+            }
+
+            // A body that did not decode holds headers that were never stored, so the range must not be advanced past
+            if ( ( overview = Decompress( body ) ).empty() && !body.empty() )
+            {
+                LOGFMT( flags, "JobBinaries::Fetched()-> %s %lu-%lu: XZVER body did not decode", CSTR( m_groups[range.group].name ), range.first, range.last );
+                stored = false;
+                Retry( range );
+                break;
+            }
+
+            Store( range.group, overview );
+        break;
+
+        // No articles in the range
+        case 420:
+        case 423:
+        break;
+
+        // Connection lost
+        case 0:
+            Retry( range );
+        break;
+
+        // No group selected, the GROUP command in front of this range failed
+        case 412:
+            conn->sGroup( "" );
+            Retry( range );
+        break;
+
+        // XZVER is not supported, fall back to XOVER without counting an attempt
+        case 500:
+        case 501:
+        case 502:
+            if ( xzver )
+            {
+                conn->sXZVER( false );
+                m_ranges.push_front( range );
+                break;
+            }
+            // fallthrough
+
+        default:
+            LOGFMT( flags, "JobBinaries::Fetched()-> %s %lu-%lu: rejected with code %lu", CSTR( m_groups[range.group].name ), range.first, range.last, code );
+            range.attempts = CFG_NNTP_RETRY;
+            Retry( range );
+        break;
+    }
+
+    if ( ( code == 224 && stored ) || code == 420 || code == 423 )
+        Advance( range );
+
+    return;
+}
+
+/**
+ * @brief Handle the response to a GROUP probe by splitting the new articles into ranges.
+ * @param[in] conn The connection the probe was sent on.
+ * @param[in] group Index into m_groups.
+ * @param[in] code The response code, 0 if the connection was lost.
+ * @param[in] line The status line of the response: 211 count first last name.
+ * @retval void
+ */
+const void JobBinaries::Probed( NNTPConn* conn, const uint_t& group, const uint_t& code, const string& line )
+{
+    UFLAGS_DE( flags );
+    Group& g = m_groups[group];
+    uint_t count = 0, first = 0, last = 0, start = 0;
+    string status;
+    Range range;
+
+    m_outstanding--;
+
+    if ( code == 0 )
+    {
+        m_probes.push_back( group );
+        return;
+    }
+
+    if ( code != 211 )
+    {
+        // The server kept its previous group, so the next range for this one must send GROUP again
+        conn->sGroup( "" );
+        LOGFMT( flags, "JobBinaries::Probed()-> %s: GROUP returned: %s", CSTR( g.name ), CSTR( line ) );
+        return;
+    }
+
+    stringstream( line ) >> status >> count >> first >> last;
+
+    if ( g.last_record == 0 )
+        start = last > CFG_NNTP_NEW_ARTICLES ? last - CFG_NNTP_NEW_ARTICLES + 1 : 1;
+    else
+        start = g.last_record + 1;
+
+    start = max( start, first );
+
+    if ( count == 0 || start > last )
+        return;
+
+    // Anything before start is either fetched already or gone from the server
+    g.done = start - 1;
+
+    // Oldest first, so anything beyond the cap is picked up by the next run
+    g.target = min( last, start + CFG_NNTP_MAX_ARTICLES - 1 );
+
+    range.group = group;
+    range.attempts = uintmin_t;
+
+    for ( range.first = start; range.first <= g.target; range.first += CFG_NNTP_BATCH )
+    {
+        range.last = min( g.target, range.first + CFG_NNTP_BATCH - 1 );
+        m_ranges.push_back( range );
+    }
+
+    return;
+}
+
+/**
+ * @brief Requeue a range that was lost or rejected, or record it as failed once #CFG_NNTP_RETRY attempts are used.
+ * @param[in] range The range to retry.
+ * @retval void
+ */
+const void JobBinaries::Retry( Range range )
+{
+    Group& g = m_groups[range.group];
+
+    if ( ++range.attempts < CFG_NNTP_RETRY )
+    {
+        m_ranges.push_back( range );
+        return;
+    }
+
+    if ( g.failed == 0 || range.first < g.failed )
+        g.failed = range.first;
+
+    return;
+}
+
+/**
+ * @brief Parse overview lines straight into the bulk insert path.
+ * @param[in] group Index into m_groups.
+ * @param[in] body Overview lines: number, subject, from, date, message-id, references, bytes, lines [, xref].
+ * @retval void
+ */
+const void JobBinaries::Store( const uint_t& group, const string& body )
+{
+    string::size_type pos = 0, eol = 0, tab = 0;
+    vector<string> fields;
+    Collator::Article article;
+
+    fields.reserve( 9 );
+    article.group = m_groups[group].id;
+    article.group_name = m_groups[group].name;
+
+    for ( pos = 0; pos < body.length(); pos = eol + 2 )
+    {
+        if ( ( eol = body.find( CRLF, pos ) ) == string::npos )
+            eol = body.length();
+
+        fields.clear();
+
+        while ( pos <= eol )
+        {
+            if ( ( tab = body.find( '\t', pos ) ) == string::npos || tab > eol )
+                tab = eol;
+
+            fields.push_back( body.substr( pos, tab - pos ) );
+            pos = tab + 1;
+        }
+
+        if ( fields.size() < 8 || fields[4].length() < 3 )
+            continue;
+
+        article.number = uintmin_t;
+        article.size = uintmin_t;
+        stringstream( fields[0] ) >> article.number;
+        stringstream( fields[6] ) >> article.size;
+        article.subject = fields[1];
+        article.from = fields[2];
+        article.date = ParseDate( fields[3] );
+        article.messageid = fields[4].substr( 1, fields[4].length() - 2 );
+        article.xref = fields.size() > 8 ? fields[8] : "";
+
+        m_collator->Add( article );
+        m_articles++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Parse an RFC 5322 overview date, such as "Mon, 06 Jan 2014 12:34:56 +0100".
+ * @param[in] input The date field of an overview line.
+ * @retval time_t The date in seconds since the epoch (UTC), 0 if it could not be parsed.
+ */
+const time_t JobBinaries::ParseDate( const string& input )
+{
+    struct tm tm;
+    const char* pos = CSTR( input );
+    const char* end = NULL;
+    sint_t offset = 0;
+
+    ::memset( &tm, 0, sizeof( tm ) );
+
+    // The day of the week is optional
+    if ( ( end = ::strchr( pos, ',' ) ) != NULL )
+        pos = end + 1;
+
+    if ( ( end = ::strptime( pos, " %d %b %Y %H:%M:%S", &tm ) ) == NULL )
+        return 0;
+
+    if ( ::sscanf( end, " %ld", &offset ) == 1 )
+        offset = ( offset / 100 ) * 3600 + ( offset % 100 ) * 60;
+
+    return ::timegm( &tm ) - offset;
+}
+
+/**
+ * @brief Constructor for the JobBinaries class.
+ */
+JobBinaries::JobBinaries( const string& host, const string& port, const string& user, const string& pass ) :
+    Job::Job( "binaries", 60, JOB_CLASS_INGEST ), m_host( host ), m_port( port ), m_user( user ), m_pass( pass )
+{
+    m_reconnects = uintmin_t;
+    m_outstanding = uintmin_t;
+    m_articles = uintmin_t;
+    m_bytes = uintmin_t;
+    m_collator = new Collator( &m_regexes );
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobBinaries class.
+ */
+JobBinaries::~JobBinaries()
+{
+    ITER( vector, NNTPConn*, vi );
+
+    for ( vi = m_conns.begin(); vi != m_conns.end(); vi++ )
+        delete *vi;
+
+    delete m_collator;
+
+    return;
+}
@@ -0,0 +1,303 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_categorize.cpp
+ * @brief All non-template member functions of the JobCategorize class.
+ *
+ * The JobCategorize class finds every release waiting to be categorized,
+ * splits their id range across the WorkerPool, and has each task classify
+ * its range in batches with the shared Categorizer. The categories of a
+ * batch are written back with one UPDATE per #CFG_DB_BULK_ROWS.
+ *
+ * Nothing is written until categorize.write is set, and until then new
+ * releases are categorized by the recategorize.php pass in thread_data.
+ * Each new or changed categorize.rules file is checked once against the
+ * newest #CFG_REL_CAT_SAMPLE releases nZEDb categorized, and the agreement
+ * logged, so the rules can be shown to match nZEDb before they touch live
+ * releases.
+ */
+#include "h/includes.h"
+#include "h/job_categorize.h"
+
+#include "h/cluster.h"
+#include "h/configfile.h"
+#include "h/dbconn.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Split the releases waiting to be categorized into a range per worker thread.
+ * @retval void
+ */
+const void JobCategorize::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    string rules = g_global->m_config->gString( "categorize.rules" );
+    struct stat st;
+    uint_t first = 0, last = 0, width = 0, low = 0, high = 0;
+
+    ::memset( &st, 0, sizeof( st ) );
+
+    if ( !rules.empty() )
+        ::stat( CSTR( rules ), &st );
+
+    // No task is running between runs, so the rules can be swapped for a new or edited file
+    if ( rules != m_rules || st.st_mtime != m_modified )
+    {
+        delete m_categorizer;
+        m_categorizer = new Categorizer();
+        m_rules = rules;
+        m_modified = st.st_mtime;
+        m_verified = false;
+
+        if ( !( m_loaded = !rules.empty() && m_categorizer->Load( rules ) ) )
+            LOGSTR( flags, "JobCategorize::Run()-> no category rules loaded, new releases are only categorized by nZEDb's recategorize.php" );
+    }
+
+    if ( !m_loaded )
+    {
+        Finish();
+
+        return;
+    }
+
+    if ( g_global->m_config->gNumber( "categorize.write" ) == 0 )
+    {
+        if ( m_verified )
+        {
+            Finish();
+
+            return;
+        }
+
+        m_verified = true;
+        m_start = chrono::high_resolution_clock::now();
+        m_categorized = uintmin_t;
+        m_outstanding++;
+        g_global->m_workers->Submit( [this]() { Verify(); }, gClass() );
+
+        return;
+    }
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobCategorize::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    result = db->Query( "SELECT MIN(id), MAX(id) FROM releases WHERE iscategorized = 0" + g_global->m_cluster->Filter( "id" ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 || result[1][0].empty() )
+    {
+        Finish();
+
+        return;
+    }
+
+    stringstream( result[1][0] ) >> first;
+    stringstream( result[1][1] ) >> last;
+
+    m_categorized = uintmin_t;
+    m_start = chrono::high_resolution_clock::now();
+
+    width = ( last - first ) / g_global->m_workers->gThreads() + 1;
+
+    // Each range is ( low, high ], together covering every id once
+    for ( low = first - 1; low < last; low = high )
+    {
+        high = min( low + width, last );
+
+        m_outstanding++;
+        g_global->m_workers->Submit( [this, low, high]() { Range( low, high ); }, gClass() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Finish the run once every range task has returned.
+ * @retval void
+ */
+const void JobCategorize::Update()
+{
+    UFLAGS_I( flags );
+    double seconds = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+
+    if ( m_categorized > 0 )
+        LOGFMT( flags, "JobCategorize::Update()-> %lu releases categorized in %.2fs: %.1f releases/sec", static_cast<uint_t>( m_categorized ), seconds, seconds > 0 ? m_categorized / seconds : 0 );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Categorize the next batch of a range.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in,out] last The highest id already categorized, moved to the last id of this batch.
+ * @param[in] end The highest id of the range.
+ * @retval uint_t The number of releases categorized, less than #CFG_REL_CAT_BATCH once the range is exhausted.
+ */
+const uint_t JobCategorize::Batch( DBConn* db, uint_t& last, const uint_t& end )
+{
+    UFLAGS_DE( flags );
+    vector<vector<string>> result;
+    string cases, ids;
+    uint_t i = 0, rows = 0, size = 0;
+
+    result = db->Query( Utils::FormatString( 0, "SELECT r.id, g.name, r.searchname, r.size FROM releases r INNER JOIN groups g ON g.id = r.groupid "
+        "WHERE r.id > %lu AND r.id <= %lu AND r.iscategorized = 0%s ORDER BY r.id LIMIT %lu", last, end, CSTR( g_global->m_cluster->Filter( "r.id" ) ), CFG_REL_CAT_BATCH ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+        return 0;
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        size = uintmin_t;
+        stringstream( result[i][3] ) >> size;
+
+        cases.append( Utils::FormatString( 0, " WHEN %s THEN %lu", CSTR( result[i][0] ), m_categorizer->Classify( result[i][1], result[i][2], size ) ) );
+        ids.append( ( ids.empty() ? "" : ", " ) + result[i][0] );
+        rows++;
+
+        if ( rows < CFG_DB_BULK_ROWS && i + 1 < result.size() )
+            continue;
+
+        if ( db->Execute( "UPDATE releases SET categoryid = CASE id" + cases + " END, iscategorized = 1 WHERE id IN (" + ids + ")" ) < 0 )
+            LOGFMT( flags, "JobCategorize::Batch()-> failed to categorize %lu releases", rows );
+
+        cases.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    stringstream( result[result.size() - 1][0] ) >> last;
+    m_categorized += result.size() - 1;
+
+    return result.size() - 1;
+}
+
+/**
+ * @brief The worker task for a range of release ids, walked once in batches.
+ * @param[in] first The id before the range.
+ * @param[in] last The last id of the range.
+ * @retval void
+ */
+const void JobCategorize::Range( const uint_t& first, const uint_t& last )
+{
+    DBConn* db = NULL;
+    uint_t position = first;
+
+    // There can be more ranges than connectors, so wait for one to free up
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        while ( !g_global->m_shutdown && position < last && Batch( db, position, last ) == CFG_REL_CAT_BATCH );
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief The worker task that classifies the newest releases nZEDb categorized and logs how many the loaded rules agree with.
+ * @retval void
+ */
+const void JobCategorize::Verify()
+{
+    UFLAGS_I( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    uint_t i = 0, category = 0, recorded = 0, size = 0, disagreed = 0;
+
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        result = db->Query( Utils::FormatString( 0, "SELECT g.name, r.searchname, r.size, r.categoryid FROM releases r INNER JOIN groups g ON g.id = r.groupid "
+            "WHERE r.iscategorized = 1 ORDER BY r.id DESC LIMIT %lu", CFG_REL_CAT_SAMPLE ) );
+        Main::ReleaseDBConn( db );
+    }
+
+    // The first row of a result set is metadata
+    for ( i = 1; i < result.size(); i++ )
+    {
+        size = recorded = uintmin_t;
+        stringstream( result[i][2] ) >> size;
+        stringstream( result[i][3] ) >> recorded;
+
+        if ( ( category = m_categorizer->Classify( result[i][0], result[i][1], size ) ) == recorded )
+            continue;
+
+        // Only the first few are shown, the total says how far off the rules are
+        if ( disagreed++ < 20 )
+            LOGFMT( flags, "JobCategorize::Verify()-> %s %s: recorded %lu, classified %lu", CSTR( result[i][0] ), CSTR( result[i][1] ), recorded, category );
+    }
+
+    if ( result.size() > 1 )
+        LOGFMT( flags, "JobCategorize::Verify()-> %s: %lu of %lu releases agree with nZEDb, %lu disagree; recategorize.php categorizes new releases until categorize.write is set",
+            CSTR( m_rules ), result.size() - 1 - disagreed, result.size() - 1, disagreed );
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobCategorize class.
+ */
+JobCategorize::JobCategorize() : Job::Job( "categorize", 60 )
+{
+    m_categorizer = new Categorizer();
+    m_loaded = false;
+    m_modified = 0;
+    m_verified = false;
+    m_outstanding = uintmin_t;
+    m_categorized = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobCategorize class.
+ */
+JobCategorize::~JobCategorize()
+{
+    delete m_categorizer;
+
+    return;
+}
@@ -0,0 +1,399 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_fixnames.cpp
+ * @brief All non-template member functions of the JobFixNames class.
+ *
+ * The JobFixNames class replaces the three fixReleaseNames.php runs, which
+ * each scanned the releases table again for their own naming source. The
+ * id range of releases that have not been renamed is split across the
+ * WorkerPool, and each task walks its range once in batches. For a batch it
+ * streams the NFOs and file names, looks every candidate up in PreDB with
+ * one query, and applies the renames with one UPDATE per #CFG_DB_BULK_ROWS.
+ *
+ * As with fixReleaseNames.php, proc_nfo and proc_files record which
+ * sources of a release were checked, so a release without a match is only
+ * checked again once postprocessing gives it a source it has not had.
+ */
+#include "h/includes.h"
+#include "h/job_fixnames.h"
+
+#include "h/cluster.h"
+#include "h/dbconn.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Split the releases waiting to be renamed into a range per worker thread.
+ * @retval void
+ */
+const void JobFixNames::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    uint_t first = 0, last = 0, width = 0, i = 0, low = 0, high = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobFixNames::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    result = db->Query( "SELECT MIN(id), MAX(id) FROM releases WHERE " + Pending() + g_global->m_cluster->Filter( "id" ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 || result[1][0].empty() )
+    {
+        Finish();
+
+        return;
+    }
+
+    stringstream( result[1][0] ) >> first;
+    stringstream( result[1][1] ) >> last;
+
+    m_checked = uintmin_t;
+    for ( i = 0; i < MAX_FIXNAMES_SOURCE; i++ )
+        m_renamed[i] = uintmin_t;
+    m_start = chrono::high_resolution_clock::now();
+
+    width = ( last - first ) / g_global->m_workers->gThreads() + 1;
+
+    // Each range is ( low, high ], together covering every id once
+    for ( low = first - 1; low < last; low = high )
+    {
+        high = min( low + width, last );
+
+        m_outstanding++;
+        g_global->m_workers->Submit( [this, low, high]() { Range( low, high ); }, gClass() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Finish the run once every range task has returned.
+ * @retval void
+ */
+const void JobFixNames::Update()
+{
+    UFLAGS_I( flags );
+    double seconds = 0;
+    uint_t renamed = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+    renamed = m_renamed[FIXNAMES_SOURCE_PREDB] + m_renamed[FIXNAMES_SOURCE_NFO] + m_renamed[FIXNAMES_SOURCE_FILES];
+
+    if ( m_checked > 0 )
+        LOGFMT( flags, "JobFixNames::Update()-> %lu releases checked, %lu renamed in %.2fs: %.1f renames/sec (predb %lu, nfo %lu, files %lu)",
+            m_checked, renamed, seconds, seconds > 0 ? renamed / seconds : 0,
+            m_renamed[FIXNAMES_SOURCE_PREDB], m_renamed[FIXNAMES_SOURCE_NFO], m_renamed[FIXNAMES_SOURCE_FILES] );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Write the new names of a batch, #CFG_DB_BULK_ROWS releases per UPDATE, then flag the sources that were checked.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in] releases The batch; releases without a new name keep theirs.
+ * @retval void
+ */
+const void JobFixNames::Apply( DBConn* db, const vector<Release>& releases )
+{
+    UFLAGS_DE( flags );
+    string names, pres, ids, nfos, files;
+    uint_t i = 0, rows = 0;
+
+    for ( i = 0; i < releases.size(); i++ )
+    {
+        if ( !releases[i].name.empty() )
+        {
+            names.append( Utils::FormatString( 0, " WHEN %lu THEN '", releases[i].id ) + db->Escape( releases[i].name ) + "'" );
+            if ( releases[i].pre > 0 )
+                pres.append( Utils::FormatString( 0, " WHEN %lu THEN %lu", releases[i].id, releases[i].pre ) );
+            ids.append( Utils::FormatString( 0, "%s%lu", ids.empty() ? "" : ", ", releases[i].id ) );
+            rows++;
+        }
+
+        if ( rows == 0 || ( rows < CFG_DB_BULK_ROWS && i + 1 < releases.size() ) )
+            continue;
+
+        // Renamed releases are categorized again from their new name
+        if ( db->Execute( "UPDATE releases SET searchname = CASE id" + names + " END, preid = " + ( pres.empty() ? string( "preid" ) : "CASE id" + pres + " ELSE preid END" ) +
+            ", isrenamed = 1, iscategorized = 0 WHERE id IN (" + ids + ")" ) < 0 )
+            LOGFMT( flags, "JobFixNames::Apply()-> failed to rename %lu releases", rows );
+
+        names.clear();
+        pres.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    // Checked with or without a match, so the release is not scanned again for the same source
+    for ( i = 0; i < releases.size(); i++ )
+    {
+        if ( releases[i].has_nfo )
+            nfos.append( Utils::FormatString( 0, "%s%lu", nfos.empty() ? "" : ", ", releases[i].id ) );
+        if ( releases[i].has_files )
+            files.append( Utils::FormatString( 0, "%s%lu", files.empty() ? "" : ", ", releases[i].id ) );
+    }
+
+    if ( !nfos.empty() && db->Execute( "UPDATE releases SET proc_nfo = 1 WHERE id IN (" + nfos + ")" ) < 0 )
+        LOGSTR( flags, "JobFixNames::Apply()-> failed to flag checked NFOs" );
+
+    if ( !files.empty() && db->Execute( "UPDATE releases SET proc_files = 1 WHERE id IN (" + files + ")" ) < 0 )
+        LOGSTR( flags, "JobFixNames::Apply()-> failed to flag checked file names" );
+
+    return;
+}
+
+/**
+ * @brief Check the next batch of a range for better names.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in,out] last The highest id already checked, moved to the last id of this batch.
+ * @param[in] end The highest id of the range.
+ * @retval uint_t The number of releases checked, less than #CFG_REL_FIX_BATCH once the range is exhausted.
+ */
+const uint_t JobFixNames::Batch( DBConn* db, uint_t& last, const uint_t& end )
+{
+    vector<vector<string>> result;
+    vector<Release> releases;
+    unordered_map<uint_t,uint_t> index;
+    unordered_map<string,pair<uint_t,string>> titles, hashes;
+    unordered_map<string,pair<uint_t,string>>::iterator match;
+    Release release;
+    string ids, others, lookup, md5s;
+    uint_t i = 0, y = 0, id = 0;
+
+    result = db->Query( Utils::FormatString( 0, "SELECT id, searchname, categoryid IN (%s) FROM releases WHERE id > %lu AND id <= %lu AND %s%s ORDER BY id LIMIT %lu",
+        CFG_REL_FIX_OTHER, last, end, CSTR( Pending() ), CSTR( g_global->m_cluster->Filter( "id" ) ), CFG_REL_FIX_BATCH ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+        return 0;
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        release.id = uintmin_t;
+        stringstream( result[i][0] ) >> release.id;
+        release.searchname = result[i][1];
+        release.other = result[i][2] == "1";
+        release.pre = uintmin_t;
+        release.source = FIXNAMES_SOURCE_PREDB;
+        release.has_nfo = false;
+        release.has_files = false;
+
+        index[release.id] = releases.size();
+        ids.append( ( ids.empty() ? "" : ", " ) + result[i][0] );
+        if ( release.other )
+            others.append( ( others.empty() ? "" : ", " ) + result[i][0] );
+
+        // An MD5 as the name is the hash of the real name, which PreDB keeps
+        if ( release.other && release.searchname.length() == 32 && release.searchname.find_first_not_of( "0123456789abcdef" ) == string::npos )
+            md5s.append( ( md5s.empty() ? "'" : ", '" ) + release.searchname + "'" );
+
+        releases.push_back( release );
+        last = release.id;
+    }
+
+    // NFOs can be large, so candidates are taken from each row as it arrives
+    db->Stream( "SELECT releaseid, UNCOMPRESS(nfo) FROM release_nfos WHERE releaseid IN (" + ids + ")", [&]( const vector<string>& row ) -> bool
+    {
+        if ( index.count( id = ::strtoul( CSTR( row[0] ), NULL, 10 ) ) > 0 )
+        {
+            Candidates( row[1], releases[index[id]].nfo );
+            releases[index[id]].has_nfo = true;
+        }
+
+        return true;
+    } );
+
+    if ( !others.empty() )
+        db->Stream( "SELECT releaseid, name FROM release_files WHERE releaseid IN (" + others + ")", [&]( const vector<string>& row ) -> bool
+        {
+            if ( index.count( id = ::strtoul( CSTR( row[0] ), NULL, 10 ) ) > 0 )
+            {
+                Candidates( row[1], releases[index[id]].files );
+                releases[index[id]].has_files = true;
+            }
+
+            return true;
+        } );
+
+    for ( i = 0; i < releases.size(); i++ )
+    {
+        for ( y = 0; y < releases[i].nfo.size(); y++ )
+            lookup.append( ( lookup.empty() ? "'" : ", '" ) + db->Escape( releases[i].nfo[y] ) + "'" );
+        for ( y = 0; y < releases[i].files.size(); y++ )
+            lookup.append( ( lookup.empty() ? "'" : ", '" ) + db->Escape( releases[i].files[y] ) + "'" );
+    }
+
+    // One PreDB query covers every candidate and hash of the batch
+    if ( !lookup.empty() || !md5s.empty() )
+    {
+        result = db->Query( "SELECT id, title, md5 FROM predb WHERE " + ( lookup.empty() ? string( "0" ) : "title IN (" + lookup + ")" ) +
+            ( md5s.empty() ? string( "" ) : " OR md5 IN (" + md5s + ")" ) );
+
+        for ( i = 1; i < result.size(); i++ )
+        {
+            id = uintmin_t;
+            stringstream( result[i][0] ) >> id;
+            titles[result[i][1]] = make_pair( id, result[i][1] );
+            hashes[result[i][2]] = make_pair( id, result[i][1] );
+        }
+    }
+
+    for ( i = 0; i < releases.size(); i++ )
+    {
+        Release& target = releases[i];
+
+        // PreDB first, then the NFO, then the file names
+        if ( target.other && ( match = hashes.find( target.searchname ) ) != hashes.end() )
+        {
+            target.name = match->second.second;
+            target.pre = match->second.first;
+        }
+
+        for ( y = 0; target.name.empty() && y < target.nfo.size() + target.files.size(); y++ )
+        {
+            if ( ( match = titles.find( y < target.nfo.size() ? target.nfo[y] : target.files[y - target.nfo.size()] ) ) != titles.end() )
+            {
+                target.name = match->second.second;
+                target.pre = match->second.first;
+            }
+        }
+
+        // Without PreDB to confirm it, a name found in the text only replaces one nZEDb could not categorize
+        if ( target.other && target.name.empty() && !target.nfo.empty() )
+        {
+            target.name = target.nfo[0];
+            target.source = FIXNAMES_SOURCE_NFO;
+        }
+
+        if ( target.other && target.name.empty() && !target.files.empty() )
+        {
+            target.name = target.files[0];
+            target.source = FIXNAMES_SOURCE_FILES;
+        }
+
+        if ( target.name == target.searchname )
+            target.name.clear();
+    }
+
+    Apply( db, releases );
+
+    lock_guard<mutex> lock( m_mutex );
+
+    m_checked += releases.size();
+    for ( i = 0; i < releases.size(); i++ )
+        if ( !releases[i].name.empty() )
+            m_renamed[releases[i].source]++;
+
+    return releases.size();
+}
+
+/**
+ * @brief Find scene style release names, such as Show.Name.S01E01.720p.HDTV.x264-GROUP, within text.
+ * @param[in] text An NFO or file name.
+ * @param[in,out] names Names found that are not already present are appended.
+ * @retval void
+ */
+const void JobFixNames::Candidates( const string& text, vector<string>& names )
+{
+    // At least three parts joined by dots or underscores, ending in -GROUP
+    static const regex scene( "[A-Za-z0-9][A-Za-z0-9()'+&-]*(?:[._][A-Za-z0-9()'+&-]+){2,}-[A-Za-z0-9]{2,15}(?![A-Za-z0-9-])" );
+    sregex_iterator it( text.begin(), text.end(), scene ), end;
+
+    for ( ; it != end; it++ )
+        if ( it->length() >= 10 && find( names.begin(), names.end(), it->str() ) == names.end() )
+            names.push_back( it->str() );
+
+    return;
+}
+
+/**
+ * @brief Returns the condition selecting releases with a naming source that has not been checked yet.
+ * NFOs are checked for every release, file names and PreDB hashes only for those in #CFG_REL_FIX_OTHER.
+ * @retval string A condition for a WHERE clause on the releases table.
+ */
+const string JobFixNames::Pending()
+{
+    return Utils::FormatString( 0, "isrenamed = 0 AND ( ( nfostatus = 1 AND proc_nfo = 0 ) OR "
+        "( proc_files = 0 AND categoryid IN (%s) AND id IN (SELECT releaseid FROM release_files) ) )", CFG_REL_FIX_OTHER );
+}
+
+/**
+ * @brief The worker task for a range of release ids, walked once in batches.
+ * @param[in] first The id before the range.
+ * @param[in] last The last id of the range.
+ * @retval void
+ */
+const void JobFixNames::Range( const uint_t& first, const uint_t& last )
+{
+    DBConn* db = NULL;
+    uint_t position = first;
+
+    // There can be more ranges than connectors, so wait for one to free up
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        while ( !g_global->m_shutdown && position < last && Batch( db, position, last ) == CFG_REL_FIX_BATCH );
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobFixNames class.
+ */
+JobFixNames::JobFixNames() : Job::Job( "fixnames", 360 )
+{
+    uint_t i = 0;
+
+    m_outstanding = uintmin_t;
+    m_checked = uintmin_t;
+    for ( i = 0; i < MAX_FIXNAMES_SOURCE; i++ )
+        m_renamed[i] = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobFixNames class.
+ */
+JobFixNames::~JobFixNames()
+{
+    return;
+}
@@ -0,0 +1,255 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_optimize.cpp
+ * @brief All non-template member functions of the JobOptimize class.
+ *
+ * The JobOptimize class replaces optimize_db.php, which rebuilt every
+ * table each hour whether it needed it or not. Each run instead reads the
+ * free space of every table from information_schema and rebuilds at most
+ * the one with the most to reclaim, provided that is at least
+ * #CFG_DB_OPT_FREE_MIN bytes and #CFG_DB_OPT_FREE_RATIO of the table.
+ * Nothing is started while tasks are queued on the WorkerPool or replication
+ * is lagging, and a rebuild waits for every other job to be idle unless it
+ * has already waited #CFG_DB_OPT_MAX_DEFER seconds. The rebuild itself runs
+ * on the WorkerPool so the update loop carries on.
+ */
+#include "h/includes.h"
+#include "h/job_optimize.h"
+
+#include "h/cluster.h"
+#include "h/dbconn.h"
+#include "h/list.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Pick the table most in need of rebuilding and start on it if the server can spare the I/O.
+ * @retval void
+ */
+const void JobOptimize::Run()
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    string table, unknown;
+    bool quiet = false;
+    uint_t i = 0, size = 0, free = 0, best = 0;
+
+    // The tables are shared, so only one node of a cluster rebuilds them
+    if ( !g_global->m_cluster->Leader() )
+    {
+        Finish();
+
+        return;
+    }
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobOptimize::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    if ( Busy( quiet, unknown ) )
+    {
+        Finish();
+
+        return;
+    }
+
+    result = db->Query( "SELECT table_name, data_length + index_length, data_free FROM information_schema.tables WHERE table_schema = DATABASE() AND engine IN ('InnoDB', 'MyISAM', 'Aria')" );
+
+    // The first row of a result set is metadata
+    for ( i = 1; i < result.size(); i++ )
+    {
+        stringstream( result[i][1] ) >> size;
+        stringstream( result[i][2] ) >> free;
+
+        if ( free < CFG_DB_OPT_FREE_MIN || free < ( size + free ) * CFG_DB_OPT_FREE_RATIO || free <= best )
+            continue;
+
+        if ( m_done.count( result[i][0] ) > 0 && chrono::duration_cast<chrono::seconds>( g_global->m_time_current - m_done[result[i][0]] ).count() < CFG_DB_OPT_COOLDOWN )
+            continue;
+
+        table = result[i][0];
+        best = free;
+    }
+
+    if ( table.empty() )
+    {
+        m_waiting = chrono::high_resolution_clock::time_point();
+        Finish();
+
+        return;
+    }
+
+    // Other jobs being busy only delays a rebuild for so long, or a server that never idles would never be tidied
+    if ( !quiet )
+    {
+        if ( m_waiting == chrono::high_resolution_clock::time_point() )
+            m_waiting = g_global->m_time_current;
+
+        if ( chrono::duration_cast<chrono::seconds>( g_global->m_time_current - m_waiting ).count() < CFG_DB_OPT_MAX_DEFER )
+        {
+            Finish();
+
+            return;
+        }
+    }
+
+    LOGFMT( iflags, "JobOptimize::Run()-> rebuilding %s to reclaim %luMB", CSTR( table ), best / 1048576 );
+
+    if ( !unknown.empty() )
+        LOGFMT( flags, "JobOptimize::Run()-> not waiting on %s, lag unknown", CSTR( unknown ) );
+
+    m_after = uintmin_t;
+    m_before = best;
+    m_running = true;
+    m_start = chrono::high_resolution_clock::now();
+    m_table = table;
+    m_waiting = chrono::high_resolution_clock::time_point();
+
+    g_global->m_workers->Submit( [this, table]() { Optimize( table ); }, gClass() );
+
+    return;
+}
+
+/**
+ * @brief Finish the run once the table has been rebuilt.
+ * @retval void
+ */
+const void JobOptimize::Update()
+{
+    UFLAGS_I( flags );
+
+    if ( m_running )
+        return;
+
+    LOGFMT( flags, "JobOptimize::Update()-> %s rebuilt in %.1fs, free space went from %luMB to %luMB", CSTR( m_table ),
+        chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count(), m_before / 1048576, static_cast<uint_t>( m_after ) / 1048576 );
+
+    m_done[m_table] = g_global->m_time_current;
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Check whether the server is too loaded to start a rebuild.
+ * @param[out] quiet Whether every other job is idle.
+ * @param[out] unknown The host:port of each replica not waited on because it has not been measured replicating, separated by commas.
+ * @retval bool True if tasks are queued on the WorkerPool past #CFG_DB_OPT_MAX_PENDING, or a replica lags past #CFG_DB_OPT_MAX_LAG.
+ */
+const bool JobOptimize::Busy( bool& quiet, string& unknown )
+{
+    ITER( vector, Job*, vi );
+    ITER( vector, DBConn*, di );
+    set<string> replicas;
+    ITER( set, string, si );
+
+    if ( g_global->m_workers->gPending() > CFG_DB_OPT_MAX_PENDING )
+        return true;
+
+    // The rebuild is replayed by every replica, so it waits on the lag Main::PollReplicas() last measured for each of them; one with no lag to wait on would hold it back for good
+    {
+        lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+
+        for ( di = dbconn_list.begin(); di != dbconn_list.end(); di++ )
+        {
+            if ( ( *di )->gRole() != DBCONN_ROLE_REPLICA )
+                continue;
+
+            if ( ( *di )->gLag() < 0 )
+                replicas.insert( ( *di )->gHost() + ":" + ( *di )->gSocket() );
+            else if ( static_cast<uint_t>( ( *di )->gLag() ) > CFG_DB_OPT_MAX_LAG )
+                return true;
+        }
+    }
+
+    for ( si = replicas.begin(); si != replicas.end(); si++ )
+        unknown += ( unknown.empty() ? "" : ", " ) + *si;
+
+    quiet = true;
+
+    for ( vi = job_list.begin(); vi != job_list.end(); vi++ )
+        if ( *vi != this && ( *vi )->gStatus() == JOB_STATUS_RUNNING )
+            quiet = false;
+
+    return false;
+}
+
+/**
+ * @brief The worker task that rebuilds a table and measures what is left free afterwards.
+ * @param[in] table The table to rebuild.
+ * @retval void
+ */
+const void JobOptimize::Optimize( const string& table )
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    uint_t free = 0;
+
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        // OPTIMIZE returns a result set that has to be read even though only its success matters
+        if ( db->Query( "OPTIMIZE TABLE `" + table + "`" ).size() < 2 )
+            LOGFMT( flags, "JobOptimize::Optimize()-> failed to rebuild %s", CSTR( table ) );
+
+        result = db->Query( "SELECT data_free FROM information_schema.tables WHERE table_schema = DATABASE() AND table_name = '" + db->Escape( table ) + "'" );
+
+        if ( result.size() > 1 )
+            stringstream( result[1][0] ) >> free;
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_after = free;
+    m_running = false;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobOptimize class.
+ */
+JobOptimize::JobOptimize() : Job::Job( "optimize", 300, JOB_CLASS_CLEANUP )
+{
+    m_after = uintmin_t;
+    m_before = uintmin_t;
+    m_running = false;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobOptimize class.
+ */
+JobOptimize::~JobOptimize()
+{
+    return;
+}
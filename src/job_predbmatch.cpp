@@ -0,0 +1,302 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_predbmatch.cpp
+ * @brief All non-template member functions of the JobPreDBMatch class.
+ *
+ * The JobPreDBMatch class replaces predbftmatch.php, which asks MySQL
+ * full-text search about every unmatched release. PreDB is instead held in
+ * a TrigramIndex that each run tops up from a WorkerPool task with only the
+ * rows added since the last. Releases added since the last run are matched against the whole
+ * index, while older releases only need checking against the new rows, so
+ * they are matched against a second index of just those. Matches are
+ * written back with one UPDATE per #CFG_DB_BULK_ROWS.
+ */
+#include "h/includes.h"
+#include "h/job_predbmatch.h"
+
+#include "h/cluster.h"
+#include "h/dbconn.h"
+#include "h/statefile.h"
+#include "h/topology.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Reset the watermarks if needed, then hand loading PreDB and splitting the releases to the worker pool.
+ * @retval void
+ */
+const void JobPreDBMatch::Run()
+{
+    m_fresh.Clear();
+
+    // After a restart only what the last finished run had not seen needs matching, not every release against every title
+    if ( m_release_last == 0 )
+    {
+        m_release_last = g_global->m_state->Get( "predbmatch.release", 0 );
+        m_predb_matched = g_global->m_state->Get( "predbmatch.predb", 0 );
+    }
+
+    // The watermarks only cover the shards held when they were set, so taking over shards from another node starts a full pass
+    if ( g_global->m_cluster->Filter( "id" ) != m_shards )
+    {
+        m_shards = g_global->m_cluster->Filter( "id" );
+        m_release_last = uintmin_t;
+        m_predb_matched = uintmin_t;
+    }
+
+    m_checked = uintmin_t;
+    m_matched = uintmin_t;
+    m_start = chrono::high_resolution_clock::now();
+
+    // A full load streams all of predb, which must not hold up the main thread
+    m_outstanding++;
+    g_global->m_workers->Submit( [this]() { Load(); }, gClass() );
+
+    return;
+}
+
+/**
+ * @brief Finish the run once every range task has returned.
+ * @retval void
+ */
+const void JobPreDBMatch::Update()
+{
+    UFLAGS_I( flags );
+    double seconds = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+
+    if ( m_checked > 0 )
+        LOGFMT( flags, "JobPreDBMatch::Update()-> %lu releases checked, %lu matched in %.2fs: %.1f releases/sec",
+            static_cast<uint_t>( m_checked ), static_cast<uint_t>( m_matched ), seconds, seconds > 0 ? m_checked / seconds : 0 );
+
+    m_predb_matched = m_predb_last;
+    g_global->m_state->Set( "predbmatch.release", m_release_last );
+    g_global->m_state->Set( "predbmatch.predb", m_predb_matched );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief The worker task that adds new PreDB rows to the index, then splits the releases that need checking across the worker pool.
+ * @retval void
+ */
+const void JobPreDBMatch::Load()
+{
+    UFLAGS_I( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    Topology::Placement placement;
+    uint_t newest = 0, id = 0;
+
+    // Loading PreDB is the heaviest read of any job, so it goes to a replica when one is close enough behind
+    db = Main::WaitDBConn( DBCONN_ROLE_REPLICA );
+
+    if ( db == NULL )
+    {
+        m_outstanding--;
+        return;
+    }
+
+    // Every worker matches against the index, so it is spread across the nodes rather than left on the node of this one
+    placement = g_global->m_topology->Interleave();
+
+    // Before the first full pass every release is checked against the whole index anyway
+    db->Stream( Utils::FormatString( 0, "SELECT id, title FROM predb WHERE id > %lu ORDER BY id", m_predb_last ), [&]( const vector<string>& row ) -> bool
+    {
+        id = ::strtoul( CSTR( row[0] ), NULL, 10 );
+
+        m_index.Add( id, row[1] );
+        if ( m_release_last > 0 && id > m_predb_matched )
+            m_fresh.Add( id, row[1] );
+        m_predb_last = max( m_predb_last, id );
+
+        return true;
+    } );
+
+    g_global->m_topology->Restore( placement );
+
+    result = db->Query( "SELECT MAX(id) FROM releases" );
+    Main::ReleaseDBConn( db );
+
+    // The first row of a result set is metadata
+    if ( result.size() > 1 )
+        stringstream( result[1][0] ) >> newest;
+
+    if ( m_fresh.gTitles() > 0 )
+        LOGFMT( flags, "JobPreDBMatch::Load()-> %lu new PreDB titles, %lu indexed by %lu trigrams in %luKB", m_fresh.gTitles(), m_index.gTitles(), m_index.gTrigrams(), m_index.gBytes() / 1024 );
+
+    if ( newest > m_release_last )
+        Split( m_index, m_release_last, newest );
+
+    if ( m_fresh.gTitles() > 0 )
+        Split( m_fresh, 0, m_release_last );
+
+    m_release_last = max( m_release_last, newest );
+
+    // The range tasks were counted before this one, so Update() cannot finish the run in between
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Match the next batch of a range and write back any matches.
+ * @param[in] reader The database connector the batch is read through, which may be a replica.
+ * @param[in] db The database connector matches are written through.
+ * @param[in] index The titles to match against.
+ * @param[in,out] last The highest id already checked, moved to the last id of this batch.
+ * @param[in] end The highest id of the range.
+ * @retval uint_t The number of releases checked, less than #CFG_REL_PRE_BATCH once the range is exhausted.
+ */
+const uint_t JobPreDBMatch::Batch( DBConn* reader, DBConn* db, const TrigramIndex& index, uint_t& last, const uint_t& end )
+{
+    UFLAGS_DE( flags );
+    vector<vector<string>> result;
+    string pres, names, ids, title;
+    uint_t i = 0, rows = 0, pre = 0;
+    double score = 0;
+
+    result = reader->Query( Utils::FormatString( 0, "SELECT id, searchname FROM releases WHERE id > %lu AND id <= %lu AND preid = 0%s ORDER BY id LIMIT %lu",
+        last, end, CSTR( g_global->m_cluster->Filter( "id" ) ), CFG_REL_PRE_BATCH ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+        return 0;
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        if ( index.Match( result[i][1], CFG_REL_PRE_SIMILARITY, pre, title, score ) )
+        {
+            pres.append( Utils::FormatString( 0, " WHEN %s THEN %lu", CSTR( result[i][0] ), pre ) );
+            if ( title != result[i][1] )
+                names.append( " WHEN " + result[i][0] + " THEN '" + db->Escape( title ) + "'" );
+            ids.append( ( ids.empty() ? "" : ", " ) + result[i][0] );
+            rows++;
+        }
+
+        if ( rows == 0 || ( rows < CFG_DB_BULK_ROWS && i + 1 < result.size() ) )
+            continue;
+
+        // A release given the PreDB title is categorized again from it
+        if ( db->Execute( "UPDATE releases SET preid = CASE id" + pres + " END" + ( names.empty() ? string( "" ) : ", searchname = CASE id" + names + " ELSE searchname END, isrenamed = 1, iscategorized = 0" ) +
+            " WHERE id IN (" + ids + ")" ) < 0 )
+            LOGFMT( flags, "JobPreDBMatch::Batch()-> failed to match %lu releases", rows );
+
+        m_matched += rows;
+        pres.clear();
+        names.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    stringstream( result[result.size() - 1][0] ) >> last;
+    m_checked += result.size() - 1;
+
+    return result.size() - 1;
+}
+
+/**
+ * @brief The worker task for a range of release ids, walked once in batches.
+ * @param[in] index The titles to match against.
+ * @param[in] first The id before the range.
+ * @param[in] last The last id of the range.
+ * @retval void
+ */
+const void JobPreDBMatch::Range( const TrigramIndex& index, const uint_t& first, const uint_t& last )
+{
+    DBConn* db = NULL, * reader = NULL;
+    uint_t position = first;
+
+    // There can be more ranges than connectors, so wait for one to free up
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        // Without a replica fit for reads this hands back db itself
+        if ( ( reader = Main::AcquireDBConn( DBCONN_ROLE_REPLICA ) ) == NULL )
+            reader = db;
+
+        while ( !g_global->m_shutdown && position < last && Batch( reader, db, index, position, last ) == CFG_REL_PRE_BATCH );
+
+        if ( reader != db )
+            Main::ReleaseDBConn( reader );
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Split a range of release ids into one task per worker thread.
+ * @param[in] index The titles the range is matched against.
+ * @param[in] first The id before the range.
+ * @param[in] last The last id of the range.
+ * @retval void
+ */
+const void JobPreDBMatch::Split( const TrigramIndex& index, const uint_t& first, const uint_t& last )
+{
+    const TrigramIndex* titles = &index;
+    uint_t width = ( last - first ) / g_global->m_workers->gThreads() + 1, low = 0, high = 0;
+
+    // Each range is ( low, high ], together covering every id once
+    for ( low = first; low < last; low = high )
+    {
+        high = min( low + width, last );
+
+        m_outstanding++;
+        g_global->m_workers->Submit( [this, titles, low, high]() { Range( *titles, low, high ); }, gClass() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobPreDBMatch class.
+ */
+JobPreDBMatch::JobPreDBMatch() : Job::Job( "predbmatch", 240 )
+{
+    m_checked = uintmin_t;
+    m_matched = uintmin_t;
+    m_outstanding = uintmin_t;
+    m_predb_last = uintmin_t;
+    m_predb_matched = uintmin_t;
+    m_release_last = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobPreDBMatch class.
+ */
+JobPreDBMatch::~JobPreDBMatch()
+{
+    return;
+}
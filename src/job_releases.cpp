@@ -0,0 +1,495 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_releases.cpp
+ * @brief All non-template member functions of the JobReleases class.
+ *
+ * The JobReleases class replaces update_releases.php. Completeness is read
+ * straight from the binaries the Collator wrote, so each batch of complete
+ * collections costs a fixed number of queries: one each for the collections,
+ * binaries, and parts, then a single transaction that inserts the releases
+ * and removes what they were built from. Parts are streamed from the
+ * server into an NzbWriter as they arrive rather than held for the batch,
+ * and the NZBs are written in the background until the transaction needs
+ * them on disk.
+ * Groups are spread across the WorkerPool, each task holding its own
+ * database connector.
+ */
+#include "h/includes.h"
+#include "h/job_releases.h"
+
+#include "h/bulkwriter.h"
+#include "h/cluster.h"
+#include "h/dbconn.h"
+#include "h/nzbwriter.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Queue a task per group that has collections waiting.
+ * @retval void
+ */
+const void JobReleases::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    uint_t i = 0, id = 0;
+    string name;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobReleases::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    m_nzb_path.clear();
+    m_split_level = 1;
+
+    result = *db->Cached( "SELECT setting, value FROM settings WHERE setting IN ('nzbpath', 'nzbsplitlevel')" );
+
+    // The first row of a result set is metadata
+    for ( i = 1; i < result.size(); i++ )
+    {
+        if ( result[i][0] == "nzbpath" )
+            m_nzb_path = result[i][1];
+        else
+            stringstream( result[i][1] ) >> m_split_level;
+    }
+
+    while ( m_nzb_path.length() > 1 && m_nzb_path[m_nzb_path.length() - 1] == '/' )
+        m_nzb_path.erase( m_nzb_path.length() - 1 );
+
+    if ( m_nzb_path.empty() )
+    {
+        LOGSTR( flags, "JobReleases::Run()-> nzbpath is not set" );
+        Finish();
+
+        return;
+    }
+
+    result = db->Query( "SELECT DISTINCT g.id, g.name FROM groups g INNER JOIN collections c ON c.groupid = g.id" );
+
+    if ( result.size() < 2 )
+    {
+        Finish();
+
+        return;
+    }
+
+    m_collections = uintmin_t;
+    m_failed = uintmin_t;
+    m_latency_max = 0;
+    m_latency_total = 0;
+    m_start = chrono::high_resolution_clock::now();
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        id = uintmin_t;
+        stringstream( result[i][0] ) >> id;
+        name = result[i][1];
+
+        // Groups are assembled by the node that fetches them
+        if ( !g_global->m_cluster->Owns( id ) )
+            continue;
+
+        m_outstanding++;
+        g_global->m_workers->Submit( [this, id, name]() { Group( id, name ); }, gClass() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Finish the run once every group task has returned.
+ * @retval void
+ */
+const void JobReleases::Update()
+{
+    UFLAGS_I( flags );
+    double seconds = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+
+    if ( m_collections > 0 || m_failed > 0 )
+        LOGFMT( flags, "JobReleases::Update()-> %lu releases in %.2fs: %.1f releases/sec, latency avg %.1fs max %.1fs, %lu batches rolled back",
+            m_collections, seconds, seconds > 0 ? m_collections / seconds : 0, m_collections > 0 ? m_latency_total / m_collections : 0, m_latency_max, m_failed );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Turn one batch of a group's complete collections into releases.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in] group The id of the group in the groups table.
+ * @param[in] name The name of the group.
+ * @retval uint_t The number of releases created, 0 if none were waiting or the batch was rolled back.
+ */
+const uint_t JobReleases::Assemble( DBConn* db, const uint_t& group, const string& name )
+{
+    UFLAGS_DE( flags );
+    vector<vector<string>> result;
+    vector<Collection> collections;
+    vector<Binary> binaries;
+    unordered_map<uint_t,uint_t> index;
+    BulkWriter releases( "releases", { "name", "searchname", "totalpart", "groupid", "size", "postdate", "adddate", "guid", "fromname", "completion", "categoryid", "nzbstatus" } );
+    Collection collection;
+    Binary binary;
+    string ids, bids, release;
+    uint_t i = 0, id = 0;
+    time_t now = 0;
+    double latency = 0;
+    bool valid = true;
+
+    // Complete means every file has arrived with all of its parts, or nothing new arrived within CFG_REL_DELAY
+    result = db->Query( Utils::FormatString( 0, "SELECT c.id, c.subject, c.fromname, c.date, UNIX_TIMESTAMP(c.date), UNIX_TIMESTAMP(c.dateadded), COUNT(b.id), SUM(b.partsize), SUM(b.currentparts), SUM(b.totalparts) "
+        "FROM collections c INNER JOIN binaries b ON b.collectionid = c.id WHERE c.groupid = %lu GROUP BY c.id "
+        "HAVING ( COUNT(b.id) >= c.totalfiles AND SUM(b.partcheck) = COUNT(b.id) ) OR c.dateadded < NOW() - INTERVAL %lu MINUTE ORDER BY c.dateadded LIMIT %lu",
+        group, CFG_REL_DELAY, CFG_REL_BATCH ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+        return 0;
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        collection.id = collection.posted = collection.complete = collection.files = collection.size = collection.parts = collection.total = uintmin_t;
+        stringstream( result[i][0] ) >> collection.id;
+        collection.subject = result[i][1];
+        collection.from = result[i][2];
+        collection.date = result[i][3];
+        stringstream( result[i][4] ) >> collection.posted;
+        stringstream( result[i][5] ) >> collection.complete;
+        stringstream( result[i][6] ) >> collection.files;
+        stringstream( result[i][7] ) >> collection.size;
+        stringstream( result[i][8] ) >> collection.parts;
+        stringstream( result[i][9] ) >> collection.total;
+
+        index[collection.id] = collections.size();
+        ids.append( ( ids.empty() ? "" : ", " ) + result[i][0] );
+        collections.push_back( collection );
+    }
+
+    result = db->Query( "SELECT id, collectionid, name, totalparts FROM binaries WHERE collectionid IN (" + ids + ") ORDER BY collectionid, filenumber, name, id" );
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        binary.id = binary.total = id = uintmin_t;
+        stringstream( result[i][0] ) >> binary.id;
+        stringstream( result[i][1] ) >> id;
+        stringstream( result[i][3] ) >> binary.total;
+        binary.collection = index[id];
+        binary.name = result[i][2];
+
+        bids.append( ( bids.empty() ? "" : ", " ) + result[i][0] );
+        binaries.push_back( binary );
+    }
+
+    if ( binaries.empty() )
+        return 0;
+
+    for ( i = 0; i < collections.size(); i++ )
+        collections[i].guid = Utils::SHA1( Utils::FormatString( 0, "%lu %lu %ld", group, collections[i].id,
+            static_cast<sint_t>( chrono::high_resolution_clock::now().time_since_epoch().count() ) ) + collections[i].subject );
+
+    valid = Nzb( db, collections, binaries, ids, name );
+    now = ::time( NULL );
+
+    for ( i = 0; valid && i < collections.size(); i++ )
+    {
+        Collection& target = collections[i];
+
+        release = Name( target.subject );
+
+        // Category 7010 is Misc until JobCategorize, or nZEDb's recategorize pass while it is read only, categorizes the release
+        releases.Add( { release, release, Utils::FormatString( 0, "%lu", target.parts ), Utils::FormatString( 0, "%lu", group ),
+            Utils::FormatString( 0, "%lu", target.size ), target.date, Utils::StrDateTime( now ), target.guid, target.from,
+            Utils::FormatString( 0, "%lu", target.total > 0 ? min( target.parts * 100 / target.total, static_cast<uint_t>( 100 ) ) : 100 ), "7010", "1" } );
+    }
+
+    // The releases only become visible once the rows they replace are gone
+    if ( valid )
+        valid = db->Execute( "START TRANSACTION" ) >= 0 && releases.Flush() &&
+            db->Execute( "DELETE FROM parts WHERE binaryid IN (" + bids + ")" ) >= 0 &&
+            db->Execute( "DELETE FROM binaries WHERE collectionid IN (" + ids + ")" ) >= 0 &&
+            db->Execute( "DELETE FROM collections WHERE id IN (" + ids + ")" ) >= 0 &&
+            db->Execute( "COMMIT" ) >= 0;
+
+    if ( !valid )
+    {
+        db->Execute( "ROLLBACK" );
+        releases.Clear();
+
+        for ( i = 0; i < collections.size(); i++ )
+            if ( !collections[i].nzb.empty() )
+                ::unlink( CSTR( collections[i].nzb ) );
+
+        LOGFMT( flags, "JobReleases::Assemble()-> %s: batch of %lu collections rolled back", CSTR( name ), collections.size() );
+
+        lock_guard<mutex> lock( m_mutex );
+        m_failed++;
+
+        return 0;
+    }
+
+    now = ::time( NULL );
+
+    lock_guard<mutex> lock( m_mutex );
+
+    for ( i = 0; i < collections.size(); i++ )
+    {
+        latency = collections[i].complete > 0 && now > collections[i].complete ? now - collections[i].complete : 0;
+        m_latency_total += latency;
+        m_latency_max = max( m_latency_max, latency );
+    }
+
+    m_collections += collections.size();
+
+    return collections.size();
+}
+
+/**
+ * @brief The worker task for a single group. Batches are assembled until the group runs dry or #CFG_REL_MAX_BATCHES is reached.
+ * @param[in] group The id of the group in the groups table.
+ * @param[in] name The name of the group.
+ * @retval void
+ */
+const void JobReleases::Group( const uint_t& group, const string& name )
+{
+    DBConn* db = NULL;
+    uint_t batch = 0;
+
+    // There can be more groups than connectors, so wait for one to free up
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        for ( batch = 0; batch < CFG_REL_MAX_BATCHES && Assemble( db, group, name ) == CFG_REL_BATCH; batch++ );
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Build a release name from a collection subject.
+ * @param[in] subject The subject of the collection.
+ * @retval string The text outside of the quoted file name if it looks like a name, otherwise the file name without its archive or parity extensions.
+ */
+const string JobReleases::Name( const string& subject )
+{
+    string file, output, ext;
+    string::size_type first = subject.find( '"' ), last = subject.rfind( '"' ), i = 0, end = 0;
+
+    if ( first != string::npos && last > first )
+        file = subject.substr( first + 1, last - first - 1 );
+
+    for ( i = 0; i < subject.length(); i++ )
+    {
+        if ( i == first && last > first )
+        {
+            i = last;
+            continue;
+        }
+
+        // Drop [01/20] and (01/20) counters and the yEnc marker
+        if ( subject[i] == '[' || subject[i] == '(' )
+        {
+            end = subject.find_first_not_of( "0123456789/ ", i + 1 );
+
+            if ( end != string::npos && end > i + 1 && subject[end] == ( subject[i] == '[' ? ']' : ')' ) && subject.find( '/', i ) < end )
+            {
+                i = end;
+                continue;
+            }
+        }
+
+        if ( subject.compare( i, 4, "yEnc" ) == 0 )
+        {
+            i += 3;
+            continue;
+        }
+
+        output.push_back( subject[i] );
+    }
+
+    while ( !output.empty() && string( " -_[]()" ).find( output[output.length() - 1] ) != string::npos )
+        output.erase( output.length() - 1 );
+    while ( !output.empty() && string( " -_[]()" ).find( output[0] ) != string::npos )
+        output.erase( 0, 1 );
+
+    if ( output.length() >= 10 || file.empty() )
+        return output.empty() ? subject : output;
+
+    // Strip extensions such as .part01.rar, .vol00+01.par2, .r00, and .001 from the end
+    while ( ( end = file.rfind( '.' ) ) != string::npos && end > 0 )
+    {
+        ext = file.substr( end + 1 );
+        transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+
+        if ( ext == "rar" || ext == "par2" || ext == "par" || ext == "nfo" || ext == "sfv" || ext == "nzb" || ext == "zip" || ext == "7z" || ext == "srr" ||
+            ( ext.length() > 4 && ext.compare( 0, 4, "part" ) == 0 && ::isdigit( ext[4] ) ) ||
+            ( ext.length() > 3 && ext.compare( 0, 3, "vol" ) == 0 && ::isdigit( ext[3] ) ) ||
+            ( ext.length() == 3 && ( ext[0] == 'r' || ::isdigit( ext[0] ) ) && ::isdigit( ext[1] ) && ::isdigit( ext[2] ) ) )
+            file.erase( end );
+        else
+            break;
+    }
+
+    return file;
+}
+
+/**
+ * @brief Stream the parts of a batch straight from the database into one gzipped NZB per collection.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in,out] collections The collections of the batch. The path of each NZB written is stored so it may be removed if the batch is rolled back.
+ * @param[in] binaries Every binary of the batch, in the order they are listed within the NZBs.
+ * @param[in] ids The ids of the collections as a comma separated list.
+ * @param[in] group The name of the group.
+ * @retval bool False if any NZB could not be written.
+ */
+const bool JobReleases::Nzb( DBConn* db, vector<Collection>& collections, const vector<Binary>& binaries, const string& ids, const string& group )
+{
+    UFLAGS_DE( flags );
+    NzbWriter writer;
+    string path;
+    uint_t next = 0, current = collections.size(), id = 0, number = 0, size = 0;
+    bool valid = true;
+
+    // Start the file element of the next binary, moving on to the next NZB when the collection changes
+    auto step = [&]() -> bool
+    {
+        if ( next >= binaries.size() )
+        {
+            LOGFMT( flags, "JobReleases::Nzb()-> %s: part of binary %lu arrived out of order", CSTR( group ), id );
+            return false;
+        }
+
+        if ( binaries[next].collection != current )
+        {
+            if ( current < collections.size() && !writer.Close() )
+                return false;
+
+            current = binaries[next].collection;
+
+            if ( ( path = Path( collections[current].guid ) ).empty() || !writer.Open( path, Name( collections[current].subject ) ) )
+                return false;
+
+            collections[current].nzb = path;
+        }
+
+        next++;
+
+        return writer.File( collections[current].from, collections[current].posted, binaries[next - 1].name, binaries[next - 1].total, group );
+    };
+
+    // Parts arrive in the same order as the binaries, so nothing more than the current row is held
+    valid = db->Stream( "SELECT p.binaryid, p.messageid, p.partnumber, p.size FROM parts p INNER JOIN binaries b ON b.id = p.binaryid "
+        "WHERE b.collectionid IN (" + ids + ") ORDER BY b.collectionid, b.filenumber, b.name, b.id, p.partnumber",
+        [&]( const vector<string>& row ) -> bool
+        {
+            id = ::strtoul( CSTR( row[0] ), NULL, 10 );
+            number = ::strtoul( CSTR( row[2] ), NULL, 10 );
+            size = ::strtoul( CSTR( row[3] ), NULL, 10 );
+
+            while ( valid && ( next == 0 || binaries[next - 1].id != id ) )
+                valid = step();
+
+            if ( valid )
+                valid = writer.Segment( size, number, row[1] );
+
+            return valid;
+        } ) && valid;
+
+    // Binaries without any parts still get a file element
+    while ( valid && next < binaries.size() )
+        valid = step();
+
+    if ( valid && current < collections.size() )
+        valid = writer.Close();
+
+    if ( !valid )
+        writer.Abort();
+
+    // The releases may not be inserted before their NZBs are on disk
+    valid = writer.Finish() && valid;
+
+    return valid;
+}
+
+/**
+ * @brief Create the directories an NZB is split into by the first characters of its guid, as nZEDb does.
+ * @param[in] guid The guid of the release.
+ * @retval string The path to write the NZB to, or an empty string if a directory could not be created.
+ */
+const string JobReleases::Path( const string& guid )
+{
+    UFLAGS_DE( flags );
+    string path( m_nzb_path );
+    uint_t i = 0;
+
+    for ( i = 0; i < m_split_level && i < guid.length(); i++ )
+    {
+        path.append( "/" + guid.substr( i, 1 ) );
+
+        if ( ::mkdir( CSTR( path ), 0755 ) != 0 && errno != EEXIST )
+        {
+            LOGERRNO( flags, "JobReleases::Path()->mkdir()->" );
+            return "";
+        }
+    }
+
+    return path + "/" + guid + ".nzb.gz";
+}
+
+/**
+ * @brief Constructor for the JobReleases class.
+ */
+JobReleases::JobReleases() : Job::Job( "releases", 120 )
+{
+    m_outstanding = uintmin_t;
+    m_collections = uintmin_t;
+    m_failed = uintmin_t;
+    m_latency_max = 0;
+    m_latency_total = 0;
+    m_split_level = 1;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobReleases class.
+ */
+JobReleases::~JobReleases()
+{
+    return;
+}
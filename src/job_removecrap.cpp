@@ -0,0 +1,522 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_removecrap.cpp
+ * @brief All non-template member functions of the JobRemoveCrap class.
+ *
+ * The JobRemoveCrap class replaces removeCrapReleases.php, which issues one
+ * DELETE with its own scan of the releases table for every rule. Recent
+ * releases are instead read once in keyset batches and held by column, the
+ * file names of a batch are folded into one bit mask per release, and each
+ * rule is a loop over the columns it needs that sets its bit in a hit mask.
+ * Flagged releases are then deleted by primary key, #CFG_DB_BULK_ROWS at a
+ * time. A dry run reports the hits and timing of every rule without
+ * deleting anything.
+ */
+#include "h/includes.h"
+#include "h/job_removecrap.h"
+
+#include "h/cluster.h"
+#include "h/collectionregex.h"
+#include "h/dbconn.h"
+#include "h/statefile.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Load the settings and blacklist, then scan the recent releases on the worker pool.
+ * @retval void
+ */
+const void JobRemoveCrap::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    vector<uint_t> captures;
+    vector<string> literals;
+    Blacklist rule;
+    uint_t i = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobRemoveCrap::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    m_nzb_path.clear();
+    m_split_level = 1;
+
+    result = *db->Cached( "SELECT setting, value FROM settings WHERE setting IN ('nzbpath', 'nzbsplitlevel')" );
+
+    // The first row of a result set is metadata
+    for ( i = 1; i < result.size(); i++ )
+    {
+        if ( result[i][0] == "nzbpath" )
+            m_nzb_path = result[i][1];
+        else
+            stringstream( result[i][1] ) >> m_split_level;
+    }
+
+    while ( m_nzb_path.length() > 1 && m_nzb_path[m_nzb_path.length() - 1] == '/' )
+        m_nzb_path.erase( m_nzb_path.length() - 1 );
+
+    m_blacklist.clear();
+    m_groups.clear();
+    m_group_rules.clear();
+
+    // Only blacklist rules on the subject apply to release names
+    result = *db->Cached( "SELECT id, groupname, regex FROM binaryblacklist WHERE status = 1 AND optype = 1 AND msgcol = 1" );
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        // Both are stored without delimiters and matched case insensitively
+        if ( !CollectionRegex::Compile( "/" + result[i][1] + "/i", rule.group, captures, literals ) || !CollectionRegex::Compile( "/" + result[i][2] + "/i", rule.pattern, captures, literals ) )
+        {
+            LOGFMT( flags, "JobRemoveCrap::Run()-> blacklist %s disabled", CSTR( result[i][0] ) );
+            continue;
+        }
+
+        m_blacklist.push_back( rule );
+    }
+
+    m_deleted = uintmin_t;
+    m_scanned = uintmin_t;
+    for ( i = 0; i < MAX_CRAP_RULE; i++ )
+    {
+        m_hits[i] = uintmin_t;
+        m_time[i] = 0;
+    }
+    m_start = chrono::high_resolution_clock::now();
+
+    m_outstanding++;
+    g_global->m_workers->Submit( [this]() { Scan(); }, gClass() );
+
+    return;
+}
+
+/**
+ * @brief Report the hits and timing of every rule once the scan has returned.
+ * @retval void
+ */
+const void JobRemoveCrap::Update()
+{
+    UFLAGS_I( flags );
+    const char* names[MAX_CRAP_RULE] = { "blacklist", "codec", "executable", "gibberish", "hashed", "huge", "installbin", "passworded", "passwordurl", "sample", "scr", "short", "size" };
+    double seconds = 0;
+    uint_t i = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+
+    LOGFMT( flags, "JobRemoveCrap::Update()-> %lu releases scanned in %.2fs, %lu %s", m_scanned, seconds, m_deleted, m_dryrun ? "would be deleted" : "deleted" );
+
+    for ( i = 0; i < MAX_CRAP_RULE; i++ )
+        if ( m_dryrun || m_hits[i] > 0 )
+            LOGFMT( flags, "JobRemoveCrap::Update()-> %-11s %8lu hits %10.3fms", names[i], m_hits[i], m_time[i] * 1000 );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Count the letters and digits a name starts with.
+ * @param[in] name The search name of a release.
+ * @retval uint_t The length of the leading run, equal to the length of the name if it has nothing else.
+ */
+const uint_t JobRemoveCrap::Alnum( const string& name )
+{
+    uint_t i = 0;
+
+    while ( i < name.length() && ::isalnum( static_cast<unsigned char>( name[i] ) ) )
+        i++;
+
+    return i;
+}
+
+/**
+ * @brief Delete the flagged releases of a batch along with their NZBs and the rows that hang off them.
+ * @param[in] db The database connector reserved by the scan.
+ * @param[in] batch A batch that has been through Evaluate().
+ * @retval void
+ */
+const void JobRemoveCrap::Delete( DBConn* db, const Batch& batch )
+{
+    UFLAGS_DE( flags );
+    const vector<string> tables = { "release_nfos", "release_files", "releaseaudio", "releasesubs", "releasevideo", "releaseextrafull" };
+    vector<string> nzbs;
+    string ids, path;
+    uint_t i = 0, y = 0, rows = 0;
+    bool valid = true;
+
+    for ( i = 0; i < batch.id.size(); i++ )
+    {
+        if ( batch.hits[i] != 0 )
+        {
+            ids.append( Utils::FormatString( 0, "%s%lu", ids.empty() ? "" : ", ", batch.id[i] ) );
+            rows++;
+
+            if ( !m_nzb_path.empty() )
+            {
+                path = m_nzb_path;
+                for ( y = 0; y < m_split_level && y < batch.guid[i].length(); y++ )
+                    path.append( "/" + batch.guid[i].substr( y, 1 ) );
+
+                nzbs.push_back( path + "/" + batch.guid[i] + ".nzb.gz" );
+            }
+        }
+
+        if ( rows == 0 || ( rows < CFG_DB_BULK_ROWS && i + 1 < batch.id.size() ) )
+            continue;
+
+        // A chunk goes as a whole or not at all, so no release is left without its child rows
+        valid = db->Execute( "START TRANSACTION" ) >= 0;
+
+        for ( y = 0; valid && y < tables.size(); y++ )
+            valid = db->Execute( "DELETE FROM " + tables[y] + " WHERE releaseid IN (" + ids + ")" ) >= 0;
+
+        valid = valid && db->Execute( "DELETE FROM releases WHERE id IN (" + ids + ")" ) >= 0 && db->Execute( "COMMIT" ) >= 0;
+
+        // The NZBs only go once their releases are gone for good, so no release is left without one
+        if ( valid )
+        {
+            for ( y = 0; y < nzbs.size(); y++ )
+                ::unlink( CSTR( nzbs[y] ) );
+        }
+        else
+        {
+            db->Execute( "ROLLBACK" );
+            LOGFMT( flags, "JobRemoveCrap::Delete()-> failed to delete %lu releases, rolled back", rows );
+        }
+
+        nzbs.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    return;
+}
+
+/**
+ * @brief Run every rule over a batch, setting the bit of each rule that flags a release in its hit mask.
+ * @param[in,out] batch A batch filled by Load().
+ * @retval void
+ */
+const void JobRemoveCrap::Evaluate( Batch& batch )
+{
+    static const regex passworded( "\\b(passworded|password[ ._-]?protected|passwort)\\b", regex::ECMAScript | regex::icase | regex::optimize );
+    chrono::high_resolution_clock::time_point start;
+    const uint_t count = batch.id.size();
+    uint32_t* hits = NULL;
+    const uint32_t* files = NULL;
+    const uint_t* size = NULL;
+    const uint_t* parts = NULL;
+    const uint8_t* bare = NULL;
+    const uint8_t* pc = NULL;
+    uint_t run = 0, y = 0;
+    uint_t i = 0, rule = 0;
+
+    batch.hits.assign( count, 0 );
+    hits = batch.hits.data();
+    files = batch.files.data();
+    size = batch.size.data();
+    parts = batch.parts.data();
+    bare = batch.bare.data();
+    pc = batch.pc.data();
+
+    // The numeric rules are branch free so the compiler can vectorize them
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= static_cast<uint32_t>( parts[i] == 1 && size[i] < CFG_REL_CRAP_SIZE ) << CRAP_RULE_SIZE;
+    m_time[CRAP_RULE_SIZE] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= static_cast<uint32_t>( parts[i] == 1 && size[i] > CFG_REL_CRAP_HUGE ) << CRAP_RULE_HUGE;
+    m_time[CRAP_RULE_HUGE] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    // The file rules only need the mask Load() built, executables being expected in the PC categories
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= files[i] & ( ( 1u << CRAP_RULE_EXECUTABLE ) * !pc[i] );
+    m_time[CRAP_RULE_EXECUTABLE] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= files[i] & ( 1u << CRAP_RULE_INSTALLBIN );
+    m_time[CRAP_RULE_INSTALLBIN] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= files[i] & ( 1u << CRAP_RULE_PASSWORDURL );
+    m_time[CRAP_RULE_PASSWORDURL] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= files[i] & ( 1u << CRAP_RULE_SCR );
+    m_time[CRAP_RULE_SCR] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= static_cast<uint32_t>( ( files[i] & FILE_WMV ) != 0 && ( files[i] & ( 1u << CRAP_RULE_EXECUTABLE ) ) != 0 && !pc[i] ) << CRAP_RULE_CODEC;
+    m_time[CRAP_RULE_CODEC] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    // A name made only of letters and digits is short or gibberish, anything in between is left alone
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= static_cast<uint32_t>( bare[i] && batch.name[i].length() <= 5 && Alnum( batch.name[i] ) == batch.name[i].length() ) << CRAP_RULE_SHORT;
+    m_time[CRAP_RULE_SHORT] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        hits[i] |= static_cast<uint32_t>( bare[i] && batch.name[i].length() >= 15 && Alnum( batch.name[i] ) == batch.name[i].length() ) << CRAP_RULE_GIBBERISH;
+    m_time[CRAP_RULE_GIBBERISH] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+    {
+        for ( run = 0, y = 0; bare[i] && run < 25 && y < batch.name[i].length(); y++ )
+            run = ::isalnum( static_cast<unsigned char>( batch.name[i][y] ) ) ? run + 1 : 0;
+
+        hits[i] |= static_cast<uint32_t>( run >= 25 ) << CRAP_RULE_HASHED;
+    }
+    m_time[CRAP_RULE_HASHED] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+    {
+        if ( parts[i] > 2 || size[i] >= CFG_REL_CRAP_SAMPLE || batch.name[i].length() < 6 )
+            continue;
+
+        for ( y = 0; y + 6 <= batch.name[i].length(); y++ )
+        {
+            if ( ::strncasecmp( batch.name[i].c_str() + y, "sample", 6 ) == 0 )
+            {
+                hits[i] |= 1u << CRAP_RULE_SAMPLE;
+                break;
+            }
+        }
+    }
+    m_time[CRAP_RULE_SAMPLE] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+        if ( regex_search( batch.name[i], passworded ) )
+            hits[i] |= 1u << CRAP_RULE_PASSWORDED;
+    m_time[CRAP_RULE_PASSWORDED] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    // Which blacklist rules apply is worked out once per group when Load() first sees it
+    start = chrono::high_resolution_clock::now();
+    for ( i = 0; i < count; i++ )
+    {
+        const vector<uint_t>& rules = m_group_rules[batch.group[i]];
+
+        for ( rule = 0; rule < rules.size(); rule++ )
+        {
+            if ( regex_search( batch.name[i], m_blacklist[rules[rule]].pattern ) )
+            {
+                hits[i] |= 1u << CRAP_RULE_BLACKLIST;
+                break;
+            }
+        }
+    }
+    m_time[CRAP_RULE_BLACKLIST] += chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+
+    for ( i = 0; i < count; i++ )
+    {
+        for ( rule = 0; rule < MAX_CRAP_RULE; rule++ )
+            m_hits[rule] += ( hits[i] >> rule ) & 1;
+
+        m_deleted += hits[i] != 0;
+    }
+
+    return;
+}
+
+/**
+ * @brief Fill a batch with the next recent releases after an id, and fold their file names into a mask per release.
+ * @param[in] db The database connector reserved by the scan.
+ * @param[out] batch The batch to fill, replacing its contents.
+ * @param[in] last The highest id already scanned.
+ * @retval uint_t The number of releases loaded, less than #CFG_REL_CRAP_BATCH once no more remain.
+ */
+const uint_t JobRemoveCrap::Load( DBConn* db, Batch& batch, const uint_t& last )
+{
+    vector<uint_t> captures;
+    vector<string> literals;
+    unordered_map<uint_t,uint_t> index;
+    string ids, name;
+    uint_t i = 0, rule = 0, value = 0;
+
+    batch.id.clear();
+    batch.size.clear();
+    batch.parts.clear();
+    batch.category.clear();
+    batch.bare.clear();
+    batch.pc.clear();
+    batch.group.clear();
+    batch.name.clear();
+    batch.guid.clear();
+
+    db->Stream( Utils::FormatString( 0, "SELECT r.id, r.size, r.totalpart, r.categoryid, r.nfostatus = 0 AND r.iscategorized = 1 AND r.rarinnerfilecount = 0, g.name, r.searchname, r.guid "
+        "FROM releases r INNER JOIN groups g ON g.id = r.groupid WHERE r.id > %lu AND r.adddate > NOW() - INTERVAL %lu HOUR%s ORDER BY r.id LIMIT %lu",
+        last, CFG_REL_CRAP_HOURS, CSTR( g_global->m_cluster->Filter( "r.id" ) ), CFG_REL_CRAP_BATCH ), [&]( const vector<string>& row ) -> bool
+    {
+        index[value = ::strtoul( CSTR( row[0] ), NULL, 10 )] = batch.id.size();
+        batch.id.push_back( value );
+        batch.size.push_back( ::strtoul( CSTR( row[1] ), NULL, 10 ) );
+        batch.parts.push_back( ::strtoul( CSTR( row[2] ), NULL, 10 ) );
+        batch.category.push_back( value = ::strtoul( CSTR( row[3] ), NULL, 10 ) );
+        batch.pc.push_back( value >= 4000 && value < 5000 );
+        batch.bare.push_back( row[4] == "1" );
+        batch.name.push_back( row[6] );
+        batch.guid.push_back( row[7] );
+
+        if ( ( value = find( m_groups.begin(), m_groups.end(), row[5] ) - m_groups.begin() ) == m_groups.size() )
+        {
+            m_groups.push_back( row[5] );
+            m_group_rules.push_back( vector<uint_t>() );
+
+            for ( rule = 0; rule < m_blacklist.size(); rule++ )
+                if ( regex_search( row[5], m_blacklist[rule].group ) )
+                    m_group_rules.back().push_back( rule );
+        }
+
+        batch.group.push_back( value );
+        ids.append( ( ids.empty() ? "" : ", " ) + row[0] );
+
+        return true;
+    } );
+
+    batch.files.assign( batch.id.size(), 0 );
+
+    if ( ids.empty() )
+        return 0;
+
+    db->Stream( "SELECT releaseid, name FROM release_files WHERE releaseid IN (" + ids + ")", [&]( const vector<string>& row ) -> bool
+    {
+        if ( index.count( value = ::strtoul( CSTR( row[0] ), NULL, 10 ) ) == 0 )
+            return true;
+
+        name = row[1];
+        for ( i = 0; i < name.length(); i++ )
+            name[i] = ::tolower( static_cast<unsigned char>( name[i] ) );
+
+        uint32_t& mask = batch.files[index[value]];
+
+        if ( name.length() > 4 && name.compare( name.length() - 4, 4, ".exe" ) == 0 )
+            mask |= 1u << CRAP_RULE_EXECUTABLE;
+        if ( name.length() > 4 && name.compare( name.length() - 4, 4, ".scr" ) == 0 )
+            mask |= 1u << CRAP_RULE_SCR;
+        if ( name.length() > 4 && name.compare( name.length() - 4, 4, ".wmv" ) == 0 )
+            mask |= FILE_WMV;
+        if ( name.find( "install.bin" ) != string::npos )
+            mask |= 1u << CRAP_RULE_INSTALLBIN;
+        if ( name.find( "password.url" ) != string::npos )
+            mask |= 1u << CRAP_RULE_PASSWORDURL;
+
+        return true;
+    } );
+
+    return batch.id.size();
+}
+
+/**
+ * @brief The worker task for a run, walking the recent releases once in batches. The cursor is checkpointed after each batch, so a scan cut short by a restart picks up where it stopped.
+ * @retval void
+ */
+const void JobRemoveCrap::Scan()
+{
+    DBConn* db = NULL;
+    Batch batch;
+    uint_t last = 0, loaded = 0;
+
+    // A dry run deletes nothing, so it has nothing to resume and must not move the cursor of a real one
+    if ( !m_dryrun )
+        last = g_global->m_state->Get( "removecrap.last", 0 );
+
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        do
+        {
+            if ( ( loaded = Load( db, batch, last ) ) == 0 )
+                break;
+
+            last = batch.id.back();
+            m_scanned += loaded;
+
+            Evaluate( batch );
+
+            if ( !m_dryrun )
+            {
+                Delete( db, batch );
+                g_global->m_state->Set( "removecrap.last", last );
+            }
+        } while ( !g_global->m_shutdown && loaded == CFG_REL_CRAP_BATCH );
+
+        // The next run starts from the beginning of the window again
+        if ( !m_dryrun && !g_global->m_shutdown )
+            g_global->m_state->Erase( "removecrap.last" );
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobRemoveCrap class.
+ * @param[in] dryrun Report what would be deleted without deleting anything.
+ */
+JobRemoveCrap::JobRemoveCrap( const bool& dryrun ) : Job::Job( "removecrap", 5400, JOB_CLASS_CLEANUP )
+{
+    uint_t i = 0;
+
+    m_deleted = uintmin_t;
+    m_dryrun = dryrun;
+    m_outstanding = uintmin_t;
+    m_scanned = uintmin_t;
+    m_split_level = 1;
+    for ( i = 0; i < MAX_CRAP_RULE; i++ )
+    {
+        m_hits[i] = uintmin_t;
+        m_time[i] = 0;
+    }
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobRemoveCrap class.
+ */
+JobRemoveCrap::~JobRemoveCrap()
+{
+    return;
+}
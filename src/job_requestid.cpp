@@ -0,0 +1,363 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file job_requestid.cpp
+ * @brief All non-template member functions of the JobRequestID class.
+ *
+ * The JobRequestID class replaces requestid.php. Each group with releases
+ * waiting on a request id lookup becomes one task on the WorkerPool, which
+ * walks that group's releases in batches of #CFG_REL_REQID_BATCH. Request
+ * ids are first answered from the RequestIDCache, then by one predb query
+ * per batch, then by one call to the web service for whatever is left.
+ * Every answer, found or not, is cached so releases that share a request
+ * id cost one lookup between them.
+ *
+ * The reqidstatus column is left as:
+ *   1 when the request id resolved and the release was renamed,
+ *  -1 when the web service could not be asked, to be tried again next run,
+ *  -2 when the release name carries no request id,
+ *  -3 when neither predb nor the web service knew the request id.
+ */
+#include "h/includes.h"
+#include "h/job_requestid.h"
+
+#include "h/cluster.h"
+#include "h/dbconn.h"
+#include "h/requestidservice.h"
+#include "h/workerpool.h"
+
+/**
+ * @brief Read the request_url setting and queue one task per group with releases to check.
+ * @retval void
+ */
+const void JobRequestID::Run()
+{
+    UFLAGS_DE( flags );
+    DBConn* db = NULL;
+    vector<vector<string>> result;
+    uint_t i = 0, group = 0;
+
+    if ( ( db = Main::AcquireDBConn() ) == NULL )
+    {
+        LOGSTR( flags, "JobRequestID::Run()-> no database connector available" );
+        Finish();
+
+        return;
+    }
+
+    result = *db->Cached( "SELECT value FROM settings WHERE setting = 'request_url'" );
+
+    // The first row of a result set is metadata
+    m_url = result.size() > 1 ? result[1][0] : "";
+
+    result = db->Query( "SELECT DISTINCT r.groupid, g.name FROM releases r INNER JOIN groups g ON g.id = r.groupid WHERE r.reqidstatus IN (0, -1)" );
+
+    if ( result.size() < 2 )
+    {
+        Finish();
+
+        return;
+    }
+
+    m_checked = uintmin_t;
+    m_found = uintmin_t;
+    m_local = uintmin_t;
+    m_remote = uintmin_t;
+    m_start = chrono::high_resolution_clock::now();
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        stringstream( result[i][0] ) >> group;
+        string name = result[i][1];
+
+        if ( !g_global->m_cluster->Owns( group ) )
+            continue;
+
+        m_outstanding++;
+        g_global->m_workers->Submit( [this, group, name]() { Group( group, name ); }, gClass() );
+    }
+
+    return;
+}
+
+/**
+ * @brief Finish the run once every group task has returned.
+ * @retval void
+ */
+const void JobRequestID::Update()
+{
+    UFLAGS_I( flags );
+    double seconds = 0;
+
+    if ( m_outstanding > 0 )
+        return;
+
+    seconds = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - m_start ).count();
+
+    if ( m_checked > 0 )
+        LOGFMT( flags, "JobRequestID::Update()-> %lu releases checked, %lu named (%lu request ids from predb, %lu from the web service) in %.2fs; cache holds %lu with %lu hits and %lu misses",
+            static_cast<uint_t>( m_checked ), static_cast<uint_t>( m_found ), static_cast<uint_t>( m_local ), static_cast<uint_t>( m_remote ), seconds,
+            m_cache.gSize(), m_cache.gHits(), m_cache.gMisses() );
+
+    Finish();
+
+    return;
+}
+
+/**
+ * @brief Resolve the next batch of a group's releases and write back the results.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in] group The id of the group.
+ * @param[in] name The name of the group, as the web service knows it.
+ * @param[in,out] last The highest release id already checked, moved to the last id of this batch.
+ * @retval uint_t The number of releases checked, less than #CFG_REL_REQID_BATCH once the group is exhausted.
+ */
+const uint_t JobRequestID::Batch( DBConn* db, const uint_t& group, const string& name, uint_t& last )
+{
+    vector<vector<string>> result;
+    unordered_map<uint_t,vector<uint_t>> waiting;
+    unordered_map<uint_t,vector<uint_t>>::iterator wi;
+    unordered_map<uint_t,string> titles;
+    unordered_map<uint_t,string>::iterator ti;
+    vector<pair<uint_t,RequestIDCache::Result>> found;
+    vector<pair<uint_t,sint_t>> status;
+    vector<uint_t> requests;
+    RequestIDCache::Result cached;
+    string ids;
+    uint_t i = 0, id = 0, request = 0;
+
+    result = db->Query( Utils::FormatString( 0, "SELECT id, name FROM releases WHERE groupid = %lu AND reqidstatus IN (0, -1) AND id > %lu ORDER BY id LIMIT %lu", group, last, CFG_REL_REQID_BATCH ) );
+
+    // The first row of a result set is metadata
+    if ( result.size() < 2 )
+        return 0;
+
+    for ( i = 1; i < result.size(); i++ )
+    {
+        stringstream( result[i][0] ) >> id;
+
+        if ( ( request = Extract( result[i][1] ) ) == 0 )
+            status.push_back( make_pair( id, -2 ) );
+        else if ( m_cache.Get( name, request, cached ) )
+        {
+            if ( cached.found )
+                found.push_back( make_pair( id, cached ) );
+            else
+                status.push_back( make_pair( id, -3 ) );
+        }
+        else
+            waiting[request].push_back( id );
+    }
+
+    if ( !waiting.empty() )
+    {
+        for ( wi = waiting.begin(); wi != waiting.end(); wi++ )
+            ids.append( Utils::FormatString( 0, ids.empty() ? "%lu" : ", %lu", wi->first ) );
+
+        // predb rows carry the group's id rather than its name
+        db->Stream( Utils::FormatString( 0, "SELECT requestid, id, title FROM predb WHERE group_id = %lu AND requestid IN (%s)", group, CSTR( ids ) ), [&]( const vector<string>& row ) -> bool
+        {
+            request = ::strtoul( CSTR( row[0] ), NULL, 10 );
+
+            if ( ( wi = waiting.find( request ) ) == waiting.end() )
+                return true;
+
+            cached.found = true;
+            cached.pre = ::strtoul( CSTR( row[1] ), NULL, 10 );
+            cached.title = row[2];
+            m_cache.Put( name, request, cached );
+            m_local++;
+
+            for ( i = 0; i < wi->second.size(); i++ )
+                found.push_back( make_pair( wi->second[i], cached ) );
+            waiting.erase( wi );
+
+            return true;
+        } );
+    }
+
+    if ( !waiting.empty() )
+    {
+        for ( wi = waiting.begin(); wi != waiting.end(); wi++ )
+            requests.push_back( wi->first );
+
+        // Without a web service predb has the final word; if the service fails nothing is cached so the next run asks again
+        if ( !m_url.empty() && !RequestIDService::Fetch( m_url, name, requests, titles ) )
+        {
+            for ( wi = waiting.begin(); wi != waiting.end(); wi++ )
+                for ( i = 0; i < wi->second.size(); i++ )
+                    status.push_back( make_pair( wi->second[i], -1 ) );
+        }
+        else
+        {
+            for ( wi = waiting.begin(); wi != waiting.end(); wi++ )
+            {
+                cached.found = ( ti = titles.find( wi->first ) ) != titles.end() && !ti->second.empty();
+                cached.pre = uintmin_t;
+                cached.title = cached.found ? ti->second : "";
+                m_cache.Put( name, wi->first, cached );
+
+                if ( cached.found )
+                    m_remote++;
+
+                for ( i = 0; i < wi->second.size(); i++ )
+                {
+                    if ( cached.found )
+                        found.push_back( make_pair( wi->second[i], cached ) );
+                    else
+                        status.push_back( make_pair( wi->second[i], -3 ) );
+                }
+            }
+        }
+    }
+
+    Write( db, found, status );
+
+    stringstream( result[result.size() - 1][0] ) >> last;
+    m_checked += result.size() - 1;
+    m_found += found.size();
+
+    return result.size() - 1;
+}
+
+/**
+ * @brief Pull the request id out of a release name, such as "[123456]-[FULL]-[#a.b.teevee]" or "REQ 123456".
+ * @param[in] name The release name.
+ * @retval uint_t The request id, or 0 if the name carries none.
+ */
+const uint_t JobRequestID::Extract( const string& name )
+{
+    static const regex pattern( "^(?:\\[ ?([0-9]{3,7}) ?\\]|REQ ?([0-9]{3,7})\\b|([0-9]{3,7})-[0-9]\\[)", regex::icase );
+    smatch match;
+    uint_t i = 0;
+
+    if ( !regex_search( name, match, pattern ) )
+        return 0;
+
+    for ( i = 1; i < match.size(); i++ )
+        if ( match[i].matched )
+            return ::strtoul( CSTR( match[i].str() ), NULL, 10 );
+
+    return 0;
+}
+
+/**
+ * @brief The worker task for one group, walked once in batches.
+ * @param[in] group The id of the group.
+ * @param[in] name The name of the group.
+ * @retval void
+ */
+const void JobRequestID::Group( const uint_t& group, const string& name )
+{
+    DBConn* db = NULL;
+    uint_t position = 0;
+
+    // There can be more groups than connectors, so wait for one to free up
+    db = Main::WaitDBConn();
+
+    if ( db != NULL )
+    {
+        while ( !g_global->m_shutdown && Batch( db, group, name, position ) == CFG_REL_REQID_BATCH );
+
+        Main::ReleaseDBConn( db );
+    }
+
+    m_outstanding--;
+
+    return;
+}
+
+/**
+ * @brief Write back the outcome of a batch, one UPDATE per #CFG_DB_BULK_ROWS.
+ * @param[in] db The database connector reserved by the calling task.
+ * @param[in] found Releases paired with the result their request id resolved to.
+ * @param[in] status Releases paired with the reqidstatus to leave them at.
+ * @retval void
+ */
+const void JobRequestID::Write( DBConn* db, const vector<pair<uint_t,RequestIDCache::Result>>& found, const vector<pair<uint_t,sint_t>>& status )
+{
+    UFLAGS_DE( flags );
+    string names, pres, states, ids;
+    uint_t i = 0, rows = 0;
+
+    for ( i = 0; i < found.size(); i++ )
+    {
+        names.append( Utils::FormatString( 0, " WHEN %lu THEN '%s'", found[i].first, CSTR( db->Escape( found[i].second.title ) ) ) );
+        pres.append( Utils::FormatString( 0, " WHEN %lu THEN %lu", found[i].first, found[i].second.pre ) );
+        ids.append( Utils::FormatString( 0, ids.empty() ? "%lu" : ", %lu", found[i].first ) );
+        rows++;
+
+        if ( rows < CFG_DB_BULK_ROWS && i + 1 < found.size() )
+            continue;
+
+        // A renamed release is categorized again from its new name
+        if ( db->Execute( "UPDATE releases SET searchname = CASE id" + names + " END, preid = CASE id" + pres + " END, isrenamed = 1, iscategorized = 0, reqidstatus = 1 WHERE id IN (" + ids + ")" ) < 0 )
+            LOGFMT( flags, "JobRequestID::Write()-> failed to rename %lu releases", rows );
+
+        names.clear();
+        pres.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    for ( i = 0; i < status.size(); i++ )
+    {
+        states.append( Utils::FormatString( 0, " WHEN %lu THEN %ld", status[i].first, status[i].second ) );
+        ids.append( Utils::FormatString( 0, ids.empty() ? "%lu" : ", %lu", status[i].first ) );
+        rows++;
+
+        if ( rows < CFG_DB_BULK_ROWS && i + 1 < status.size() )
+            continue;
+
+        if ( db->Execute( "UPDATE releases SET reqidstatus = CASE id" + states + " END WHERE id IN (" + ids + ")" ) < 0 )
+            LOGFMT( flags, "JobRequestID::Write()-> failed to update %lu releases", rows );
+
+        states.clear();
+        ids.clear();
+        rows = uintmin_t;
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the JobRequestID class.
+ */
+JobRequestID::JobRequestID() : Job::Job( "requestid", 300 )
+{
+    m_checked = uintmin_t;
+    m_found = uintmin_t;
+    m_local = uintmin_t;
+    m_outstanding = uintmin_t;
+    m_remote = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the JobRequestID class.
+ */
+JobRequestID::~JobRequestID()
+{
+    return;
+}
@@ -37,3 +37,10 @@
  * @param DBConn* A pointer to a DBConn object in memory.
  */
 vector<DBConn*> dbconn_list;
+
+/**
+ * @var job_list
+ * @brief All native jobs that are scheduled within the server.
+ * @param Job* A pointer to a Job object in memory.
+ */
+vector<Job*> job_list;
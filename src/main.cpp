@@ -23,12 +23,35 @@
 #include "h/includes.h"
 #include "h/main.h"
 
+#include "h/archivelister.h"
+#include "h/categorizer.h"
+#include "h/cluster.h"
+#include "h/collectionregex.h"
+#include "h/configfile.h"
+#include "h/controlsocket.h"
 #include "h/dbconn_mysql.h"
+#include "h/fileio.h"
+#include "h/job_binaries.h"
+#include "h/job_categorize.h"
+#include "h/job_fixnames.h"
+#include "h/job_optimize.h"
+#include "h/job_predbmatch.h"
+#include "h/job_releases.h"
+#include "h/job_removecrap.h"
+#include "h/job_requestid.h"
 #include "h/list.h"
+#include "h/nntpconn.h"
+#include "h/par2parser.h"
+#include "h/querycache.h"
+#include "h/requestidservice.h"
+#include "h/statefile.h"
+#include "h/topology.h"
+#include "h/workerpool.h"
 
 using namespace std;
 
 Main::Global* g_global; /**< Global variables. */
+volatile sig_atomic_t Main::Global::m_terminate = 0;
 
 struct ThreadData
 {
@@ -44,18 +67,18 @@ const int compute_seconds( const ThreadData* data );
 chrono::high_resolution_clock::time_point time_current;
 
 // Eventually split this out to a config file and parse in nZEDb config files
+// update_binaries.php is replaced by JobBinaries
+// update_releases.php is replaced by JobReleases, except for categorizing
+// fixReleaseNames.php is replaced by JobFixNames
+// optimize_db.php is replaced by JobOptimize
+// predbftmatch.php is replaced by JobPreDBMatch
+// removeCrapReleases.php is replaced by JobRemoveCrap
+// requestid.php is replaced by JobRequestID
 const vector<ThreadData> thread_data
 {
-    { "php update_binaries.php", 0, 1, 0 },
-    { "php update_releases.php 1 true", 0, 2, 0 },
+    // JobReleases files new releases under Misc Other; until categorize.write is on by default with shipped rules, nZEDb categorizes them
+    { "php ../testing/Release/recategorize.php misc true", 0, 2, 0 },
     { "php postprocess.php all true", 0, 3, 0 },
-    { "php predbftmatch.php full show", 0, 4, 0 },
-    { "php requestid.php full show", 0, 5, 0 },
-    { "php ../testing/Release/fixReleaseNames.php 1 true all yes", 0, 6, 0 },
-    { "php ../testing/Release/fixReleaseNames.php 3 true other yes", 0, 6, 0 },
-    { "php ../testing/Release/fixReleaseNames.php 5 true other yes", 0, 6, 0 },
-    { "php ../testing/Release/removeCrapReleases.php true 2", 1, 30, 0 },
-    { "php optimize_db.php run", 1, 0, 0 },
     //{ "php update_tvschedule.php", 60 * 60 * 24 },
     //{ "php update_theaters.php", 60 * 60 * 24 }
 };
@@ -68,6 +91,125 @@ int main( const int argc, char* argv[] )
     // Ensure globals are first as other items depend on them
     g_global = new Main::Global();
 
+    // Time the collection regexes against a recorded corpus and exit
+    if ( argc > 2 && string( argv[1] ) == "--bench-regex" )
+    {
+        CollectionRegex regexes;
+
+        Main::Startup( "", false );
+
+        if ( regexes.Load() )
+            regexes.Benchmark( argv[2] );
+
+        delete g_global->m_workers;
+        mysql_library_end();
+
+        return 0;
+    }
+
+    // Time the category rules against a recorded corpus, report how many agree with it, and exit
+    if ( argc > 3 && string( argv[1] ) == "--bench-category" )
+    {
+        Categorizer categorizer;
+
+        g_global->m_workers = new WorkerPool( CFG_THR_WORKERS );
+
+        categorizer.Benchmark( argv[2], argv[3] );
+
+        delete g_global->m_workers;
+
+        return 0;
+    }
+
+    // List a set of archives, showing how little of each was read, and exit
+    if ( argc > 2 && string( argv[1] ) == "--bench-archive" )
+    {
+        ArchiveLister::Benchmark( vector<string>( argv + 2, argv + argc ) );
+
+        return 0;
+    }
+
+    // Time writing a set of files with and without the FileIO engine and exit
+    if ( argc > 2 && string( argv[1] ) == "--bench-io" )
+    {
+        g_global->m_workers = new WorkerPool( CFG_THR_WORKERS );
+        g_global->m_fileio = new FileIO();
+        g_global->m_fileio->Open( argc > 5 ? argv[5] : CFG_FIO_ENGINE );
+
+        FileIO::Benchmark( argv[2], argc > 3 ? ::strtoul( argv[3], NULL, 10 ) : 10000, argc > 4 ? ::strtoul( argv[4], NULL, 10 ) : 4096 );
+
+        delete g_global->m_workers;
+        delete g_global->m_fileio;
+
+        return 0;
+    }
+
+    // Time par2 parsing over a set of files and exit
+    if ( argc > 2 && string( argv[1] ) == "--bench-par2" )
+    {
+        g_global->m_workers = new WorkerPool( CFG_THR_WORKERS );
+
+        Par2Parser::Benchmark( vector<string>( argv + 2, argv + argc ) );
+
+        delete g_global->m_workers;
+
+        return 0;
+    }
+
+    // Report what a removecrap run would delete, rule by rule, and exit
+    if ( argc > 1 && string( argv[1] ) == "--dry-run-crap" )
+    {
+        JobRemoveCrap* job = NULL;
+
+        Main::Startup( "", false );
+
+        job = new JobRemoveCrap( true );
+        job->Poll();
+
+        while ( !g_global->m_shutdown && job->gStatus() == JOB_STATUS_RUNNING )
+        {
+            ::usleep( CFG_THR_SLEEP );
+            job->Poll();
+        }
+
+        delete g_global->m_workers;
+        mysql_library_end();
+
+        return 0;
+    }
+
+    // Send a command to a running server over its control socket and print the answer
+    if ( argc > 3 && string( argv[1] ) == "--control" )
+    {
+        string command = argv[3];
+
+        for ( sint_t i = 4; i < argc; i++ )
+            command.append( string( " " ) + argv[i] );
+
+        return ControlSocket::Request( argv[2], command ) ? 0 : 1;
+    }
+
+    // Replay captured overview data in place of a usenet provider, for testing JobBinaries offline
+    if ( argc > 3 && string( argv[1] ) == "--nntp-standin" )
+    {
+        // Startup() is skipped, so nothing else clears the flag the serving loop runs until
+        g_global->m_shutdown = false;
+
+        NNTPConn::Serve( argv[2], argv[3] );
+
+        return 0;
+    }
+
+    // Answer request id lookups from a file in place of the web service, for testing JobRequestID offline
+    if ( argc > 3 && string( argv[1] ) == "--reqid-standin" )
+    {
+        // Startup() is skipped, so nothing else clears the flag the serving loop runs until
+        g_global->m_shutdown = false;
+        RequestIDService::Serve( argv[2], argv[3] );
+
+        return 0;
+    }
+
     if ( argc > 1 )
         Main::Startup( argv[1] );
     else
@@ -75,6 +217,19 @@ int main( const int argc, char* argv[] )
 
     while ( !g_global->m_shutdown )
         Main::Update();
+
+    // Let any queued work finish before the connectors go away
+    delete g_global->m_workers;
+    // Whatever the workers left queued is written out
+    delete g_global->m_fileio;
+    // With no run left the shards are handed to the other nodes right away
+    delete g_global->m_cluster;
+    // Everything those tasks recorded reaches the disk before exit
+    delete g_global->m_state;
+    // Only this thread is left to log, so the channel can go
+    delete g_global->m_control;
+    g_global->m_control = NULL;
+    delete g_global->m_topology;
     // Fork to the background immediately to avoid shell output
     // daemon( 1, 0 );
 /*
@@ -103,18 +258,278 @@ int main( const int argc, char* argv[] )
     return 0;
 }
 
+/**
+ * @brief Returns a database connector reserved for the calling thread. The main thread keeps its connector, while worker threads must return theirs with Main::ReleaseDBConn().
+ *
+ * A free connector goes to the most urgent #JOB_CLASS waiting for one: a
+ * thread running a task of a less urgent class is turned away while one of
+ * a more urgent class has been kept waiting within the last second, and
+ * waits in Main::WaitDBConn() like any other thread that found none free.
+ * @param[in] role #DBCONN_ROLE_REPLICA for a connector that will only read, which falls back to the primary while no replica is within db.replica.lag of it.
+ * @retval DBConn* A pointer to a ready DBConn object, or NULL if all are busy, reserved, or unavailable.
+ */
+DBConn* Main::AcquireDBConn( const uint_t& role )
+{
+    lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+    ITER( vector, DBConn*, vi );
+    thread::id self = this_thread::get_id(), owners[] = { self, thread::id() };
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+    uint_t roles[] = { role, DBCONN_ROLE_PRIMARY }, cls = WorkerPool::gCurrent(), owned = 2, i = 0, y = 0;
+    auto usable = []( DBConn* db, const uint_t& want ) -> bool
+    {
+        return db->gStatus() == DBCONN_STATUS_READY && db->gRole() == want &&
+            ( want == DBCONN_ROLE_PRIMARY || ( db->gLag() >= 0 && static_cast<uint_t>( db->gLag() ) <= g_global->m_replica_lag ) );
+    };
+
+    // A thread of a more urgent class still waiting leaves this one only the connector it already holds
+    for ( i = 0; i < cls && owned == 2; i++ )
+        if ( g_global->m_dbconn_wanted[i] != chrono::high_resolution_clock::time_point() &&
+            chrono::duration_cast<chrono::seconds>( now - g_global->m_dbconn_wanted[i] ).count() < 1 )
+            owned = 1;
+
+    // A reader takes a replica close enough behind the primary if there is one, otherwise the primary
+    for ( i = 0; i < ( role == DBCONN_ROLE_REPLICA ? 2 : 1 ); i++ )
+    {
+        // The caller's own connector comes first; reserving it again refreshes when it was last used
+        for ( y = 0; y < owned; y++ )
+        {
+            for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+            {
+                if ( ( *vi )->gOwner() == owners[y] && usable( *vi, roles[i] ) )
+                {
+                    ( *vi )->sOwner( self );
+                    g_global->m_dbconn_wanted[cls] = chrono::high_resolution_clock::time_point();
+
+                    return *vi;
+                }
+            }
+        }
+    }
+
+    g_global->m_dbconn_misses++;
+    g_global->m_dbconn_wanted[cls] = now;
+
+    return NULL;
+}
+
+/**
+ * @brief Apply the job settings of the configuration to every job, restoring the defaults of any no longer mentioned, and the budget of each #JOB_CLASS to the WorkerPool.
+ * @retval void
+ */
+const void Main::Configure()
+{
+    UFLAGS_DE( flags );
+    ConfigFile* config = g_global->m_config;
+    ITER( vector, Job*, vi );
+    vector<string> names = config->gJobs();
+    ITER( vector, string, si );
+    uint_t i = 0;
+
+    for ( vi = job_list.begin(); vi != job_list.end(); vi++ )
+    {
+        ( *vi )->sEnabled( config->gNumber( "job." + ( *vi )->gName() + ".enabled", 1 ) != 0 );
+        ( *vi )->sInterval( config->gNumber( "job." + ( *vi )->gName() + ".interval", ( *vi )->gDefault() ) );
+
+        if ( ( si = find( names.begin(), names.end(), ( *vi )->gName() ) ) != names.end() )
+            names.erase( si );
+    }
+
+    for ( si = names.begin(); si != names.end(); si++ )
+        LOGFMT( flags, "Main::Configure()-> settings given for unknown job %s", CSTR( *si ) );
+
+    for ( i = 0; i < MAX_JOB_CLASS; i++ )
+        g_global->m_workers->sBudget( i, config->gNumber( "class." + WorkerPool::gName( i ) + ".budget" ) );
+
+    // Moving the socket drops any clients of the old one; a failure leaves the server without one until the next reload
+    g_global->m_control->Open( config->gString( "server.control" ) );
+
+    return;
+}
+
+/**
+ * @brief Open a connector on a thread of its own, so any number connect at once and a slow or unreachable server holds up nothing else. The connector sits in dbconn_list as #DBCONN_STATUS_CONNECT, reserved for that thread until it settles. Called with Main::Global::m_dbconn_mutex held.
+ * @param[in] key The host:port or host:socket to connect to.
+ * @param[in] role From #DBCONN_ROLE.
+ * @retval void
+ */
+const void Main::OpenDBConn( const string& key, const uint_t& role )
+{
+    ConfigFile* config = g_global->m_config;
+    DBConn* db;
+    string host = key.substr( 0, key.find( ':' ) ), socket = key.find( ':' ) == string::npos ? "3306" : key.substr( key.find( ':' ) + 1 );
+    uint_t timeout = config->gNumber( "db.connect.timeout" );
+    thread worker;
+
+    db = new DBConnMySQL( DBCONN_TYPE_MYSQL, host, socket, config->gString( "db.user" ), config->gString( "db.pass" ), config->gString( "db.name" ), role );
+    dbconn_list.push_back( db );
+
+    worker = thread( [db, key, timeout]()
+    {
+        UFLAGS_DE( flags );
+        chrono::high_resolution_clock::time_point now;
+        map<string,chrono::high_resolution_clock::time_point>::iterator mi;
+        uint_t delay = 0;
+        bool connected = false;
+
+        mysql_thread_init();
+        connected = db->Connect( timeout );
+        now = chrono::high_resolution_clock::now();
+
+        {
+            lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+
+            // Main::PollDBConn() closes a failed connector only once this thread lets go of it
+            db->sOwner( thread::id() );
+
+            if ( connected )
+            {
+                g_global->m_dbconn_failures.erase( key );
+                g_global->m_dbconn_retry.erase( key );
+                g_global->m_dbconn_released++;
+                g_global->m_dbconn_freed.notify_all();
+            }
+            // Connectors opened together that fail together count as one failure
+            else if ( ( mi = g_global->m_dbconn_retry.find( key ) ) == g_global->m_dbconn_retry.end() || now >= mi->second )
+            {
+                delay = min<uint_t>( CFG_DB_BACKOFF_MAX, CFG_DB_BACKOFF_MIN << min<uint_t>( g_global->m_dbconn_failures[key]++, 16 ) );
+                g_global->m_dbconn_retry[key] = now + chrono::seconds( delay );
+                LOGFMT( flags, "Main::OpenDBConn()-> %s unreachable, retrying in %lu seconds", CSTR( key ), delay );
+            }
+        }
+
+        mysql_thread_end();
+
+        return;
+    } );
+
+    db->sOwner( worker.get_id() );
+    worker.detach();
+
+    return;
+}
+
+/**
+ * @brief Mark every connector to a replica with how far it was measured behind the primary, logging when its reads move to or from it. Called with Main::Global::m_dbconn_mutex held.
+ * @param[in] key The host:port of the replica.
+ * @param[in] lag Seconds behind the primary, or -1 if not replicating.
+ * @retval void
+ */
+const void Main::RecordLag( const string& key, const sint_t& lag )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    ITER( vector, DBConn*, vi );
+    bool was = false, now = false, logged = false;
+
+    for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+    {
+        if ( ( *vi )->gRole() != DBCONN_ROLE_REPLICA || ( *vi )->gHost() + ":" + ( *vi )->gSocket() != key )
+            continue;
+
+        was = ( *vi )->gLag() >= 0 && static_cast<uint_t>( ( *vi )->gLag() ) <= g_global->m_replica_lag;
+        now = lag >= 0 && static_cast<uint_t>( lag ) <= g_global->m_replica_lag;
+
+        // Log the first measurement and each change of state once per replica, not once per connector
+        if ( ( was != now || ( *vi )->gLag() == -2 ) && !logged )
+        {
+            if ( now )
+                LOGFMT( iflags, "Main::RecordLag()-> %s is %ld seconds behind, taking reads", CSTR( key ), lag );
+            else if ( lag < 0 )
+                LOGFMT( flags, "Main::RecordLag()-> %s is not replicating, reads fall back to the primary", CSTR( key ) );
+            else
+                LOGFMT( flags, "Main::RecordLag()-> %s is %ld seconds behind, reads fall back to the primary", CSTR( key ), lag );
+
+            logged = true;
+        }
+
+        ( *vi )->sLag( lag );
+    }
+
+    return;
+}
+
+/**
+ * @brief Return a database connector reserved by Main::AcquireDBConn() so other threads may use it.
+ * @param[in] db The database connector to release.
+ * @retval void
+ */
+const void Main::ReleaseDBConn( DBConn* db )
+{
+    lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+
+    if ( db != NULL )
+    {
+        db->sOwner( thread::id() );
+        g_global->m_dbconn_released++;
+        g_global->m_dbconn_freed.notify_all();
+    }
+
+    return;
+}
+
+/**
+ * @brief Check whether less urgent work should hold off, because the pool cannot grow to meet demand or more urgent tasks are queued.
+ * @retval bool True while the pool is at db.pool.max with threads still kept waiting, or #JOB_CLASS_INGEST or #JOB_CLASS_PROCESS tasks wait on the WorkerPool.
+ */
+const bool Main::Saturated()
+{
+    if ( g_global->m_dbconn_saturated )
+        return true;
+
+    return g_global->m_workers != NULL && g_global->m_workers->gQueued( JOB_CLASS_INGEST ) + g_global->m_workers->gQueued( JOB_CLASS_PROCESS ) > 0;
+}
+
+/**
+ * @brief The SIGTERM and SIGINT handler, which only notes the signal for Main::Update() to act on.
+ * @param[in] number The signal received.
+ * @retval void
+ */
+void Main::Signal( int number )
+{
+    Main::Global::m_terminate = 1;
+
+    return;
+}
+
 /**
  * @brief Start the nzedb-backend server.
  * @param[in] config An optional path to a configuration file to load.
+ * @param[in] server False for the offline tools, which only need connectors and workers: no shards are claimed, and the state file, control socket and jobs are left out.
  * @retval void
  */
-const void Main::Startup( const string& config )
+const void Main::Startup( const string& config, const bool& server )
 {
     UFLAGS_DE( flags );
+    ITER( vector, DBConn*, vi );
+    chrono::high_resolution_clock::time_point start;
+    struct sigaction action;
+    uint_t timeout = 0, ready = 0, i = 0;
+    bool pending = false;
+
     g_global->m_shutdown = false;
 
+    // Stopping by signal lets main() release the shards, flush the checkpoints and write out queued files; a second signal kills outright should that hang
+    ::memset( &action, 0, sizeof( action ) );
+    action.sa_handler = &Main::Signal;
+    ::sigemptyset( &action.sa_mask );
+    action.sa_flags = SA_RESTART | SA_RESETHAND;
+    if ( server )
+    {
+        ::sigaction( SIGTERM, &action, NULL );
+        ::sigaction( SIGINT, &action, NULL );
+    }
+
     LOGFMT( 0, "%s started.", CFG_STR_VERSION );
 
+    // Settings are loaded before anything that depends on them, and a bad file at startup is fatal rather than silently ignored
+    g_global->m_config = new ConfigFile();
+
+    if ( !config.empty() && !g_global->m_config->Load( config ) )
+    {
+        LOGFMT( flags, "Failed to load configuration file %s.", CSTR( config ) );
+        ::exit( EXIT_FAILURE );
+    }
+
     // This needs to be called prior to any threads firing off that may hit the DB
     if ( mysql_library_init( 0, NULL, NULL ) )
     {
@@ -122,76 +537,475 @@ const void Main::Startup( const string& config )
         ::exit( EXIT_FAILURE );
     }
 
-    for ( auto i = 0; i < CFG_MEM_MAX_DBCONN; i++ )
-        new DBConnMySQL( DBCONN_TYPE_MYSQL, "localhost", "/var/run/mysqld/mysqld.sock", "nzedb", "nzedb", "nzedb" );
+    g_global->m_query_cache = new QueryCache();
+
+    // Jobs resume from checkpoints as they start, so these are loaded first; without them they only start over
+    g_global->m_state = new StateFile();
+
+    if ( server && !g_global->m_config->gString( "server.state" ).empty() && !g_global->m_state->Open( g_global->m_config->gString( "server.state" ) ) )
+        LOGFMT( flags, "Main::Startup()-> checkpoints will not be kept, %s could not be opened", CSTR( g_global->m_config->gString( "server.state" ) ) );
 
-    // Wait for the threads to all initialize otherwise to ensure the update loop doesn't poll
-    // them before they are ready
-    while ( dbconn_list.size() < CFG_MEM_MAX_DBCONN )
+    // Output is written in the background from here on; jobs may queue files as soon as they start
+    g_global->m_fileio = new FileIO();
+    g_global->m_fileio->Open( g_global->m_config->gString( "io.engine" ) );
+
+    // Pinned before the connectors open so the threads that open them share the CPU of this one; workers place themselves as they start
+    g_global->m_topology = new Topology();
+
+    if ( g_global->m_config->gNumber( "server.affinity" ) && g_global->m_topology->Load() )
+        g_global->m_topology->PinReactor();
+
+    g_global->m_dbconn_target = g_global->m_config->gNumber( "db.pool.min" );
+    g_global->m_replica_lag = g_global->m_config->gNumber( "db.replica.lag" );
+    timeout = g_global->m_config->gNumber( "db.connect.timeout" );
+    start = chrono::high_resolution_clock::now();
+
+    {
+        lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+
+        for ( i = 0; i < g_global->m_dbconn_target; i++ )
+            Main::OpenDBConn( g_global->m_config->gString( "db.host" ) + ":" + g_global->m_config->gString( "db.socket" ), DBCONN_ROLE_PRIMARY );
+    }
+
+    // The connectors open in parallel, so this waits out the slowest rather than all of them in turn. Any that
+    // failed are closed and retried with backoff by Main::PollDBConn(), so startup never waits on them again
+    for ( pending = true; pending && chrono::duration_cast<chrono::seconds>( chrono::high_resolution_clock::now() - start ).count() <= static_cast<sint_t>( timeout ); )
+    {
         ::usleep( CFG_THR_SLEEP );
 
+        lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+        pending = false;
+        ready = uintmin_t;
+
+        for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+        {
+            if ( ( *vi )->gStatus() == DBCONN_STATUS_CONNECT )
+                pending = true;
+            else if ( ( *vi )->gStatus() == DBCONN_STATUS_READY )
+                ready++;
+        }
+    }
+
+    if ( ready == 0 )
+        LOGSTR( flags, "Main::Startup()-> no database connectors could be opened, retrying in the background" );
+
+    // Shards are claimed before the first jobs run, so a node joining a cluster does not start out with nothing to do
+    g_global->m_cluster = new Cluster();
+
+    if ( server )
+        g_global->m_cluster->Poll( true );
+
+    g_global->m_workers = new WorkerPool( CFG_THR_WORKERS );
+
+    // A tool that exits on its own has nothing to schedule, and must leave the control socket to any server running
+    if ( !server )
+        return;
+
+    new JobBinaries( g_global->m_config->gString( "nntp.host" ), g_global->m_config->gString( "nntp.port" ), g_global->m_config->gString( "nntp.user" ), g_global->m_config->gString( "nntp.pass" ) );
+    new JobReleases();
+    new JobCategorize();
+    new JobFixNames();
+    new JobOptimize();
+    new JobPreDBMatch();
+    new JobRemoveCrap();
+    new JobRequestID();
+
+    g_global->m_control = new ControlSocket();
+
+    Main::Configure();
+
     return;
 }
 
 /**
- * @brief The core update loop of nzedb-backend. This loop spawns all other subsystem update routines and then sleeps for #CFG_THR_SLEEP each cycle.
+ * @brief The core update loop of nzedb-backend. This loop spawns all other subsystem update routines and then sleeps for the server.sleep setting each cycle.
  * @retval void
  */
 const void Main::Update()
 {
+    UFLAGS_I( flags );
+
     g_global->m_time_current = chrono::high_resolution_clock::now();
 
+    if ( Main::Global::m_terminate && !g_global->m_shutdown )
+    {
+        LOGSTR( flags, "Main::Update()-> signal received, shutting down" );
+        g_global->m_shutdown = true;
+
+        return;
+    }
+
+    // Reload the configuration if asked to
+    Main::PollConfig();
+
     // Poll all database connectors
     Main::PollDBConn();
 
+    // Heartbeat and rebalance shards with the other nodes, if any
+    g_global->m_cluster->Poll();
+
+    // Start or progress all native jobs
+    Main::PollJob();
+
+    // Submit the writes the jobs queued and run the callbacks of files now on disk
+    g_global->m_fileio->Poll();
+
+    // Flush checkpoints the jobs recorded, no more often than CFG_STATE_SYNC
+    g_global->m_state->Sync();
+
+    // Answer operator commands against the state just polled
+    g_global->m_control->Poll();
+
     // Sleep
-    ::usleep( CFG_THR_SLEEP );
+    ::usleep( g_global->m_config->gNumber( "server.sleep" ) );
 
     return;
 }
 
 /**
- * @brief Polls all DBConn objects to ensure validity and process updates.
+ * @brief Reload the configuration file after a SIGHUP or a change to it, then apply the new settings to the jobs. The connector pool follows in Main::PollDBConn().
+ * @retval void
+ */
+const void Main::PollConfig()
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    ConfigFile* config = g_global->m_config;
+
+    if ( !config->Changed() )
+        return;
+
+    if ( config->gPath().empty() )
+    {
+        LOGSTR( flags, "Main::PollConfig()-> reload requested, but no configuration file was given at startup" );
+        return;
+    }
+
+    // Load() keeps the previous settings on failure, so a half saved file never takes effect
+    if ( !config->Load( config->gPath() ) )
+    {
+        LOGFMT( flags, "Main::PollConfig()-> %s is invalid, keeping the previous settings", CSTR( config->gPath() ) );
+        return;
+    }
+
+    LOGFMT( iflags, "Main::PollConfig()-> reloaded %s", CSTR( config->gPath() ) );
+    Main::Configure();
+
+    return;
+}
+
+/**
+ * @brief Polls all DBConn objects to ensure validity and process updates, and sizes the pool to demand.
+ *
+ * The pool of primary connectors grows by one each time threads have been
+ * kept waiting for db.pool.wait milliseconds, or work is queued on the
+ * WorkerPool with no connector free, up to db.pool.max. A connector unused
+ * for db.pool.idle seconds is closed, down to db.pool.min. Each replica in
+ * db.replicas keeps db.replica.pool connectors of its own. Connectors that
+ * fail or close are replaced, as are idle ones whose server or credentials
+ * no longer match the configuration. No more than db.pool.grow connectors
+ * are opened a second, each on a thread of its own through
+ * Main::OpenDBConn(), and a server that keeps failing is retried after a
+ * delay doubling from #CFG_DB_BACKOFF_MIN to #CFG_DB_BACKOFF_MAX seconds.
+ * Connectors left unused for #CFG_DB_HEALTH_CHECK seconds are pinged on a
+ * thread of their own, and closed if they no longer answer.
  * @retval void
  */
 const void Main::PollDBConn()
 {
     UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+    ConfigFile* config = g_global->m_config;
     ITER( vector, DBConn*, vi );
     DBConn* db;
+    thread::id self = this_thread::get_id();
+    chrono::high_resolution_clock::time_point now = g_global->m_time_current;
+    vector<string> replicas = config->gList( "db.replicas" );
+    map<string,uint_t> counts;
+    map<string,chrono::high_resolution_clock::time_point>::iterator mi;
+    string key;
+    thread worker;
+    uint_t low = config->gNumber( "db.pool.min" ), high = config->gNumber( "db.pool.max" ), current = 0, free = 0, opened = 0, want = 0, i = 0;
+    bool starving = g_global->m_dbconn_misses > 0 || g_global->m_dbconn_waiting > 0, idle = false, stale = false, check = false;
+
+    g_global->m_dbconn_misses = uintmin_t;
+    g_global->m_dbconn_target = min( max( g_global->m_dbconn_target, low ), high );
+    g_global->m_replica_lag = config->gNumber( "db.replica.lag" );
+
+    // A replica given without a port is on the default one, as are the connectors opened to it
+    for ( i = 0; i < replicas.size(); i++ )
+        if ( replicas[i].find( ':' ) == string::npos )
+            replicas[i].append( ":3306" );
+
+    if ( ( check = chrono::duration_cast<chrono::seconds>( now - g_global->m_dbconn_checked ).count() >= CFG_DB_HEALTH_CHECK ) )
+        g_global->m_dbconn_checked = now;
 
     for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi = g_global->m_next_dbconn )
     {
         db = *vi;
-        g_global->m_next_dbconn = ++vi;
+        g_global->m_next_dbconn = vi + 1;
+        key = db->gHost() + ":" + db->gSocket();
 
-        if ( db->gStatus() == DBCONN_STATUS_READY || db->gStatus() == DBCONN_STATUS_NONE || db->gStatus() == DBCONN_STATUS_BUSY )
-            continue;
-        else if ( db->gStatus() == DBCONN_STATUS_ERROR )
+        // Only a connector nobody else holds can be closed; the main thread's own is idle between polls
+        idle = db->gStatus() == DBCONN_STATUS_READY && ( db->gOwner() == thread::id() || db->gOwner() == self );
+        stale = db->gUser() != config->gString( "db.user" ) || db->gPass() != config->gString( "db.pass" ) || db->gDatabase() != config->gString( "db.name" ) ||
+            ( db->gRole() == DBCONN_ROLE_PRIMARY ? key != config->gString( "db.host" ) + ":" + config->gString( "db.socket" ) : find( replicas.begin(), replicas.end(), key ) == replicas.end() );
+
+        // Still connecting counts toward the pool, so the same connector is not opened twice
+        if ( db->gStatus() == DBCONN_STATUS_CONNECT )
         {
-            LOGSTR( flags, "DBConn::MySQL::New()-> error while attempting to connect" );
-            delete db;
+            if ( stale )
+                continue;
+            else if ( db->gRole() == DBCONN_ROLE_PRIMARY )
+                current++;
+            else
+                counts[key]++;
+
             continue;
         }
+        // A failed connect or health check is closed once its thread lets go of it
+        else if ( db->gStatus() == DBCONN_STATUS_ERROR && db->gOwner() != thread::id() && db->gOwner() != self )
+            continue;
+        else if ( db->gStatus() == DBCONN_STATUS_ERROR )
+            LOGFMT( flags, "Main::PollDBConn()-> closing failed connector to %s", CSTR( key ) );
         else if ( db->gStatus() == DBCONN_STATUS_CLOSE )
-        {
             LOGSTR( flags, "DBConn::MySQL::New()-> connector closing down" );
-            delete db;
+        else if ( db->gRole() == DBCONN_ROLE_REPLICA )
+        {
+            if ( !( idle && ( stale || counts[key] >= config->gNumber( "db.replica.pool" ) ) ) )
+            {
+                if ( !stale )
+                    counts[key]++;
+
+                continue;
+            }
+        }
+        else if ( idle && !stale && current < g_global->m_dbconn_target && g_global->m_dbconn_target > low && !starving &&
+            chrono::duration_cast<chrono::seconds>( now - db->gUsed() ).count() >= static_cast<sint_t>( config->gNumber( "db.pool.idle" ) ) )
+        {
+            g_global->m_dbconn_target--;
+            LOGFMT( iflags, "Main::PollDBConn()-> shrinking the pool to %lu connectors", g_global->m_dbconn_target );
+        }
+        else if ( !( idle && ( stale || current >= g_global->m_dbconn_target ) ) )
+        {
+            // A stale connector that is still in use is replaced now and closed once released
+            if ( !stale )
+            {
+                current++;
+                if ( idle && db->gOwner() == thread::id() )
+                    free++;
+            }
+
             continue;
         }
+
+        // Connectors closed for failing or going stale leave the target alone, so they are replaced below
+        g_global->m_next_dbconn = dbconn_list.erase( vi );
+        delete db;
+    }
+
+    // Connectors left unused a while are proven to still work before a thread is handed one that does not
+    for ( vi = dbconn_list.begin(); check && vi != dbconn_list.end(); vi++ )
+    {
+        db = *vi;
+
+        if ( db->gStatus() != DBCONN_STATUS_READY || db->gOwner() != thread::id() || chrono::duration_cast<chrono::seconds>( now - db->gUsed() ).count() < CFG_DB_HEALTH_CHECK )
+            continue;
+
+        worker = thread( [db]()
+        {
+            mysql_thread_init();
+            db->Ping();
+
+            {
+                lock_guard<mutex> release( g_global->m_dbconn_mutex );
+                db->sOwner( thread::id() );
+            }
+
+            mysql_thread_end();
+
+            return;
+        } );
+
+        db->sOwner( worker.get_id() );
+        worker.detach();
+    }
+
+    // Work queued with no connector to give it will be waiting soon enough
+    if ( g_global->m_workers != NULL && g_global->m_workers->gPending() > 0 && free == 0 )
+        starving = true;
+
+    g_global->m_dbconn_saturated = starving && g_global->m_dbconn_target >= high;
+
+    if ( !starving )
+        g_global->m_dbconn_starved = chrono::high_resolution_clock::time_point();
+    else if ( g_global->m_dbconn_starved == chrono::high_resolution_clock::time_point() )
+        g_global->m_dbconn_starved = now;
+    else if ( g_global->m_dbconn_target < high && chrono::duration_cast<chrono::milliseconds>( now - g_global->m_dbconn_starved ).count() >= static_cast<sint_t>( config->gNumber( "db.pool.wait" ) ) )
+    {
+        // Each step waits out another db.pool.wait to see whether the last was enough
+        g_global->m_dbconn_starved = now;
+        g_global->m_dbconn_target++;
+        LOGFMT( iflags, "Main::PollDBConn()-> growing the pool to %lu connectors", g_global->m_dbconn_target );
+    }
+
+    // The primary is topped up first, then each replica in turn
+    if ( chrono::duration_cast<chrono::seconds>( now - g_global->m_dbconn_opened ).count() >= 1 )
+    {
+        for ( i = 0; i <= replicas.size() && opened < config->gNumber( "db.pool.grow" ); i++ )
+        {
+            key = i == 0 ? config->gString( "db.host" ) + ":" + config->gString( "db.socket" ) : replicas[i - 1];
+            want = i == 0 ? g_global->m_dbconn_target : config->gNumber( "db.replica.pool" );
+
+            // A server that failed to connect is left alone until its backoff runs out
+            if ( ( mi = g_global->m_dbconn_retry.find( key ) ) != g_global->m_dbconn_retry.end() && now < mi->second )
+                continue;
+
+            for ( ; ( i == 0 ? current : counts[key] ) < want && opened < config->gNumber( "db.pool.grow" ); opened++ )
+            {
+                Main::OpenDBConn( key, i == 0 ? DBCONN_ROLE_PRIMARY : DBCONN_ROLE_REPLICA );
+
+                if ( i == 0 )
+                    current++;
+                else
+                    counts[key]++;
+            }
+        }
+
+        if ( opened > 0 )
+            g_global->m_dbconn_opened = now;
+    }
+
+    if ( !replicas.empty() && chrono::duration_cast<chrono::seconds>( now - g_global->m_replica_checked ).count() >= CFG_DB_REPLICA_CHECK )
+    {
+        g_global->m_replica_checked = now;
+        Main::PollReplicas();
+    }
+
+    return;
+}
+
+/**
+ * @brief Measure how far each replica lags the primary through one of its idle connectors, on a thread of its own like the health check, so a replica that stops answering holds up nothing else. Called from Main::PollDBConn() with Main::Global::m_dbconn_mutex held, so the connector used cannot be reserved meanwhile.
+ * @retval void
+ */
+const void Main::PollReplicas()
+{
+    ITER( vector, DBConn*, vi );
+    DBConn* db;
+    string key;
+    thread worker;
+
+    for ( vi = dbconn_list.begin(); vi != dbconn_list.end(); vi++ )
+    {
+        db = *vi;
+        key = db->gHost() + ":" + db->gSocket();
+
+        // A replica still being measured is not measured again, so a hung one does not tie up every connector to it
+        if ( db->gRole() != DBCONN_ROLE_REPLICA || db->gStatus() != DBCONN_STATUS_READY || db->gOwner() != thread::id() || g_global->m_replica_probes.count( key ) > 0 )
+            continue;
+
+        g_global->m_replica_probes.insert( key );
+
+        worker = thread( [db, key]()
+        {
+            sint_t lag = 0;
+
+            mysql_thread_init();
+            lag = db->Lag();
+
+            {
+                lock_guard<mutex> release( g_global->m_dbconn_mutex );
+                Main::RecordLag( key, lag );
+                g_global->m_replica_probes.erase( key );
+                db->sOwner( thread::id() );
+            }
+
+            mysql_thread_end();
+
+            return;
+        } );
+
+        db->sOwner( worker.get_id() );
+        worker.detach();
     }
 
     return;
 }
 
+/**
+ * @brief Polls all Job objects to start any that are due and progress those already running.
+ * @retval void
+ */
+const void Main::PollJob()
+{
+    ITER( vector, Job*, vi );
+
+    for ( vi = job_list.begin(); vi != job_list.end(); vi++ )
+        ( *vi )->Poll();
+
+    return;
+}
+
+/**
+ * @brief Returns a database connector as Main::AcquireDBConn() does, blocking until one is free rather than returning NULL.
+ *
+ * The thread sleeps until a connector is released or finishes connecting,
+ * waking every #CFG_DB_POOL_WAIT milliseconds regardless: well inside the
+ * one second a more urgent #JOB_CLASS holds it off for, and often enough
+ * to notice a replica catching up or the server shutting down.
+ * @param[in] role #DBCONN_ROLE_REPLICA for a connector that will only read, as for Main::AcquireDBConn().
+ * @retval DBConn* A pointer to a ready DBConn object, or NULL if the server shut down first.
+ */
+DBConn* Main::WaitDBConn( const uint_t& role )
+{
+    DBConn* db = NULL;
+    uint_t released = 0;
+
+    while ( !g_global->m_shutdown )
+    {
+        {
+            lock_guard<mutex> lock( g_global->m_dbconn_mutex );
+            released = g_global->m_dbconn_released;
+        }
+
+        if ( ( db = AcquireDBConn( role ) ) != NULL )
+            break;
+
+        // A connector freed since the count was taken ends the wait at once; Main::PollDBConn() grows the pool while any thread waits here
+        unique_lock<mutex> lock( g_global->m_dbconn_mutex );
+        g_global->m_dbconn_waiting++;
+        g_global->m_dbconn_freed.wait_for( lock, chrono::milliseconds( CFG_DB_POOL_WAIT ), [&]() { return g_global->m_dbconn_released != released; } );
+        g_global->m_dbconn_waiting--;
+    }
+
+    return db;
+}
+
 /**
  * @brief Constructor for the Main::Global class.
  */
 Main::Global::Global()
 {
+    m_cluster = NULL;
+    m_config = NULL;
+    m_control = NULL;
+    m_dbconn_misses = uintmin_t;
+    m_dbconn_released = uintmin_t;
+    m_dbconn_saturated = false;
+    m_dbconn_target = uintmin_t;
+    m_dbconn_waiting = uintmin_t;
+    m_fileio = NULL;
+    m_replica_lag = uintmin_t;
+    m_log_level = UTILS_LEVEL_INFO;
     m_next_dbconn = dbconn_list.begin();
+    m_query_cache = NULL;
     m_shutdown = true;
+    m_state = NULL;
     m_time_current = chrono::high_resolution_clock::now();
+    m_topology = NULL;
+    m_workers = NULL;
 
     return;
 }
@@ -0,0 +1,680 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file nntpconn.cpp
+ * @brief All non-template member functions of the NNTPConn class.
+ *
+ * The NNTPConn class provides a non-blocking, pipelined connection to a
+ * usenet provider. Serve() stands in for a provider by replaying captured
+ * overview data, so the header fetcher can be run without reaching one.
+ */
+#include "h/includes.h"
+#include "h/nntpconn.h"
+
+/**
+ * @brief Returns the group selected by the most recently sent GROUP command.
+ * @retval string The currently selected group, empty if none.
+ */
+const string NNTPConn::gGroup()
+{
+    return m_group;
+}
+
+/**
+ * @brief Returns the host of the usenet provider.
+ * @retval string The host of the usenet provider.
+ */
+const string NNTPConn::gHost()
+{
+    return m_host;
+}
+
+/**
+ * @brief Returns the number of commands queued or awaiting a response.
+ * @retval uint_t The number of commands queued or awaiting a response.
+ */
+const uint_t NNTPConn::gPending()
+{
+    return m_queue.size() + m_sent.size();
+}
+
+/**
+ * @brief Returns the current status of the connection from #NNTPCONN_STATUS.
+ * @retval uint_t A uint_t associated to #NNTPCONN_STATUS.
+ */
+const uint_t NNTPConn::gStatus()
+{
+    return m_status;
+}
+
+/**
+ * @brief Returns if the provider is believed to support XZVER.
+ * @retval bool True until the provider rejects an XZVER command.
+ */
+const bool NNTPConn::gXZVER()
+{
+    return m_xzver;
+}
+
+/**
+ * @brief Queue a command to be sent once the connection is ready and the pipeline has room.
+ * @param[in] command The command to send, without CRLF.
+ * @param[in] multi If true, a 2xx response is followed by a multi-line body.
+ * @param[in] callback Invoked once the full response has been received, or with a code of 0 if the connection is lost first. It must not delete the connection.
+ * @retval void
+ */
+const void NNTPConn::Send( const string& command, const bool& multi, const NNTPCallback& callback )
+{
+    UFLAGS_DE( flags );
+    Command cmd;
+
+    if ( command.empty() )
+    {
+        LOGSTR( flags, "NNTPConn::Send()-> called with empty command" );
+        return;
+    }
+
+    cmd.line = command;
+    cmd.multi = multi;
+    cmd.callback = callback;
+
+    if ( m_status == NNTPCONN_STATUS_ERROR || m_status == NNTPCONN_STATUS_CLOSE )
+    {
+        cmd.callback( this, 0, "", "" );
+        return;
+    }
+
+    m_queue.push_back( cmd );
+
+    return;
+}
+
+/**
+ * @brief Replay captured overview data to any number of clients until shutdown, as a stand in for a usenet provider.
+ * @param[in] port The port to listen on, bound to the loopback address only.
+ * @param[in] file A file of lines holding a group name and an overview line as XOVER returns it, separated by a tab.
+ * @retval bool False if the file could not be read or the port could not be bound.
+ */
+const bool NNTPConn::Serve( const string& port, const string& file )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    // Shared with every client thread, which may outlive this call
+    shared_ptr<map<string,map<uint_t,string>>> groups = make_shared<map<string,map<uint_t,string>>>();
+    struct sockaddr_in addr;
+    ifstream input( file );
+    string line;
+    string::size_type tab = 0;
+    sint_t fd = -1, client = -1, yes = 1;
+    uint_t articles = 0, served = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "NNTPConn::Serve()-> unable to open %s", CSTR( file ) );
+        return false;
+    }
+
+    while ( getline( input, line ) )
+    {
+        if ( !line.empty() && line[line.length() - 1] == '\r' )
+            line.erase( line.length() - 1 );
+
+        if ( ( tab = line.find( '\t' ) ) == string::npos || tab == 0 )
+            continue;
+
+        ( *groups )[line.substr( 0, tab )][::strtoul( CSTR( line ) + tab + 1, NULL, 10 )] = line.substr( tab + 1 );
+        articles++;
+    }
+
+    ::memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = htons( ::strtoul( CSTR( port ), NULL, 10 ) );
+
+    if ( ( fd = ::socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        LOGERRNO( flags, "NNTPConn::Serve()->socket()->" );
+        return false;
+    }
+
+    ::setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof( yes ) );
+
+    if ( ::bind( fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) ) < 0 || ::listen( fd, 16 ) < 0 )
+    {
+        LOGERRNO( flags, "NNTPConn::Serve()->bind()->" );
+        ::close( fd );
+        return false;
+    }
+
+    LOGFMT( iflags, "NNTPConn::Serve()-> replaying %lu articles from %lu groups on 127.0.0.1:%s", articles, groups->size(), CSTR( port ) );
+
+    while ( !g_global->m_shutdown )
+    {
+        if ( ( client = ::accept( fd, NULL, NULL ) ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            LOGERRNO( flags, "NNTPConn::Serve()->accept()->" );
+            break;
+        }
+
+        // The fetcher opens several connections at once, so each is answered on a thread of its own
+        thread( [groups, client]() { Replay( client, *groups ); } ).detach();
+        served++;
+    }
+
+    ::close( fd );
+    LOGFMT( iflags, "NNTPConn::Serve()-> served %lu connections", served );
+
+    return true;
+}
+
+/**
+ * @brief Sets the group the connection has selected. Used to track GROUP commands as they are queued.
+ * @param[in] group The name of the group.
+ * @retval void
+ */
+const void NNTPConn::sGroup( const string& group )
+{
+    m_group = group;
+
+    return;
+}
+
+/**
+ * @brief Sets if XZVER should be used on this connection.
+ * @param[in] xzver False once the provider has rejected XZVER.
+ * @retval void
+ */
+const void NNTPConn::sXZVER( const bool& xzver )
+{
+    m_xzver = xzver;
+
+    return;
+}
+
+/**
+ * @brief Called by the owner each cycle to progress the connection, fill the pipeline, and dispatch any complete responses.
+ * @retval void
+ */
+const void NNTPConn::Update()
+{
+    UFLAGS_DE( flags );
+    struct pollfd pfd;
+    sint_t err = 0;
+    socklen_t len = sizeof( err );
+
+    if ( m_status == NNTPCONN_STATUS_NONE || m_status == NNTPCONN_STATUS_ERROR || m_status == NNTPCONN_STATUS_CLOSE )
+        return;
+
+    if ( m_status == NNTPCONN_STATUS_CONNECTING )
+    {
+        pfd.fd = m_fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+
+        if ( ::poll( &pfd, 1, 0 ) <= 0 )
+            return;
+
+        if ( ::getsockopt( m_fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 || err != 0 )
+        {
+            Fail( Utils::FormatString( flags, "connect failed: %s", strerror( err ) ) );
+            return;
+        }
+
+        // The greeting is the response to a command that was never sent
+        Command greeting;
+        greeting.multi = false;
+        greeting.callback = [this]( NNTPConn* conn, const uint_t& code, const string& line, const string& body ) { Login( code ); };
+        m_sent.push_back( greeting );
+
+        sStatus( NNTPCONN_STATUS_AUTH );
+    }
+
+    if ( m_status == NNTPCONN_STATUS_READY )
+    {
+        while ( !m_queue.empty() && m_sent.size() < CFG_NNTP_PIPELINE )
+        {
+            m_output.append( m_queue.front().line );
+            m_output.append( CRLF );
+            m_sent.push_back( m_queue.front() );
+            m_queue.pop_front();
+        }
+    }
+
+    Write();
+    Read();
+    Parse();
+
+    return;
+}
+
+/**
+ * @brief Begin a non-blocking connection to the provider.
+ * @retval void
+ */
+const void NNTPConn::Connect()
+{
+    UFLAGS_DE( flags );
+    struct addrinfo hints, *res = NULL;
+    sint_t ret = 0;
+
+    if ( m_host.empty() )
+    {
+        LOGSTR( flags, "NNTPConn::Connect()-> called with empty host" );
+        sStatus( NNTPCONN_STATUS_ERROR );
+        return;
+    }
+
+    ::memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ( ( ret = ::getaddrinfo( CSTR( m_host ), CSTR( m_port ), &hints, &res ) ) != 0 )
+    {
+        LOGFMT( flags, "NNTPConn::Connect()->getaddrinfo()-> %s: %s", CSTR( m_host ), gai_strerror( ret ) );
+        sStatus( NNTPCONN_STATUS_ERROR );
+        return;
+    }
+
+    if ( ( m_fd = ::socket( res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol ) ) < 0 )
+    {
+        LOGERRNO( flags, "NNTPConn::Connect()->socket()->" );
+        ::freeaddrinfo( res );
+        sStatus( NNTPCONN_STATUS_ERROR );
+        return;
+    }
+
+    if ( ::connect( m_fd, res->ai_addr, res->ai_addrlen ) < 0 && errno != EINPROGRESS )
+    {
+        LOGERRNO( flags, "NNTPConn::Connect()->connect()->" );
+        ::freeaddrinfo( res );
+        sStatus( NNTPCONN_STATUS_ERROR );
+        return;
+    }
+
+    ::freeaddrinfo( res );
+    sStatus( NNTPCONN_STATUS_CONNECTING );
+
+    return;
+}
+
+/**
+ * @brief Close the connection and notify the callbacks of every outstanding command so the owner can requeue the work.
+ * @param[in] reason Why the connection failed.
+ * @retval void
+ */
+const void NNTPConn::Fail( const string& reason )
+{
+    UFLAGS_DE( flags );
+    deque<Command> lost;
+    ITER( deque, Command, di );
+
+    LOGFMT( flags, "NNTPConn::Fail()-> %s: %s", CSTR( m_host ), CSTR( reason ) );
+
+    if ( m_fd >= 0 )
+    {
+        ::close( m_fd );
+        m_fd = -1;
+    }
+
+    sStatus( NNTPCONN_STATUS_ERROR );
+    m_body_open = false;
+    m_input.clear();
+    m_output.clear();
+
+    // Swap first so callbacks are free to queue new commands, which fail immediately
+    lost.swap( m_sent );
+    lost.insert( lost.end(), m_queue.begin(), m_queue.end() );
+    m_queue.clear();
+
+    for ( di = lost.begin(); di != lost.end(); di++ )
+        di->callback( this, 0, "", "" );
+
+    return;
+}
+
+/**
+ * @brief Steps through the greeting and AUTHINFO exchange.
+ * @param[in] code The response code of the greeting or the last AUTHINFO command.
+ * @retval void
+ */
+const void NNTPConn::Login( const uint_t& code )
+{
+    UFLAGS_DE( flags );
+    Command cmd;
+
+    cmd.multi = false;
+    cmd.callback = [this]( NNTPConn* conn, const uint_t& rcode, const string& line, const string& body ) { Login( rcode ); };
+
+    switch ( code )
+    {
+        // Greeting, posting allowed or not
+        case 200:
+        case 201:
+            if ( m_user.empty() )
+            {
+                sStatus( NNTPCONN_STATUS_READY );
+                return;
+            }
+
+            cmd.line = "AUTHINFO USER " + m_user;
+        break;
+
+        // Password required
+        case 381:
+            cmd.line = "AUTHINFO PASS " + m_pass;
+        break;
+
+        // Authentication accepted
+        case 281:
+            sStatus( NNTPCONN_STATUS_READY );
+        return;
+
+        // Connection lost, Fail() has already run
+        case 0:
+        return;
+
+        default:
+            Fail( Utils::FormatString( flags, "login rejected with code %lu", code ) );
+        return;
+    }
+
+    m_output.append( cmd.line );
+    m_output.append( CRLF );
+    m_sent.push_back( cmd );
+
+    return;
+}
+
+/**
+ * @brief Split received data into responses and dispatch them to their callbacks in order.
+ * @retval void
+ */
+const void NNTPConn::Parse()
+{
+    UFLAGS_DE( flags );
+    string::size_type pos = 0, eol = 0, start = 0;
+    uint_t code = 0;
+    Command cmd;
+
+    while ( m_status != NNTPCONN_STATUS_ERROR && ( eol = m_input.find( CRLF, pos ) ) != string::npos )
+    {
+        if ( m_body_open )
+        {
+            // A lone "." terminates the body; anything else starting with "." was dot-stuffed
+            if ( eol - pos == 1 && m_input[pos] == '.' )
+            {
+                cmd = m_sent.front();
+                m_sent.pop_front();
+                m_body_open = false;
+
+                cmd.callback( this, m_code, m_line, m_body );
+                m_body.clear();
+            }
+            else
+            {
+                start = m_input[pos] == '.' ? pos + 1 : pos;
+                m_body.append( m_input, start, eol + 2 - start );
+            }
+        }
+        else
+        {
+            stringstream( m_input.substr( pos, 3 ) ) >> code;
+
+            if ( m_sent.empty() )
+                LOGFMT( flags, "NNTPConn::Parse()-> %s: unsolicited response: %s", CSTR( m_host ), CSTR( m_input.substr( pos, eol - pos ) ) );
+            else if ( m_sent.front().multi && code / 100 == 2 )
+            {
+                m_body_open = true;
+                m_code = code;
+                m_line = m_input.substr( pos, eol - pos );
+            }
+            else
+            {
+                cmd = m_sent.front();
+                m_sent.pop_front();
+
+                cmd.callback( this, code, m_input.substr( pos, eol - pos ), "" );
+            }
+        }
+
+        pos = eol + 2;
+    }
+
+    m_input.erase( 0, pos );
+
+    return;
+}
+
+/**
+ * @brief Read everything currently available on the socket.
+ * @retval void
+ */
+const void NNTPConn::Read()
+{
+    UFLAGS_DE( flags );
+    char buf[CFG_NNTP_BUF_SIZE];
+    ssize_t ret = 0;
+
+    while ( m_status != NNTPCONN_STATUS_ERROR )
+    {
+        if ( ( ret = ::recv( m_fd, buf, sizeof( buf ), 0 ) ) > 0 )
+        {
+            m_input.append( buf, ret );
+            continue;
+        }
+
+        if ( ret == 0 )
+            Fail( "connection closed by provider" );
+        else if ( errno == EINTR )
+            continue;
+        else if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            Fail( Utils::FormatString( flags, "recv failed: %s", strerror( errno ) ) );
+
+        break;
+    }
+
+    return;
+}
+
+/**
+ * @brief Answer the commands of one client of Serve() until it quits or disconnects. AUTHINFO is accepted, GROUP and XOVER are answered from the captured overview data, and XZVER is refused so the client falls back to XOVER.
+ * @param[in] fd The connected socket, which is closed on return.
+ * @param[in] groups The overview lines of each group by article number.
+ * @retval void
+ */
+const void NNTPConn::Replay( const sint_t& fd, const map<string,map<uint_t,string>>& groups )
+{
+    map<string,map<uint_t,string>>::const_iterator gi = groups.end();
+    map<uint_t,string>::const_iterator ai;
+    char buf[CFG_NNTP_BUF_SIZE];
+    string input, output, line, command, argument, body;
+    string::size_type eol = 0;
+    ssize_t ret = 0, sent = 0;
+    uint_t first = 0, last = 0;
+    bool quit = false;
+
+    output = "200 nzedb-backend stand-in ready" CRLF;
+
+    while ( !quit )
+    {
+        // Pipelined commands are answered in order, and every answer so far goes out before reading more
+        for ( sent = 0; !quit && sent < static_cast<ssize_t>( output.length() ); sent += ret )
+            if ( ( ret = ::send( fd, output.data() + sent, output.length() - sent, MSG_NOSIGNAL ) ) <= 0 )
+                quit = true;
+
+        output.clear();
+
+        while ( !quit && ( eol = input.find( CRLF ) ) != string::npos )
+        {
+            line = input.substr( 0, eol );
+            input.erase( 0, eol + 2 );
+
+            command.clear();
+            argument.clear();
+            stringstream( line ) >> command >> argument;
+            transform( command.begin(), command.end(), command.begin(), ::toupper );
+
+            if ( command == "AUTHINFO" )
+                output.append( ::strcasecmp( CSTR( argument ), "USER" ) == 0 ? "381 password required" CRLF : "281 authentication accepted" CRLF );
+            else if ( command == "GROUP" )
+            {
+                if ( ( gi = groups.find( argument ) ) == groups.end() || gi->second.empty() )
+                    output.append( "411 no such group" CRLF );
+                else
+                    output.append( Utils::FormatString( 0, "211 %lu %lu %lu %s" CRLF, gi->second.size(), gi->second.begin()->first, gi->second.rbegin()->first, CSTR( gi->first ) ) );
+            }
+            else if ( command == "XOVER" || command == "OVER" )
+            {
+                if ( gi == groups.end() )
+                {
+                    output.append( "412 no group selected" CRLF );
+                    continue;
+                }
+
+                // A range is n, n- or n-m
+                first = last = ::strtoul( CSTR( argument ), NULL, 10 );
+                if ( argument.find( '-' ) != string::npos )
+                    last = argument.find( '-' ) + 1 < argument.length() ? ::strtoul( CSTR( argument ) + argument.find( '-' ) + 1, NULL, 10 ) : uintmax_t;
+
+                body.clear();
+                for ( ai = gi->second.lower_bound( first ); ai != gi->second.end() && ai->first <= last; ai++ )
+                    body.append( ( ai->second[0] == '.' ? "." : "" ) + ai->second + CRLF );
+
+                output.append( body.empty() ? string( "423 no articles in that range" CRLF ) : "224 overview follows" CRLF + body + "." CRLF );
+            }
+            else if ( command == "QUIT" )
+            {
+                output.append( "205 closing connection" CRLF );
+                break;
+            }
+            else
+                output.append( "500 command not recognized" CRLF );
+        }
+
+        if ( !output.empty() )
+        {
+            // QUIT leaves its own answer to be sent before the connection closes
+            if ( command == "QUIT" )
+            {
+                for ( sent = 0; sent < static_cast<ssize_t>( output.length() ); sent += ret )
+                    if ( ( ret = ::send( fd, output.data() + sent, output.length() - sent, MSG_NOSIGNAL ) ) <= 0 )
+                        break;
+
+                quit = true;
+            }
+
+            continue;
+        }
+
+        if ( ( ret = ::recv( fd, buf, sizeof( buf ), 0 ) ) > 0 )
+            input.append( buf, ret );
+        else if ( ret == 0 || errno != EINTR )
+            quit = true;
+    }
+
+    ::close( fd );
+
+    return;
+}
+
+/**
+ * @brief Write as much pending output as the socket will currently accept.
+ * @retval void
+ */
+const void NNTPConn::Write()
+{
+    UFLAGS_DE( flags );
+    ssize_t ret = 0;
+
+    while ( !m_output.empty() )
+    {
+        if ( ( ret = ::send( m_fd, m_output.data(), m_output.length(), MSG_NOSIGNAL ) ) >= 0 )
+        {
+            m_output.erase( 0, ret );
+            continue;
+        }
+
+        if ( errno == EINTR )
+            continue;
+        else if ( errno != EAGAIN && errno != EWOULDBLOCK )
+            Fail( Utils::FormatString( flags, "send failed: %s", strerror( errno ) ) );
+
+        break;
+    }
+
+    return;
+}
+
+/**
+ * @brief Sets the current status of the connection from #NNTPCONN_STATUS.
+ * @param[in] status The current status of the connection from #NNTPCONN_STATUS.
+ * @retval void
+ */
+const void NNTPConn::sStatus( const uint_t& status )
+{
+    UFLAGS_DE( flags );
+
+    if ( status < uintmin_t || status >= MAX_NNTPCONN_STATUS )
+    {
+        LOGFMT( flags, "NNTPConn::sStatus()-> called with invalid status: %lu", status );
+        return;
+    }
+
+    m_status = status;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the NNTPConn class.
+ */
+NNTPConn::NNTPConn( const string& host, const string& port, const string& user, const string& pass ) :
+    m_host( host ), m_port( port ), m_user( user ), m_pass( pass )
+{
+    m_fd = -1;
+    m_status = NNTPCONN_STATUS_NONE;
+    m_xzver = true;
+    m_body_open = false;
+    m_code = uintmin_t;
+
+    Connect();
+
+    return;
+}
+
+/**
+ * @brief Destructor for the NNTPConn class.
+ */
+NNTPConn::~NNTPConn()
+{
+    if ( m_fd >= 0 )
+    {
+        ::send( m_fd, "QUIT" CRLF, 6, MSG_NOSIGNAL );
+        ::close( m_fd );
+    }
+
+    return;
+}
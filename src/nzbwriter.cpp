@@ -0,0 +1,407 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file nzbwriter.cpp
+ * @brief All non-template member functions of the NzbWriter class.
+ *
+ * The NzbWriter class builds an NZB a segment at a time. XML is escaped
+ * into a fixed buffer sixteen bytes per step where the CPU allows it, and
+ * each time the buffer fills it is pushed through zlib's gzip stream with
+ * every compressed chunk handed to the FileIO engine, so the thread goes
+ * straight on to the next while the disk catches up. Memory use is the
+ * same for a release of ten segments as for one of a hundred thousand.
+ */
+#include "h/includes.h"
+#include "h/nzbwriter.h"
+
+#include "h/fileio.h"
+
+/**
+ * @brief Close and remove a partially written NZB.
+ * @retval void
+ */
+const void NzbWriter::Abort()
+{
+    if ( m_file == 0 )
+        return;
+
+    deflateEnd( &m_zstream );
+    g_global->m_fileio->Abort( m_file );
+
+    m_file = 0;
+    m_in_file = false;
+
+    return;
+}
+
+/**
+ * @brief Finish the XML, flush the gzip stream, and queue the close of the file. Whether it reached the disk is reported by Finish().
+ * @retval bool False if compression failed, in which case the file has been removed.
+ */
+const bool NzbWriter::Close()
+{
+    if ( m_file == 0 )
+        return false;
+
+    if ( m_in_file )
+        Append( "  </segments>\n </file>\n" );
+    Append( "</nzb>\n" );
+
+    m_in_file = false;
+
+    if ( !Deflate( Z_FINISH ) )
+    {
+        Abort();
+        return false;
+    }
+
+    deflateEnd( &m_zstream );
+
+    g_global->m_fileio->Close( m_file );
+    m_closed.push_back( m_file );
+    m_file = 0;
+
+    return true;
+}
+
+/**
+ * @brief Start a new file element, closing the previous one.
+ * @param[in] poster The poster of the file.
+ * @param[in] date When the file was posted.
+ * @param[in] subject The subject of the file without its part counter.
+ * @param[in] total The number of parts the file should have.
+ * @param[in] group The name of the group the file was posted to.
+ * @retval bool False if the NZB is not open or a write has failed.
+ */
+const bool NzbWriter::File( const string& poster, const time_t& date, const string& subject, const uint_t& total, const string& group )
+{
+    char buf[64];
+
+    if ( m_file == 0 )
+        return false;
+
+    if ( m_in_file )
+        Append( "  </segments>\n </file>\n" );
+
+    Append( " <file poster=\"" );
+    Escape( poster );
+    Append( buf, ::snprintf( buf, sizeof( buf ), "\" date=\"%ld\" subject=\"", static_cast<sint_t>( date ) ) );
+    Escape( subject );
+    Append( buf, ::snprintf( buf, sizeof( buf ), " (1/%lu)\">\n  <groups>\n   <group>", total ) );
+    Escape( group );
+    Append( "</group>\n  </groups>\n  <segments>\n" );
+
+    m_in_file = true;
+
+    return m_valid;
+}
+
+/**
+ * @brief Wait for every NZB closed since the last call to reach the disk.
+ * @retval bool False if any could not be written, in which case those have been removed.
+ */
+const bool NzbWriter::Finish()
+{
+    ITER( vector, uint_t, vi );
+    bool valid = true;
+
+    for ( vi = m_closed.begin(); vi != m_closed.end(); vi++ )
+        valid = g_global->m_fileio->Finish( *vi ) && valid;
+
+    m_closed.clear();
+
+    return valid;
+}
+
+/**
+ * @brief Returns the number of segments written to the current NZB.
+ * @retval uint_t The number of segments written to the current NZB.
+ */
+const uint_t NzbWriter::gSegments()
+{
+    return m_segments;
+}
+
+/**
+ * @brief Returns the number of compressed bytes queued for the current NZB.
+ * @retval uint_t The number of compressed bytes queued for the current NZB.
+ */
+const uint_t NzbWriter::gWritten()
+{
+    return m_written;
+}
+
+/**
+ * @brief Create an NZB and write its header. Any NZB still open is aborted.
+ * @param[in] path Where to write the gzipped NZB.
+ * @param[in] name The name of the release, stored as the name meta element.
+ * @retval bool False if the file could not be queued. One that cannot be created is reported by Finish().
+ */
+const bool NzbWriter::Open( const string& path, const string& name )
+{
+    UFLAGS_DE( flags );
+
+    Abort();
+
+    m_path = path;
+    m_xml_length = uintmin_t;
+    m_segments = uintmin_t;
+    m_written = uintmin_t;
+    m_valid = true;
+
+    if ( ( m_file = g_global->m_fileio->Create( m_path ) ) == 0 )
+        return false;
+
+    memset( &m_zstream, 0, sizeof( m_zstream ) );
+
+    // Adding 16 to the window bits asks zlib for a gzip header and trailer
+    if ( deflateInit2( &m_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        LOGFMT( flags, "NzbWriter::Open()->deflateInit2()-> unable to start compressing %s", CSTR( m_path ) );
+        g_global->m_fileio->Abort( m_file );
+        m_file = 0;
+
+        return false;
+    }
+
+    Append( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<!DOCTYPE nzb PUBLIC \"-//newzBin//DTD NZB 1.1//EN\" \"http://www.newzbin.com/DTD/nzb/nzb-1.1.dtd\">\n"
+            "<nzb xmlns=\"http://www.newzbin.com/DTD/2003/nzb\">\n"
+            " <head>\n  <meta type=\"name\">" );
+    Escape( name );
+    Append( "</meta>\n </head>\n" );
+
+    return m_valid;
+}
+
+/**
+ * @brief Add a segment to the open file element.
+ * @param[in] bytes The size of the article.
+ * @param[in] number The part number of the article.
+ * @param[in] messageid The message-id of the article, without angle brackets.
+ * @retval bool False if no file element is open or a write has failed.
+ */
+const bool NzbWriter::Segment( const uint_t& bytes, const uint_t& number, const string& messageid )
+{
+    char buf[64];
+
+    if ( !m_in_file )
+        return false;
+
+    Append( buf, ::snprintf( buf, sizeof( buf ), "   <segment bytes=\"%lu\" number=\"%lu\">", bytes, number ) );
+    Escape( messageid );
+    Append( "</segment>\n" );
+
+    m_segments++;
+
+    return m_valid;
+}
+
+/**
+ * @brief Copy raw XML into the buffer, compressing whatever is already there if it would overflow.
+ * @param[in] data The XML to add.
+ * @param[in] length The number of bytes to add.
+ * @retval void
+ */
+const void NzbWriter::Append( const char* data, const uint_t& length )
+{
+    uint_t done = 0, size = 0;
+
+    for ( done = 0; done < length; done += size )
+    {
+        size = min( length - done, m_xml.size() );
+        Reserve( size );
+        memcpy( &m_xml[m_xml_length], data + done, size );
+        m_xml_length += size;
+    }
+
+    return;
+}
+
+/**
+ * @brief Copy raw XML into the buffer, compressing whatever is already there if it would overflow.
+ * @param[in] data The XML to add.
+ * @retval void
+ */
+const void NzbWriter::Append( const string& data )
+{
+    Append( data.data(), data.length() );
+
+    return;
+}
+
+/**
+ * @brief Compress the XML buffer and queue the result to be written.
+ * @param[in] flush Z_NO_FLUSH while the NZB is being built, Z_FINISH to end the gzip stream.
+ * @retval bool False if compression failed.
+ */
+const bool NzbWriter::Deflate( const int& flush )
+{
+    UFLAGS_DE( flags );
+    uint_t have = 0;
+
+    if ( !m_valid )
+        return false;
+
+    m_zstream.next_in = &m_xml[0];
+    m_zstream.avail_in = m_xml_length;
+
+    do
+    {
+        m_zstream.next_out = &m_out[0];
+        m_zstream.avail_out = m_out.size();
+
+        if ( deflate( &m_zstream, flush ) == Z_STREAM_ERROR )
+        {
+            LOGFMT( flags, "NzbWriter::Deflate()->deflate()-> stream error writing %s", CSTR( m_path ) );
+            m_valid = false;
+
+            return false;
+        }
+
+        have = m_out.size() - m_zstream.avail_out;
+
+        // The chunk is copied, so the buffer is free again as soon as this returns
+        g_global->m_fileio->Write( m_file, reinterpret_cast<const char*>( &m_out[0] ), have );
+        m_written += have;
+    } while ( m_zstream.avail_out == 0 );
+
+    m_xml_length = uintmin_t;
+
+    return true;
+}
+
+/**
+ * @brief Returns the entity a character must be replaced with in XML text or attributes.
+ * @param[in] c The character to check.
+ * @retval char* The entity, or NULL if the character may be written as is.
+ */
+const char* NzbWriter::Entity( const char& c )
+{
+    switch ( c )
+    {
+        case '&':  return "&amp;";
+        case '<':  return "&lt;";
+        case '>':  return "&gt;";
+        case '"':  return "&quot;";
+        case '\'': return "&apos;";
+        default:   return NULL;
+    }
+}
+
+/**
+ * @brief Copy text into the buffer, escaping it for use within XML text or an attribute.
+ * @param[in] data The text to add.
+ * @retval void
+ */
+const void NzbWriter::Escape( const string& data )
+{
+    const char* input = data.data();
+    const char* entity = NULL;
+    uint_t i = 0, length = data.length();
+
+#if defined( __x86_64__ )
+    const __m128i amp = _mm_set1_epi8( '&' ), lt = _mm_set1_epi8( '<' ), gt = _mm_set1_epi8( '>' ), quot = _mm_set1_epi8( '"' ), apos = _mm_set1_epi8( '\'' );
+    __m128i block;
+    uint_t mask = 0, run = 0;
+
+    // Sixteen bytes at a time; most message-ids and subjects never need escaping
+    while ( i + 16 <= length )
+    {
+        block = _mm_loadu_si128( reinterpret_cast<const __m128i*>( input + i ) );
+        mask = _mm_movemask_epi8( _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( block, amp ), _mm_cmpeq_epi8( block, lt ) ),
+            _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( block, gt ), _mm_cmpeq_epi8( block, quot ) ), _mm_cmpeq_epi8( block, apos ) ) ) );
+
+        if ( mask == 0 )
+        {
+            Reserve( 16 );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( &m_xml[m_xml_length] ), block );
+            m_xml_length += 16;
+            i += 16;
+
+            continue;
+        }
+
+        run = __builtin_ctz( mask );
+        Append( input + i, run );
+        i += run;
+
+        entity = Entity( input[i++] );
+        Append( entity, ::strlen( entity ) );
+    }
+#endif
+
+    for ( ; i < length; i++ )
+    {
+        Reserve( 6 );
+
+        if ( ( entity = Entity( input[i] ) ) == NULL )
+            m_xml[m_xml_length++] = input[i];
+        else
+            Append( entity, ::strlen( entity ) );
+    }
+
+    return;
+}
+
+/**
+ * @brief Ensure the XML buffer has room, compressing what it holds if not.
+ * @param[in] length The number of bytes about to be added.
+ * @retval void
+ */
+const void NzbWriter::Reserve( const uint_t& length )
+{
+    // Once a write has failed the XML is discarded; Close() reports the failure
+    if ( m_xml_length + length > m_xml.size() && !Deflate( Z_NO_FLUSH ) )
+        m_xml_length = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the NzbWriter class.
+ */
+NzbWriter::NzbWriter()
+{
+    m_file = 0;
+    m_xml.resize( CFG_MEM_NZB_CHUNK );
+    m_xml_length = uintmin_t;
+    m_out.resize( CFG_MEM_NZB_CHUNK );
+    m_in_file = false;
+    m_valid = false;
+    m_segments = uintmin_t;
+    m_written = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the NzbWriter class. An NZB that was never closed is removed, and any that were are waited on.
+ */
+NzbWriter::~NzbWriter()
+{
+    Abort();
+    Finish();
+
+    return;
+}
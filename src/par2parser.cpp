@@ -0,0 +1,368 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file par2parser.cpp
+ * @brief All non-template member functions of the Par2Parser class.
+ *
+ * The Par2Parser class scans decoded par2 data for packet headers. Only the
+ * main and file description packets are held long enough to check their
+ * MD5; recovery slices, which make up nearly all of a par2 volume, are
+ * skipped by length. Packets split across chunks are carried over, so the
+ * parser can be fed one article at a time and stopped once gComplete() is
+ * true.
+ */
+#include "h/includes.h"
+#include "h/par2parser.h"
+
+#include "h/workerpool.h"
+
+/**
+ * @brief Time parsing of a set of par2 files spread across the WorkerPool.
+ * @param[in] files Paths of the par2 files to parse.
+ * @retval void
+ */
+const void Par2Parser::Benchmark( const vector<string>& files )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    vector<string> buffers;
+    chrono::high_resolution_clock::time_point start;
+    atomic<uint_t> packets, names, corrupt;
+    uint_t i = 0, pass = 0;
+    double elapsed = 0;
+
+    for ( i = 0; i < files.size(); i++ )
+    {
+        ifstream input( files[i], ios::binary );
+
+        if ( !input.is_open() )
+        {
+            LOGFMT( flags, "Par2Parser::Benchmark()-> unable to open %s", CSTR( files[i] ) );
+            continue;
+        }
+
+        buffers.push_back( string( istreambuf_iterator<char>( input ), istreambuf_iterator<char>() ) );
+    }
+
+    if ( buffers.empty() )
+        return;
+
+    packets = names = corrupt = uintmin_t;
+    start = chrono::high_resolution_clock::now();
+
+    // Keep going for at least a second so the rate means something for small sets
+    for ( pass = 0; pass < 1000 && elapsed < 1; pass++ )
+    {
+        for ( i = 0; i < buffers.size(); i++ )
+        {
+            const string* buffer = &buffers[i];
+
+            g_global->m_workers->Submit( [buffer, &packets, &names, &corrupt]()
+            {
+                Par2Parser parser;
+
+                parser.Parse( *buffer );
+                packets += parser.gPackets();
+                names += parser.gFiles().size();
+                corrupt += parser.gCorrupt();
+            } );
+        }
+
+        while ( g_global->m_workers->gPending() > 0 )
+            ::usleep( CFG_THR_SLEEP );
+
+        elapsed = chrono::duration_cast<chrono::duration<double>>( chrono::high_resolution_clock::now() - start ).count();
+    }
+
+    LOGFMT( iflags, "Par2Parser::Benchmark()-> %lu files x %lu passes on %lu threads: %.0f files/sec, %lu packets, %lu file names, %lu corrupt",
+        buffers.size(), pass, g_global->m_workers->gThreads(), elapsed > 0 ? buffers.size() * pass / elapsed : 0,
+        static_cast<uint_t>( packets ) / pass, static_cast<uint_t>( names ) / pass, static_cast<uint_t>( corrupt ) / pass );
+
+    return;
+}
+
+/**
+ * @brief Returns whether every file of the recovery set has been described.
+ * @retval bool True once the main packet and a description of each file it lists have been seen.
+ */
+const bool Par2Parser::gComplete()
+{
+    uint_t i = 0;
+
+    if ( !m_main )
+        return false;
+
+    for ( i = 0; i < m_expected.size(); i++ )
+        if ( m_index.find( m_expected[i] ) == m_index.end() )
+            return false;
+
+    return true;
+}
+
+/**
+ * @brief Returns the number of packet headers found with an impossible length or a bad MD5.
+ * @retval uint_t The number of packet headers found with an impossible length or a bad MD5.
+ */
+const uint_t Par2Parser::gCorrupt()
+{
+    return m_corrupt;
+}
+
+/**
+ * @brief Returns the files described so far.
+ * @retval vector<File> The files described so far, in the order first seen.
+ */
+const vector<Par2Parser::File> Par2Parser::gFiles()
+{
+    return m_files;
+}
+
+/**
+ * @brief Returns the number of packets found.
+ * @retval uint_t The number of packets found.
+ */
+const uint_t Par2Parser::gPackets()
+{
+    return m_packets;
+}
+
+/**
+ * @brief Returns the recovery set id.
+ * @retval string The recovery set id as hex, or an empty string if no packet has been verified.
+ */
+const string Par2Parser::gSet()
+{
+    return m_set;
+}
+
+/**
+ * @brief Parse the next chunk of par2 data.
+ * @param[in] data The decoded data.
+ * @param[in] length The number of bytes of data.
+ * @retval void
+ */
+const void Par2Parser::Parse( const char* data, const uint_t& length )
+{
+    const uint8_t* input = reinterpret_cast<const uint8_t*>( data );
+    uint_t size = length, used = 0;
+
+    if ( m_skip > 0 )
+    {
+        used = min( m_skip, size );
+        m_skip -= used;
+        input += used;
+        size -= used;
+    }
+
+    // Only a packet that was cut off is copied, everything else is scanned in place
+    if ( m_pending.empty() )
+    {
+        used = Scan( input, size );
+        m_pending.assign( reinterpret_cast<const char*>( input ) + used, size - used );
+    }
+    else
+    {
+        m_pending.append( reinterpret_cast<const char*>( input ), size );
+        used = Scan( reinterpret_cast<const uint8_t*>( m_pending.data() ), m_pending.length() );
+        m_pending.erase( 0, used );
+    }
+
+    return;
+}
+
+/**
+ * @brief Parse the next chunk of par2 data.
+ * @param[in] data The decoded data.
+ * @retval void
+ */
+const void Par2Parser::Parse( const string& data )
+{
+    Parse( data.data(), data.length() );
+
+    return;
+}
+
+/**
+ * @brief Forget everything parsed so far to start on another recovery set.
+ * @retval void
+ */
+const void Par2Parser::Reset()
+{
+    m_pending.clear();
+    m_skip = uintmin_t;
+    m_packets = uintmin_t;
+    m_corrupt = uintmin_t;
+    m_set.clear();
+    m_files.clear();
+    m_index.clear();
+    m_expected.clear();
+    m_main = false;
+
+    return;
+}
+
+/**
+ * @brief Walk the packets of a buffer.
+ * @param[in] data The buffer to scan.
+ * @param[in] length The number of bytes in the buffer.
+ * @retval uint_t The number of bytes consumed. Anything after that is the start of a packet that needs more data.
+ */
+const uint_t Par2Parser::Scan( const uint8_t* data, const uint_t& length )
+{
+    static const uint8_t magic[8] = { 'P', 'A', 'R', '2', '\0', 'P', 'K', 'T' };
+    static const uint8_t filedesc[16] = { 'P', 'A', 'R', ' ', '2', '.', '0', '\0', 'F', 'i', 'l', 'e', 'D', 'e', 's', 'c' };
+    static const uint8_t main[16] = { 'P', 'A', 'R', ' ', '2', '.', '0', '\0', 'M', 'a', 'i', 'n', '\0', '\0', '\0', '\0' };
+    const uint8_t* found = NULL;
+    const uint8_t* name = NULL;
+    uint8_t digest[16];
+    uint64_t size = 0;
+    uint32_t count = 0;
+    uint_t i = 0, y = 0;
+    File file;
+    string id;
+
+    while ( i + sizeof( magic ) <= length )
+    {
+        if ( ( found = static_cast<const uint8_t*>( ::memmem( data + i, length - i, magic, sizeof( magic ) ) ) ) == NULL )
+            // Keep enough of the tail to catch magic split across chunks
+            return length - sizeof( magic ) + 1;
+
+        i = found - data;
+
+        // The header is 64 bytes: magic, length, packet MD5, recovery set id, and type
+        if ( length - i < 64 )
+            return i;
+
+        size = uintmin_t;
+        for ( y = 0; y < 8; y++ )
+            size |= static_cast<uint64_t>( data[i + 8 + y] ) << ( y * 8 );
+
+        if ( size < 64 || size % 4 != 0 )
+        {
+            m_corrupt++;
+            i += sizeof( magic );
+
+            continue;
+        }
+
+        if ( memcmp( data + i + 48, filedesc, 16 ) != 0 && memcmp( data + i + 48, main, 16 ) != 0 )
+        {
+            m_packets++;
+
+            if ( size > length - i )
+            {
+                m_skip = size - ( length - i );
+                return length;
+            }
+
+            i += size;
+
+            continue;
+        }
+
+        // A Main packet too short to hold its file count is corrupt, whatever its MD5 says
+        if ( size > CFG_MEM_MAX_PAR2_PACKET || ( size < 76 && memcmp( data + i + 48, main, 16 ) == 0 ) )
+        {
+            m_corrupt++;
+            i += sizeof( magic );
+
+            continue;
+        }
+
+        if ( size > length - i )
+            return i;
+
+        // The packet MD5 covers everything from the recovery set id on
+        Utils::MD5( data + i + 32, size - 32, digest );
+
+        if ( memcmp( digest, data + i + 16, 16 ) != 0 )
+        {
+            m_corrupt++;
+            i += sizeof( magic );
+
+            continue;
+        }
+
+        m_packets++;
+
+        if ( m_set.empty() )
+            m_set = Utils::StrHex( data + i + 32, 16 );
+
+        if ( data[i + 56] == 'M' )
+        {
+            // Main: slice size, file count, then the ids of the files in the recovery set
+            count = data[i + 72] | data[i + 73] << 8 | data[i + 74] << 16 | static_cast<uint32_t>( data[i + 75] ) << 24;
+            m_main = true;
+            m_expected.clear();
+
+            for ( y = 0; y < count && 76 + ( y + 1 ) * 16 <= size; y++ )
+                m_expected.push_back( Utils::StrHex( data + i + 76 + y * 16, 16 ) );
+        }
+        else if ( size >= 120 )
+        {
+            // FileDesc: file id, MD5, MD5 of the first 16KiB, length, then the name padded with nulls
+            id = Utils::StrHex( data + i + 64, 16 );
+
+            if ( m_index.find( id ) == m_index.end() )
+            {
+                file.id = id;
+                file.hash = Utils::StrHex( data + i + 80, 16 );
+                file.hash16k = Utils::StrHex( data + i + 96, 16 );
+                file.size = uintmin_t;
+                for ( y = 0; y < 8; y++ )
+                    file.size |= static_cast<uint_t>( data[i + 112 + y] ) << ( y * 8 );
+
+                name = data + i + 120;
+                file.name.assign( reinterpret_cast<const char*>( name ), ::strnlen( reinterpret_cast<const char*>( name ), size - 120 ) );
+
+                m_index[id] = m_files.size();
+                m_files.push_back( file );
+            }
+        }
+
+        i += size;
+    }
+
+    return i;
+}
+
+/**
+ * @brief Constructor for the Par2Parser class.
+ */
+Par2Parser::Par2Parser()
+{
+    m_skip = uintmin_t;
+    m_packets = uintmin_t;
+    m_corrupt = uintmin_t;
+    m_main = false;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the Par2Parser class.
+ */
+Par2Parser::~Par2Parser()
+{
+    return;
+}
@@ -0,0 +1,354 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file querycache.cpp
+ * @brief All non-template member functions of the QueryCache class.
+ *
+ * The QueryCache class sits in front of DBConn::Query() for reads that only
+ * touch tables listed in TTL(), such as settings, categories and the regex
+ * and blacklist tables every stage reloads. Results are keyed by database and
+ * the query with its whitespace normalized, and handed out as shared_ptr so
+ * threads share one immutable copy. An entry lives for the shortest TTL of
+ * the tables it read, and is dropped early when DBConnMySQL::Execute() runs
+ * one of our own writes against any of them. Each such write also bumps a
+ * generation per table, so a read that was running meanwhile is not stored.
+ * Writes made by nZEDb itself are only picked up once the TTL runs out. The
+ * hit rate is logged every #CFG_DB_CACHE_REPORT seconds.
+ */
+#include "h/includes.h"
+#include "h/querycache.h"
+
+#include "h/dbconn.h"
+
+/**
+ * @brief Returns the number of queries answered from the cache.
+ * @retval uint_t The number of queries answered from the cache.
+ */
+const uint_t QueryCache::gHits()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_hits;
+}
+
+/**
+ * @brief Returns the number of cacheable queries that had to be run.
+ * @retval uint_t The number of cacheable queries that had to be run.
+ */
+const uint_t QueryCache::gMisses()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_misses;
+}
+
+/**
+ * @brief Drop every cached result read from a table a write statement touched.
+ * @param[in] query The write statement, which was successful.
+ * @retval void
+ */
+const void QueryCache::Invalidate( const string& query )
+{
+    // Only the head names the tables written; the rest may be megabytes of bulk VALUES or subject text
+    vector<string> tables = Tables( Head( query ) );
+    unordered_map<string,Entry>::iterator mi;
+    uint_t i = 0;
+    bool cached = false;
+
+    // Most writes are to tables that are never cached, and need not wait on the lock
+    for ( i = 0; i < tables.size(); i++ )
+        if ( TTL( tables[i] ) > 0 )
+            cached = true;
+
+    if ( !cached )
+        return;
+
+    lock_guard<mutex> lock( m_mutex );
+
+    for ( i = 0; i < tables.size(); i++ )
+        if ( TTL( tables[i] ) > 0 )
+            m_generations[tables[i]]++;
+
+    for ( mi = m_entries.begin(); mi != m_entries.end(); )
+    {
+        for ( i = 0; i < tables.size(); i++ )
+            if ( find( mi->second.tables.begin(), mi->second.tables.end(), tables[i] ) != mi->second.tables.end() )
+                break;
+
+        if ( i < tables.size() )
+        {
+            mi = m_entries.erase( mi );
+            m_invalidated++;
+        }
+        else
+            mi++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Run a query through the cache.
+ * @param[in] db The database connector to run the query on if its result is not cached.
+ * @param[in] query The query.
+ * @retval shared_ptr<const vector<vector<string>>> The result set, shared with other callers if it was cached.
+ */
+const shared_ptr<const vector<vector<string>>> QueryCache::Query( DBConn* db, const string& query )
+{
+    UFLAGS_I( flags );
+    unordered_map<string,Entry>::iterator mi, oldest;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    string key;
+    Entry entry;
+    vector<uint_t> generations;
+    uint_t ttl = 0, i = 0;
+
+    entry.tables = Tables( query );
+
+    for ( i = 0; i < entry.tables.size(); i++ )
+        ttl = i == 0 ? TTL( entry.tables[i] ) : min( ttl, TTL( entry.tables[i] ) );
+
+    if ( ttl == 0 || !DBConn::ReadOnly( query ) )
+        return make_shared<const vector<vector<string>>>( db->Query( query ) );
+
+    key = db->gDatabase() + "\n" + Normalize( query );
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+
+        if ( ( mi = m_entries.find( key ) ) != m_entries.end() && mi->second.expires > now )
+        {
+            m_hits++;
+            return mi->second.result;
+        }
+
+        m_misses++;
+
+        for ( i = 0; i < entry.tables.size(); i++ )
+            generations.push_back( m_generations[entry.tables[i]] );
+    }
+
+    // The query runs without the lock so a slow one does not hold up hits on others
+    entry.result = make_shared<const vector<vector<string>>>( db->Query( query ) );
+    entry.expires = now + chrono::seconds( ttl );
+
+    lock_guard<mutex> lock( m_mutex );
+
+    // A write to any of the tables while the query ran may have been read before or after it, so the result is not kept
+    for ( i = 0; i < entry.tables.size(); i++ )
+        if ( m_generations[entry.tables[i]] != generations[i] )
+            break;
+
+    // An empty result is as likely to be an error as an empty table, so it is not kept
+    if ( entry.result->size() > 1 && i == entry.tables.size() )
+        m_entries[key] = entry;
+
+    // Expired entries go first, then whichever would expire soonest
+    for ( mi = m_entries.begin(); m_entries.size() > CFG_MEM_MAX_QUERY_CACHE && mi != m_entries.end(); )
+        mi = mi->second.expires <= now ? m_entries.erase( mi ) : next( mi );
+
+    while ( m_entries.size() > CFG_MEM_MAX_QUERY_CACHE )
+    {
+        for ( oldest = mi = m_entries.begin(); mi != m_entries.end(); mi++ )
+            if ( mi->second.expires < oldest->second.expires )
+                oldest = mi;
+
+        m_entries.erase( oldest );
+    }
+
+    if ( chrono::duration_cast<chrono::seconds>( now - m_reported ).count() >= CFG_DB_CACHE_REPORT )
+    {
+        m_reported = now;
+        LOGFMT( flags, "QueryCache::Query()-> %lu hits, %lu misses, %lu invalidated, %lu cached", m_hits, m_misses, m_invalidated, m_entries.size() );
+    }
+
+    return entry.result;
+}
+
+/**
+ * @brief Cut a write statement before its VALUES, SET or WHERE clause, outside of quoted strings.
+ * @param[in] query The write statement.
+ * @retval string The part of the statement that names the tables written.
+ */
+const string QueryCache::Head( const string& query )
+{
+    static const string clauses[] = { "VALUES", "VALUE", "SET", "WHERE" };
+    string::size_type i = 0, end = 0;
+    string word;
+    uint_t y = 0;
+    char quote = 0;
+
+    for ( i = 0; i < query.length(); i++ )
+    {
+        if ( quote != 0 )
+        {
+            if ( query[i] == '\\' )
+                i++;
+            else if ( query[i] == quote )
+                quote = 0;
+
+            continue;
+        }
+
+        if ( query[i] == '\'' || query[i] == '"' || query[i] == '`' )
+        {
+            quote = query[i];
+            continue;
+        }
+
+        if ( !::isalpha( static_cast<unsigned char>( query[i] ) ) || ( i > 0 && ( ::isalnum( static_cast<unsigned char>( query[i - 1] ) ) || query[i - 1] == '_' ) ) )
+            continue;
+
+        for ( end = i; end < query.length() && ( ::isalnum( static_cast<unsigned char>( query[end] ) ) || query[end] == '_' ); end++ );
+
+        word = query.substr( i, end - i );
+        transform( word.begin(), word.end(), word.begin(), ::toupper );
+
+        for ( y = 0; y < sizeof( clauses ) / sizeof( clauses[0] ); y++ )
+            if ( word == clauses[y] )
+                return query.substr( 0, i );
+
+        i = end - 1;
+    }
+
+    return query;
+}
+
+/**
+ * @brief Collapse the whitespace of a query outside of quoted strings, so formatting differences share one entry.
+ * @param[in] query The query.
+ * @retval string The normalized query.
+ */
+const string QueryCache::Normalize( const string& query )
+{
+    string output;
+    uint_t i = 0;
+    char quote = 0;
+
+    for ( i = 0; i < query.length(); i++ )
+    {
+        if ( quote != 0 )
+        {
+            output.push_back( query[i] );
+
+            if ( query[i] == '\\' && i + 1 < query.length() )
+                output.push_back( query[++i] );
+            else if ( query[i] == quote )
+                quote = 0;
+        }
+        else if ( ::isspace( static_cast<unsigned char>( query[i] ) ) )
+        {
+            if ( !output.empty() && output[output.length() - 1] != ' ' )
+                output.push_back( ' ' );
+        }
+        else
+        {
+            if ( query[i] == '\'' || query[i] == '"' || query[i] == '`' )
+                quote = query[i];
+
+            output.push_back( query[i] );
+        }
+    }
+
+    while ( !output.empty() && ( output[output.length() - 1] == ' ' || output[output.length() - 1] == ';' ) )
+        output.erase( output.length() - 1 );
+
+    return output;
+}
+
+/**
+ * @brief Find every table a statement names, whether it reads or writes them.
+ * @param[in] query The statement.
+ * @retval vector<string> The tables following FROM, JOIN, INTO, UPDATE or TABLE, including comma separated lists, in lower case.
+ */
+const vector<string> QueryCache::Tables( const string& query )
+{
+    static const regex names( "\\b(?:FROM|JOIN|INTO|UPDATE|TABLE)\\s+((?:`?\\w+`?(?:\\s+(?:AS\\s+)?\\w+)?\\s*,\\s*)*`?\\w+`?)", regex::icase );
+    sregex_iterator it( query.begin(), query.end(), names ), end;
+    vector<string> tables;
+    stringstream list;
+    string table;
+
+    for ( ; it != end; it++ )
+    {
+        list.clear();
+        list.str( ( *it )[1].str() );
+
+        while ( getline( list, table, ',' ) )
+        {
+            table.erase( 0, table.find_first_not_of( " \t\n`" ) );
+            table.erase( table.find_first_of( " \t\n`" ) == string::npos ? table.length() : table.find_first_of( " \t\n`" ) );
+            transform( table.begin(), table.end(), table.begin(), ::tolower );
+
+            if ( !table.empty() && find( tables.begin(), tables.end(), table ) == tables.end() )
+                tables.push_back( table );
+        }
+    }
+
+    return tables;
+}
+
+/**
+ * @brief Returns how long results read from a table may be cached.
+ * @param[in] table The table, in lower case.
+ * @retval uint_t Seconds to cache results read from the table, or 0 if they must not be cached.
+ */
+const uint_t QueryCache::TTL( const string& table )
+{
+    // Only small tables that nZEDb rarely changes belong here
+    static const pair<string,uint_t> ttls[] =
+    {
+        { "binaryblacklist",    300 },
+        { "categories",         300 },
+        { "collection_regexes", 300 },
+        { "settings",           300 }
+    };
+    uint_t i = 0;
+
+    for ( i = 0; i < sizeof( ttls ) / sizeof( ttls[0] ); i++ )
+        if ( ttls[i].first == table )
+            return ttls[i].second;
+
+    return 0;
+}
+
+/**
+ * @brief Constructor for the QueryCache class.
+ */
+QueryCache::QueryCache()
+{
+    m_hits = uintmin_t;
+    m_invalidated = uintmin_t;
+    m_misses = uintmin_t;
+    m_reported = chrono::steady_clock::now();
+
+    return;
+}
+
+/**
+ * @brief Destructor for the QueryCache class.
+ */
+QueryCache::~QueryCache()
+{
+    return;
+}
@@ -0,0 +1,156 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file requestidcache.cpp
+ * @brief All non-template member functions of the RequestIDCache class.
+ *
+ * The RequestIDCache class keeps request id lookups between runs so the
+ * same request ids are not resolved over and over. Titles and misses are
+ * both cached, each with their own time to live, and the least recently
+ * used entry is dropped once #CFG_MEM_MAX_REQID_CACHE is reached.
+ */
+#include "h/includes.h"
+#include "h/requestidcache.h"
+
+/**
+ * @brief Find a cached result.
+ * @param[in] group The name of the group the request id was posted to.
+ * @param[in] request The request id.
+ * @param[out] result The cached result, found or not.
+ * @retval bool False if the request id must be looked up.
+ */
+const bool RequestIDCache::Get( const string& group, const uint_t& request, Result& result )
+{
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,list<Entry>::iterator>::iterator mi;
+    string key = Utils::FormatString( 0, "%lu ", request ) + group;
+
+    if ( ( mi = m_index.find( key ) ) == m_index.end() )
+    {
+        m_misses++;
+        return false;
+    }
+
+    if ( mi->second->expires <= chrono::steady_clock::now() )
+    {
+        m_order.erase( mi->second );
+        m_index.erase( mi );
+        m_misses++;
+
+        return false;
+    }
+
+    m_order.splice( m_order.begin(), m_order, mi->second );
+    result = mi->second->result;
+    m_hits++;
+
+    return true;
+}
+
+/**
+ * @brief Returns the number of lookups answered from the cache.
+ * @retval uint_t The number of lookups answered from the cache.
+ */
+const uint_t RequestIDCache::gHits()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_hits;
+}
+
+/**
+ * @brief Returns the number of lookups that were not cached or had expired.
+ * @retval uint_t The number of lookups that were not cached or had expired.
+ */
+const uint_t RequestIDCache::gMisses()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_misses;
+}
+
+/**
+ * @brief Returns the number of cached results.
+ * @retval uint_t The number of cached results.
+ */
+const uint_t RequestIDCache::gSize()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return m_order.size();
+}
+
+/**
+ * @brief Cache a result, replacing any earlier one for the same request id.
+ * @param[in] group The name of the group the request id was posted to.
+ * @param[in] request The request id.
+ * @param[in] result The result; misses expire after #CFG_REL_REQID_MISS_TTL and titles after #CFG_REL_REQID_HIT_TTL.
+ * @retval void
+ */
+const void RequestIDCache::Put( const string& group, const uint_t& request, const Result& result )
+{
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,list<Entry>::iterator>::iterator mi;
+    Entry entry;
+
+    entry.key = Utils::FormatString( 0, "%lu ", request ) + group;
+    entry.result = result;
+    entry.expires = chrono::steady_clock::now() + chrono::seconds( result.found ? CFG_REL_REQID_HIT_TTL : CFG_REL_REQID_MISS_TTL );
+
+    if ( ( mi = m_index.find( entry.key ) ) != m_index.end() )
+    {
+        m_order.erase( mi->second );
+        m_index.erase( mi );
+    }
+
+    m_order.push_front( entry );
+    m_index[entry.key] = m_order.begin();
+
+    while ( m_order.size() > m_capacity )
+    {
+        m_index.erase( m_order.back().key );
+        m_order.pop_back();
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the RequestIDCache class.
+ * @param[in] capacity Most entries kept before the least recently used is dropped.
+ */
+RequestIDCache::RequestIDCache( const uint_t& capacity ) : m_capacity( capacity )
+{
+    m_hits = uintmin_t;
+    m_misses = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the RequestIDCache class.
+ */
+RequestIDCache::~RequestIDCache()
+{
+    return;
+}
@@ -0,0 +1,440 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file requestidservice.cpp
+ * @brief All non-template member functions of the RequestIDService class.
+ *
+ * The RequestIDService class asks the request id web service about a batch
+ * of request ids from one group at a time. The request_url setting uses the
+ * same [REQUEST_ID] and [GROUP_NM] placeholders as nZEDb, with the request
+ * ids joined by commas, and the reply is read for items carrying reqid and
+ * title attributes. Only plain http is spoken. Serve() answers the same
+ * requests from a tab separated file so the requestid stage can be run
+ * without reaching the real service.
+ */
+#include "h/includes.h"
+#include "h/requestidservice.h"
+
+/**
+ * @brief Look up a batch of request ids from one group.
+ * @param[in] url The request_url setting.
+ * @param[in] group The name of the group the request ids were posted to.
+ * @param[in] requests The request ids to look up.
+ * @param[out] titles The title of every request id the service knew.
+ * @retval bool False if the service could not be asked, in which case nothing is known about any of the request ids.
+ */
+const bool RequestIDService::Fetch( const string& url, const string& group, const vector<uint_t>& requests, unordered_map<uint_t,string>& titles )
+{
+    UFLAGS_DE( flags );
+    static const regex item( "<[^>]*\\breqid=\"([0-9]+)\"[^>]*\\b(?:title|name)=\"([^\"]*)\"" );
+    struct addrinfo hints, *res = NULL;
+    string host, port = "80", path, joined, response;
+    sregex_iterator it, end;
+    string::size_type pos = 0;
+    sint_t fd = -1, ret = 0;
+    uint_t i = 0;
+
+    if ( url.compare( 0, 7, "http://" ) != 0 )
+    {
+        LOGFMT( flags, "RequestIDService::Fetch()-> unsupported request_url: %s", CSTR( url ) );
+        return false;
+    }
+
+    host = url.substr( 7 );
+    if ( ( pos = host.find( '/' ) ) != string::npos )
+    {
+        path = host.substr( pos );
+        host.erase( pos );
+    }
+    else
+        path = "/";
+
+    if ( ( pos = host.find( ':' ) ) != string::npos )
+    {
+        port = host.substr( pos + 1 );
+        host.erase( pos );
+    }
+
+    for ( i = 0; i < requests.size(); i++ )
+        joined.append( Utils::FormatString( 0, i > 0 ? ",%lu" : "%lu", requests[i] ) );
+
+    if ( ( pos = path.find( "[REQUEST_ID]" ) ) != string::npos )
+        path.replace( pos, 12, joined );
+    if ( ( pos = path.find( "[GROUP_NM]" ) ) != string::npos )
+        path.replace( pos, 10, Encode( group ) );
+
+    ::memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ( ( ret = ::getaddrinfo( CSTR( host ), CSTR( port ), &hints, &res ) ) != 0 )
+    {
+        LOGFMT( flags, "RequestIDService::Fetch()->getaddrinfo()-> %s: %s", CSTR( host ), gai_strerror( ret ) );
+        return false;
+    }
+
+    if ( ( fd = ::socket( res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol ) ) < 0 )
+    {
+        LOGERRNO( flags, "RequestIDService::Fetch()->socket()->" );
+        ::freeaddrinfo( res );
+        return false;
+    }
+
+    if ( ::connect( fd, res->ai_addr, res->ai_addrlen ) < 0 && errno != EINPROGRESS )
+    {
+        LOGERRNO( flags, "RequestIDService::Fetch()->connect()->" );
+        ::freeaddrinfo( res );
+        ::close( fd );
+        return false;
+    }
+
+    ::freeaddrinfo( res );
+
+    if ( !Exchange( fd, "GET " + path + " HTTP/1.0\r\nHost: " + host + "\r\nConnection: close\r\n\r\n", response ) )
+    {
+        LOGFMT( flags, "RequestIDService::Fetch()-> %s: no reply within %lus", CSTR( host ), CFG_REL_REQID_TIMEOUT );
+        ::close( fd );
+        return false;
+    }
+
+    ::close( fd );
+
+    if ( response.compare( 0, 9, "HTTP/1.0 " ) != 0 && response.compare( 0, 9, "HTTP/1.1 " ) != 0 )
+    {
+        LOGFMT( flags, "RequestIDService::Fetch()-> %s: malformed reply", CSTR( host ) );
+        return false;
+    }
+
+    if ( response.compare( 9, 3, "200" ) != 0 )
+    {
+        LOGFMT( flags, "RequestIDService::Fetch()-> %s: %s", CSTR( host ), CSTR( response.substr( 9, response.find( '\r' ) - 9 ) ) );
+        return false;
+    }
+
+    for ( it = sregex_iterator( response.begin(), response.end(), item ); it != end; it++ )
+        titles[::strtoul( CSTR( ( *it )[1].str() ), NULL, 10 )] = Decode( ( *it )[2].str() );
+
+    return true;
+}
+
+/**
+ * @brief Answer request id lookups from a file until shutdown, as a stand in for the web service.
+ * @param[in] port The port to listen on, bound to the loopback address only.
+ * @param[in] file A file of lines holding a group name, request id and title separated by tabs.
+ * @retval bool False if the file could not be read or the port could not be bound.
+ */
+const bool RequestIDService::Serve( const string& port, const string& file )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    unordered_map<string,string> known;
+    unordered_map<string,string>::iterator mi;
+    struct sockaddr_in addr;
+    ifstream input( file );
+    string line, request, query, group, reply;
+    stringstream ids;
+    string::size_type first = 0, second = 0;
+    sint_t fd = -1, client = -1, yes = 1;
+    uint_t served = 0, id = 0;
+
+    if ( !input.is_open() )
+    {
+        LOGFMT( flags, "RequestIDService::Serve()-> unable to open %s", CSTR( file ) );
+        return false;
+    }
+
+    while ( getline( input, line ) )
+    {
+        if ( ( first = line.find( '\t' ) ) == string::npos || ( second = line.find( '\t', first + 1 ) ) == string::npos )
+            continue;
+
+        known[line.substr( first + 1, second - first - 1 ) + " " + line.substr( 0, first )] = line.substr( second + 1 );
+    }
+
+    ::memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = htons( ::strtoul( CSTR( port ), NULL, 10 ) );
+
+    if ( ( fd = ::socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        LOGERRNO( flags, "RequestIDService::Serve()->socket()->" );
+        return false;
+    }
+
+    ::setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof( yes ) );
+
+    if ( ::bind( fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr ) ) < 0 || ::listen( fd, 16 ) < 0 )
+    {
+        LOGERRNO( flags, "RequestIDService::Serve()->bind()->" );
+        ::close( fd );
+        return false;
+    }
+
+    LOGFMT( iflags, "RequestIDService::Serve()-> answering for %lu request ids on http://127.0.0.1:%s/?reqid=[REQUEST_ID]&group=[GROUP_NM]", known.size(), CSTR( port ) );
+
+    while ( !g_global->m_shutdown )
+    {
+        if ( ( client = ::accept( fd, NULL, NULL ) ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            LOGERRNO( flags, "RequestIDService::Serve()->accept()->" );
+            break;
+        }
+
+        request.clear();
+
+        // Read only up to the end of the request line, which is all that is needed
+        if ( !Exchange( client, "", request ) || ( first = request.find( ' ' ) ) == string::npos || ( second = request.find( ' ', first + 1 ) ) == string::npos )
+        {
+            ::close( client );
+            continue;
+        }
+
+        query = request.substr( first + 1, second - first - 1 );
+        query = query.find( '?' ) == string::npos ? "" : query.substr( query.find( '?' ) + 1 );
+        group = Parameter( query, "group" );
+        reply = "<requests>\n";
+
+        ids.clear();
+        ids.str( Parameter( query, "reqid" ) );
+
+        while ( ids >> id )
+        {
+            if ( ( mi = known.find( Utils::FormatString( 0, "%lu ", id ) + group ) ) != known.end() )
+                reply.append( Utils::FormatString( 0, "<item reqid=\"%lu\" title=\"%s\"/>\n", id, CSTR( Escape( mi->second ) ) ) );
+
+            if ( ids.peek() == ',' )
+                ids.ignore();
+        }
+
+        reply.append( "</requests>\n" );
+        reply = Utils::FormatString( 0, "HTTP/1.0 200 OK\r\nContent-Type: text/xml\r\nContent-Length: %lu\r\n\r\n", reply.length() ) + reply;
+
+        // The client reads until the connection closes, so the socket is left blocking to write the whole reply at once
+        ::send( client, reply.data(), reply.length(), MSG_NOSIGNAL );
+        ::close( client );
+        served++;
+    }
+
+    ::close( fd );
+    LOGFMT( iflags, "RequestIDService::Serve()-> answered %lu requests", served );
+
+    return true;
+}
+
+/**
+ * @brief Undo the XML entities the service escapes titles with.
+ * @param[in] text The escaped text.
+ * @retval string The plain text.
+ */
+const string RequestIDService::Decode( const string& text )
+{
+    static const pair<string,char> entities[] = { { "&amp;", '&' }, { "&apos;", '\'' }, { "&gt;", '>' }, { "&lt;", '<' }, { "&quot;", '"' } };
+    string output;
+    uint_t i = 0, y = 0;
+
+    for ( i = 0; i < text.length(); i++ )
+    {
+        if ( text[i] == '&' )
+        {
+            for ( y = 0; y < sizeof( entities ) / sizeof( entities[0] ); y++ )
+                if ( text.compare( i, entities[y].first.length(), entities[y].first ) == 0 )
+                    break;
+
+            if ( y < sizeof( entities ) / sizeof( entities[0] ) )
+            {
+                output.push_back( entities[y].second );
+                i += entities[y].first.length() - 1;
+
+                continue;
+            }
+        }
+
+        output.push_back( text[i] );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Escape text for use within a URL.
+ * @param[in] text The plain text.
+ * @retval string The text with every byte other than letters, digits and .-_ written as a percent escape.
+ */
+const string RequestIDService::Encode( const string& text )
+{
+    string output;
+    uint_t i = 0;
+
+    for ( i = 0; i < text.length(); i++ )
+    {
+        if ( ::isalnum( static_cast<unsigned char>( text[i] ) ) || text[i] == '.' || text[i] == '-' || text[i] == '_' )
+            output.push_back( text[i] );
+        else
+            output.append( Utils::FormatString( 0, "%%%02X", static_cast<unsigned char>( text[i] ) ) );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Escape text for use within an XML attribute, the reverse of Decode().
+ * @param[in] text The plain text.
+ * @retval string The text with markup characters written as entities.
+ */
+const string RequestIDService::Escape( const string& text )
+{
+    string output;
+    uint_t i = 0;
+
+    for ( i = 0; i < text.length(); i++ )
+    {
+        switch ( text[i] )
+        {
+            case '&': output.append( "&amp;" ); break;
+            case '<': output.append( "&lt;" ); break;
+            case '>': output.append( "&gt;" ); break;
+            case '"': output.append( "&quot;" ); break;
+            default: output.push_back( text[i] ); break;
+        }
+    }
+
+    return output;
+}
+
+/**
+ * @brief Write a request to a socket and read until the peer closes, all within #CFG_REL_REQID_TIMEOUT.
+ * @param[in] fd The socket.
+ * @param[in] request What to write; when empty, reading instead stops at the end of the first line.
+ * @param[out] response Everything read.
+ * @retval bool False if the socket failed or timed out before finishing.
+ */
+const bool RequestIDService::Exchange( const sint_t& fd, const string& request, string& response )
+{
+    struct pollfd pfd;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds( CFG_REL_REQID_TIMEOUT );
+    char buf[16384];
+    sint_t ret = 0;
+    uint_t sent = 0;
+
+    pfd.fd = fd;
+
+    while ( chrono::steady_clock::now() < deadline )
+    {
+        pfd.events = sent < request.length() ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+
+        if ( ( ret = ::poll( &pfd, 1, CFG_REL_REQID_TIMEOUT * 1000 ) ) < 0 && errno != EINTR )
+            return false;
+
+        if ( ret <= 0 )
+            continue;
+
+        if ( sent < request.length() )
+        {
+            if ( ( ret = ::send( fd, request.data() + sent, request.length() - sent, MSG_NOSIGNAL ) ) > 0 )
+                sent += ret;
+            else if ( errno != EAGAIN )
+                return false;
+
+            continue;
+        }
+
+        if ( ( ret = ::recv( fd, buf, sizeof( buf ), 0 ) ) == 0 )
+            return true;
+
+        if ( ret < 0 )
+        {
+            if ( errno != EAGAIN )
+                return false;
+
+            continue;
+        }
+
+        response.append( buf, ret );
+
+        if ( request.empty() && response.find( '\n' ) != string::npos )
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Find a parameter within the query string of a URL.
+ * @param[in] query The query string, without the leading question mark.
+ * @param[in] name The name of the parameter.
+ * @retval string The value of the parameter with percent escapes undone, or empty if it was not present.
+ */
+const string RequestIDService::Parameter( const string& query, const string& name )
+{
+    string output, value;
+    string::size_type pos = 0, stop = 0;
+    uint_t i = 0;
+
+    while ( pos < query.length() )
+    {
+        if ( ( stop = query.find( '&', pos ) ) == string::npos )
+            stop = query.length();
+
+        if ( query.compare( pos, name.length() + 1, name + "=" ) == 0 )
+        {
+            value = query.substr( pos + name.length() + 1, stop - pos - name.length() - 1 );
+            break;
+        }
+
+        pos = stop + 1;
+    }
+
+    for ( i = 0; i < value.length(); i++ )
+    {
+        if ( value[i] == '%' && i + 2 < value.length() && ::isxdigit( static_cast<unsigned char>( value[i + 1] ) ) && ::isxdigit( static_cast<unsigned char>( value[i + 2] ) ) )
+        {
+            output.push_back( static_cast<char>( ::strtoul( CSTR( value.substr( i + 1, 2 ) ), NULL, 16 ) ) );
+            i += 2;
+        }
+        else
+            output.push_back( value[i] == '+' ? ' ' : value[i] );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Constructor for the RequestIDService class.
+ */
+RequestIDService::RequestIDService()
+{
+    return;
+}
+
+/**
+ * @brief Destructor for the RequestIDService class.
+ */
+RequestIDService::~RequestIDService()
+{
+    return;
+}
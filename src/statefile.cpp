@@ -0,0 +1,347 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file statefile.cpp
+ * @brief All non-template member functions of the StateFile class.
+ *
+ * The StateFile class keeps checkpoints that would otherwise live nowhere,
+ * or only be rediscovered by scanning tables, such as the last article of
+ * each group and the cursor of a scan part way through. The file is mapped
+ * into memory, and every checkpoint is stored twice with a sequence number
+ * and checksum. A write replaces the older copy, so a crash part way
+ * through one leaves the previous value readable. Writes are flushed to
+ * disk at most every #CFG_STATE_SYNC seconds by Sync(), which
+ * Main::Update() calls each cycle. A checkpoint lost that way only moves a
+ * stage back to an earlier point, so stages must only record progress that
+ * is already in the database.
+ */
+#include "h/includes.h"
+#include "h/statefile.h"
+
+/**
+ * @brief Compute the CRC-32 of part of the file.
+ * @param[in] data The bytes to check.
+ * @param[in] length Number of bytes.
+ * @retval uint32_t The CRC-32.
+ */
+const uint32_t StateFile::Checksum( const void* data, const uint_t& length )
+{
+    return ::crc32( ::crc32( 0, Z_NULL, 0 ), static_cast<const Bytef*>( data ), length );
+}
+
+/**
+ * @brief Flush and unmap the file if one is open.
+ * @retval void
+ */
+const void StateFile::Close()
+{
+    if ( m_header != NULL )
+    {
+        if ( m_dirty )
+            ::msync( m_header, m_size, MS_SYNC );
+
+        ::munmap( m_header, m_size );
+    }
+
+    if ( m_fd >= 0 )
+        ::close( m_fd );
+
+    m_dirty = false;
+    m_fd = -1;
+    m_free.clear();
+    m_header = NULL;
+    m_index.clear();
+    m_records = NULL;
+
+    return;
+}
+
+/**
+ * @brief Remove a checkpoint, such as the cursor of a scan that finished.
+ * @param[in] key Name of the checkpoint.
+ * @retval void
+ */
+const void StateFile::Erase( const string& key )
+{
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,uint_t>::iterator mi;
+
+    if ( m_header == NULL || ( mi = m_index.find( key ) ) == m_index.end() )
+        return;
+
+    Write( mi->second, "", 0 );
+    m_free.push_back( mi->second );
+    m_index.erase( mi );
+
+    return;
+}
+
+/**
+ * @brief Returns a checkpoint.
+ * @param[in] key Name of the checkpoint.
+ * @param[in] fallback Returned if there is no such checkpoint or no file is open.
+ * @retval uint_t The checkpoint, or the fallback.
+ */
+const uint_t StateFile::Get( const string& key, const uint_t& fallback )
+{
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,uint_t>::iterator mi;
+    uint_t slot = 0;
+
+    if ( m_header == NULL || ( mi = m_index.find( key ) ) == m_index.end() )
+        return fallback;
+
+    slot = mi->second * 2;
+
+    if ( !Valid( m_records[slot] ) || ( Valid( m_records[slot + 1] ) && m_records[slot + 1].sequence > m_records[slot].sequence ) )
+        slot++;
+
+    return m_records[slot].value;
+}
+
+/**
+ * @brief Map a state file, creating it if needed, and index the newest valid copy of each checkpoint. A file that is missing, from another layout, or has a damaged header starts out empty.
+ * @param[in] path Path of the file.
+ * @retval bool False if the file could not be opened or mapped, in which case checkpoints are not kept.
+ */
+const bool StateFile::Open( const string& path )
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    lock_guard<mutex> lock( m_mutex );
+    struct stat st;
+    Record* copy = NULL;
+    uint_t i = 0, y = 0, size = sizeof( Header ) + sizeof( Record ) * CFG_STATE_RECORDS * 2;
+    void* map = NULL;
+    bool fresh = false;
+
+    Close();
+
+    if ( ( m_fd = ::open( CSTR( path ), O_RDWR | O_CREAT, 0644 ) ) < 0 || ::fstat( m_fd, &st ) != 0 )
+    {
+        LOGERRNO( flags, "StateFile::Open()->open()->" );
+        Close();
+
+        return false;
+    }
+
+    if ( static_cast<uint_t>( st.st_size ) != size )
+    {
+        fresh = true;
+
+        if ( ::ftruncate( m_fd, 0 ) != 0 || ::ftruncate( m_fd, size ) != 0 )
+        {
+            LOGERRNO( flags, "StateFile::Open()->ftruncate()->" );
+            Close();
+
+            return false;
+        }
+    }
+
+    if ( ( map = ::mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 ) ) == MAP_FAILED )
+    {
+        LOGERRNO( flags, "StateFile::Open()->mmap()->" );
+        Close();
+
+        return false;
+    }
+
+    m_header = static_cast<Header*>( map );
+    m_records = reinterpret_cast<Record*>( m_header + 1 );
+    m_size = size;
+    m_path = path;
+    m_sequence = uintmin_t;
+
+    if ( !fresh && ( ::memcmp( m_header->magic, "NZBSTATE", 8 ) != 0 || m_header->version != 1 || m_header->records != CFG_STATE_RECORDS ||
+        m_header->crc != Checksum( m_header, offsetof( Header, crc ) ) ) )
+    {
+        LOGFMT( flags, "StateFile::Open()-> %s is damaged or from another layout, starting over", CSTR( path ) );
+        fresh = true;
+    }
+
+    if ( fresh )
+    {
+        ::memset( map, 0, size );
+        ::memcpy( m_header->magic, "NZBSTATE", 8 );
+        m_header->version = 1;
+        m_header->records = CFG_STATE_RECORDS;
+        m_header->crc = Checksum( m_header, offsetof( Header, crc ) );
+        ::msync( map, size, MS_SYNC );
+    }
+
+    for ( i = 0; i < CFG_STATE_RECORDS; i++ )
+    {
+        copy = NULL;
+
+        // The newer of the two copies that are intact is the checkpoint
+        for ( y = i * 2; y < i * 2 + 2; y++ )
+            if ( Valid( m_records[y] ) && ( copy == NULL || m_records[y].sequence > copy->sequence ) )
+                copy = &m_records[y];
+
+        if ( copy != NULL )
+            m_sequence = max( m_sequence, copy->sequence );
+
+        if ( copy != NULL && copy->key[0] != '\0' && copy->key[sizeof( copy->key ) - 1] == '\0' )
+            m_index[copy->key] = i;
+        else
+            m_free.push_back( i );
+    }
+
+    // Lowest first, so the file fills from the front
+    reverse( m_free.begin(), m_free.end() );
+    m_synced = chrono::high_resolution_clock::now();
+
+    if ( !fresh )
+        LOGFMT( iflags, "StateFile::Open()-> %lu checkpoints loaded from %s", m_index.size(), CSTR( path ) );
+
+    return true;
+}
+
+/**
+ * @brief Sets a checkpoint, which reaches the disk by the next Sync().
+ * @param[in] key Name of the checkpoint, up to 39 characters.
+ * @param[in] value The checkpoint.
+ * @retval void
+ */
+const void StateFile::Set( const string& key, const uint_t& value )
+{
+    UFLAGS_DE( flags );
+    lock_guard<mutex> lock( m_mutex );
+    unordered_map<string,uint_t>::iterator mi;
+    uint_t index = 0;
+
+    if ( m_header == NULL )
+        return;
+
+    if ( key.empty() || key.length() >= sizeof( m_records[0].key ) )
+    {
+        LOGFMT( flags, "StateFile::Set()-> called with invalid key: %s", CSTR( key ) );
+        return;
+    }
+
+    if ( ( mi = m_index.find( key ) ) != m_index.end() )
+        index = mi->second;
+    else if ( m_free.empty() )
+    {
+        LOGFMT( flags, "StateFile::Set()-> %s is full, %s not kept", CSTR( m_path ), CSTR( key ) );
+        return;
+    }
+    else
+    {
+        index = m_index[key] = m_free.back();
+        m_free.pop_back();
+    }
+
+    Write( index, key, value );
+
+    return;
+}
+
+/**
+ * @brief Flush checkpoints to disk, batching every write since the last flush into one.
+ * @param[in] force Flush now rather than waiting out #CFG_STATE_SYNC seconds since the last flush.
+ * @retval void
+ */
+const void StateFile::Sync( const bool& force )
+{
+    UFLAGS_DE( flags );
+    lock_guard<mutex> lock( m_mutex );
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+
+    if ( m_header == NULL || !m_dirty )
+        return;
+
+    if ( !force && chrono::duration_cast<chrono::seconds>( now - m_synced ).count() < CFG_STATE_SYNC )
+        return;
+
+    if ( ::msync( m_header, m_size, MS_SYNC ) != 0 )
+        LOGERRNO( flags, "StateFile::Sync()->msync()->" );
+
+    m_dirty = false;
+    m_synced = now;
+
+    return;
+}
+
+/**
+ * @brief Check whether a copy of a checkpoint is intact.
+ * @param[in] record The copy.
+ * @retval bool True if its checksum matches.
+ */
+const bool StateFile::Valid( const Record& record )
+{
+    return record.crc == Checksum( &record, offsetof( Record, crc ) );
+}
+
+/**
+ * @brief Write a checkpoint over its older copy. Called with m_mutex held.
+ * @param[in] index The checkpoint.
+ * @param[in] key Name of the checkpoint, or empty to free it.
+ * @param[in] value The checkpoint.
+ * @retval void
+ */
+const void StateFile::Write( const uint_t& index, const string& key, const uint_t& value )
+{
+    Record* older = &m_records[index * 2];
+
+    // A damaged copy is always the one replaced, so the intact one survives until this write is whole
+    if ( Valid( *older ) && ( !Valid( m_records[index * 2 + 1] ) || m_records[index * 2 + 1].sequence < older->sequence ) )
+        older = &m_records[index * 2 + 1];
+
+    // The checksum is written last, so a copy is only ever valid once the rest of it is
+    ::memset( older->key, 0, sizeof( older->key ) );
+    ::memcpy( older->key, key.data(), key.length() );
+    older->value = value;
+    older->sequence = ++m_sequence;
+    older->crc = Checksum( older, offsetof( Record, crc ) );
+    m_dirty = true;
+
+    return;
+}
+
+/**
+ * @brief Constructor for the StateFile class.
+ */
+StateFile::StateFile()
+{
+    m_dirty = false;
+    m_fd = -1;
+    m_header = NULL;
+    m_records = NULL;
+    m_sequence = uintmin_t;
+    m_size = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the StateFile class.
+ */
+StateFile::~StateFile()
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    Close();
+
+    return;
+}
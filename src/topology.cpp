@@ -0,0 +1,380 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file topology.cpp
+ * @brief All non-template member functions of the Topology class.
+ *
+ * The Topology class reads the NUMA nodes and their CPUs from sysfs and,
+ * when server.affinity is set, places threads on them. The main loop is
+ * pinned to the first CPU of the first node, and the threads it starts to
+ * open and check connectors inherit that CPU, keeping the I/O of the
+ * server off the cores the workers compute on. Its allocations are
+ * interleaved across the nodes. Worker threads are spread across the nodes
+ * in turn, each free to move between the CPUs of its node but not beyond,
+ * and allocate from that node, so the buffers a task decodes into or
+ * matches against stay local to the CPU using them. A task building
+ * something every node reads, such as the PreDB TrigramIndex, interleaves
+ * its allocations between Interleave() and Restore() instead.
+ * On hosts with one node the memory policy is left alone. Placement is
+ * applied as threads start, so changing server.affinity takes a restart.
+ */
+#include "h/includes.h"
+#include "h/topology.h"
+
+/**
+ * @brief Returns the number of CPUs threads are placed on.
+ * @retval uint_t The number of usable CPUs across every node, or 0 if no layout was read.
+ */
+const uint_t Topology::gCpus()
+{
+    uint_t cpus = 0, i = 0;
+
+    for ( i = 0; i < m_nodes.size(); i++ )
+        cpus += m_nodes[i].cpus.size();
+
+    return cpus;
+}
+
+/**
+ * @brief Returns the number of NUMA nodes threads are placed on.
+ * @retval uint_t The number of nodes with a usable CPU, or 0 if no layout was read.
+ */
+const uint_t Topology::gNodes()
+{
+    return m_nodes.size();
+}
+
+/**
+ * @brief Interleave what the calling thread allocates across the nodes, for a structure that workers on every node read, until Restore() is called. Does nothing unless Load() succeeded on a host with more than one node.
+ * @retval Placement The policy the thread had, to pass to Restore().
+ */
+const Topology::Placement Topology::Interleave()
+{
+    UFLAGS_DE( flags );
+    Placement placement;
+    vector<uint_t> nodes;
+    int mode = 0;
+    uint_t i = 0;
+
+    placement.mode = -1;
+    placement.mask = uintmin_t;
+
+    if ( !m_loaded || m_nodes.size() < 2 )
+        return placement;
+
+    if ( ::syscall( SYS_get_mempolicy, &mode, &placement.mask, sizeof( placement.mask ) * 8 + 1, NULL, 0 ) != 0 )
+    {
+        LOGERRNO( flags, "Topology::Interleave()->get_mempolicy()->" );
+        return placement;
+    }
+
+    for ( i = 0; i < m_nodes.size(); i++ )
+        nodes.push_back( m_nodes[i].id );
+
+    if ( Policy( MPOL_INTERLEAVE, nodes ) )
+        placement.mode = mode;
+
+    return placement;
+}
+
+/**
+ * @brief Read the layout of the host. Must be called before any thread is pinned, as it only keeps the CPUs the process may already run on.
+ * @retval bool False if the layout could not be read, in which case threads are left where the scheduler puts them.
+ */
+const bool Topology::Load()
+{
+    UFLAGS_DE( flags );
+    UFLAGS_I( iflags );
+    cpu_set_t allowed;
+    ifstream input;
+    string line;
+    vector<uint_t> ids, cpus;
+    Node node;
+    uint_t i = 0, y = 0;
+
+    m_nodes.clear();
+    m_loaded = false;
+
+    CPU_ZERO( &allowed );
+
+    if ( ::sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 )
+    {
+        LOGERRNO( flags, "Topology::Load()->sched_getaffinity()->" );
+        return false;
+    }
+
+    // Kernels built without NUMA have no node directory; every CPU is then one node
+    input.open( "/sys/devices/system/node/online" );
+    if ( input.is_open() && getline( input, line ) )
+        ids = ParseList( line );
+    input.close();
+
+    if ( ids.empty() )
+        ids.push_back( 0 );
+
+    for ( i = 0; i < ids.size(); i++ )
+    {
+        line.clear();
+        input.open( Utils::FormatString( 0, "/sys/devices/system/node/node%lu/cpulist", ids[i] ) );
+        if ( input.is_open() )
+            getline( input, line );
+        input.close();
+
+        if ( line.empty() && ids.size() == 1 )
+        {
+            input.open( "/sys/devices/system/cpu/online" );
+            if ( input.is_open() )
+                getline( input, line );
+            input.close();
+        }
+
+        cpus = ParseList( line );
+        node.id = ids[i];
+        node.cpus.clear();
+
+        for ( y = 0; y < cpus.size(); y++ )
+            if ( cpus[y] < CPU_SETSIZE && CPU_ISSET( cpus[y], &allowed ) )
+                node.cpus.push_back( cpus[y] );
+
+        // Memory only nodes, or nodes outside a cpuset, get no threads
+        if ( !node.cpus.empty() )
+            m_nodes.push_back( node );
+    }
+
+    if ( m_nodes.empty() )
+    {
+        LOGSTR( flags, "Topology::Load()-> no usable CPUs found in sysfs, threads are left unpinned" );
+        return false;
+    }
+
+    m_reactor = m_nodes[0].cpus[0];
+    m_loaded = true;
+
+    for ( i = 0; i < m_nodes.size(); i++ )
+        LOGFMT( iflags, "Topology::Load()-> node %lu: cpus %s", m_nodes[i].id, CSTR( Print( m_nodes[i].cpus ) ) );
+
+    return true;
+}
+
+/**
+ * @brief Parse a sysfs CPU or node list, such as "0-3,8-11".
+ * @param[in] list The list.
+ * @retval vector<uint_t> Every number in the list, in order.
+ */
+const vector<uint_t> Topology::ParseList( const string& list )
+{
+    vector<uint_t> output;
+    stringstream ss( list );
+    string range;
+    uint_t first = 0, last = 0;
+    char* end = NULL;
+
+    while ( getline( ss, range, ',' ) )
+    {
+        if ( range.empty() || !::isdigit( range[0] ) )
+            continue;
+
+        first = last = ::strtoul( CSTR( range ), &end, 10 );
+
+        if ( *end == '-' )
+            last = ::strtoul( end + 1, NULL, 10 );
+
+        for ( ; first <= last; first++ )
+            output.push_back( first );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Pin the calling thread to a set of CPUs.
+ * @param[in] cpus The CPUs.
+ * @retval bool False if the kernel refused.
+ */
+const bool Topology::Pin( const vector<uint_t>& cpus )
+{
+    UFLAGS_DE( flags );
+    cpu_set_t set;
+    uint_t i = 0;
+
+    CPU_ZERO( &set );
+
+    for ( i = 0; i < cpus.size(); i++ )
+        CPU_SET( cpus[i], &set );
+
+    if ( ::sched_setaffinity( 0, sizeof( set ), &set ) != 0 )
+    {
+        LOGERRNO( flags, "Topology::Pin()->sched_setaffinity()->" );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Pin the main loop to its CPU and interleave what it allocates across the nodes. Does nothing unless Load() succeeded.
+ * @retval void
+ */
+const void Topology::PinReactor()
+{
+    UFLAGS_I( flags );
+    vector<uint_t> nodes;
+    uint_t i = 0;
+
+    if ( !m_loaded || !Pin( vector<uint_t>( 1, m_reactor ) ) )
+        return;
+
+    for ( i = 0; i < m_nodes.size(); i++ )
+        nodes.push_back( m_nodes[i].id );
+
+    if ( nodes.size() > 1 )
+        Policy( MPOL_INTERLEAVE, nodes );
+
+    LOGFMT( flags, "Topology::PinReactor()-> main loop and connector threads on cpu %lu%s", m_reactor, nodes.size() > 1 ? ", allocations interleaved across nodes" : "" );
+
+    return;
+}
+
+/**
+ * @brief Pin the calling worker thread to a node, taken in turn, and allocate from that node. Does nothing unless Load() succeeded.
+ * @param[in] index The number of the worker within the WorkerPool.
+ * @retval void
+ */
+const void Topology::PinWorker( const uint_t& index )
+{
+    UFLAGS_I( flags );
+    vector<uint_t> cpus;
+    uint_t i = 0;
+
+    if ( !m_loaded )
+        return;
+
+    const Node& node = m_nodes[index % m_nodes.size()];
+
+    // The CPU of the main loop is left to it, unless that would leave the node too few
+    for ( i = 0; i < node.cpus.size(); i++ )
+        if ( node.cpus[i] != m_reactor || node.cpus.size() < 4 )
+            cpus.push_back( node.cpus[i] );
+
+    if ( !Pin( cpus ) )
+        return;
+
+    if ( m_nodes.size() > 1 )
+        Policy( MPOL_PREFERRED, vector<uint_t>( 1, node.id ) );
+
+    LOGFMT( flags, "Topology::PinWorker()-> worker %lu on node %lu, cpus %s", index, node.id, CSTR( Print( cpus ) ) );
+
+    return;
+}
+
+/**
+ * @brief Set the NUMA memory policy of the calling thread.
+ * @param[in] mode MPOL_INTERLEAVE or MPOL_PREFERRED.
+ * @param[in] nodes The nodes the policy covers.
+ * @retval bool False if the kernel refused, in which case the thread allocates from whichever node it runs on.
+ */
+const bool Topology::Policy( const sint_t& mode, const vector<uint_t>& nodes )
+{
+    UFLAGS_DE( flags );
+    unsigned long mask = 0;
+    uint_t i = 0;
+
+    for ( i = 0; i < nodes.size(); i++ )
+        if ( nodes[i] < sizeof( mask ) * 8 )
+            mask |= 1UL << nodes[i];
+
+    // glibc has no wrapper, and libnuma is not worth linking for one call
+    if ( ::syscall( SYS_set_mempolicy, mode, &mask, sizeof( mask ) * 8 + 1 ) != 0 )
+    {
+        LOGERRNO( flags, "Topology::Policy()->set_mempolicy()->" );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Put back the memory policy the calling thread had before Interleave().
+ * @param[in] placement What Interleave() returned.
+ * @retval void
+ */
+const void Topology::Restore( const Placement& placement )
+{
+    UFLAGS_DE( flags );
+
+    if ( placement.mode < 0 )
+        return;
+
+    if ( ::syscall( SYS_set_mempolicy, placement.mode, placement.mode == MPOL_DEFAULT ? NULL : &placement.mask, placement.mode == MPOL_DEFAULT ? 0 : sizeof( placement.mask ) * 8 + 1 ) != 0 )
+        LOGERRNO( flags, "Topology::Restore()->set_mempolicy()->" );
+
+    return;
+}
+
+/**
+ * @brief Format a list of CPUs as sysfs does.
+ * @param[in] cpus The CPUs, in order.
+ * @retval string The list, such as "0-3,8".
+ */
+const string Topology::Print( const vector<uint_t>& cpus )
+{
+    string output;
+    uint_t i = 0, first = 0;
+
+    for ( i = 0; i < cpus.size(); i++ )
+    {
+        first = i;
+
+        while ( i + 1 < cpus.size() && cpus[i + 1] == cpus[i] + 1 )
+            i++;
+
+        if ( !output.empty() )
+            output.append( "," );
+
+        if ( i == first )
+            output.append( Utils::FormatString( 0, "%lu", cpus[i] ) );
+        else
+            output.append( Utils::FormatString( 0, "%lu-%lu", cpus[first], cpus[i] ) );
+    }
+
+    return output;
+}
+
+/**
+ * @brief Constructor for the Topology class.
+ */
+Topology::Topology()
+{
+    m_loaded = false;
+    m_reactor = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the Topology class.
+ */
+Topology::~Topology()
+{
+    return;
+}
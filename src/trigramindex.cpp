@@ -0,0 +1,431 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file trigramindex.cpp
+ * @brief All non-template member functions of the TrigramIndex class.
+ *
+ * The TrigramIndex class replaces asking MySQL full-text search about one
+ * release name at a time. Titles are folded to lower case letters and
+ * digits, and each distinct run of three characters points at the titles
+ * containing it through a posting list of variable length deltas. A name is
+ * scored with the Dice coefficient of the two trigram sets. Only titles
+ * sharing one of the rarest trigrams of the name can reach the threshold,
+ * so they alone become candidates, and each remaining list is intersected
+ * with the candidates four at a time to count the trigrams they share.
+ */
+#include "h/includes.h"
+#include "h/trigramindex.h"
+
+/**
+ * @brief Add a title. Titles must be added from one thread, and not while Match() is running.
+ * @param[in] id The caller's id for the title, such as the id of the predb row.
+ * @param[in] title The title.
+ * @retval void
+ */
+const void TrigramIndex::Add( const uint_t& id, const string& title )
+{
+    vector<uint32_t> trigrams;
+    uint32_t delta = 0, index = m_ids.size();
+    uint_t i = 0;
+
+    Trigrams( title, trigrams );
+
+    m_ids.push_back( id );
+    m_titles.push_back( title );
+    m_sizes.push_back( min( trigrams.size(), static_cast<size_t>( numeric_limits<uint16_t>::max() ) ) );
+
+    // Titles are only ever appended, so every list stays sorted and each delta is small
+    for ( i = 0; i < trigrams.size(); i++ )
+    {
+        Posting& posting = m_postings[trigrams[i]];
+
+        m_bytes -= posting.data.capacity() + posting.skips.capacity() * sizeof( posting.skips[0] );
+
+        // Each block starts from an absolute index kept beside the data so blocks can be skipped without decoding them
+        if ( posting.count % BLOCK == 0 )
+            posting.skips.push_back( make_pair( index, static_cast<uint32_t>( posting.data.size() ) ) );
+        else
+        {
+            for ( delta = index - posting.last; delta >= 0x80; delta >>= 7 )
+                posting.data.push_back( static_cast<uint8_t>( delta | 0x80 ) );
+
+            posting.data.push_back( static_cast<uint8_t>( delta ) );
+        }
+
+        posting.count++;
+        posting.last = index;
+        m_bytes += posting.data.capacity() + posting.skips.capacity() * sizeof( posting.skips[0] );
+    }
+
+    return;
+}
+
+/**
+ * @brief Remove every title.
+ * @retval void
+ */
+const void TrigramIndex::Clear()
+{
+    m_bytes = uintmin_t;
+    m_ids.clear();
+    m_postings.clear();
+    m_sizes.clear();
+    m_titles.clear();
+
+    return;
+}
+
+/**
+ * @brief Returns the bytes used by the posting lists.
+ * @retval uint_t The bytes used by the posting lists.
+ */
+const uint_t TrigramIndex::gBytes()
+{
+    return m_bytes;
+}
+
+/**
+ * @brief Returns the number of titles added.
+ * @retval uint_t The number of titles added.
+ */
+const uint_t TrigramIndex::gTitles()
+{
+    return m_titles.size();
+}
+
+/**
+ * @brief Returns the number of distinct trigrams across every title.
+ * @retval uint_t The number of distinct trigrams across every title.
+ */
+const uint_t TrigramIndex::gTrigrams()
+{
+    return m_postings.size();
+}
+
+/**
+ * @brief Find the title most similar to a name. Safe to call from any number of threads at once.
+ * @param[in] name The name to look up, such as the search name of a release.
+ * @param[in] threshold The lowest similarity accepted, from 0 to 1.
+ * @param[out] id The caller's id of the best title.
+ * @param[out] title The best title.
+ * @param[out] score The similarity of the best title, from 0 to 1.
+ * @retval bool False if no title reached the threshold.
+ */
+const bool TrigramIndex::Match( const string& name, const double& threshold, uint_t& id, string& title, double& score ) const
+{
+    vector<uint32_t> query, candidates, list;
+    vector<uint16_t> counts, required;
+    vector<const Posting*> lists;
+    unordered_map<uint32_t,Posting>::const_iterator pi;
+    uint_t i = 0, y = 0, absent = 0, best = 0, decoded = 0, length = 0, needed = 0, prefix = 0, total = 0;
+    double similarity = 0;
+
+    Trigrams( name, query );
+
+    if ( query.empty() || threshold <= 0 || threshold > 1 )
+        return false;
+
+    // Dice is 2c / ( q + t ), so even a title made only of shared trigrams needs this many
+    needed = max( static_cast<uint_t>( ::ceil( threshold * query.size() / ( 2 - threshold ) - 1e-9 ) ), static_cast<uint_t>( 1 ) );
+
+    for ( i = 0; i < query.size(); i++ )
+    {
+        if ( ( pi = m_postings.find( query[i] ) ) == m_postings.end() )
+            absent++;
+        else
+            lists.push_back( &pi->second );
+    }
+
+    // A title missing every one of the rarest q - needed + 1 trigrams cannot share enough of the rest, and those no title has are the rarest of all
+    if ( ( prefix = query.size() - needed + 1 ) <= absent )
+        return false;
+
+    prefix -= absent;
+    sort( lists.begin(), lists.end(), []( const Posting* a, const Posting* b ) { return a->count < b->count; } );
+
+    // Decode() may resize list, so its iterators are only taken once it returns
+    for ( i = 0; i < prefix && i < lists.size(); i++ )
+    {
+        for ( y = 0; y < lists[i]->skips.size(); y++ )
+        {
+            decoded = Decode( *lists[i], y, list );
+            candidates.insert( candidates.end(), list.begin(), list.begin() + decoded );
+        }
+    }
+
+    sort( candidates.begin(), candidates.end() );
+
+    // Each title appears once per list, so the run length is how many of the prefix it shares
+    for ( i = 0, length = 0; i < candidates.size(); i = y )
+    {
+        for ( y = i; y < candidates.size() && candidates[y] == candidates[i]; y++ );
+
+        // A title's own size sets how many trigrams it must share, which rules out titles much longer or shorter than the name
+        if ( ( total = static_cast<uint_t>( ::ceil( threshold * ( query.size() + m_sizes[candidates[i]] ) / 2 - 1e-9 ) ) ) > min( query.size(), static_cast<uint_t>( m_sizes[candidates[i]] ) ) )
+            continue;
+
+        candidates[length++] = candidates[i];
+        counts.push_back( y - i );
+        required.push_back( total );
+    }
+
+    candidates.resize( length );
+
+    for ( i = prefix; i < lists.size() && !candidates.empty(); i++ )
+    {
+        Count( *lists[i], candidates, counts );
+
+        // Drop titles that could not reach the threshold even if they shared every list still to come
+        for ( y = 0, length = 0; y < candidates.size(); y++ )
+        {
+            if ( counts[y] + lists.size() - i - 1 >= required[y] )
+            {
+                candidates[length] = candidates[y];
+                counts[length] = counts[y];
+                required[length++] = required[y];
+            }
+        }
+
+        candidates.resize( length );
+        counts.resize( length );
+        required.resize( length );
+    }
+
+    score = 0;
+
+    for ( i = 0; i < candidates.size(); i++ )
+    {
+        similarity = 2.0 * counts[i] / ( query.size() + m_sizes[candidates[i]] );
+
+        // Ties go to the oldest title, which is usually the original pre
+        if ( similarity > score )
+        {
+            score = similarity;
+            best = candidates[i];
+        }
+    }
+
+    if ( score < threshold )
+        return false;
+
+    id = m_ids[best];
+    title = m_titles[best];
+
+    return true;
+}
+
+/**
+ * @brief Add one to the count of each candidate in a posting list, decoding only the blocks that could hold a candidate.
+ * @param[in] posting The posting list.
+ * @param[in] candidates Sorted title indices.
+ * @param[in,out] counts Per candidate, incremented if the candidate is in the list.
+ * @retval void
+ */
+const void TrigramIndex::Count( const Posting& posting, const vector<uint32_t>& candidates, vector<uint16_t>& counts )
+{
+    vector<uint32_t> block;
+    uint_t i = 0, y = 0, b = 0, length = 0;
+
+    while ( i < candidates.size() && b < posting.skips.size() )
+    {
+        // Common trigrams have long lists, of which only a few blocks usually hold a candidate
+        while ( b + 1 < posting.skips.size() && posting.skips[b + 1].first <= candidates[i] )
+            b++;
+
+        if ( candidates[i] < posting.skips[b].first )
+        {
+            i++;
+            continue;
+        }
+
+        length = Decode( posting, b, block );
+
+        for ( y = i; y < candidates.size() && ( b + 1 >= posting.skips.size() || candidates[y] < posting.skips[b + 1].first ); y++ );
+
+        Intersect( candidates.data() + i, y - i, block.data(), length, counts.data() + i );
+
+        i = y;
+        b++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Expand one block of a posting list into title indices.
+ * @param[in] posting The posting list.
+ * @param[in] block The index of the block within the list.
+ * @param[out] list Receives the title indices of the block, in ascending order; it is only grown, never shrunk.
+ * @retval uint_t The number of title indices in the block.
+ */
+const uint_t TrigramIndex::Decode( const Posting& posting, const uint_t& block, vector<uint32_t>& list )
+{
+    const uint8_t* data = posting.data.data() + posting.skips[block].second;
+    uint32_t delta = 0;
+    uint_t i = 0, shift = 0, length = min( static_cast<uint_t>( BLOCK ), posting.count - block * BLOCK );
+
+    if ( list.size() < length )
+        list.resize( BLOCK );
+
+    list[0] = posting.skips[block].first;
+
+    for ( i = 1; i < length; i++ )
+    {
+        for ( delta = 0, shift = 0; ( *data & 0x80 ) != 0; data++, shift += 7 )
+            delta |= static_cast<uint32_t>( *data & 0x7F ) << shift;
+        delta |= static_cast<uint32_t>( *data++ ) << shift;
+
+        list[i] = list[i - 1] + delta;
+    }
+
+    return length;
+}
+
+/**
+ * @brief Add one to the count of each candidate also in a list.
+ * @param[in] candidates Sorted title indices.
+ * @param[in] count The number of candidates.
+ * @param[in] list Sorted title indices.
+ * @param[in] length The number of title indices in list.
+ * @param[in,out] counts Per candidate, incremented if the candidate is in the list.
+ * @retval void
+ */
+const void TrigramIndex::Intersect( const uint32_t* candidates, const uint_t& count, const uint32_t* list, const uint_t& length, uint16_t* counts )
+{
+    uint_t i = 0, y = 0;
+
+#if defined( __x86_64__ )
+    __m128i left, right, matches;
+    uint_t mask = 0;
+
+    // Each block of four candidates is compared against every rotation of four from the list, then whichever block ends lower is done
+    while ( i + 4 <= count && y + 4 <= length )
+    {
+        left = _mm_loadu_si128( reinterpret_cast<const __m128i*>( candidates + i ) );
+        right = _mm_loadu_si128( reinterpret_cast<const __m128i*>( list + y ) );
+
+        matches = _mm_cmpeq_epi32( left, right );
+        right = _mm_shuffle_epi32( right, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+        matches = _mm_or_si128( matches, _mm_cmpeq_epi32( left, right ) );
+        right = _mm_shuffle_epi32( right, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+        matches = _mm_or_si128( matches, _mm_cmpeq_epi32( left, right ) );
+        right = _mm_shuffle_epi32( right, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+        matches = _mm_or_si128( matches, _mm_cmpeq_epi32( left, right ) );
+
+        for ( mask = _mm_movemask_ps( _mm_castsi128_ps( matches ) ); mask != 0; mask &= mask - 1 )
+            counts[i + __builtin_ctz( mask )]++;
+
+        if ( candidates[i + 3] == list[y + 3] )
+        {
+            i += 4;
+            y += 4;
+        }
+        else if ( candidates[i + 3] < list[y + 3] )
+            i += 4;
+        else
+            y += 4;
+    }
+#endif
+
+    while ( i < count && y < length )
+    {
+        if ( candidates[i] == list[y] )
+        {
+            counts[i]++;
+            i++;
+            y++;
+        }
+        else if ( candidates[i] < list[y] )
+            i++;
+        else
+            y++;
+    }
+
+    return;
+}
+
+/**
+ * @brief Fold text to lower case letters and digits, with each run of anything else as one space, and list its distinct trigrams.
+ * @param[in] text The text.
+ * @param[out] trigrams The distinct trigrams, each packed into the low 24 bits, sorted.
+ * @retval void
+ */
+const void TrigramIndex::Trigrams( const string& text, vector<uint32_t>& trigrams )
+{
+    uint32_t window = 0;
+    uint_t i = 0, length = 0;
+    uint8_t c = 0;
+    bool space = true;
+
+    trigrams.clear();
+
+    for ( i = 0; i < text.length(); i++ )
+    {
+        c = static_cast<uint8_t>( text[i] );
+
+        if ( ::isalnum( c ) )
+        {
+            c = ::tolower( c );
+            space = false;
+        }
+        else if ( space )
+            continue;
+        else
+        {
+            c = ' ';
+            space = true;
+        }
+
+        window = ( ( window << 8 ) | c ) & 0xFFFFFF;
+
+        if ( ++length >= 3 )
+            trigrams.push_back( window );
+    }
+
+    // A trailing separator would only add trigrams that end in a space
+    if ( space && length > 3 )
+        trigrams.pop_back();
+
+    sort( trigrams.begin(), trigrams.end() );
+    trigrams.erase( unique( trigrams.begin(), trigrams.end() ), trigrams.end() );
+
+    return;
+}
+
+/**
+ * @brief Constructor for the TrigramIndex class.
+ */
+TrigramIndex::TrigramIndex()
+{
+    m_bytes = uintmin_t;
+
+    return;
+}
+
+/**
+ * @brief Destructor for the TrigramIndex class.
+ */
+TrigramIndex::~TrigramIndex()
+{
+    return;
+}
@@ -32,6 +32,119 @@
 #include "h/includes.h"
 #include "h/utils.h"
 
+#include "h/controlsocket.h"
+
+/**
+ * @brief Computes the raw MD5 digest of a buffer without copying it.
+ * @param[in] data The data to digest.
+ * @param[in] length The number of bytes to digest.
+ * @param[out] digest The 16 byte digest.
+ * @retval void
+ */
+const void Utils::MD5( const uint8_t* data, const uint_t& length, uint8_t* digest )
+{
+    static const uint32_t k[64] =
+    {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+    static const uint8_t r[64] =
+    {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+    };
+    uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint32_t a = 0, b = 0, c = 0, d = 0, f = 0, g = 0, t = 0, w[16];
+    uint8_t tail[128];
+    const uint8_t* block = NULL;
+    uint64_t bits = static_cast<uint64_t>( length ) * 8;
+    uint_t full = length - length % 64, extra = 0, offset = 0, i = 0;
+
+    // Only the last partial block is copied, padded to 64 or 128 bytes with the bit length in the last 8, little endian
+    memset( tail, 0, sizeof( tail ) );
+    memcpy( tail, data + full, length - full );
+    tail[length - full] = 0x80;
+    extra = length - full < 56 ? 64 : 128;
+    for ( i = 0; i < 8; i++ )
+        tail[extra - 8 + i] = static_cast<uint8_t>( bits >> ( i * 8 ) );
+
+    for ( offset = 0; offset < full + extra; offset += 64 )
+    {
+        block = offset < full ? data + offset : tail + offset - full;
+
+        for ( i = 0; i < 16; i++ )
+            w[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 | static_cast<uint32_t>( block[i * 4 + 3] ) << 24;
+
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+
+        for ( i = 0; i < 64; i++ )
+        {
+            if ( i < 16 )
+            {
+                f = ( b & c ) | ( ~b & d );
+                g = i;
+            }
+            else if ( i < 32 )
+            {
+                f = ( d & b ) | ( ~d & c );
+                g = ( 5 * i + 1 ) % 16;
+            }
+            else if ( i < 48 )
+            {
+                f = b ^ c ^ d;
+                g = ( 3 * i + 5 ) % 16;
+            }
+            else
+            {
+                f = c ^ ( b | ~d );
+                g = ( 7 * i ) % 16;
+            }
+
+            t = d;
+            d = c;
+            c = b;
+            f += a + k[i] + w[g];
+            b += ( f << r[i] ) | ( f >> ( 32 - r[i] ) );
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+    }
+
+    for ( i = 0; i < 16; i++ )
+        digest[i] = ( h[i / 4] >> ( ( i % 4 ) * 8 ) ) & 0xff;
+
+    return;
+}
+
+/**
+ * @brief Returns the MD5 digest of a string as lower case hex, as PHP's md5() does.
+ * @param[in] input The data to digest.
+ * @retval string The 32 character hex digest.
+ */
+const string Utils::MD5( const string& input )
+{
+    uint8_t digest[16];
+
+    MD5( reinterpret_cast<const uint8_t*>( input.data() ), input.length(), digest );
+
+    return StrHex( digest, sizeof( digest ) );
+}
+
 /**
  * @brief Returns the number of a specific character in a given string.
  * @param[in] input A string value to search.
@@ -56,6 +169,124 @@ const uint_t Utils::NumChar( const string& input, const string& item )
     return amount;
 }
 
+/**
+ * @brief Returns the SHA1 digest of a string as lower case hex, as PHP's sha1() does.
+ * @param[in] input The data to digest.
+ * @retval string The 40 character hex digest.
+ */
+const string Utils::SHA1( const string& input )
+{
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    uint32_t a = 0, b = 0, c = 0, d = 0, e = 0, f = 0, k = 0, t = 0, w[80];
+    string data( input ), output;
+    uint64_t bits = static_cast<uint64_t>( input.length() ) * 8;
+    uint_t block = 0, i = 0;
+
+    // Pad to a multiple of 64 bytes with the bit length in the last 8, big endian
+    data.push_back( static_cast<char>( 0x80 ) );
+    while ( data.length() % 64 != 56 )
+        data.push_back( 0 );
+    for ( i = 0; i < 8; i++ )
+        data.push_back( static_cast<char>( bits >> ( 56 - i * 8 ) ) );
+
+    for ( block = 0; block < data.length(); block += 64 )
+    {
+        for ( i = 0; i < 16; i++ )
+            w[i] = static_cast<uint32_t>( static_cast<uint8_t>( data[block + i * 4] ) ) << 24 | static_cast<uint8_t>( data[block + i * 4 + 1] ) << 16 |
+                   static_cast<uint8_t>( data[block + i * 4 + 2] ) << 8 | static_cast<uint8_t>( data[block + i * 4 + 3] );
+        for ( i = 16; i < 80; i++ )
+        {
+            t = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = ( t << 1 ) | ( t >> 31 );
+        }
+
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+        e = h[4];
+
+        for ( i = 0; i < 80; i++ )
+        {
+            if ( i < 20 )
+            {
+                f = ( b & c ) | ( ~b & d );
+                k = 0x5a827999;
+            }
+            else if ( i < 40 )
+            {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if ( i < 60 )
+            {
+                f = ( b & c ) | ( b & d ) | ( c & d );
+                k = 0x8f1bbcdc;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+
+            t = ( ( a << 5 ) | ( a >> 27 ) ) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ( b << 30 ) | ( b >> 2 );
+            b = a;
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for ( i = 0; i < 5; i++ )
+        output.append( FormatString( 0, "%08x", h[i] ) );
+
+    return output;
+}
+
+/**
+ * @brief Returns a given time as a MySQL DATETIME string in local time.
+ * @param[in] now A time_t to be formatted into a string.
+ * @retval string A string value in the form YYYY-MM-DD HH:MM:SS.
+ */
+const string Utils::StrDateTime( const time_t& now )
+{
+    struct tm local;
+    char buf[32];
+
+    ::localtime_r( &now, &local );
+    ::strftime( buf, sizeof( buf ), "%Y-%m-%d %H:%M:%S", &local );
+
+    return buf;
+}
+
+/**
+ * @brief Returns binary data as lower case hex.
+ * @param[in] data The bytes to convert.
+ * @param[in] length The number of bytes to convert.
+ * @retval string The hex string, two characters per byte.
+ */
+const string Utils::StrHex( const uint8_t* data, const uint_t& length )
+{
+    static const char digits[] = "0123456789abcdef";
+    string output( length * 2, '0' );
+    uint_t i = 0;
+
+    for ( i = 0; i < length; i++ )
+    {
+        output[i * 2] = digits[data[i] >> 4];
+        output[i * 2 + 1] = digits[data[i] & 0x0f];
+    }
+
+    return output;
+}
+
 /**
  * @brief Returns a given time as a string.
  * @param[in] now A time_t to be formatted into a string.
@@ -207,6 +438,10 @@ const void Utils::_Logger( const uint_t& narg, const bitset<CFG_MEM_MAX_BITSET>&
         return;
     }
 
+    // Below the info level only errors are worth formatting
+    if ( g_global->m_log_level == UTILS_LEVEL_ERROR && !flags.test( UTILS_TYPE_ERROR ) )
+        return;
+
     va_start( args, fmt );
     output = __FormatString( narg, flags, caller, fmt, args );
     va_end( args );
@@ -254,8 +489,14 @@ const void Utils::_Logger( const uint_t& narg, const bitset<CFG_MEM_MAX_BITSET>&
         }
     }
 
+    // At the debug level every line says where it came from
+    if ( g_global->m_log_level == UTILS_LEVEL_DEBUG && !flags.test( UTILS_DEBUG ) && !flags.test( UTILS_RAW ) )
+        post.append( " [" + caller + "]" );
+
     clog << pre << output << post << endl;
-    /** @todo Add monitor channel support */
+
+    if ( g_global->m_control != NULL )
+        g_global->m_control->Monitor( pre + output + post );
 
     return;
 }
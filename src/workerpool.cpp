@@ -0,0 +1,337 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file workerpool.cpp
+ * @brief All non-template member functions of the WorkerPool class.
+ *
+ * The WorkerPool class runs tasks off the main update loop. Each thread is
+ * registered with the MySQL client library so tasks may use a DBConn
+ * reserved through Main::AcquireDBConn(), and must hand it back with
+ * Main::ReleaseDBConn() before returning.
+ *
+ * Tasks are queued by #JOB_CLASS, and a free thread always takes the oldest
+ * task of the most urgent class that is under its budget, so ingest never
+ * waits behind cleanup. How long each class waited is logged every
+ * #CFG_THR_QUEUE_REPORT seconds.
+ */
+#include "h/includes.h"
+#include "h/workerpool.h"
+
+#include "h/topology.h"
+
+/**
+ * @brief The #JOB_CLASS of the task the thread is running. Threads outside the pool, such as the main thread that drives every job, count as the most urgent.
+ */
+static thread_local uint_t current_class = JOB_CLASS_INGEST;
+
+/**
+ * @brief Returns the most tasks of a #JOB_CLASS that run at once.
+ * @param[in] cls The #JOB_CLASS.
+ * @retval uint_t The budget of the class.
+ */
+const uint_t WorkerPool::gBudget( const uint_t& cls )
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return cls < MAX_JOB_CLASS ? m_budget[cls] : 0;
+}
+
+/**
+ * @brief Returns the #JOB_CLASS of the task the calling thread is running.
+ * @retval uint_t The #JOB_CLASS of the task the calling thread is running, or #JOB_CLASS_INGEST outside the pool.
+ */
+const uint_t WorkerPool::gCurrent()
+{
+    return current_class;
+}
+
+/**
+ * @brief Returns the name of a #JOB_CLASS, as used in logs and the configuration.
+ * @param[in] cls The #JOB_CLASS.
+ * @retval string The name of the class.
+ */
+const string WorkerPool::gName( const uint_t& cls )
+{
+    static const string names[MAX_JOB_CLASS] = { "ingest", "process", "cleanup" };
+
+    return cls < MAX_JOB_CLASS ? names[cls] : "unknown";
+}
+
+/**
+ * @brief Returns the number of tasks queued or running.
+ * @retval uint_t The number of tasks queued or running.
+ */
+const uint_t WorkerPool::gPending()
+{
+    lock_guard<mutex> lock( m_mutex );
+    uint_t pending = 0, i = 0;
+
+    for ( i = 0; i < MAX_JOB_CLASS; i++ )
+        pending += m_tasks[i].size() + m_running[i];
+
+    return pending;
+}
+
+/**
+ * @brief Returns the number of tasks of a #JOB_CLASS waiting for a thread.
+ * @param[in] cls The #JOB_CLASS.
+ * @retval uint_t The number of tasks of the class waiting for a thread.
+ */
+const uint_t WorkerPool::gQueued( const uint_t& cls )
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return cls < MAX_JOB_CLASS ? m_tasks[cls].size() : 0;
+}
+
+/**
+ * @brief Returns the number of tasks of a #JOB_CLASS being run.
+ * @param[in] cls The #JOB_CLASS.
+ * @retval uint_t The number of tasks of the class being run.
+ */
+const uint_t WorkerPool::gRunning( const uint_t& cls )
+{
+    lock_guard<mutex> lock( m_mutex );
+
+    return cls < MAX_JOB_CLASS ? m_running[cls] : 0;
+}
+
+/**
+ * @brief Returns the number of worker threads.
+ * @retval uint_t The number of worker threads.
+ */
+const uint_t WorkerPool::gThreads()
+{
+    return m_threads.size();
+}
+
+/**
+ * @brief Find the most urgent #JOB_CLASS with a task waiting and fewer than its budget running. Called with m_mutex held.
+ * @param[out] cls The #JOB_CLASS to take a task from.
+ * @retval bool False if no class may start a task.
+ */
+const bool WorkerPool::Next( uint_t& cls )
+{
+    for ( cls = 0; cls < MAX_JOB_CLASS; cls++ )
+        if ( !m_tasks[cls].empty() && m_running[cls] < m_budget[cls] )
+            return true;
+
+    return false;
+}
+
+/**
+ * @brief Record how long a task waited, and log the waits of every class once #CFG_THR_QUEUE_REPORT seconds have passed. Called with m_mutex held.
+ * @param[in] cls The #JOB_CLASS of the task.
+ * @param[in] queued When the task was submitted.
+ * @retval void
+ */
+const void WorkerPool::Report( const uint_t& cls, const chrono::high_resolution_clock::time_point& queued )
+{
+    UFLAGS_I( flags );
+    chrono::high_resolution_clock::time_point now = chrono::high_resolution_clock::now();
+    uint_t waited = chrono::duration_cast<chrono::milliseconds>( now - queued ).count(), i = 0;
+
+    m_started[cls]++;
+    m_waited[cls] += waited;
+    m_longest[cls] = max( m_longest[cls], waited );
+
+    if ( chrono::duration_cast<chrono::seconds>( now - m_reported ).count() < CFG_THR_QUEUE_REPORT )
+        return;
+
+    m_reported = now;
+
+    for ( i = 0; i < MAX_JOB_CLASS; i++ )
+    {
+        if ( m_started[i] > 0 )
+            LOGFMT( flags, "WorkerPool::Report()-> %s: %lu tasks waited %lums on average and %lums at most, %lu still queued",
+                CSTR( gName( i ) ), m_started[i], m_waited[i] / m_started[i], m_longest[i], m_tasks[i].size() );
+
+        m_longest[i] = uintmin_t;
+        m_started[i] = uintmin_t;
+        m_waited[i] = uintmin_t;
+    }
+
+    return;
+}
+
+/**
+ * @brief Sets the most tasks of a #JOB_CLASS run at once, so a class with a lot of work cannot take every thread.
+ * @param[in] cls The #JOB_CLASS.
+ * @param[in] budget Most tasks of the class to run at once, at least 1.
+ * @retval void
+ */
+const void WorkerPool::sBudget( const uint_t& cls, const uint_t& budget )
+{
+    UFLAGS_DE( flags );
+
+    if ( cls >= MAX_JOB_CLASS || budget < 1 )
+    {
+        LOGFMT( flags, "WorkerPool::sBudget()-> called with invalid class %lu or budget %lu", cls, budget );
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+        m_budget[cls] = budget;
+    }
+
+    // A larger budget may let waiting tasks start
+    m_cond.notify_all();
+
+    return;
+}
+
+/**
+ * @brief Queue a task to be run by the next free thread, behind any of a more urgent #JOB_CLASS.
+ * @param[in] task The task to run.
+ * @param[in] cls The #JOB_CLASS of the job the task belongs to.
+ * @retval void
+ */
+const void WorkerPool::Submit( const function<void()>& task, const uint_t& cls )
+{
+    UFLAGS_DE( flags );
+    Task queued;
+
+    if ( cls >= MAX_JOB_CLASS )
+    {
+        LOGFMT( flags, "WorkerPool::Submit()-> called with invalid class: %lu", cls );
+        return;
+    }
+
+    queued.run = task;
+    queued.queued = chrono::high_resolution_clock::now();
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+        m_tasks[cls].push_back( queued );
+    }
+
+    // Any one thread may be held back by the budget of this class, so wake them all
+    m_cond.notify_all();
+
+    return;
+}
+
+/**
+ * @brief The loop of each worker thread.
+ * @param[in] index The number of the thread within the pool, which decides where on the host it is placed.
+ * @retval void
+ */
+const void WorkerPool::Work( const uint_t& index )
+{
+    Task task;
+    uint_t cls = 0, i = 0;
+    bool empty = false;
+
+    // Pools started outside of Main::Startup(), such as by the benchmarks, have no topology
+    if ( g_global->m_topology != NULL )
+        g_global->m_topology->PinWorker( index );
+
+    mysql_thread_init();
+
+    while ( true )
+    {
+        {
+            unique_lock<mutex> lock( m_mutex );
+
+            m_cond.wait( lock, [this, &cls, &empty, &i]()
+            {
+                for ( empty = true, i = 0; i < MAX_JOB_CLASS; i++ )
+                    if ( !m_tasks[i].empty() )
+                        empty = false;
+
+                return Next( cls ) || ( m_shutdown && empty );
+            } );
+
+            if ( empty )
+                break;
+
+            task = m_tasks[cls].front();
+            m_tasks[cls].pop_front();
+            m_running[cls]++;
+            Report( cls, task.queued );
+        }
+
+        current_class = cls;
+        task.run();
+        current_class = JOB_CLASS_INGEST;
+
+        {
+            lock_guard<mutex> lock( m_mutex );
+            m_running[cls]--;
+        }
+
+        // The slot just freed may be what a task of this class was waiting for
+        m_cond.notify_all();
+    }
+
+    mysql_thread_end();
+
+    return;
+}
+
+/**
+ * @brief Constructor for the WorkerPool class.
+ * @param[in] threads The number of worker threads to start.
+ */
+WorkerPool::WorkerPool( const uint_t& threads )
+{
+    uint_t i = 0;
+
+    for ( i = 0; i < MAX_JOB_CLASS; i++ )
+    {
+        m_budget[i] = i == JOB_CLASS_CLEANUP ? CFG_THR_BUDGET_CLEANUP : threads;
+        m_longest[i] = uintmin_t;
+        m_running[i] = uintmin_t;
+        m_started[i] = uintmin_t;
+        m_waited[i] = uintmin_t;
+    }
+
+    m_reported = chrono::high_resolution_clock::now();
+    m_shutdown = false;
+
+    for ( i = 0; i < threads; i++ )
+        m_threads.push_back( thread( &WorkerPool::Work, this, i ) );
+
+    return;
+}
+
+/**
+ * @brief Destructor for the WorkerPool class. Queued tasks are finished before the threads exit.
+ */
+WorkerPool::~WorkerPool()
+{
+    ITER( vector, thread, vi );
+
+    {
+        lock_guard<mutex> lock( m_mutex );
+        m_shutdown = true;
+    }
+
+    m_cond.notify_all();
+
+    for ( vi = m_threads.begin(); vi != m_threads.end(); vi++ )
+        vi->join();
+
+    return;
+}
@@ -0,0 +1,887 @@
+/**
+ * nzedb-backend
+ * Copyright (c) 2012-2014 Matthew Goff <matt@goff.cc>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ **/
+/**
+ * @file yencdecoder.cpp
+ * @brief All non-template member functions of the YEncDecoder class.
+ *
+ * The YEncDecoder class decodes yEnc article bodies. Runs of plain data are
+ * decoded by a vector kernel picked for the host CPU at construction, and
+ * the scalar state machine only steps in for escapes, line breaks, stuffed
+ * dots and =y header lines.
+ */
+#include "h/includes.h"
+#include "h/yencdecoder.h"
+
+#if defined( __x86_64__ )
+/**
+ * @brief Shuffle indices that pack the kept bytes of an 8 byte half to the front, indexed by the keep mask.
+ */
+static struct YEncCompact
+{
+    uint8_t index[256][8]; /**< Source positions of the kept bytes, in order. */
+    uint8_t count[256]; /**< Number of kept bytes. */
+
+    YEncCompact()
+    {
+        uint_t mask = 0, bit = 0, n = 0;
+
+        for ( mask = 0; mask < 256; mask++ )
+        {
+            ::memset( index[mask], 0x80, 8 );
+
+            for ( bit = 0, n = 0; bit < 8; bit++ )
+                if ( mask & ( 1 << bit ) )
+                    index[mask][n++] = bit;
+
+            count[mask] = n;
+        }
+    }
+} yenc_compact;
+
+/**
+ * @brief Decode 16 bytes at a time until the first '=', CR or LF.
+ * @param[in] input The encoded data.
+ * @param[in] length Bytes available at input.
+ * @param[out] output Receives the decoded data. Must have 32 bytes of slack past length.
+ * @param[out] produced Bytes written to output.
+ * @param[out] line True if the last byte consumed ended a line.
+ * @param[in] raw Whether stuffed dots may appear at the start of a line.
+ * @retval uint_t Bytes consumed from input.
+ */
+static uint_t yenc_kernel_sse2( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line, const bool& raw )
+{
+    const __m128i eq = _mm_set1_epi8( '=' ), cr = _mm_set1_epi8( '\r' ), lf = _mm_set1_epi8( '\n' ), off = _mm_set1_epi8( 42 );
+    __m128i data;
+    uint_t i = 0;
+    sint_t mask = 0;
+
+    line = false;
+
+    for ( i = 0; i + 16 <= length; i += 16 )
+    {
+        data = _mm_loadu_si128( reinterpret_cast<const __m128i*>( input + i ) );
+        mask = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( data, eq ), _mm_or_si128( _mm_cmpeq_epi8( data, cr ), _mm_cmpeq_epi8( data, lf ) ) ) );
+
+        // Always store; bytes past a special character are overwritten by the scalar path
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( output + i ), _mm_sub_epi8( data, off ) );
+
+        if ( mask != 0 )
+        {
+            i += __builtin_ctz( mask );
+            break;
+        }
+    }
+
+    produced = i;
+
+    return i;
+}
+
+/**
+ * @brief Decode one 16 byte block in registers: escapes are applied and '=', CR and LF are packed out.
+ *
+ * The block is cut short at the first line that starts with '=' (which may
+ * be a =y header) or, for raw input, with a stuffed '.', and before an '='
+ * in the last byte, since its escaped byte is in the next block. Those are
+ * left to the scalar state machine.
+ * @param[in] input The 16 encoded bytes.
+ * @param[out] output Receives the decoded data. Must have 32 bytes of room.
+ * @param[out] produced Bytes written to output.
+ * @param[in,out] start True if the block begins a line; on return, true if the next byte begins a line.
+ * @param[in] raw Whether stuffed dots may appear at the start of a line.
+ * @retval uint_t Bytes consumed from input, 16 unless the block was cut short.
+ */
+__attribute__(( target( "ssse3" ) ))
+static inline uint_t yenc_block_ssse3( const uint8_t* input, uint8_t* output, uint_t& produced, bool& start, const bool& raw )
+{
+    const __m128i data = _mm_loadu_si128( reinterpret_cast<const __m128i*>( input ) );
+    const __m128i eq = _mm_cmpeq_epi8( data, _mm_set1_epi8( '=' ) );
+    __m128i decoded, index;
+    uint32_t m_eq = 0, m_lf = 0, m_special = 0, starts = 0, danger = 0, keep = 0, limit = 16;
+
+    m_eq = _mm_movemask_epi8( eq );
+    m_lf = _mm_movemask_epi8( _mm_cmpeq_epi8( data, _mm_set1_epi8( '\n' ) ) );
+    m_special = m_eq | m_lf | _mm_movemask_epi8( _mm_cmpeq_epi8( data, _mm_set1_epi8( '\r' ) ) );
+
+    starts = ( ( m_lf << 1 ) | ( start ? 1 : 0 ) ) & 0xFFFF;
+    danger = starts & ( m_eq | ( raw ? _mm_movemask_epi8( _mm_cmpeq_epi8( data, _mm_set1_epi8( '.' ) ) ) : 0 ) );
+    danger |= m_eq & 0x8000;
+
+    if ( danger != 0 )
+        limit = __builtin_ctz( danger );
+
+    // The byte after each '=' is escaped by a further 64
+    decoded = _mm_sub_epi8( data, _mm_set1_epi8( 42 ) );
+    decoded = _mm_sub_epi8( decoded, _mm_and_si128( _mm_slli_si128( eq, 1 ), _mm_set1_epi8( 64 ) ) );
+    keep = ~m_special & ( ( 1 << limit ) - 1 );
+
+    index = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[keep & 0xFF] ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( output ), _mm_shuffle_epi8( decoded, index ) );
+    produced = yenc_compact.count[keep & 0xFF];
+
+    index = _mm_add_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[keep >> 8] ) ), _mm_set1_epi8( 8 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( output + produced ), _mm_shuffle_epi8( decoded, index ) );
+    produced += yenc_compact.count[keep >> 8];
+
+    start = limit == 16 ? ( m_lf >> 15 ) != 0 : ( ( starts >> limit ) & 1 ) != 0;
+
+    return limit;
+}
+
+/**
+ * @brief Decode 16 bytes at a time, handling escapes and line breaks in registers.
+ * @param[in] input The encoded data.
+ * @param[in] length Bytes available at input.
+ * @param[out] output Receives the decoded data. Must have 32 bytes of slack past length.
+ * @param[out] produced Bytes written to output.
+ * @param[out] line True if the last byte consumed ended a line.
+ * @param[in] raw Whether stuffed dots may appear at the start of a line.
+ * @retval uint_t Bytes consumed from input.
+ */
+__attribute__(( target( "ssse3" ) ))
+static uint_t yenc_kernel_ssse3( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line, const bool& raw )
+{
+    uint_t i = 0, o = 0, n = 0, used = 0;
+
+    line = false;
+
+    for ( i = 0; i + 16 <= length; i += used )
+    {
+        used = yenc_block_ssse3( input + i, output + o, n, line, raw );
+        o += n;
+
+        if ( used < 16 )
+        {
+            i += used;
+            break;
+        }
+    }
+
+    produced = o;
+
+    return i;
+}
+
+/**
+ * @brief Decode 32 bytes at a time, handling escapes and line breaks in registers.
+ *
+ * This is the 32 byte form of yenc_block_ssse3(), and is cut short for the
+ * same reasons.
+ * @param[in] input The encoded data.
+ * @param[in] length Bytes available at input.
+ * @param[out] output Receives the decoded data. Must have 32 bytes of slack past length.
+ * @param[out] produced Bytes written to output.
+ * @param[out] line True if the last byte consumed ended a line.
+ * @param[in] raw Whether stuffed dots may appear at the start of a line.
+ * @retval uint_t Bytes consumed from input.
+ */
+__attribute__(( target( "avx2" ) ))
+static uint_t yenc_kernel_avx2( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line, const bool& raw )
+{
+    __m256i data, eq, decoded;
+    __m128i half;
+    uint64_t m_eq = 0, m_lf = 0, m_special = 0, starts = 0, danger = 0, keep = 0, limit = 32;
+    uint_t i = 0, o = 0, n = 0;
+
+    line = false;
+
+    while ( limit == 32 && i + 32 <= length )
+    {
+        data = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( input + i ) );
+        eq = _mm256_cmpeq_epi8( data, _mm256_set1_epi8( '=' ) );
+
+        m_eq = static_cast<uint32_t>( _mm256_movemask_epi8( eq ) );
+        m_lf = static_cast<uint32_t>( _mm256_movemask_epi8( _mm256_cmpeq_epi8( data, _mm256_set1_epi8( '\n' ) ) ) );
+        m_special = m_eq | m_lf | static_cast<uint32_t>( _mm256_movemask_epi8( _mm256_cmpeq_epi8( data, _mm256_set1_epi8( '\r' ) ) ) );
+
+        starts = ( ( m_lf << 1 ) | ( line ? 1 : 0 ) ) & 0xFFFFFFFF;
+        danger = starts & ( m_eq | ( raw ? static_cast<uint32_t>( _mm256_movemask_epi8( _mm256_cmpeq_epi8( data, _mm256_set1_epi8( '.' ) ) ) ) : 0 ) );
+        danger |= m_eq & 0x80000000;
+        limit = danger != 0 ? __builtin_ctzll( danger ) : 32;
+
+        // Shift the '=' lanes up one byte, across the 128 bit boundary, to find escaped bytes
+        decoded = _mm256_sub_epi8( data, _mm256_set1_epi8( 42 ) );
+        decoded = _mm256_sub_epi8( decoded, _mm256_and_si256( _mm256_alignr_epi8( eq, _mm256_permute2x128_si256( eq, eq, 0x08 ), 15 ), _mm256_set1_epi8( 64 ) ) );
+        keep = ~m_special & ( ( static_cast<uint64_t>( 1 ) << limit ) - 1 );
+
+        half = _mm256_castsi256_si128( decoded );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( output + o ), _mm_shuffle_epi8( half, _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[keep & 0xFF] ) ) ) );
+        o += yenc_compact.count[keep & 0xFF];
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( output + o ), _mm_shuffle_epi8( half, _mm_add_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[( keep >> 8 ) & 0xFF] ) ), _mm_set1_epi8( 8 ) ) ) );
+        o += yenc_compact.count[( keep >> 8 ) & 0xFF];
+
+        half = _mm256_extracti128_si256( decoded, 1 );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( output + o ), _mm_shuffle_epi8( half, _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[( keep >> 16 ) & 0xFF] ) ) ) );
+        o += yenc_compact.count[( keep >> 16 ) & 0xFF];
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( output + o ), _mm_shuffle_epi8( half, _mm_add_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( yenc_compact.index[( keep >> 24 ) & 0xFF] ) ), _mm_set1_epi8( 8 ) ) ) );
+        o += yenc_compact.count[( keep >> 24 ) & 0xFF];
+
+        line = limit == 32 ? ( m_lf >> 31 ) != 0 : ( ( starts >> limit ) & 1 ) != 0;
+        i += limit;
+    }
+
+    // Finish any 16 byte block left over
+    if ( limit == 32 && i + 16 <= length )
+    {
+        i += yenc_block_ssse3( input + i, output + o, n, line, raw );
+        o += n;
+    }
+
+    produced = o;
+
+    return i;
+}
+
+/**
+ * @brief Continue a raw (not inverted) CRC32 over a multiple of 16 bytes using carry-less multiplication.
+ *
+ * This folds four 128 bit lanes per 64 bytes and finishes with a Barrett
+ * reduction, as described in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction".
+ * @param[in] crc The running CRC32, already inverted.
+ * @param[in] data The data to checksum. At least 64 bytes.
+ * @param[in] length Bytes at data. Must be a multiple of 16.
+ * @retval uint32_t The running CRC32, still inverted.
+ */
+__attribute__(( target( "sse4.1,pclmul" ) ))
+static uint32_t yenc_crc32_clmul( uint32_t crc, const uint8_t* data, uint_t length )
+{
+    alignas( 16 ) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas( 16 ) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas( 16 ) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas( 16 ) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x00 ) );
+    x2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x10 ) );
+    x3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x20 ) );
+    x4 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x30 ) );
+    x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( crc ) );
+    x0 = _mm_load_si128( reinterpret_cast<const __m128i*>( k1k2 ) );
+
+    data += 64;
+    length -= 64;
+
+    // Fold 64 bytes at a time
+    while ( length >= 64 )
+    {
+        x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+        x6 = _mm_clmulepi64_si128( x2, x0, 0x00 );
+        x7 = _mm_clmulepi64_si128( x3, x0, 0x00 );
+        x8 = _mm_clmulepi64_si128( x4, x0, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+        x2 = _mm_clmulepi64_si128( x2, x0, 0x11 );
+        x3 = _mm_clmulepi64_si128( x3, x0, 0x11 );
+        x4 = _mm_clmulepi64_si128( x4, x0, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x00 ) ) );
+        x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x10 ) ) );
+        x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x20 ) ) );
+        x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 0x30 ) ) );
+
+        data += 64;
+        length -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128( reinterpret_cast<const __m128i*>( k3k4 ) );
+
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x2 ), x5 );
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x3 ), x5 );
+    x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+    x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+    x1 = _mm_xor_si128( _mm_xor_si128( x1, x4 ), x5 );
+
+    // Fold 16 bytes at a time
+    while ( length >= 16 )
+    {
+        x5 = _mm_clmulepi64_si128( x1, x0, 0x00 );
+        x1 = _mm_clmulepi64_si128( x1, x0, 0x11 );
+        x1 = _mm_xor_si128( _mm_xor_si128( x1, _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) ) ), x5 );
+
+        data += 16;
+        length -= 16;
+    }
+
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128( x1, x0, 0x10 );
+    x3 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+    x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+
+    x0 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( k5k0 ) );
+    x2 = _mm_srli_si128( x1, 4 );
+    x1 = _mm_and_si128( x1, x3 );
+    x1 = _mm_xor_si128( _mm_clmulepi64_si128( x1, x0, 0x00 ), x2 );
+
+    // Barrett reduction down to 32 bits
+    x0 = _mm_load_si128( reinterpret_cast<const __m128i*>( poly ) );
+    x2 = _mm_and_si128( x1, x3 );
+    x2 = _mm_clmulepi64_si128( x2, x0, 0x10 );
+    x2 = _mm_and_si128( x2, x3 );
+    x2 = _mm_clmulepi64_si128( x2, x0, 0x00 );
+    x1 = _mm_xor_si128( x1, x2 );
+
+    return _mm_extract_epi32( x1, 1 );
+}
+#endif
+
+#if defined( __aarch64__ )
+/**
+ * @brief Decode 16 bytes at a time until the first '=', CR or LF.
+ * @param[in] input The encoded data.
+ * @param[in] length Bytes available at input.
+ * @param[out] output Receives the decoded data. Must have 32 bytes of slack past length.
+ * @param[out] produced Bytes written to output.
+ * @param[out] line Always false; line breaks are left to the scalar path.
+ * @param[in] raw Unused; line starts are left to the scalar path.
+ * @retval uint_t Bytes consumed from input.
+ */
+static uint_t yenc_kernel_neon( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line, const bool& raw )
+{
+    const uint8x16_t eq = vdupq_n_u8( '=' ), cr = vdupq_n_u8( '\r' ), lf = vdupq_n_u8( '\n' ), off = vdupq_n_u8( 42 );
+    uint8x16_t data, hit;
+    uint_t i = 0;
+    uint64_t mask = 0;
+
+    line = false;
+
+    for ( i = 0; i + 16 <= length; i += 16 )
+    {
+        data = vld1q_u8( input + i );
+        hit = vorrq_u8( vceqq_u8( data, eq ), vorrq_u8( vceqq_u8( data, cr ), vceqq_u8( data, lf ) ) );
+
+        vst1q_u8( output + i, vsubq_u8( data, off ) );
+
+        // Narrow each byte of the comparison to a nibble to get a 64 bit mask
+        mask = vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( hit ), 4 ) ), 0 );
+
+        if ( mask != 0 )
+        {
+            i += __builtin_ctzll( mask ) >> 2;
+            break;
+        }
+    }
+
+    produced = i;
+
+    return i;
+}
+#endif
+
+/**
+ * @brief Continue a zlib compatible CRC32, using carry-less multiplication where the CPU supports it.
+ * @param[in] crc The CRC32 of the preceding data, 0 to start.
+ * @param[in] data The data to checksum.
+ * @param[in] length Bytes at data.
+ * @retval uint32_t The CRC32 of the preceding data followed by data.
+ */
+const uint32_t YEncDecoder::Checksum( const uint32_t& crc, const char* data, const uint_t& length )
+{
+    uint32_t result = crc;
+    uint_t bulk = 0;
+
+#if defined( __x86_64__ )
+    if ( m_clmul && length >= 64 )
+    {
+        bulk = length & ~static_cast<uint_t>( 15 );
+        result = ~yenc_crc32_clmul( ~result, reinterpret_cast<const uint8_t*>( data ), bulk );
+    }
+#endif
+
+    return ::crc32( result, reinterpret_cast<const Bytef*>( data + bulk ), length - bulk );
+}
+
+/**
+ * @brief Decode the next chunk of one or more article bodies. Chunks may split lines anywhere.
+ * @param[in] input Encoded data.
+ * @param[in] length Bytes at input.
+ * @param[out] output Decoded data is appended to this.
+ * @retval bool False once any part has failed a size or CRC32 check.
+ */
+const bool YEncDecoder::Decode( const char* input, const uint_t& length, string& output )
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>( input );
+    const uint8_t* end = in + length;
+    const uint8_t* eol = NULL;
+    uint8_t* out = NULL;
+    uint8_t* seg = NULL;
+    uint_t start = output.length(), run = 0, produced = 0;
+    bool line = false;
+
+    // Decoding never grows the data; the slack absorbs the kernels' full width stores
+    output.resize( start + length + 32 );
+    out = seg = reinterpret_cast<uint8_t*>( &output[start] );
+
+    while ( in < end )
+    {
+        switch ( m_state )
+        {
+            case YENC_STATE_LINE:
+                if ( m_raw && *in == '.' )
+                {
+                    in++;
+                    m_state = YENC_STATE_DATA;
+                }
+                else if ( *in == '=' )
+                {
+                    in++;
+                    m_state = YENC_STATE_LINE_ESCAPE;
+                }
+                else
+                    m_state = YENC_STATE_DATA;
+            break;
+
+            case YENC_STATE_LINE_ESCAPE:
+                if ( *in == 'y' )
+                {
+                    m_header = "=";
+                    m_state = YENC_STATE_HEADER;
+                }
+                else
+                    m_state = YENC_STATE_ESCAPE;
+            break;
+
+            case YENC_STATE_HEADER:
+                if ( ( eol = static_cast<const uint8_t*>( ::memchr( in, '\n', end - in ) ) ) == NULL )
+                {
+                    m_header.append( reinterpret_cast<const char*>( in ), end - in );
+                    in = end;
+                    break;
+                }
+
+                m_header.append( reinterpret_cast<const char*>( in ), eol - in );
+                in = eol + 1;
+
+                if ( !m_header.empty() && m_header[m_header.length() - 1] == '\r' )
+                    m_header.resize( m_header.length() - 1 );
+
+                // Account for everything decoded so far before =yend closes the part
+                if ( m_in_part )
+                {
+                    m_part_crc = Checksum( m_part_crc, reinterpret_cast<const char*>( seg ), out - seg );
+                    m_part_size += out - seg;
+                }
+                seg = out;
+
+                Header( m_header );
+                m_header.clear();
+                m_state = YENC_STATE_LINE;
+            break;
+
+            case YENC_STATE_ESCAPE:
+                if ( *in == '\r' || *in == '\n' )
+                {
+                    // A dangling escape at the end of a line is dropped
+                    m_state = YENC_STATE_DATA;
+                    break;
+                }
+
+                if ( m_in_part )
+                    *out++ = *in - 64 - 42;
+
+                in++;
+                m_state = YENC_STATE_DATA;
+            break;
+
+            case YENC_STATE_DATA:
+                if ( !m_in_part )
+                {
+                    // Anything outside =ybegin / =yend is not part of the file
+                    if ( ( eol = static_cast<const uint8_t*>( ::memchr( in, '\n', end - in ) ) ) == NULL )
+                    {
+                        in = end;
+                        break;
+                    }
+
+                    in = eol + 1;
+                    m_state = YENC_STATE_LINE;
+                    break;
+                }
+
+                run = Kernel( in, end - in, out, produced, line );
+                in += run;
+                out += produced;
+
+                if ( line )
+                {
+                    m_state = YENC_STATE_LINE;
+                    break;
+                }
+
+                if ( in == end )
+                    break;
+
+                if ( *in == '\n' )
+                    m_state = YENC_STATE_LINE;
+                else if ( *in == '=' )
+                    m_state = YENC_STATE_ESCAPE;
+                else if ( *in != '\r' )
+                    *out++ = *in - 42;
+
+                in++;
+            break;
+
+            default:
+                m_state = YENC_STATE_LINE;
+            break;
+        }
+    }
+
+    if ( m_in_part )
+    {
+        m_part_crc = Checksum( m_part_crc, reinterpret_cast<const char*>( seg ), out - seg );
+        m_part_size += out - seg;
+    }
+
+    output.resize( out - reinterpret_cast<uint8_t*>( &output[0] ) );
+
+    return m_valid;
+}
+
+/**
+ * @brief Decode the next chunk of one or more article bodies. Chunks may split lines anywhere.
+ * @param[in] input Encoded data.
+ * @param[out] output Decoded data is appended to this.
+ * @retval bool False once any part has failed a size or CRC32 check.
+ */
+const bool YEncDecoder::Decode( const string& input, string& output )
+{
+    return Decode( input.data(), input.length(), output );
+}
+
+/**
+ * @brief Returns the offset of the current part within the file.
+ * @retval uint_t The offset of the current part, from 0.
+ */
+const uint_t YEncDecoder::gBegin()
+{
+    return m_begin;
+}
+
+/**
+ * @brief Returns if every byte of the file has been decoded.
+ * @retval bool True once the decoded parts add up to the size given by =ybegin.
+ */
+const bool YEncDecoder::gComplete()
+{
+    return m_size > 0 && m_decoded >= m_size;
+}
+
+/**
+ * @brief Returns the CRC32 of the whole file.
+ * @retval uint32_t The CRC32 of the whole file, 0 until complete.
+ */
+const uint32_t YEncDecoder::gCRC()
+{
+    return m_crc;
+}
+
+/**
+ * @brief Returns the vector kernel chosen for this CPU from #YENC_KERNEL.
+ * @retval uint_t A uint_t associated to #YENC_KERNEL.
+ */
+const uint_t YEncDecoder::gKernel()
+{
+    return m_kernel;
+}
+
+/**
+ * @brief Returns the file name given by =ybegin.
+ * @retval string The file name given by =ybegin.
+ */
+const string YEncDecoder::gName()
+{
+    return m_name;
+}
+
+/**
+ * @brief Returns the number of the current part.
+ * @retval uint_t The part number given by =ybegin, 0 for single part files.
+ */
+const uint_t YEncDecoder::gPart()
+{
+    return m_part;
+}
+
+/**
+ * @brief Returns the size of the whole file.
+ * @retval uint_t The file size given by =ybegin.
+ */
+const uint_t YEncDecoder::gSize()
+{
+    return m_size;
+}
+
+/**
+ * @brief Returns if every size and CRC32 check so far has passed.
+ * @retval bool False once any check fails.
+ */
+const bool YEncDecoder::gValid()
+{
+    return m_valid;
+}
+
+/**
+ * @brief Forget all state, ready to decode an unrelated file.
+ * @retval void
+ */
+const void YEncDecoder::Reset()
+{
+    m_state = YENC_STATE_LINE;
+    m_header.clear();
+    m_in_part = false;
+    m_name.clear();
+    m_size = uintmin_t;
+    m_part = uintmin_t;
+    m_begin = uintmin_t;
+    m_part_size = uintmin_t;
+    m_part_crc = 0;
+    m_file_crc = 0;
+    m_crc = 0;
+    m_parts.clear();
+    m_decoded = uintmin_t;
+    m_valid = true;
+
+    return;
+}
+
+/**
+ * @brief Process a =ybegin, =ypart or =yend line.
+ * @param[in] line The full line, without CRLF.
+ * @retval void
+ */
+const void YEncDecoder::Header( const string& line )
+{
+    UFLAGS_DE( flags );
+    Part part;
+    string::size_type pos = 0;
+    uint_t size = 0, number = 0;
+    uint32_t crc = 0;
+
+    // Returns the value of key, or an empty string if it is not present
+    auto value = [&line]( const string& key ) -> string
+    {
+        string::size_type at = line.find( " " + key + "=" ), stop = 0;
+
+        if ( at == string::npos )
+            return "";
+
+        at += key.length() + 2;
+        stop = line.find( ' ', at );
+
+        return line.substr( at, stop == string::npos ? string::npos : stop - at );
+    };
+
+    if ( line.compare( 0, 7, "=ybegin" ) == 0 )
+    {
+        stringstream( value( "size" ) ) >> size;
+        stringstream( value( "part" ) ) >> number;
+
+        // A first part or a different file starts over
+        if ( number <= 1 || size != m_size || m_parts.empty() )
+        {
+            m_parts.clear();
+            m_decoded = uintmin_t;
+            m_file_crc = 0;
+            m_crc = 0;
+            m_valid = true;
+        }
+
+        m_size = size;
+        m_part = number;
+        m_name = ( pos = line.find( " name=" ) ) == string::npos ? "" : line.substr( pos + 6 );
+        m_begin = uintmin_t;
+        m_part_size = uintmin_t;
+        m_part_crc = 0;
+        m_in_part = true;
+    }
+    else if ( line.compare( 0, 6, "=ypart" ) == 0 )
+    {
+        stringstream( value( "begin" ) ) >> m_begin;
+
+        if ( m_begin > 0 )
+            m_begin--;
+    }
+    else if ( line.compare( 0, 5, "=yend" ) == 0 )
+    {
+        if ( !m_in_part )
+            return;
+
+        m_in_part = false;
+        stringstream( value( "size" ) ) >> size;
+
+        if ( size != m_part_size )
+        {
+            LOGFMT( flags, "YEncDecoder::Header()-> %s part %lu: decoded %lu bytes, expected %lu", CSTR( m_name ), m_part, m_part_size, size );
+            m_valid = false;
+        }
+
+        // Single part files carry only crc32, which then covers the part
+        if ( !value( "pcrc32" ).empty() )
+            crc = ::strtoul( CSTR( value( "pcrc32" ) ), NULL, 16 );
+        else if ( m_part == 0 && !value( "crc32" ).empty() )
+            crc = ::strtoul( CSTR( value( "crc32" ) ), NULL, 16 );
+        else
+            crc = m_part_crc;
+
+        if ( crc != m_part_crc )
+        {
+            LOGFMT( flags, "YEncDecoder::Header()-> %s part %lu: CRC32 %08x, expected %08x", CSTR( m_name ), m_part, m_part_crc, crc );
+            m_valid = false;
+        }
+
+        if ( !value( "crc32" ).empty() )
+            m_file_crc = ::strtoul( CSTR( value( "crc32" ) ), NULL, 16 );
+
+        part.begin = m_begin;
+        part.size = m_part_size;
+        part.crc = m_part_crc;
+        m_parts.push_back( part );
+        m_decoded += m_part_size;
+
+        Verify();
+    }
+
+    return;
+}
+
+/**
+ * @brief Decode with the vector kernel chosen for this CPU, starting within a line.
+ * @param[in] input The encoded data.
+ * @param[in] length Bytes available at input.
+ * @param[out] output Receives the decoded data.
+ * @param[out] produced Bytes written to output.
+ * @param[out] line True if the last byte consumed ended a line.
+ * @retval uint_t Bytes consumed before anything the kernel leaves to the state machine, or before a tail too short for the kernel.
+ */
+const uint_t YEncDecoder::Kernel( const uint8_t* input, const uint_t& length, uint8_t* output, uint_t& produced, bool& line )
+{
+    produced = 0;
+    line = false;
+
+    switch ( m_kernel )
+    {
+#if defined( __x86_64__ )
+        case YENC_KERNEL_AVX2:
+            return yenc_kernel_avx2( input, length, output, produced, line, m_raw );
+
+        case YENC_KERNEL_SSSE3:
+            return yenc_kernel_ssse3( input, length, output, produced, line, m_raw );
+
+        case YENC_KERNEL_SSE2:
+            return yenc_kernel_sse2( input, length, output, produced, line, m_raw );
+#endif
+#if defined( __aarch64__ )
+        case YENC_KERNEL_NEON:
+            return yenc_kernel_neon( input, length, output, produced, line, m_raw );
+#endif
+        default:
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Once every byte has been decoded, combine the part CRCs in file order and check the file CRC32.
+ * @retval void
+ */
+const void YEncDecoder::Verify()
+{
+    UFLAGS_DE( flags );
+    ITER( vector, Part, pi );
+    uint_t next = 0;
+    uint32_t crc = 0;
+
+    if ( !gComplete() )
+        return;
+
+    // Parts may arrive in any order
+    sort( m_parts.begin(), m_parts.end(), []( const Part& a, const Part& b ) { return a.begin < b.begin; } );
+
+    for ( pi = m_parts.begin(); pi != m_parts.end(); pi++ )
+    {
+        if ( pi->begin != next )
+        {
+            LOGFMT( flags, "YEncDecoder::Verify()-> %s: part at offset %lu, expected %lu", CSTR( m_name ), pi->begin, next );
+            m_valid = false;
+
+            return;
+        }
+
+        crc = ::crc32_combine( crc, pi->crc, pi->size );
+        next += pi->size;
+    }
+
+    m_crc = crc;
+
+    if ( m_file_crc != 0 && m_file_crc != m_crc )
+    {
+        LOGFMT( flags, "YEncDecoder::Verify()-> %s: CRC32 %08x, expected %08x", CSTR( m_name ), m_crc, m_file_crc );
+        m_valid = false;
+    }
+
+    return;
+}
+
+/**
+ * @brief Constructor for the YEncDecoder class.
+ */
+YEncDecoder::YEncDecoder( const bool& raw ) :
+    m_raw( raw )
+{
+    m_kernel = YENC_KERNEL_SCALAR;
+    m_clmul = false;
+
+#if defined( __x86_64__ )
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) )
+        m_kernel = YENC_KERNEL_AVX2;
+    else if ( __builtin_cpu_supports( "ssse3" ) )
+        m_kernel = YENC_KERNEL_SSSE3;
+    else
+        m_kernel = YENC_KERNEL_SSE2;
+
+    if ( ::__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+        m_clmul = ( ecx & bit_PCLMUL ) && ( ecx & bit_SSE4_1 );
+#elif defined( __aarch64__ )
+    m_kernel = YENC_KERNEL_NEON;
+#endif
+
+    Reset();
+
+    return;
+}
+
+/**
+ * @brief Destructor for the YEncDecoder class.
+ */
+YEncDecoder::~YEncDecoder()
+{
+    return;
+}